@@ -0,0 +1,468 @@
+#include "NVSImageReader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "NVSHash.hpp"
+
+using namespace nvs_format;
+
+namespace {
+
+uint16_t ReadLE16(const uint8_t* data) {
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t ReadLE32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool IsVariableLength(ItemType type) {
+    return type == ItemType::String || type == ItemType::BlobLegacy || type == ItemType::BlobData;
+}
+
+bool IsPrimitive(ItemType type) {
+    switch(type) {
+        case ItemType::U8: case ItemType::I8:
+        case ItemType::U16: case ItemType::I16:
+        case ItemType::U32: case ItemType::I32:
+        case ItemType::U64: case ItemType::I64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::string_view EntryKey(const uint8_t* entry) {
+    const char* key = reinterpret_cast<const char*>(entry + EntryKeyOffset);
+    return std::string_view(key, strnlen(key, MaxKeyLength + 1));
+}
+
+EntryState StateOf(const uint8_t* page, size_t index) {
+    uint8_t bits = page[PageHeaderSize + index / 4];
+    return static_cast<EntryState>((bits >> ((index % 4) * 2)) & 0x03);
+}
+
+void SetError(std::string* error, const std::string& message) {
+    if(error != nullptr) {
+        *error = message;
+    }
+}
+
+size_t HashBytes(const void* data, size_t size) {
+    // FNV-1a
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return static_cast<size_t>(hash);
+}
+
+} // namespace
+
+namespace nvs_format {
+
+uint32_t EntryCrc32(const uint8_t* entry) {
+    uint32_t crc = NVSCrc32(entry, EntryCrcOffset, 0xFFFFFFFF);
+    return NVSCrc32(entry + EntryKeyOffset, EntrySize - EntryKeyOffset, crc);
+}
+
+uint32_t PageHeaderCrc32(const uint8_t* header) {
+    return NVSCrc32(header + PageHeaderSequenceOffset, PageHeaderCrcOffset - PageHeaderSequenceOffset, 0xFFFFFFFF);
+}
+
+uint32_t DataCrc32(const uint8_t* data, size_t size) {
+    return NVSCrc32(data, size, 0xFFFFFFFF);
+}
+
+} // namespace nvs_format
+
+size_t NVSImageReader::IndexKeyHash::operator()(const IndexKey& key) const {
+    return HashBytes(&key, sizeof(key));
+}
+
+size_t NVSImageReader::ChunkKeyHash::operator()(const ChunkKey& key) const {
+    return HashBytes(&key, sizeof(key));
+}
+
+NVSImageReader::~NVSImageReader() {
+    close();
+}
+
+NVSImageReader::NVSImageReader(NVSImageReader&& other) noexcept {
+    *this = std::move(other);
+}
+
+NVSImageReader& NVSImageReader::operator=(NVSImageReader&& other) noexcept {
+    if(this != &other) {
+        close();
+        _image = other._image;
+        _size = other._size;
+        _mapped = other._mapped;
+        _stats = other._stats;
+        _items = std::move(other._items);
+        _segments = std::move(other._segments);
+        _index = std::move(other._index);
+        std::copy(std::begin(other._namespaces), std::end(other._namespaces), std::begin(_namespaces));
+        other._image = nullptr;
+        other._size = 0;
+        other._mapped = false;
+        other.close();
+    }
+    return *this;
+}
+
+bool NVSImageReader::open(const char* path, std::string* error) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0) {
+        SetError(error, std::string("Cannot open ") + path + ": " + strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size <= 0) {
+        SetError(error, std::string("Cannot read size of ") + path);
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* image = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(image == MAP_FAILED) {
+        SetError(error, std::string("Cannot map ") + path + ": " + strerror(errno));
+        return false;
+    }
+    // Pages are walked once, front to back
+    madvise(image, size, MADV_SEQUENTIAL);
+    _image = static_cast<const uint8_t*>(image);
+    _size = size;
+    _mapped = true;
+    return Index(error);
+}
+
+bool NVSImageReader::load(const uint8_t* image, size_t size, std::string* error) {
+    close();
+    _image = image;
+    _size = size;
+    return Index(error);
+}
+
+void NVSImageReader::close() {
+    if(_mapped && _image != nullptr) {
+        munmap(const_cast<uint8_t*>(_image), _size);
+    }
+    _image = nullptr;
+    _size = 0;
+    _mapped = false;
+    _stats = Stats();
+    _items.clear();
+    _segments.clear();
+    _index.clear();
+    std::fill(std::begin(_namespaces), std::end(_namespaces), std::string_view());
+}
+
+bool NVSImageReader::Index(std::string* error) {
+    if(_size == 0 || _size % PageSize != 0) {
+        SetError(error, "Image size " + std::to_string(_size) + " is not a multiple of the page size");
+        return false;
+    }
+
+    // Order valid pages by sequence number so newer copies of a key win
+    struct PageOrder {
+        uint32_t sequence;
+        uint32_t page;
+    };
+    std::vector<PageOrder> pages;
+    _stats.pages = _size / PageSize;
+    for(uint32_t page = 0; page < _stats.pages; page++) {
+        const uint8_t* header = _image + static_cast<size_t>(page) * PageSize;
+        PageState state = static_cast<PageState>(ReadLE32(header + PageHeaderStateOffset));
+        switch(state) {
+            case PageState::Empty:
+                _stats.emptyPages++;
+                continue;
+            case PageState::Active:
+                _stats.activePages++;
+                break;
+            case PageState::Full:
+                _stats.fullPages++;
+                break;
+            case PageState::Freeing:
+                _stats.freeingPages++;
+                break;
+            default:
+                _stats.corruptPages++;
+                continue;
+        }
+        if(ReadLE32(header + PageHeaderCrcOffset) != PageHeaderCrc32(header)) {
+            _stats.corruptPages++;
+            continue;
+        }
+        pages.push_back({ReadLE32(header + PageHeaderSequenceOffset), page});
+    }
+    std::stable_sort(pages.begin(), pages.end(), [](const PageOrder& a, const PageOrder& b) {
+        return a.sequence < b.sequence;
+    });
+
+    std::vector<RawItem> rawItems;
+    std::vector<RawItem> rawChunks;
+    rawItems.reserve(pages.size() * EntriesPerPage / 2);
+    for(const PageOrder& order : pages) {
+        WalkPage(order.page, rawItems, rawChunks);
+    }
+
+    std::unordered_map<ChunkKey, RawItem, ChunkKeyHash> chunks;
+    chunks.reserve(rawChunks.size());
+    for(const RawItem& raw : rawChunks) {
+        ChunkKey key = {};
+        key.namespaceIndex = raw.entry[EntryNamespaceOffset];
+        key.chunkIndex = raw.entry[EntryChunkIndexOffset];
+        std::string_view name = EntryKey(raw.entry);
+        std::memcpy(key.key, name.data(), name.size());
+        chunks[key] = raw;
+    }
+
+    _items.reserve(rawItems.size());
+    _segments.reserve(rawItems.size() + rawChunks.size());
+    _index.reserve(rawItems.size());
+    for(const RawItem& raw : rawItems) {
+        AddItem(raw, chunks);
+    }
+    return true;
+}
+
+void NVSImageReader::WalkPage(uint32_t page, std::vector<RawItem>& items, std::vector<RawItem>& chunks) {
+    const uint8_t* base = _image + static_cast<size_t>(page) * PageSize;
+    const uint8_t* entries = base + PageHeaderSize + EntryStateBitmapSize;
+
+    size_t index = 0;
+    while(index < EntriesPerPage) {
+        EntryState state = StateOf(base, index);
+        if(state == EntryState::Empty) {
+            _stats.emptyEntries++;
+            index++;
+            continue;
+        }
+        if(state != EntryState::Written) {
+            _stats.erasedEntries++;
+            index++;
+            continue;
+        }
+
+        const uint8_t* entry = entries + index * EntrySize;
+        uint8_t span = entry[EntrySpanOffset];
+        if(ReadLE32(entry + EntryCrcOffset) != EntryCrc32(entry) || span == 0 || index + span > EntriesPerPage) {
+            _stats.crcErrors++;
+            _stats.erasedEntries++;
+            index++;
+            continue;
+        }
+
+        ItemType type = static_cast<ItemType>(entry[EntryTypeOffset]);
+        if(IsVariableLength(type)) {
+            uint16_t size = ReadLE16(entry + EntryDataOffset);
+            const uint8_t* data = entry + EntrySize;
+            if(size > (span - 1) * EntrySize || ReadLE32(entry + EntryDataOffset + 4) != DataCrc32(data, size)) {
+                _stats.crcErrors++;
+                _stats.erasedEntries += span;
+                index += span;
+                continue;
+            }
+        }
+
+        _stats.writtenEntries += span;
+        RawItem raw = {entry, page, static_cast<uint8_t>(index)};
+        if(entry[EntryNamespaceOffset] == NamespaceDefinitionIndex) {
+            _namespaces[entry[EntryDataOffset]] = EntryKey(entry);
+        } else if(type == ItemType::BlobData) {
+            chunks.push_back(raw);
+        } else {
+            items.push_back(raw);
+        }
+        index += span;
+    }
+}
+
+void NVSImageReader::AddItem(const RawItem& raw, std::unordered_map<ChunkKey, RawItem, ChunkKeyHash>& chunks) {
+    const uint8_t* entry = raw.entry;
+    ItemType type = static_cast<ItemType>(entry[EntryTypeOffset]);
+    std::string_view key = EntryKey(entry);
+
+    NVSImageItem item;
+    item.namespaceIndex = entry[EntryNamespaceOffset];
+    item.type = type;
+    item.key = key;
+    item.page = raw.page;
+    item.entry = raw.index;
+    item.firstSegment = static_cast<uint32_t>(_segments.size());
+
+    if(IsPrimitive(type)) {
+        item.size = static_cast<uint8_t>(type) & 0x0F;
+        _segments.push_back({entry + EntryDataOffset, item.size});
+        item.segmentCount = 1;
+    } else if(type == ItemType::String || type == ItemType::BlobLegacy) {
+        item.size = ReadLE16(entry + EntryDataOffset);
+        _segments.push_back({entry + EntrySize, item.size});
+        item.segmentCount = 1;
+    } else if(type == ItemType::BlobIndex) {
+        uint32_t size = ReadLE32(entry + EntryDataOffset);
+        uint8_t chunkCount = entry[EntryDataOffset + 4];
+        uint8_t chunkStart = entry[EntryDataOffset + 5];
+        ChunkKey chunkKey = {};
+        chunkKey.namespaceIndex = item.namespaceIndex;
+        std::memcpy(chunkKey.key, key.data(), key.size());
+
+        size_t total = 0;
+        for(uint8_t i = 0; i < chunkCount; i++) {
+            chunkKey.chunkIndex = static_cast<uint8_t>(chunkStart + i);
+            auto chunk = chunks.find(chunkKey);
+            if(chunk == chunks.end()) {
+                break;
+            }
+            const uint8_t* chunkEntry = chunk->second.entry;
+            size_t chunkSize = ReadLE16(chunkEntry + EntryDataOffset);
+            _segments.push_back({chunkEntry + EntrySize, chunkSize});
+            total += chunkSize;
+        }
+        if(_segments.size() - item.firstSegment != chunkCount || total != size) {
+            _stats.incompleteBlobs++;
+            _segments.resize(item.firstSegment);
+            return;
+        }
+        item.type = ItemType::BlobData;
+        item.size = size;
+        item.segmentCount = chunkCount;
+    } else {
+        // Unknown item type
+        return;
+    }
+
+    IndexKey indexKey = MakeIndexKey(item.namespaceIndex, item.type, key);
+    auto existing = _index.find(indexKey);
+    if(existing != _index.end()) {
+        _stats.duplicates++;
+        _items[existing->second] = item;
+        return;
+    }
+    _index.emplace(indexKey, static_cast<uint32_t>(_items.size()));
+    _items.push_back(item);
+}
+
+NVSImageReader::IndexKey NVSImageReader::MakeIndexKey(uint8_t namespaceIndex, ItemType type, std::string_view key) {
+    IndexKey result = {};
+    result.namespaceIndex = namespaceIndex;
+    result.type = type;
+    std::memcpy(result.key, key.data(), std::min(key.size(), MaxKeyLength));
+    return result;
+}
+
+std::string_view NVSImageReader::namespaceName(uint8_t index) const {
+    return _namespaces[index];
+}
+
+int NVSImageReader::namespaceIndex(std::string_view name) const {
+    for(int i = 1; i < 255; i++) {
+        if(!_namespaces[i].empty() && _namespaces[i] == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const NVSImageItem* NVSImageReader::Find(int namespaceIndex, std::string_view key, ItemType type) const {
+    if(namespaceIndex < 0 || key.size() > MaxKeyLength) {
+        return nullptr;
+    }
+    if(type == ItemType::Any) {
+        static constexpr ItemType AllTypes[] = {
+            ItemType::U8, ItemType::I8, ItemType::U16, ItemType::I16,
+            ItemType::U32, ItemType::I32, ItemType::U64, ItemType::I64,
+            ItemType::String, ItemType::BlobLegacy, ItemType::BlobData
+        };
+        for(ItemType candidate : AllTypes) {
+            const NVSImageItem* item = Find(namespaceIndex, key, candidate);
+            if(item != nullptr) {
+                return item;
+            }
+        }
+        return nullptr;
+    }
+    auto it = _index.find(MakeIndexKey(static_cast<uint8_t>(namespaceIndex), type, key));
+    return it == _index.end() ? nullptr : &_items[it->second];
+}
+
+const NVSImageItem* NVSImageReader::find(std::string_view namespc, std::string_view key, ItemType type) const {
+    return Find(namespaceIndex(namespc), key, type);
+}
+
+const NVSImageItem* NVSImageReader::FindBlob(std::string_view namespc, std::string_view key) const {
+    int index = namespaceIndex(namespc);
+    const NVSImageItem* item = Find(index, key, ItemType::BlobData);
+    return item != nullptr ? item : Find(index, key, ItemType::BlobLegacy);
+}
+
+size_t NVSImageReader::copyValue(const NVSImageItem& item, void* buffer, size_t size) const {
+    if(item.size > size) {
+        return item.size;
+    }
+    uint8_t* out = static_cast<uint8_t*>(buffer);
+    const Segment* segment = segments(item);
+    for(uint32_t i = 0; i < item.segmentCount; i++) {
+        std::memcpy(out, segment[i].data, segment[i].size);
+        out += segment[i].size;
+    }
+    return item.size;
+}
+
+bool NVSImageReader::getString(std::string_view namespc, std::string_view key, std::string& value,
+                               NVSImageStringPreference preference) const {
+    const NVSImageItem* blob = FindBlob(namespc, key);
+    const NVSImageItem* string = find(namespc, key, ItemType::String);
+    const NVSImageItem* item = preference == NVSImageStringPreference::PreferBlob
+        ? (blob != nullptr ? blob : string)
+        : (string != nullptr ? string : blob);
+    if(item == nullptr) {
+        return false;
+    }
+    readValue(*item, value);
+    // nvs_set_str() stores the terminating null character
+    if(item->type == ItemType::String && !value.empty() && value.back() == '\0') {
+        value.pop_back();
+    }
+    return true;
+}
+
+bool NVSImageReader::getInteger(std::string_view namespc, std::string_view key, int64_t& value) const {
+    int index = namespaceIndex(namespc);
+    static constexpr ItemType IntegerTypes[] = {
+        ItemType::U8, ItemType::I8, ItemType::U16, ItemType::I16,
+        ItemType::U32, ItemType::I32, ItemType::U64, ItemType::I64
+    };
+    for(ItemType type : IntegerTypes) {
+        const NVSImageItem* item = Find(index, key, type);
+        if(item != nullptr) {
+            value = DecodeInteger(*item, *segments(*item));
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t NVSImageReader::DecodeInteger(const NVSImageItem& item, const Segment& segment) {
+    uint64_t raw = 0;
+    for(size_t i = 0; i < segment.size && i < 8; i++) {
+        raw |= static_cast<uint64_t>(segment.data[i]) << (8 * i);
+    }
+    bool isSigned = (static_cast<uint8_t>(item.type) & 0x10) != 0;
+    size_t bits = segment.size * 8;
+    if(isSigned && bits < 64 && (raw & (1ULL << (bits - 1))) != 0) {
+        raw |= ~0ULL << bits;
+    }
+    return static_cast<int64_t>(raw);
+}
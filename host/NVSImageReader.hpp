@@ -0,0 +1,262 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "NVSPartitionFormat.hpp"
+
+namespace nvs_format {
+
+/**
+ * @brief CRC32 of an entry as stored in its CRC field (covers all bytes except the CRC field itself)
+ */
+uint32_t EntryCrc32(const uint8_t* entry);
+
+/**
+ * @brief CRC32 of a page header as stored in its CRC field (covers bytes 4..27)
+ */
+uint32_t PageHeaderCrc32(const uint8_t* header);
+
+/**
+ * @brief CRC32 of the payload of a string or blob chunk
+ */
+uint32_t DataCrc32(const uint8_t* data, size_t size);
+
+} // namespace nvs_format
+
+/**
+ * @brief Which layout to try first when reading a string, mirroring NVSStringStoragePreference.
+ */
+enum class NVSImageStringPreference : uint8_t {
+    /**
+     * Blob layout first: NVSStringValue, NVSLazyValue<std::string>
+     */
+    PreferBlob,
+    /**
+     * nvs_set_str() layout first: NVSValue<std::string>
+     */
+    PreferString
+};
+
+/**
+ * @brief A live key found in an NVS partition image.
+ *
+ * The payload is not copied. It is made up of one or more segments pointing
+ * into the image: one for primitive values, strings and version 1 blobs and
+ * one per chunk for version 2 blobs.
+ */
+struct NVSImageItem {
+    uint8_t namespaceIndex;
+    /**
+     * Type of the item. Version 2 blobs are reported as BlobData,
+     * independently of the number of chunks.
+     */
+    nvs_format::ItemType type;
+    /**
+     * Key, pointing into the image
+     */
+    std::string_view key;
+    /**
+     * Total payload size in bytes. For primitive types, this is the width of the type.
+     */
+    size_t size;
+    /**
+     * Position of the (first) entry in the image
+     */
+    uint32_t page;
+    uint8_t entry;
+    uint32_t firstSegment;
+    uint32_t segmentCount;
+};
+
+/**
+ * @brief Zero-copy reader for raw NVS partition images (e.g. from esptool read_flash).
+ *
+ * The image is memory-mapped and walked once: entry and data CRCs are verified,
+ * blob chunks are linked to their index entry and a hash index over
+ * (namespace, key, type) is built. Lookups afterwards do not touch the pages again.
+ *
+ * The typed getters decode values the same way the firmware classes store them.
+ */
+class NVSImageReader {
+public:
+    struct Segment {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    struct Stats {
+        size_t pages = 0;
+        size_t emptyPages = 0;
+        size_t activePages = 0;
+        size_t fullPages = 0;
+        size_t freeingPages = 0;
+        size_t corruptPages = 0;
+        size_t writtenEntries = 0;
+        size_t erasedEntries = 0;
+        size_t emptyEntries = 0;
+        /**
+         * Entries whose header or data CRC did not match. They are treated as erased.
+         */
+        size_t crcErrors = 0;
+        /**
+         * Blob indexes with missing or inconsistent chunks. These blobs are skipped.
+         */
+        size_t incompleteBlobs = 0;
+        /**
+         * Keys found more than once, e.g. after a power loss during a write.
+         * The copy in the page with the higher sequence number is used.
+         */
+        size_t duplicates = 0;
+    };
+
+    NVSImageReader() = default;
+    ~NVSImageReader();
+
+    NVSImageReader(const NVSImageReader&) = delete;
+    NVSImageReader& operator=(const NVSImageReader&) = delete;
+    NVSImageReader(NVSImageReader&& other) noexcept;
+    NVSImageReader& operator=(NVSImageReader&& other) noexcept;
+
+    /**
+     * @brief Memory-map and index an image file.
+     * @param error Receives a description if the file cannot be mapped
+     * @return false if the file cannot be opened or its size is not a multiple of the page size
+     */
+    bool open(const char* path, std::string* error = nullptr);
+
+    /**
+     * @brief Index an image which is already in memory. The memory must outlive the reader.
+     */
+    bool load(const uint8_t* image, size_t size, std::string* error = nullptr);
+
+    void close();
+
+    const Stats& stats() const { return _stats; }
+    const std::vector<NVSImageItem>& items() const { return _items; }
+
+    /**
+     * @return Name of the namespace with the given index, empty if unknown
+     */
+    std::string_view namespaceName(uint8_t index) const;
+
+    /**
+     * @return Index of the namespace or -1 if the image does not contain it
+     */
+    int namespaceIndex(std::string_view name) const;
+
+    /**
+     * @brief Find an item. ItemType::Any returns the first item with the key, regardless of type.
+     */
+    const NVSImageItem* find(std::string_view namespc, std::string_view key,
+                             nvs_format::ItemType type = nvs_format::ItemType::Any) const;
+
+    /**
+     * @return The segments making up the payload of an item
+     */
+    const Segment* segments(const NVSImageItem& item) const { return _segments.data() + item.firstSegment; }
+
+    /**
+     * @brief Copy the payload of an item into caller storage.
+     * @return Payload size. Nothing is copied if it exceeds @p size.
+     */
+    size_t copyValue(const NVSImageItem& item, void* buffer, size_t size) const;
+
+    /**
+     * @brief Copy the payload of an item into a container with data() and resize().
+     */
+    template<typename Container>
+    void readValue(const NVSImageItem& item, Container& out) const {
+        out.resize(item.size);
+        copyValue(item, out.data(), out.size());
+    }
+
+    /**
+     * @brief Read a value stored by NVSValue<T>, i.e. a blob of exactly sizeof(T) bytes.
+     */
+    template<typename T>
+    bool get(std::string_view namespc, std::string_view key, T& value) const {
+        static_assert(std::is_trivially_copyable_v<T>, "NVSImageReader::get() requires a trivially copyable type");
+        const NVSImageItem* item = FindBlob(namespc, key);
+        if(item == nullptr || item->size != sizeof(T)) {
+            return false;
+        }
+        copyValue(*item, &value, sizeof(T));
+        return true;
+    }
+
+    /**
+     * @brief Read a string in blob or nvs_set_str() layout, like NVSReadStringValue().
+     */
+    bool getString(std::string_view namespc, std::string_view key, std::string& value,
+                   NVSImageStringPreference preference = NVSImageStringPreference::PreferBlob) const;
+
+    /**
+     * @brief Read a native integer entry (nvs_set_u8() ... nvs_set_i64()), sign-extended if signed.
+     */
+    bool getInteger(std::string_view namespc, std::string_view key, int64_t& value) const;
+
+    /**
+     * @brief Decode a primitive item into a 64 bit value, sign-extended if the type is signed.
+     */
+    static int64_t DecodeInteger(const NVSImageItem& item, const Segment& segment);
+
+private:
+    struct IndexKey {
+        uint8_t namespaceIndex;
+        nvs_format::ItemType type;
+        char key[nvs_format::MaxKeyLength + 1];
+
+        bool operator==(const IndexKey& other) const {
+            return namespaceIndex == other.namespaceIndex && type == other.type &&
+                   std::memcmp(key, other.key, sizeof(key)) == 0;
+        }
+    };
+
+    struct IndexKeyHash {
+        size_t operator()(const IndexKey& key) const;
+    };
+
+    struct ChunkKey {
+        uint8_t namespaceIndex;
+        uint8_t chunkIndex;
+        char key[nvs_format::MaxKeyLength + 1];
+
+        bool operator==(const ChunkKey& other) const {
+            return namespaceIndex == other.namespaceIndex && chunkIndex == other.chunkIndex &&
+                   std::memcmp(key, other.key, sizeof(key)) == 0;
+        }
+    };
+
+    struct ChunkKeyHash {
+        size_t operator()(const ChunkKey& key) const;
+    };
+
+    struct RawItem {
+        const uint8_t* entry;
+        uint32_t page;
+        uint8_t index;
+    };
+
+    bool Index(std::string* error);
+    void WalkPage(uint32_t page, std::vector<RawItem>& items, std::vector<RawItem>& chunks);
+    void AddItem(const RawItem& raw, std::unordered_map<ChunkKey, RawItem, ChunkKeyHash>& chunks);
+    const NVSImageItem* Find(int namespaceIndex, std::string_view key, nvs_format::ItemType type) const;
+    const NVSImageItem* FindBlob(std::string_view namespc, std::string_view key) const;
+    static IndexKey MakeIndexKey(uint8_t namespaceIndex, nvs_format::ItemType type, std::string_view key);
+
+    const uint8_t* _image = nullptr;
+    size_t _size = 0;
+    bool _mapped = false;
+
+    Stats _stats;
+    std::vector<NVSImageItem> _items;
+    std::vector<Segment> _segments;
+    std::unordered_map<IndexKey, uint32_t, IndexKeyHash> _index;
+    std::string_view _namespaces[256];
+};
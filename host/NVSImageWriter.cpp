@@ -0,0 +1,235 @@
+#include "NVSImageWriter.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "NVSImageReader.hpp"
+
+using namespace nvs_format;
+
+namespace {
+
+void WriteLE16(uint8_t* out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void WriteLE32(uint8_t* out, uint32_t value) {
+    for(size_t i = 0; i < 4; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+/**
+ * First chunk index of blobs written to an empty partition
+ */
+constexpr uint8_t BlobChunkStart = BlobChunkStartVersion0;
+constexpr size_t MaxBlobChunks = BlobChunkStartVersion1 - BlobChunkStartVersion0;
+
+} // namespace
+
+NVSImageWriter::NVSImageWriter(size_t partitionSize)
+    : _image(partitionSize - partitionSize % PageSize, 0xFF), _pageCount(partitionSize / PageSize) {
+    if(_pageCount > 0) {
+        StartPage(0);
+    }
+}
+
+bool NVSImageWriter::Fail(const std::string& message) {
+    _error = message;
+    return false;
+}
+
+bool NVSImageWriter::CheckKey(std::string_view key) {
+    if(key.empty() || key.size() > MaxKeyLength || key.find('\0') != std::string_view::npos) {
+        return Fail("Invalid key '" + std::string(key) + "'");
+    }
+    return true;
+}
+
+void NVSImageWriter::StartPage(size_t page) {
+    uint8_t* header = _image.data() + page * PageSize;
+    WriteLE32(header + PageHeaderStateOffset, static_cast<uint32_t>(PageState::Active));
+    WriteLE32(header + PageHeaderSequenceOffset, static_cast<uint32_t>(page));
+    header[PageHeaderVersionOffset] = PageVersion2;
+    WriteLE32(header + PageHeaderCrcOffset, PageHeaderCrc32(header));
+    _page = page;
+    _nextEntry = 0;
+}
+
+bool NVSImageWriter::NextPage() {
+    // ESP-IDF needs one empty page to run garbage collection
+    if(_page + 2 >= _pageCount) {
+        return Fail("Partition full");
+    }
+    // The state is not covered by the header CRC
+    WriteLE32(_image.data() + _page * PageSize + PageHeaderStateOffset, static_cast<uint32_t>(PageState::Full));
+    StartPage(_page + 1);
+    return true;
+}
+
+uint8_t* NVSImageWriter::Allocate(size_t span) {
+    if(_pageCount < 2) {
+        Fail("Partition needs at least two pages");
+        return nullptr;
+    }
+    if(span > EntriesPerPage) {
+        Fail("Value too large");
+        return nullptr;
+    }
+    if(FreeEntries() < span && !NextPage()) {
+        return nullptr;
+    }
+    uint8_t* page = _image.data() + _page * PageSize;
+    for(size_t i = _nextEntry; i < _nextEntry + span; i++) {
+        uint8_t& bits = page[PageHeaderSize + i / 4];
+        size_t shift = (i % 4) * 2;
+        bits = static_cast<uint8_t>((bits & ~(0x03 << shift)) | (static_cast<uint8_t>(EntryState::Written) << shift));
+    }
+    uint8_t* entry = page + PageHeaderSize + EntryStateBitmapSize + _nextEntry * EntrySize;
+    _nextEntry += span;
+    return entry;
+}
+
+uint8_t* NVSImageWriter::WriteEntry(uint8_t namespaceIndex, ItemType type, uint8_t span, uint8_t chunkIndex,
+                                    std::string_view key, const uint8_t* data) {
+    uint8_t* entry = Allocate(span);
+    if(entry == nullptr) {
+        return nullptr;
+    }
+    entry[EntryNamespaceOffset] = namespaceIndex;
+    entry[EntryTypeOffset] = static_cast<uint8_t>(type);
+    entry[EntrySpanOffset] = span;
+    entry[EntryChunkIndexOffset] = chunkIndex;
+    // Keys are zero-padded like strncpy() does on the target
+    std::memset(entry + EntryKeyOffset, 0, MaxKeyLength + 1);
+    std::memcpy(entry + EntryKeyOffset, key.data(), key.size());
+    std::memcpy(entry + EntryDataOffset, data, EntryDataSize);
+    WriteLE32(entry + EntryCrcOffset, EntryCrc32(entry));
+    return entry;
+}
+
+bool NVSImageWriter::WriteVariable(uint8_t namespaceIndex, ItemType type, uint8_t chunkIndex,
+                                   std::string_view key, const uint8_t* data, size_t size) {
+    uint8_t header[EntryDataSize];
+    WriteLE16(header, static_cast<uint16_t>(size));
+    WriteLE16(header + 2, 0xFFFF);
+    WriteLE32(header + 4, DataCrc32(data, size));
+    uint8_t* entry = WriteEntry(namespaceIndex, type, static_cast<uint8_t>(VariableEntrySpan(size)), chunkIndex, key, header);
+    if(entry == nullptr) {
+        return false;
+    }
+    // Padding up to the next entry stays erased (0xFF)
+    std::memcpy(entry + EntrySize, data, size);
+    return true;
+}
+
+int NVSImageWriter::Namespace(std::string_view namespc) {
+    auto it = _namespaces.find(namespc);
+    if(it != _namespaces.end()) {
+        return it->second;
+    }
+    if(!CheckKey(namespc)) {
+        return -1;
+    }
+    if(_namespaces.size() >= 254) {
+        Fail("Too many namespaces");
+        return -1;
+    }
+    uint8_t index = static_cast<uint8_t>(_namespaces.size() + 1);
+    uint8_t data[EntryDataSize];
+    std::memset(data, 0xFF, sizeof(data));
+    data[0] = index;
+    if(WriteEntry(NamespaceDefinitionIndex, ItemType::U8, 1, ChunkIndexNone, namespc, data) == nullptr) {
+        return -1;
+    }
+    _namespaces.emplace(std::string(namespc), index);
+    return index;
+}
+
+bool NVSImageWriter::setInteger(std::string_view namespc, std::string_view key, ItemType type, int64_t value) {
+    size_t width = static_cast<uint8_t>(type) & 0x0F;
+    if(width != 1 && width != 2 && width != 4 && width != 8) {
+        return Fail("Not an integer type");
+    }
+    if(!CheckKey(key)) {
+        return false;
+    }
+    int namespaceIndex = Namespace(namespc);
+    if(namespaceIndex < 0) {
+        return false;
+    }
+    uint8_t data[EntryDataSize];
+    std::memset(data, 0xFF, sizeof(data));
+    uint64_t raw = static_cast<uint64_t>(value);
+    for(size_t i = 0; i < width; i++) {
+        data[i] = static_cast<uint8_t>(raw >> (8 * i));
+    }
+    return WriteEntry(static_cast<uint8_t>(namespaceIndex), type, 1, ChunkIndexNone, key, data) != nullptr;
+}
+
+bool NVSImageWriter::setString(std::string_view namespc, std::string_view key, std::string_view value) {
+    if(value.size() + 1 > MaxChunkDataSize) {
+        return Fail("String '" + std::string(key) + "' too long");
+    }
+    if(!CheckKey(key)) {
+        return false;
+    }
+    int namespaceIndex = Namespace(namespc);
+    if(namespaceIndex < 0) {
+        return false;
+    }
+    // nvs_set_str() stores the terminating null character
+    std::vector<uint8_t> data(value.begin(), value.end());
+    data.push_back(0);
+    return WriteVariable(static_cast<uint8_t>(namespaceIndex), ItemType::String, ChunkIndexNone, key, data.data(), data.size());
+}
+
+bool NVSImageWriter::setBlob(std::string_view namespc, std::string_view key, const void* data, size_t size) {
+    if(!CheckKey(key)) {
+        return false;
+    }
+    int namespaceIndex = Namespace(namespc);
+    if(namespaceIndex < 0) {
+        return false;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    size_t offset = 0;
+    size_t chunks = 0;
+    // Like nvs_set_blob(), fill the remaining space of the current page first
+    do {
+        if(FreeEntries() < 2 && !NextPage()) {
+            return false;
+        }
+        if(chunks == MaxBlobChunks) {
+            return Fail("Blob '" + std::string(key) + "' too large");
+        }
+        size_t chunkSize = std::min({size - offset, (FreeEntries() - 1) * EntrySize, MaxChunkDataSize});
+        if(!WriteVariable(static_cast<uint8_t>(namespaceIndex), ItemType::BlobData, static_cast<uint8_t>(BlobChunkStart + chunks),
+                          key, bytes + offset, chunkSize)) {
+            return false;
+        }
+        offset += chunkSize;
+        chunks++;
+    } while(offset < size);
+
+    uint8_t index[EntryDataSize];
+    WriteLE32(index, static_cast<uint32_t>(size));
+    index[4] = static_cast<uint8_t>(chunks);
+    index[5] = BlobChunkStart;
+    index[6] = 0xFF;
+    index[7] = 0xFF;
+    return WriteEntry(static_cast<uint8_t>(namespaceIndex), ItemType::BlobIndex, 1, ChunkIndexNone, key, index) != nullptr;
+}
+
+bool NVSImageWriter::save(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if(file == nullptr) {
+        return Fail(std::string("Cannot open ") + path + ": " + strerror(errno));
+    }
+    bool ok = fwrite(_image.data(), 1, _image.size(), file) == _image.size();
+    ok = fclose(file) == 0 && ok;
+    return ok || Fail(std::string("Cannot write ") + path);
+}
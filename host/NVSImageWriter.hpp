@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "NVSPartitionFormat.hpp"
+
+/**
+ * @brief Builds a ready-to-flash NVS partition image on the host.
+ *
+ * Entries are laid out the way ESP-IDF writes them to an empty partition:
+ * pages are filled in order, blobs use the version 2 chunked layout and the
+ * last page is kept empty for garbage collection. Each key must only be set once.
+ *
+ * The value classes read these layouts as follows:
+ *  - NVSValue<T>: set<T>() (a blob of sizeof(T) bytes)
+ *  - NVSValue<std::string>: setString() (nvs_set_str())
+ *  - NVSStringValue, NVSLazyValue<std::string>: setBlob() with the string bytes
+ */
+class NVSImageWriter {
+public:
+    /**
+     * @param partitionSize Size of the NVS partition, a multiple of the page size
+     */
+    explicit NVSImageWriter(size_t partitionSize);
+
+    /**
+     * @brief Store a native integer entry (nvs_set_u8() ... nvs_set_i64())
+     */
+    bool setInteger(std::string_view namespc, std::string_view key, nvs_format::ItemType type, int64_t value);
+
+    /**
+     * @brief Store a null-terminated string entry (nvs_set_str())
+     */
+    bool setString(std::string_view namespc, std::string_view key, std::string_view value);
+
+    /**
+     * @brief Store a blob (nvs_set_blob()), split into chunks if it does not fit into one page
+     */
+    bool setBlob(std::string_view namespc, std::string_view key, const void* data, size_t size);
+
+    /**
+     * @brief Store a value the way NVSValue<T> does
+     */
+    template<typename T>
+    bool set(std::string_view namespc, std::string_view key, const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>, "NVSImageWriter::set() requires a trivially copyable type");
+        return setBlob(namespc, key, &value, sizeof(T));
+    }
+
+    /**
+     * @return Description of the last failure
+     */
+    const std::string& error() const { return _error; }
+
+    const std::vector<uint8_t>& image() const { return _image; }
+
+    /**
+     * @return Number of pages containing entries
+     */
+    size_t usedPages() const { return _page + 1; }
+
+    bool save(const char* path);
+
+private:
+    bool Fail(const std::string& message);
+    bool CheckKey(std::string_view key);
+    int Namespace(std::string_view namespc);
+    /**
+     * @brief Reserve span consecutive entries, moving to the next page if necessary
+     * @return Pointer to the first entry or nullptr if the partition is full
+     */
+    uint8_t* Allocate(size_t span);
+    bool NextPage();
+    void StartPage(size_t page);
+    uint8_t* WriteEntry(uint8_t namespaceIndex, nvs_format::ItemType type, uint8_t span, uint8_t chunkIndex,
+                        std::string_view key, const uint8_t* data);
+    bool WriteVariable(uint8_t namespaceIndex, nvs_format::ItemType type, uint8_t chunkIndex,
+                       std::string_view key, const uint8_t* data, size_t size);
+    size_t FreeEntries() const { return nvs_format::EntriesPerPage - _nextEntry; }
+
+    std::vector<uint8_t> _image;
+    size_t _pageCount;
+    size_t _page = 0;
+    size_t _nextEntry = 0;
+    std::map<std::string, uint8_t, std::less<>> _namespaces;
+    std::string _error;
+};
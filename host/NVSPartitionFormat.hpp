@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Constants describing the ESP-IDF NVS on-flash layout.
+ *
+ * This header does not depend on ESP-IDF so it can be used by the
+ * host-side tools in this directory.
+ */
+namespace nvs_format {
+
+constexpr size_t PageSize = 4096;
+constexpr size_t EntrySize = 32;
+constexpr size_t PageHeaderSize = 32;
+constexpr size_t EntryStateBitmapSize = 32;
+constexpr size_t EntriesPerPage = (PageSize - PageHeaderSize - EntryStateBitmapSize) / EntrySize;
+/**
+ * Maximum payload of a string entry or of a single blob chunk
+ */
+constexpr size_t MaxChunkDataSize = (EntriesPerPage - 1) * EntrySize;
+constexpr size_t MaxKeyLength = 15;
+
+/**
+ * Page header layout: state, sequence number, format version, CRC32 of bytes 4..27
+ */
+constexpr size_t PageHeaderStateOffset = 0;
+constexpr size_t PageHeaderSequenceOffset = 4;
+constexpr size_t PageHeaderVersionOffset = 8;
+constexpr size_t PageHeaderCrcOffset = 28;
+constexpr uint8_t PageVersion1 = 0xFF;
+constexpr uint8_t PageVersion2 = 0xFE;
+
+/**
+ * Entry layout: namespace index, type, span, chunk index, CRC32, key, data
+ */
+constexpr size_t EntryNamespaceOffset = 0;
+constexpr size_t EntryTypeOffset = 1;
+constexpr size_t EntrySpanOffset = 2;
+constexpr size_t EntryChunkIndexOffset = 3;
+constexpr size_t EntryCrcOffset = 4;
+constexpr size_t EntryKeyOffset = 8;
+constexpr size_t EntryDataOffset = 24;
+constexpr size_t EntryDataSize = 8;
+
+/**
+ * Entries with this namespace index map namespace names (key) to their index (u8 data)
+ */
+constexpr uint8_t NamespaceDefinitionIndex = 0;
+/**
+ * Chunk index of entries which are not blob data chunks
+ */
+constexpr uint8_t ChunkIndexNone = 0xFF;
+/**
+ * First chunk index of the two alternating blob versions
+ */
+constexpr uint8_t BlobChunkStartVersion0 = 0x00;
+constexpr uint8_t BlobChunkStartVersion1 = 0x80;
+
+enum class PageState : uint32_t {
+    Empty = 0xFFFFFFFF,
+    Active = 0xFFFFFFFE,
+    Full = 0xFFFFFFFC,
+    Freeing = 0xFFFFFFF8,
+    Corrupt = 0xFFFFFFF0,
+    Invalid = 0
+};
+
+/**
+ * 2-bit entry states in the entry state bitmap following the page header
+ */
+enum class EntryState : uint8_t {
+    Erased = 0,
+    Written = 2,
+    Empty = 3
+};
+
+/**
+ * Item types as stored in the type field of an entry
+ */
+enum class ItemType : uint8_t {
+    U8 = 0x01,
+    I8 = 0x11,
+    U16 = 0x02,
+    I16 = 0x12,
+    U32 = 0x04,
+    I32 = 0x14,
+    U64 = 0x08,
+    I64 = 0x18,
+    String = 0x21,
+    /**
+     * Single-entry blob used by NVS format version 1
+     */
+    BlobLegacy = 0x41,
+    BlobData = 0x42,
+    BlobIndex = 0x48,
+    Any = 0xFF
+};
+
+/**
+ * @brief Number of entries occupied by a string or blob chunk with the given payload size
+ */
+constexpr size_t VariableEntrySpan(size_t dataSize) {
+    return 1 + (dataSize + EntrySize - 1) / EntrySize;
+}
+
+} // namespace nvs_format
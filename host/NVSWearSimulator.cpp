@@ -0,0 +1,269 @@
+#include "NVSWearSimulator.hpp"
+
+#include <algorithm>
+
+using namespace nvs_format;
+
+NVSWearSimulator::NVSWearSimulator(const Config& config)
+    : _config(config), _pages(std::max<size_t>(config.partitionSize / PageSize, 2)) {
+    for(size_t i = 0; i < _pages.size(); ++i) {
+        std::fill(std::begin(_pages[i].owners), std::end(_pages[i].owners), -1);
+        _freePages.push_back(static_cast<uint16_t>(i));
+    }
+}
+
+bool NVSWearSimulator::write(const std::string& namespc, const std::string& key, NVSSimStorage storage, size_t size) {
+    if(!EnsureNamespace(namespc)) {
+        _stats.failedWrites++;
+        return false;
+    }
+    int32_t itemId = ItemFor(namespc + "/" + key);
+    KeyStats& keyStats = _keyStats[namespc + "/" + key];
+    uint64_t entriesBefore = _stats.entriesWritten;
+
+    // NVS writes the new item first and erases the previous version afterwards.
+    // Both stay registered with the item while writing, so garbage collection
+    // triggered by a later chunk relocates the chunks written so far as well.
+    std::vector<EntryRef>& entries = _items[itemId].entries;
+    size_t previousCount = entries.size();
+    EntryRef ref{};
+    bool ok = true;
+
+    switch(storage) {
+        case NVSSimStorage::Primitive: {
+            if((ok = Allocate(itemId, 1, ref, _stats.entriesWritten))) {
+                entries.push_back(ref);
+            }
+            break;
+        }
+        case NVSSimStorage::String: {
+            if(size + 1 > MaxChunkDataSize) {
+                ok = false;
+                break;
+            }
+            if((ok = Allocate(itemId, static_cast<uint16_t>(VariableEntrySpan(size + 1)), ref, _stats.entriesWritten))) {
+                entries.push_back(ref);
+            }
+            break;
+        }
+        case NVSSimStorage::Blob: {
+            // Split into chunks which fill the remaining space of the active page
+            size_t remaining = size;
+            do {
+                if(!EnsureFreeEntries(2)) {
+                    ok = false;
+                    break;
+                }
+                size_t chunk = std::min(remaining, std::min((FreeEntriesInActivePage() - 1) * EntrySize, MaxChunkDataSize));
+                if(!Allocate(itemId, static_cast<uint16_t>(VariableEntrySpan(chunk)), ref, _stats.entriesWritten)) {
+                    ok = false;
+                    break;
+                }
+                entries.push_back(ref);
+                remaining -= chunk;
+            } while(remaining > 0);
+            // Blob index entry
+            if(ok && (ok = Allocate(itemId, 1, ref, _stats.entriesWritten))) {
+                entries.push_back(ref);
+            }
+            break;
+        }
+    }
+
+    std::vector<EntryRef> previous(entries.begin(), entries.begin() + previousCount);
+    std::vector<EntryRef> written(entries.begin() + previousCount, entries.end());
+    if(!ok) {
+        // Roll back partially written chunks, like NVS does on failure
+        EraseEntries(written);
+        entries = previous;
+        _stats.failedWrites++;
+        return false;
+    }
+
+    EraseEntries(previous);
+    entries = written;
+    _stats.writes++;
+    _stats.payloadBytes += size;
+    keyStats.writes++;
+    keyStats.payloadBytes += size;
+    keyStats.entriesWritten += _stats.entriesWritten - entriesBefore;
+    return true;
+}
+
+void NVSWearSimulator::erase(const std::string& namespc, const std::string& key) {
+    auto it = _itemIds.find(namespc + "/" + key);
+    if(it == _itemIds.end()) {
+        return;
+    }
+    EraseEntries(_items[it->second].entries);
+    _items[it->second].entries.clear();
+}
+
+uint32_t NVSWearSimulator::maxPageEraseCount() const {
+    uint32_t result = 0;
+    for(const Page& page : _pages) {
+        result = std::max(result, page.eraseCount);
+    }
+    return result;
+}
+
+size_t NVSWearSimulator::liveEntries() const {
+    size_t result = 0;
+    for(const Page& page : _pages) {
+        for(EntryState state : page.entries) {
+            result += state == EntryState::Written ? 1 : 0;
+        }
+    }
+    return result;
+}
+
+double NVSWearSimulator::writeAmplification() const {
+    if(_stats.payloadBytes == 0) {
+        return 0.0;
+    }
+    double flashBytes = static_cast<double>(_stats.entriesWritten + _stats.entriesRelocated) * EntrySize
+        + static_cast<double>(_stats.pageActivations) * PageHeaderSize;
+    return flashBytes / static_cast<double>(_stats.payloadBytes);
+}
+
+double NVSWearSimulator::projectedLifetimeSeconds(double simulatedSeconds) const {
+    uint32_t maxErases = maxPageEraseCount();
+    if(maxErases == 0 || simulatedSeconds <= 0) {
+        return -1.0;
+    }
+    return static_cast<double>(_config.endurance) * simulatedSeconds / maxErases;
+}
+
+int32_t NVSWearSimulator::ItemFor(const std::string& id) {
+    auto it = _itemIds.find(id);
+    if(it != _itemIds.end()) {
+        return it->second;
+    }
+    int32_t itemId = static_cast<int32_t>(_items.size());
+    _items.emplace_back();
+    _itemIds.emplace(id, itemId);
+    return itemId;
+}
+
+bool NVSWearSimulator::EnsureNamespace(const std::string& namespc) {
+    std::string id = "\x01ns/" + namespc;
+    if(_itemIds.count(id) != 0) {
+        return true;
+    }
+    int32_t itemId = ItemFor(id);
+    EntryRef ref;
+    if(!Allocate(itemId, 1, ref, _stats.entriesWritten)) {
+        return false;
+    }
+    _items[itemId].entries.push_back(ref);
+    return true;
+}
+
+size_t NVSWearSimulator::FreeEntriesInActivePage() const {
+    if(_activePage < 0) {
+        return 0;
+    }
+    return EntriesPerPage - _pages[_activePage].nextFree;
+}
+
+bool NVSWearSimulator::EnsureFreeEntries(size_t count) {
+    // Every attempt either takes a free page or reclaims one, so
+    // trying once per page is enough to tell whether space can be found.
+    for(size_t attempt = 0; FreeEntriesInActivePage() < count; ++attempt) {
+        if(attempt > _pages.size() || !RequestNewPage()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NVSWearSimulator::Allocate(int32_t owner, uint16_t span, EntryRef& ref, uint64_t& counter) {
+    if(!EnsureFreeEntries(span)) {
+        return false;
+    }
+    Page& page = _pages[_activePage];
+    ref = EntryRef{static_cast<uint16_t>(_activePage), page.nextFree, span};
+    for(uint16_t i = 0; i < span; ++i) {
+        page.entries[page.nextFree + i] = EntryState::Written;
+        page.owners[page.nextFree + i] = owner;
+    }
+    page.nextFree += span;
+    counter += span;
+    return true;
+}
+
+void NVSWearSimulator::ActivatePage(uint16_t page) {
+    _pages[page].state = PageState::Active;
+    _activePage = page;
+    _stats.pageActivations++;
+}
+
+bool NVSWearSimulator::RequestNewPage() {
+    if(_activePage >= 0) {
+        _pages[_activePage].state = PageState::Full;
+    }
+    // NVS always keeps one free page in reserve for garbage collection
+    if(_freePages.size() > 1) {
+        uint16_t page = _freePages.front();
+        _freePages.pop_front();
+        ActivatePage(page);
+        return true;
+    }
+
+    int32_t victim = -1;
+    for(size_t i = 0; i < _pages.size(); ++i) {
+        if(_pages[i].state == PageState::Full && (victim < 0 || _pages[i].erased > _pages[victim].erased)) {
+            victim = static_cast<int32_t>(i);
+        }
+    }
+    if(victim < 0 || _pages[victim].erased == 0 || _freePages.empty()) {
+        return false;
+    }
+
+    uint16_t target = _freePages.front();
+    _freePages.pop_front();
+    ActivatePage(target);
+
+    // Move live entries of the victim to the new page
+    Page& source = _pages[victim];
+    for(uint16_t i = 0; i < EntriesPerPage;) {
+        if(source.entries[i] != EntryState::Written) {
+            ++i;
+            continue;
+        }
+        int32_t owner = source.owners[i];
+        uint16_t next = i + 1;
+        for(EntryRef& ref : _items[owner].entries) {
+            if(ref.page == victim && ref.index == i) {
+                // The new page has room for all live entries of the victim
+                EntryRef moved;
+                Allocate(owner, ref.span, moved, _stats.entriesRelocated);
+                next = i + ref.span;
+                ref = moved;
+                break;
+            }
+        }
+        i = next;
+    }
+
+    uint32_t eraseCount = source.eraseCount + 1;
+    source = Page();
+    std::fill(std::begin(source.owners), std::end(source.owners), -1);
+    source.eraseCount = eraseCount;
+    _stats.pageErases++;
+    _freePages.push_back(static_cast<uint16_t>(victim));
+
+    // The caller checks whether the new active page has enough room
+    return true;
+}
+
+void NVSWearSimulator::EraseEntries(const std::vector<EntryRef>& entries) {
+    for(const EntryRef& ref : entries) {
+        Page& page = _pages[ref.page];
+        for(uint16_t i = 0; i < ref.span; ++i) {
+            page.entries[ref.index + i] = EntryState::Erased;
+            page.owners[ref.index + i] = -1;
+        }
+        page.erased += ref.span;
+    }
+}
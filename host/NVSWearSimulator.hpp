@@ -0,0 +1,149 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "NVSPartitionFormat.hpp"
+
+/**
+ * @brief How a simulated write is stored, mirroring the ESPNVSValue classes.
+ */
+enum class NVSSimStorage : uint8_t {
+    /**
+     * nvs_set_blob(): NVSValue<T>, NVSLazyValue<T>, NVSStringValue, NVSLazyValue<std::string>
+     */
+    Blob,
+    /**
+     * nvs_set_str(): NVSValue<std::string>
+     */
+    String,
+    /**
+     * nvs_set_u8() ... nvs_set_i64(): always a single entry
+     */
+    Primitive
+};
+
+/**
+ * @brief Host-side model of NVS page and entry usage.
+ *
+ * Models entry spans, multi-page blob chunks, page activation and the
+ * garbage collection which moves live entries out of the page with the
+ * most erased entries and erases it. The model follows the ESP-IDF
+ * NVS implementation closely enough to compare storage strategies,
+ * but does not reproduce its exact page order.
+ */
+class NVSWearSimulator {
+public:
+    struct Config {
+        size_t partitionSize = 0x6000;
+        /**
+         * Rated erase cycles per flash sector
+         */
+        uint32_t endurance = 100000;
+    };
+
+    struct Stats {
+        /**
+         * Payload bytes requested by the application
+         */
+        uint64_t payloadBytes = 0;
+        uint64_t writes = 0;
+        /**
+         * Entries written for application data, including blob indices and namespace entries
+         */
+        uint64_t entriesWritten = 0;
+        /**
+         * Entries copied by garbage collection
+         */
+        uint64_t entriesRelocated = 0;
+        uint64_t pageActivations = 0;
+        uint64_t pageErases = 0;
+        /**
+         * Writes which failed because no page could be reclaimed
+         */
+        uint64_t failedWrites = 0;
+    };
+
+    struct KeyStats {
+        uint64_t writes = 0;
+        uint64_t payloadBytes = 0;
+        uint64_t entriesWritten = 0;
+    };
+
+    explicit NVSWearSimulator(const Config& config);
+
+    /**
+     * @brief Simulate one write which changes the value of the given key.
+     * @return false if the partition is full
+     */
+    bool write(const std::string& namespc, const std::string& key, NVSSimStorage storage, size_t size);
+
+    /**
+     * @brief Simulate nvs_erase_key()
+     */
+    void erase(const std::string& namespc, const std::string& key);
+
+    const Stats& stats() const { return _stats; }
+    const std::map<std::string, KeyStats>& keyStats() const { return _keyStats; }
+
+    size_t pageCount() const { return _pages.size(); }
+    uint32_t pageEraseCount(size_t page) const { return _pages[page].eraseCount; }
+    uint32_t maxPageEraseCount() const;
+    size_t liveEntries() const;
+
+    /**
+     * @brief Flash bytes written (entries and page headers) per payload byte
+     */
+    double writeAmplification() const;
+
+    /**
+     * @brief Projected time until the most worn page reaches its rated endurance
+     * @param simulatedSeconds Real time represented by the simulated workload
+     * @return Lifetime in seconds, or a negative value if no page has been erased yet
+     */
+    double projectedLifetimeSeconds(double simulatedSeconds) const;
+
+private:
+    enum class PageState : uint8_t { Empty, Active, Full };
+    enum class EntryState : uint8_t { Empty, Written, Erased };
+
+    struct Page {
+        PageState state = PageState::Empty;
+        uint16_t nextFree = 0;
+        uint16_t erased = 0;
+        uint32_t eraseCount = 0;
+        EntryState entries[nvs_format::EntriesPerPage] = {};
+        int32_t owners[nvs_format::EntriesPerPage] = {};
+    };
+
+    struct EntryRef {
+        uint16_t page;
+        uint16_t index;
+        uint16_t span;
+    };
+
+    struct Item {
+        std::vector<EntryRef> entries;
+    };
+
+    int32_t ItemFor(const std::string& id);
+    bool EnsureFreeEntries(size_t count);
+    bool Allocate(int32_t owner, uint16_t span, EntryRef& ref, uint64_t& counter);
+    bool RequestNewPage();
+    void ActivatePage(uint16_t page);
+    void EraseEntries(const std::vector<EntryRef>& entries);
+    bool EnsureNamespace(const std::string& namespc);
+    size_t FreeEntriesInActivePage() const;
+
+    Config _config;
+    std::vector<Page> _pages;
+    std::deque<uint16_t> _freePages;
+    int32_t _activePage = -1;
+    std::vector<Item> _items;
+    std::map<std::string, int32_t> _itemIds;
+    std::map<std::string, KeyStats> _keyStats;
+    Stats _stats;
+};
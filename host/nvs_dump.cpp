@@ -0,0 +1,265 @@
+/**
+ * @brief Command line front end for NVSImageReader.
+ *
+ * Build on Linux with:
+ *   g++ -std=c++17 -O2 -Iinclude host/NVSImageReader.cpp src/NVSHash.cpp host/nvs_dump.cpp -o nvs_dump
+ *
+ * Prints all keys of one or more raw NVS partition images. Integers and
+ * nvs_set_str() strings are decoded from their entry type. Blobs are printed
+ * as hex unless a type is given with --as, because their C++ type
+ * (NVSValue<T>, NVSStringValue, ...) is not stored in flash.
+ */
+#include "NVSImageReader.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+struct Decoding {
+    std::string namespc;
+    std::string key;
+    std::string type;
+};
+
+struct Options {
+    const char* namespc = nullptr;
+    const char* key = nullptr;
+    bool csv = false;
+    bool stats = false;
+    std::vector<Decoding> decodings;
+};
+
+const char* TypeName(nvs_format::ItemType type) {
+    switch(type) {
+        case nvs_format::ItemType::U8: return "u8";
+        case nvs_format::ItemType::I8: return "i8";
+        case nvs_format::ItemType::U16: return "u16";
+        case nvs_format::ItemType::I16: return "i16";
+        case nvs_format::ItemType::U32: return "u32";
+        case nvs_format::ItemType::I32: return "i32";
+        case nvs_format::ItemType::U64: return "u64";
+        case nvs_format::ItemType::I64: return "i64";
+        case nvs_format::ItemType::String: return "string";
+        case nvs_format::ItemType::BlobLegacy:
+        case nvs_format::ItemType::BlobData: return "blob";
+        default: return "unknown";
+    }
+}
+
+void AppendEscaped(std::string& out, const std::string& value, bool csv) {
+    out += '"';
+    for(unsigned char c : value) {
+        if(c == '"') {
+            out += csv ? "\"\"" : "\\\"";
+        } else if(c == '\\' && !csv) {
+            out += "\\\\";
+        } else if(c < 0x20 || c >= 0x7F) {
+            char escaped[5];
+            snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            out += escaped;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+}
+
+void AppendHex(std::string& out, const std::string& value) {
+    static const char Digits[] = "0123456789abcdef";
+    for(unsigned char c : value) {
+        out += Digits[c >> 4];
+        out += Digits[c & 0x0F];
+    }
+}
+
+template<typename T>
+bool Format(const std::string& data, const char* format, std::string& out) {
+    if(data.size() != sizeof(T)) {
+        return false;
+    }
+    T value;
+    memcpy(&value, data.data(), sizeof(T));
+    char text[64];
+    snprintf(text, sizeof(text), format, value);
+    out += text;
+    return true;
+}
+
+/**
+ * @brief Decode a blob as the given C++ type, e.g. "float" for NVSValue<float>
+ */
+bool DecodeAs(const std::string& type, const std::string& data, bool csv, std::string& out) {
+    if(type == "string") {
+        AppendEscaped(out, data, csv);
+        return true;
+    }
+    if(type == "hex") {
+        AppendHex(out, data);
+        return true;
+    }
+    if(type == "bool" && data.size() == 1) {
+        out += data[0] ? "true" : "false";
+        return true;
+    }
+    if(type == "u8") return Format<uint8_t>(data, "%" PRIu8, out);
+    if(type == "i8") return Format<int8_t>(data, "%" PRId8, out);
+    if(type == "u16") return Format<uint16_t>(data, "%" PRIu16, out);
+    if(type == "i16") return Format<int16_t>(data, "%" PRId16, out);
+    if(type == "u32") return Format<uint32_t>(data, "%" PRIu32, out);
+    if(type == "i32") return Format<int32_t>(data, "%" PRId32, out);
+    if(type == "u64") return Format<uint64_t>(data, "%" PRIu64, out);
+    if(type == "i64") return Format<int64_t>(data, "%" PRId64, out);
+    if(type == "float") return Format<float>(data, "%.9g", out);
+    if(type == "double") return Format<double>(data, "%.17g", out);
+    return false;
+}
+
+const Decoding* FindDecoding(const Options& options, std::string_view namespc, std::string_view key) {
+    for(const Decoding& decoding : options.decodings) {
+        if(decoding.key == key && (decoding.namespc.empty() || decoding.namespc == namespc)) {
+            return &decoding;
+        }
+    }
+    return nullptr;
+}
+
+bool ParseDecoding(const char* argument, Decoding& decoding) {
+    const char* equals = strchr(argument, '=');
+    if(equals == nullptr) {
+        return false;
+    }
+    std::string name(argument, equals);
+    size_t slash = name.find('/');
+    if(slash != std::string::npos) {
+        decoding.namespc = name.substr(0, slash);
+        name = name.substr(slash + 1);
+    }
+    decoding.key = name;
+    decoding.type = equals + 1;
+    return true;
+}
+
+void PrintStats(const char* path, const NVSImageReader::Stats& stats) {
+    printf("%s: %zu pages (%zu active, %zu full, %zu freeing, %zu empty, %zu corrupt), "
+           "entries %zu written, %zu erased, %zu empty, %zu CRC errors, %zu incomplete blobs, %zu duplicates\n",
+        path, stats.pages, stats.activePages, stats.fullPages, stats.freeingPages, stats.emptyPages, stats.corruptPages,
+        stats.writtenEntries, stats.erasedEntries, stats.emptyEntries, stats.crcErrors, stats.incompleteBlobs, stats.duplicates);
+}
+
+void DumpImage(const char* path, const NVSImageReader& reader, const Options& options) {
+    std::string data;
+    std::string line;
+    for(const NVSImageItem& item : reader.items()) {
+        std::string_view namespc = reader.namespaceName(item.namespaceIndex);
+        if((options.namespc != nullptr && namespc != options.namespc) || (options.key != nullptr && item.key != options.key)) {
+            continue;
+        }
+        line.clear();
+        if(options.csv) {
+            line += path;
+            line += ',';
+            line += namespc;
+            line += ',';
+            line += item.key;
+            line += ',';
+            line += TypeName(item.type);
+            line += ',';
+        } else {
+            line += namespc;
+            line += '/';
+            line += item.key;
+            line += " (";
+            line += TypeName(item.type);
+            line += ", " + std::to_string(item.size) + " bytes) = ";
+        }
+
+        reader.readValue(item, data);
+        const Decoding* decoding = FindDecoding(options, namespc, item.key);
+        bool isBlob = item.type == nvs_format::ItemType::BlobData || item.type == nvs_format::ItemType::BlobLegacy;
+        if(item.type == nvs_format::ItemType::String) {
+            if(!data.empty() && data.back() == '\0') {
+                data.pop_back();
+            }
+            AppendEscaped(line, data, options.csv);
+        } else if(isBlob) {
+            if(decoding == nullptr || !DecodeAs(decoding->type, data, options.csv, line)) {
+                AppendHex(line, data);
+            }
+        } else {
+            int64_t value = NVSImageReader::DecodeInteger(item, *reader.segments(item));
+            bool isUnsigned = (static_cast<uint8_t>(item.type) & 0x10) == 0;
+            line += isUnsigned ? std::to_string(static_cast<uint64_t>(value)) : std::to_string(value);
+        }
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), stdout);
+    }
+}
+
+void PrintUsage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [options] image.bin [image.bin ...]\n"
+        "  --namespace NAME              Only print keys of this namespace\n"
+        "  --key KEY                     Only print this key\n"
+        "  --as [NAMESPACE/]KEY=TYPE     Decode a blob as bool, u8 ... i64, float, double, string or hex\n"
+        "  --csv                         Print file,namespace,key,type,value rows\n"
+        "  --stats                       Print page and entry statistics per image\n",
+        program);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<const char*> images;
+
+    for(int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--namespace") == 0 && hasValue) {
+            options.namespc = argv[++i];
+        } else if(strcmp(argv[i], "--key") == 0 && hasValue) {
+            options.key = argv[++i];
+        } else if(strcmp(argv[i], "--as") == 0 && hasValue) {
+            Decoding decoding;
+            if(!ParseDecoding(argv[++i], decoding)) {
+                PrintUsage(argv[0]);
+                return 2;
+            }
+            options.decodings.push_back(decoding);
+        } else if(strcmp(argv[i], "--csv") == 0) {
+            options.csv = true;
+        } else if(strcmp(argv[i], "--stats") == 0) {
+            options.stats = true;
+        } else if(argv[i][0] != '-') {
+            images.push_back(argv[i]);
+        } else {
+            PrintUsage(argv[0]);
+            return 2;
+        }
+    }
+    if(images.empty()) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    if(options.csv) {
+        printf("file,namespace,key,type,value\n");
+    }
+    int result = 0;
+    NVSImageReader reader;
+    for(const char* path : images) {
+        std::string error;
+        if(!reader.open(path, &error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            result = 1;
+            continue;
+        }
+        if(options.stats) {
+            PrintStats(path, reader.stats());
+        }
+        DumpImage(path, reader, options);
+    }
+    return result;
+}
@@ -0,0 +1,414 @@
+/**
+ * @brief Generates a ready-to-flash NVS partition image from manifests.
+ *
+ * Build on Linux with:
+ *   g++ -std=c++17 -O2 -Iinclude host/NVSImageWriter.cpp host/NVSImageReader.cpp src/NVSHash.cpp host/nvs_image_gen.cpp -o nvs_image_gen
+ *
+ * Manifests contain one setting per line. Blank lines and text after '#' are
+ * ignored. When several manifests are given, later values for the same key
+ * replace earlier ones, e.g. defaults.txt followed by a per-unit manifest.
+ *
+ *   namespace <name>                  Namespace for the following lines (default "app")
+ *   set <key> <class> <value>
+ *
+ * <class> selects how the value is stored, matching the class that reads it:
+ *   value:<type>                      NVSValue<type>, NVSLazyValue<type>, type is one of
+ *                                     bool u8 i8 u16 i16 u32 i32 u64 i64 float double
+ *   string                            NVSValue<std::string> (nvs_set_str())
+ *   stringvalue                       NVSStringValue, NVSLazyValue<std::string>
+ *   blob                              raw blob, value given as hex
+ *   u8 i8 u16 i16 u32 i32 u64 i64     native integer entries (nvs_set_u8() ...)
+ *
+ * String values may be quoted ("...") to keep leading spaces or '#', with \" \\ \n \t and \xHH escapes.
+ *
+ * The generated image is read back with NVSImageReader and compared to the manifest before it is saved.
+ */
+#include "NVSImageReader.hpp"
+#include "NVSImageWriter.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+enum class Storage : uint8_t {
+    Blob,
+    String,
+    Integer
+};
+
+struct Setting {
+    std::string namespc;
+    std::string key;
+    Storage storage;
+    nvs_format::ItemType integerType;
+    int64_t integer;
+    std::string bytes;
+    std::string origin;
+};
+
+struct IntegerType {
+    const char* name;
+    nvs_format::ItemType type;
+    bool isSigned;
+    size_t size;
+};
+
+const IntegerType IntegerTypes[] = {
+    {"u8", nvs_format::ItemType::U8, false, 1},
+    {"i8", nvs_format::ItemType::I8, true, 1},
+    {"u16", nvs_format::ItemType::U16, false, 2},
+    {"i16", nvs_format::ItemType::I16, true, 2},
+    {"u32", nvs_format::ItemType::U32, false, 4},
+    {"i32", nvs_format::ItemType::I32, true, 4},
+    {"u64", nvs_format::ItemType::U64, false, 8},
+    {"i64", nvs_format::ItemType::I64, true, 8},
+};
+
+const IntegerType* FindIntegerType(const std::string& name) {
+    for(const IntegerType& type : IntegerTypes) {
+        if(name == type.name) {
+            return &type;
+        }
+    }
+    return nullptr;
+}
+
+bool ParseInteger(const std::string& text, const IntegerType& type, int64_t& value) {
+    if(text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    if(type.isSigned) {
+        long long parsed = strtoll(text.c_str(), &end, 0);
+        int64_t limit = type.size == 8 ? INT64_MAX : (int64_t(1) << (type.size * 8 - 1)) - 1;
+        if(parsed > limit || parsed < -limit - 1) {
+            return false;
+        }
+        value = parsed;
+    } else {
+        if(text[0] == '-') {
+            return false;
+        }
+        unsigned long long parsed = strtoull(text.c_str(), &end, 0);
+        if(type.size < 8 && parsed >> (type.size * 8) != 0) {
+            return false;
+        }
+        value = static_cast<int64_t>(parsed);
+    }
+    return errno == 0 && *end == '\0';
+}
+
+template<typename T>
+std::string BytesOf(const T& value) {
+    return std::string(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/**
+ * @brief Encode a value as stored by NVSValue<type>. Host and target are both little-endian.
+ */
+bool EncodeValue(const std::string& type, const std::string& text, std::string& bytes) {
+    char* end = nullptr;
+    if(type == "bool") {
+        if(text != "true" && text != "false" && text != "1" && text != "0") {
+            return false;
+        }
+        bytes = BytesOf<bool>(text == "true" || text == "1");
+        return true;
+    }
+    if(type == "float" || type == "double") {
+        errno = 0;
+        double value = strtod(text.c_str(), &end);
+        if(text.empty() || *end != '\0' || errno != 0) {
+            return false;
+        }
+        bytes = type == "float" ? BytesOf(static_cast<float>(value)) : BytesOf(value);
+        return true;
+    }
+    const IntegerType* integerType = FindIntegerType(type);
+    int64_t value;
+    if(integerType == nullptr || !ParseInteger(text, *integerType, value)) {
+        return false;
+    }
+    uint64_t raw = static_cast<uint64_t>(value);
+    bytes = BytesOf(raw).substr(0, integerType->size);
+    return true;
+}
+
+bool DecodeHex(const std::string& text, std::string& bytes) {
+    if(text.size() % 2 != 0) {
+        return false;
+    }
+    bytes.clear();
+    for(size_t i = 0; i < text.size(); i += 2) {
+        char digits[3] = {text[i], text[i + 1], 0};
+        char* end = nullptr;
+        long value = strtol(digits, &end, 16);
+        if(*end != '\0' || !isxdigit(static_cast<unsigned char>(digits[0]))) {
+            return false;
+        }
+        bytes += static_cast<char>(value);
+    }
+    return true;
+}
+
+/**
+ * @brief Parse a quoted string with escapes, or take the text up to a '#' comment
+ */
+bool ParseString(const std::string& text, std::string& value) {
+    if(text.empty() || text[0] != '"') {
+        size_t end = text.find('#');
+        value = text.substr(0, end);
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        return true;
+    }
+    value.clear();
+    for(size_t i = 1; i < text.size(); i++) {
+        char c = text[i];
+        if(c == '"') {
+            size_t rest = text.find_first_not_of(" \t\r", i + 1);
+            return rest == std::string::npos || text[rest] == '#';
+        }
+        if(c != '\\') {
+            value += c;
+            continue;
+        }
+        if(++i >= text.size()) {
+            return false;
+        }
+        switch(text[i]) {
+            case 'n': value += '\n'; break;
+            case 't': value += '\t'; break;
+            case '0': value += '\0'; break;
+            case 'x': {
+                std::string byte;
+                if(i + 2 >= text.size() || !DecodeHex(text.substr(i + 1, 2), byte)) {
+                    return false;
+                }
+                value += byte;
+                i += 2;
+                break;
+            }
+            default: value += text[i]; break;
+        }
+    }
+    return false;
+}
+
+bool ParseSetting(const std::string& key, const std::string& storage, const std::string& text, Setting& setting) {
+    setting.key = key;
+    setting.integer = 0;
+    setting.integerType = nvs_format::ItemType::Any;
+    if(storage.compare(0, 6, "value:") == 0 || storage.compare(0, 5, "lazy:") == 0) {
+        setting.storage = Storage::Blob;
+        std::string value;
+        return ParseString(text, value) && EncodeValue(storage.substr(storage.find(':') + 1), value, setting.bytes);
+    }
+    if(storage == "string" || storage == "stringvalue") {
+        setting.storage = storage == "string" ? Storage::String : Storage::Blob;
+        if(!ParseString(text, setting.bytes)) {
+            return false;
+        }
+        // nvs_set_str() cannot store embedded null characters
+        return setting.storage == Storage::Blob || setting.bytes.find('\0') == std::string::npos;
+    }
+    if(storage == "blob") {
+        setting.storage = Storage::Blob;
+        std::string value;
+        return ParseString(text, value) && DecodeHex(value, setting.bytes);
+    }
+    const IntegerType* integerType = FindIntegerType(storage);
+    if(integerType != nullptr) {
+        setting.storage = Storage::Integer;
+        setting.integerType = integerType->type;
+        std::string value;
+        return ParseString(text, value) && ParseInteger(value, *integerType, setting.integer);
+    }
+    return false;
+}
+
+bool ParseManifest(const char* path, std::vector<Setting>& settings, std::map<std::string, size_t>& byName) {
+    std::ifstream input(path);
+    if(!input) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    std::string namespc = "app";
+    std::string line;
+    for(unsigned lineNumber = 1; std::getline(input, line); ++lineNumber) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if(start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        std::vector<std::string> words;
+        size_t position = start;
+        while(words.size() < 3 && position < line.size()) {
+            size_t end = line.find_first_of(" \t\r", position);
+            words.push_back(line.substr(position, end - position));
+            position = line.find_first_not_of(" \t\r", end == std::string::npos ? line.size() : end);
+            if(position == std::string::npos) {
+                position = line.size();
+            }
+        }
+        std::string rest = line.substr(position);
+        std::string origin = std::string(path) + ":" + std::to_string(lineNumber);
+
+        if(words[0] == "namespace" && words.size() == 2) {
+            namespc = words[1];
+            if(namespc.empty() || namespc.size() > nvs_format::MaxKeyLength) {
+                fprintf(stderr, "%s: invalid namespace\n", origin.c_str());
+                return false;
+            }
+            continue;
+        }
+        if(words[0] != "set" || words.size() < 3) {
+            fprintf(stderr, "%s: expected 'namespace <name>' or 'set <key> <class> <value>'\n", origin.c_str());
+            return false;
+        }
+        Setting setting;
+        setting.namespc = namespc;
+        setting.origin = origin;
+        if(words[1].size() > nvs_format::MaxKeyLength) {
+            fprintf(stderr, "%s: key '%s' is longer than %zu characters\n", origin.c_str(), words[1].c_str(), nvs_format::MaxKeyLength);
+            return false;
+        }
+        if(!ParseSetting(words[1], words[2], rest, setting)) {
+            fprintf(stderr, "%s: invalid value for '%s' of class '%s'\n", origin.c_str(), words[1].c_str(), words[2].c_str());
+            return false;
+        }
+        std::string name = namespc + "/" + words[1];
+        auto existing = byName.find(name);
+        if(existing != byName.end()) {
+            settings[existing->second] = setting;
+        } else {
+            byName.emplace(name, settings.size());
+            settings.push_back(setting);
+        }
+    }
+    return true;
+}
+
+bool Write(NVSImageWriter& writer, const Setting& setting) {
+    switch(setting.storage) {
+        case Storage::Blob:
+            return writer.setBlob(setting.namespc, setting.key, setting.bytes.data(), setting.bytes.size());
+        case Storage::String:
+            return writer.setString(setting.namespc, setting.key, setting.bytes);
+        case Storage::Integer:
+            return writer.setInteger(setting.namespc, setting.key, setting.integerType, setting.integer);
+    }
+    return false;
+}
+
+/**
+ * @brief Read the image back the way the firmware classes do and compare it to the manifest
+ */
+bool Verify(const std::vector<uint8_t>& image, const std::vector<Setting>& settings) {
+    NVSImageReader reader;
+    std::string error;
+    if(!reader.load(image.data(), image.size(), &error)) {
+        fprintf(stderr, "Verification failed: %s\n", error.c_str());
+        return false;
+    }
+    const NVSImageReader::Stats& stats = reader.stats();
+    bool ok = stats.crcErrors == 0 && stats.incompleteBlobs == 0 && stats.duplicates == 0 && stats.corruptPages == 0 &&
+              reader.items().size() == settings.size();
+    if(!ok) {
+        fprintf(stderr, "Verification failed: image contains %zu keys, %zu CRC errors, %zu incomplete blobs, %zu duplicates\n",
+            reader.items().size(), stats.crcErrors, stats.incompleteBlobs, stats.duplicates);
+    }
+
+    std::string value;
+    for(const Setting& setting : settings) {
+        bool matches = false;
+        if(setting.storage == Storage::Integer) {
+            int64_t stored;
+            matches = reader.find(setting.namespc, setting.key, setting.integerType) != nullptr &&
+                      reader.getInteger(setting.namespc, setting.key, stored) && stored == setting.integer;
+        } else if(setting.storage == Storage::String) {
+            matches = reader.getString(setting.namespc, setting.key, value, NVSImageStringPreference::PreferString) &&
+                      value == setting.bytes;
+        } else {
+            const NVSImageItem* item = reader.find(setting.namespc, setting.key, nvs_format::ItemType::BlobData);
+            if(item != nullptr) {
+                reader.readValue(*item, value);
+                matches = value == setting.bytes;
+            }
+        }
+        if(!matches) {
+            fprintf(stderr, "Verification failed: %s/%s (%s) does not read back\n",
+                setting.namespc.c_str(), setting.key.c_str(), setting.origin.c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void PrintUsage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [options] -o image.bin manifest.txt [manifest.txt ...]\n"
+        "  --partition-size BYTES        NVS partition size (default 0x6000)\n"
+        "  -o, --output FILE             Image file to write\n",
+        program);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t partitionSize = 0x6000;
+    const char* outputPath = nullptr;
+    std::vector<const char*> manifests;
+
+    for(int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--partition-size") == 0 && hasValue) {
+            partitionSize = strtoul(argv[++i], nullptr, 0);
+        } else if((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) && hasValue) {
+            outputPath = argv[++i];
+        } else if(argv[i][0] != '-') {
+            manifests.push_back(argv[i]);
+        } else {
+            PrintUsage(argv[0]);
+            return 2;
+        }
+    }
+    if(outputPath == nullptr || manifests.empty()) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+    if(partitionSize % nvs_format::PageSize != 0 || partitionSize < 2 * nvs_format::PageSize) {
+        fprintf(stderr, "Partition size must be a multiple of %zu and at least two pages\n", nvs_format::PageSize);
+        return 2;
+    }
+
+    std::vector<Setting> settings;
+    std::map<std::string, size_t> byName;
+    for(const char* manifest : manifests) {
+        if(!ParseManifest(manifest, settings, byName)) {
+            return 1;
+        }
+    }
+
+    NVSImageWriter writer(partitionSize);
+    for(const Setting& setting : settings) {
+        if(!Write(writer, setting)) {
+            fprintf(stderr, "%s: %s\n", setting.origin.c_str(), writer.error().c_str());
+            return 1;
+        }
+    }
+    if(!Verify(writer.image(), settings)) {
+        return 1;
+    }
+    if(!writer.save(outputPath)) {
+        fprintf(stderr, "%s\n", writer.error().c_str());
+        return 1;
+    }
+    printf("%s: %zu keys in %zu of %zu pages\n", outputPath, settings.size(), writer.usedPages(), partitionSize / nvs_format::PageSize);
+    return 0;
+}
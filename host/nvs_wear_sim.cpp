@@ -0,0 +1,193 @@
+/**
+ * @brief Command line front end for NVSWearSimulator.
+ *
+ * Build on Linux with:
+ *   g++ -std=c++17 -O2 host/NVSWearSimulator.cpp host/nvs_wear_sim.cpp -o nvs_wear_sim
+ *
+ * The workload file contains one operation per line. All operations are
+ * executed once per iteration; blank lines and text after '#' are ignored.
+ *
+ *   namespace <name>                  Namespace for the following lines (default "app")
+ *   set <key> <class> [size] [xN]     One changing set() call, repeated N times
+ *   erase <key>                       nvs_erase_key()
+ *
+ * <class> selects how the value is stored:
+ *   value, lazy, stringvalue, blob    nvs_set_blob() (NVSValue<T>, NVSLazyValue<T>, NVSStringValue)
+ *   string                            nvs_set_str() (NVSValue<std::string>)
+ *   u8 i8 u16 i16 u32 i32 u64 i64     native integer entries (size is implied)
+ */
+#include "NVSWearSimulator.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+struct Operation {
+    bool erase;
+    std::string namespc;
+    std::string key;
+    NVSSimStorage storage;
+    size_t size;
+    unsigned repeat;
+};
+
+bool ParseStorage(const std::string& name, NVSSimStorage& storage, size_t& impliedSize) {
+    impliedSize = 0;
+    if(name == "value" || name == "lazy" || name == "stringvalue" || name == "blob") {
+        storage = NVSSimStorage::Blob;
+        return true;
+    }
+    if(name == "string") {
+        storage = NVSSimStorage::String;
+        return true;
+    }
+    static const char* const Integers[] = {"u8", "i8", "u16", "i16", "u32", "i32", "u64", "i64"};
+    static const size_t IntegerSizes[] = {1, 1, 2, 2, 4, 4, 8, 8};
+    for(size_t i = 0; i < 8; ++i) {
+        if(name == Integers[i]) {
+            storage = NVSSimStorage::Primitive;
+            impliedSize = IntegerSizes[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseWorkload(std::istream& input, std::vector<Operation>& operations) {
+    std::string namespc = "app";
+    std::string line;
+    for(unsigned lineNumber = 1; std::getline(input, line); ++lineNumber) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string command;
+        if(!(words >> command)) {
+            continue;
+        }
+        if(command == "namespace") {
+            words >> namespc;
+            continue;
+        }
+        Operation op{command == "erase", namespc, "", NVSSimStorage::Blob, 0, 1};
+        std::string storage;
+        if(!(words >> op.key) || op.key.size() > nvs_format::MaxKeyLength) {
+            fprintf(stderr, "Line %u: missing or too long key\n", lineNumber);
+            return false;
+        }
+        if(command == "set") {
+            size_t impliedSize;
+            if(!(words >> storage) || !ParseStorage(storage, op.storage, impliedSize)) {
+                fprintf(stderr, "Line %u: unknown value class '%s'\n", lineNumber, storage.c_str());
+                return false;
+            }
+            op.size = impliedSize;
+            std::string word;
+            while(words >> word) {
+                if(word[0] == 'x') {
+                    op.repeat = static_cast<unsigned>(strtoul(word.c_str() + 1, nullptr, 10));
+                } else {
+                    op.size = strtoul(word.c_str(), nullptr, 0);
+                }
+            }
+        } else if(command != "erase") {
+            fprintf(stderr, "Line %u: unknown command '%s'\n", lineNumber, command.c_str());
+            return false;
+        }
+        operations.push_back(op);
+    }
+    return true;
+}
+
+void PrintUsage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [options] workload.txt\n"
+        "  --partition-size BYTES        NVS partition size (default 0x6000)\n"
+        "  --endurance CYCLES            Rated erase cycles per sector (default 100000)\n"
+        "  --iterations N                Number of times the workload is run (default 1000)\n"
+        "  --seconds-per-iteration S     Real time represented by one iteration (default 60)\n",
+        program);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    NVSWearSimulator::Config config;
+    unsigned long iterations = 1000;
+    double secondsPerIteration = 60;
+    const char* workloadPath = nullptr;
+
+    for(int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--partition-size") == 0 && hasValue) {
+            config.partitionSize = strtoul(argv[++i], nullptr, 0);
+        } else if(strcmp(argv[i], "--endurance") == 0 && hasValue) {
+            config.endurance = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        } else if(strcmp(argv[i], "--iterations") == 0 && hasValue) {
+            iterations = strtoul(argv[++i], nullptr, 0);
+        } else if(strcmp(argv[i], "--seconds-per-iteration") == 0 && hasValue) {
+            secondsPerIteration = strtod(argv[++i], nullptr);
+        } else if(argv[i][0] != '-' && workloadPath == nullptr) {
+            workloadPath = argv[i];
+        } else {
+            PrintUsage(argv[0]);
+            return 2;
+        }
+    }
+    if(workloadPath == nullptr) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    std::ifstream input(workloadPath);
+    if(!input) {
+        fprintf(stderr, "Cannot open %s\n", workloadPath);
+        return 1;
+    }
+    std::vector<Operation> operations;
+    if(!ParseWorkload(input, operations)) {
+        return 1;
+    }
+
+    NVSWearSimulator simulator(config);
+    for(unsigned long iteration = 0; iteration < iterations; ++iteration) {
+        for(const Operation& op : operations) {
+            if(op.erase) {
+                simulator.erase(op.namespc, op.key);
+                continue;
+            }
+            for(unsigned n = 0; n < op.repeat; ++n) {
+                if(!simulator.write(op.namespc, op.key, op.storage, op.size)) {
+                    fprintf(stderr, "Partition full at iteration %lu writing %s/%s\n", iteration, op.namespc.c_str(), op.key.c_str());
+                    return 1;
+                }
+            }
+        }
+    }
+
+    const NVSWearSimulator::Stats& stats = simulator.stats();
+    double simulatedSeconds = iterations * secondsPerIteration;
+    printf("Pages:               %zu (%zu live entries)\n", simulator.pageCount(), simulator.liveEntries());
+    printf("Writes:              %llu (%llu payload bytes)\n", (unsigned long long)stats.writes, (unsigned long long)stats.payloadBytes);
+    printf("Entries written:     %llu\n", (unsigned long long)stats.entriesWritten);
+    printf("Entries relocated:   %llu\n", (unsigned long long)stats.entriesRelocated);
+    printf("Page erases:         %llu (max %u per page)\n", (unsigned long long)stats.pageErases, simulator.maxPageEraseCount());
+    printf("Write amplification: %.2f\n", simulator.writeAmplification());
+    double lifetime = simulator.projectedLifetimeSeconds(simulatedSeconds);
+    if(lifetime < 0) {
+        printf("Projected lifetime:  no page erased in %.0f s, increase --iterations\n", simulatedSeconds);
+    } else {
+        printf("Projected lifetime:  %.1f years\n", lifetime / (365.25 * 24 * 3600));
+    }
+
+    printf("\n%-24s %10s %12s %10s\n", "Key", "Writes", "Entries", "Per write");
+    for(const auto& entry : simulator.keyStats()) {
+        const NVSWearSimulator::KeyStats& keyStats = entry.second;
+        printf("%-24s %10llu %12llu %10.2f\n", entry.first.c_str(),
+            (unsigned long long)keyStats.writes, (unsigned long long)keyStats.entriesWritten,
+            keyStats.writes > 0 ? static_cast<double>(keyStats.entriesWritten) / keyStats.writes : 0.0);
+    }
+    return 0;
+}
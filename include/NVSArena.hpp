@@ -0,0 +1,196 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <esp_heap_caps.h>
+
+/**
+ * @brief Usage statistics of an NVSArena
+ */
+struct NVSArenaStats {
+    size_t capacity;
+    /**
+     * Bytes currently allocated from the arena, including block headers
+     */
+    size_t used;
+    /**
+     * Maximum of used since the arena was created or resetHighWaterMark() was called
+     */
+    size_t highWaterMark;
+    size_t allocations;
+    /**
+     * Allocations which did not fit into the arena and were served by the fallback heap
+     */
+    size_t fallbackAllocations;
+    /**
+     * Allocations which failed both in the arena and in the fallback heap
+     */
+    size_t failedAllocations;
+};
+
+/**
+ * @brief Fixed-size memory arena for cached value payloads.
+ *
+ * Allocations are served first-fit from a single contiguous buffer, so all
+ * payloads of e.g. one namespace can be placed in external RAM together.
+ * Freed blocks are returned to an address-ordered free list and merged with
+ * their neighbours. When the arena is full, allocations fall back to
+ * heap_caps_malloc() with the fallback capabilities instead of failing.
+ *
+ * The arena is not thread-safe. Use it from one task or protect it externally.
+ */
+class NVSArena {
+public:
+    /**
+     * @param buffer Memory managed by the arena, e.g. a static buffer with EXT_RAM_BSS_ATTR.
+     *               It must outlive the arena and all allocations from it.
+     * @param size Size of buffer in bytes
+     * @param fallbackCaps Capabilities used when the arena is full, 0 to fail instead
+     */
+    NVSArena(void* buffer, size_t size, uint32_t fallbackCaps = MALLOC_CAP_DEFAULT);
+
+    NVSArena(const NVSArena&) = delete;
+    NVSArena& operator=(const NVSArena&) = delete;
+
+    /**
+     * @return Memory aligned to at least alignment, or nullptr if both the arena and the fallback heap are exhausted
+     */
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    /**
+     * @brief Return memory obtained from allocate(), either to the arena or to the fallback heap
+     */
+    void deallocate(void* pointer);
+
+    /**
+     * @return Whether pointer lies within the arena buffer
+     */
+    bool owns(const void* pointer) const;
+
+    /**
+     * @brief Construct an object in the arena, e.g. a large NVSValue<T>
+     */
+    template<typename T, typename... Args>
+    T* create(Args&&... args) {
+        void* memory = allocate(sizeof(T), alignof(T));
+        return memory != nullptr ? new(memory) T(std::forward<Args>(args)...) : nullptr;
+    }
+
+    /**
+     * @brief Destroy an object created by create()
+     */
+    template<typename T>
+    void destroy(T* object) {
+        if(object != nullptr) {
+            object->~T();
+            deallocate(object);
+        }
+    }
+
+    const NVSArenaStats& stats() const { return _stats; }
+    size_t highWaterMark() const { return _stats.highWaterMark; }
+    void resetHighWaterMark() { _stats.highWaterMark = _stats.used; }
+
+protected:
+    NVSArena() = default;
+    void Initialize(void* buffer, size_t size, uint32_t fallbackCaps);
+
+private:
+    struct FreeBlock {
+        size_t size;
+        FreeBlock* next;
+    };
+
+    static constexpr size_t Alignment = alignof(std::max_align_t) > sizeof(FreeBlock) ? alignof(std::max_align_t) : sizeof(FreeBlock);
+    /**
+     * Allocated blocks store their size in front of the payload
+     */
+    static constexpr size_t HeaderSize = Alignment;
+
+    void* FallbackAllocate(size_t size);
+
+    uint8_t* _begin = nullptr;
+    uint8_t* _end = nullptr;
+    FreeBlock* _freeList = nullptr;
+    uint32_t _fallbackCaps = 0;
+    NVSArenaStats _stats = {};
+};
+
+/**
+ * @brief NVSArena whose buffer is allocated with heap_caps_malloc(), e.g. in PSRAM.
+ *
+ * If the buffer cannot be allocated, the arena has a capacity of 0 and
+ * all allocations are served by the fallback heap.
+ */
+class NVSCapsArena : public NVSArena {
+public:
+    NVSCapsArena(size_t size, uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, uint32_t fallbackCaps = MALLOC_CAP_DEFAULT);
+    ~NVSCapsArena();
+
+private:
+    void* _buffer;
+};
+
+/**
+ * @brief Standard allocator which allocates from an NVSArena.
+ *
+ * A default-constructed allocator has no arena and uses the default heap,
+ * so containers using it can still be default-constructed.
+ */
+template<typename T>
+class NVSArenaAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    NVSArenaAllocator() noexcept : _arena(nullptr) {}
+    explicit NVSArenaAllocator(NVSArena& arena) noexcept : _arena(&arena) {}
+
+    template<typename U>
+    NVSArenaAllocator(const NVSArenaAllocator<U>& other) noexcept : _arena(other.arena()) {}
+
+    T* allocate(size_t count) {
+        void* memory = _arena != nullptr
+            ? _arena->allocate(count * sizeof(T), alignof(T))
+            : heap_caps_malloc(count * sizeof(T), MALLOC_CAP_DEFAULT);
+        if(memory == nullptr) {
+#if defined(__cpp_exceptions)
+            throw std::bad_alloc();
+#else
+            abort();
+#endif
+        }
+        return static_cast<T*>(memory);
+    }
+
+    void deallocate(T* pointer, size_t) noexcept {
+        if(_arena != nullptr) {
+            _arena->deallocate(pointer);
+        } else {
+            heap_caps_free(pointer);
+        }
+    }
+
+    NVSArena* arena() const noexcept { return _arena; }
+
+    template<typename U>
+    bool operator==(const NVSArenaAllocator<U>& other) const noexcept { return _arena == other.arena(); }
+    template<typename U>
+    bool operator!=(const NVSArenaAllocator<U>& other) const noexcept { return _arena != other.arena(); }
+
+private:
+    NVSArena* _arena;
+};
+
+/**
+ * @brief String whose payload is allocated from an NVSArena.
+ * Use it with NVSValue, e.g. NVSValue<NVSArenaString>.
+ */
+typedef std::basic_string<char, std::char_traits<char>, NVSArenaAllocator<char>> NVSArenaString;
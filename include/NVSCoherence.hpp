@@ -0,0 +1,184 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include <nvs.h>
+
+#if __has_include("sdkconfig.h")
+#include "sdkconfig.h"
+#endif
+
+#ifndef CONFIG_ESPNVSVALUE_COHERENCE
+#define CONFIG_ESPNVSVALUE_COHERENCE 0
+#endif
+
+/*
+ * Coherence directory for value objects bound to the same key.
+ *
+ * Every live NVSValue, NVSStringValue and NVSLazyValue is linked into a
+ * directory entry for its NVS handle and key. After a successful write,
+ * the writer publishes the new bytes and every other instance of the same
+ * key updates its cached state in RAM, without reading flash. Lazy values,
+ * which have no cache of their own, read from a caching instance of the same
+ * key if there is one.
+ *
+ * Instances of one key are expected to use compatible types. A published
+ * value whose size does not match a fixed-size type is treated like a
+ * stored value of the wrong size, i.e. as not existing.
+ *
+ * The directory is only compiled in if CONFIG_ESPNVSVALUE_COHERENCE is
+ * enabled. Otherwise NVSCoherenceLink is empty and all calls are no-ops.
+ */
+
+/**
+ * @brief Counters of the coherence directory
+ */
+struct NVSCoherenceStats {
+    /**
+     * Number of instances currently linked
+     */
+    uint32_t linked;
+    /**
+     * Number of peer updates applied in RAM instead of re-reading NVS
+     */
+    uint32_t peerUpdates;
+    /**
+     * Number of lazy reads served by a peer instead of flash
+     */
+    uint32_t peerReads;
+};
+
+/**
+ * @brief Current directory counters. All fields are 0 if coherence is disabled.
+ */
+NVSCoherenceStats NVSCoherenceGetStats();
+
+#if CONFIG_ESPNVSVALUE_COHERENCE
+class NVSCoherenceNode;
+
+/**
+ * @brief Type-specific callbacks of a linked instance.
+ * They are called with the directory locked and must not access the directory.
+ */
+struct NVSCoherenceOps {
+    const std::string& (*key)(const NVSCoherenceNode& node);
+    /**
+     * Another instance of the same key has written data to NVS
+     */
+    void (*applyWrite)(NVSCoherenceNode& node, const void* data, size_t size);
+    /**
+     * Provide the cached value if it is known to equal the stored value
+     * @return false if the instance has no cached copy of the stored value
+     */
+    bool (*cachedValue)(const NVSCoherenceNode& node, const void*& data, size_t& size);
+};
+
+/**
+ * @brief Receives the cached value of a peer during NVSCoherenceNode::ReadPeer()
+ */
+typedef void (*NVSCoherenceSink)(void* context, const void* data, size_t size);
+
+/**
+ * @brief Intrusive directory entry. Use NVSCoherenceLink as base class.
+ */
+class NVSCoherenceNode {
+protected:
+    explicit NVSCoherenceNode(const NVSCoherenceOps* ops)
+        : _next(nullptr), _prev(nullptr), _ops(ops), _handle(0), _keyHash(0), _linked(false) {}
+    ~NVSCoherenceNode() { Detach(); }
+
+    NVSCoherenceNode(const NVSCoherenceNode&) = delete;
+    NVSCoherenceNode& operator=(const NVSCoherenceNode&) = delete;
+
+    /**
+     * @brief Link this instance to the directory entry of handle and key.
+     * Must be called whenever the handle or key change.
+     * Instances with an invalid handle or an empty key are not linked.
+     */
+    void Attach(nvs_handle_t handle, const std::string& key);
+
+    /**
+     * @brief Unlink this instance. Owners call this first in their destructor,
+     * so no peer can access members which are already destroyed.
+     */
+    void Detach();
+
+    /**
+     * @brief Update all other instances of the same key after data has been written
+     */
+    void Publish(const void* data, size_t size);
+
+    /**
+     * @brief Call sink with the cached value of another instance of the same key
+     * @return false if no instance holds a cached copy of the stored value
+     */
+    bool ReadPeer(NVSCoherenceSink sink, void* context) const;
+
+    template<typename Fn>
+    bool ReadPeer(Fn&& fn) const {
+        typedef std::remove_reference_t<Fn> Function;
+        return ReadPeer([](void* context, const void* data, size_t size) {
+            (*static_cast<Function*>(context))(data, size);
+        }, static_cast<void*>(&fn));
+    }
+
+private:
+    friend class NVSCoherenceDirectory;
+
+    NVSCoherenceNode* _next;
+    NVSCoherenceNode* _prev;
+    const NVSCoherenceOps* _ops;
+    nvs_handle_t _handle;
+    uint32_t _keyHash;
+    bool _linked;
+};
+
+/**
+ * @brief Base class which links Owner into the coherence directory.
+ *
+ * Owner needs to provide (and befriend this class for) the following members:
+ *  - const std::string& key() const
+ *  - void ApplyPeerWrite(const void* data, size_t size)
+ *  - bool CachedPeerValue(const void*& data, size_t& size) const
+ *
+ * Copies start unlinked. The owner calls Attach() at the end of each
+ * constructor and assignment, and Detach() at the start of its destructor.
+ */
+template<typename Owner>
+class NVSCoherenceLink : public NVSCoherenceNode {
+protected:
+    NVSCoherenceLink() : NVSCoherenceNode(&Operations) {}
+    NVSCoherenceLink(const NVSCoherenceLink&) : NVSCoherenceNode(&Operations) {}
+    NVSCoherenceLink& operator=(const NVSCoherenceLink&) { return *this; }
+
+private:
+    static const std::string& Key(const NVSCoherenceNode& node) {
+        return static_cast<const Owner&>(node).key();
+    }
+
+    static void ApplyWrite(NVSCoherenceNode& node, const void* data, size_t size) {
+        static_cast<Owner&>(node).ApplyPeerWrite(data, size);
+    }
+
+    static bool CachedValue(const NVSCoherenceNode& node, const void*& data, size_t& size) {
+        return static_cast<const Owner&>(node).CachedPeerValue(data, size);
+    }
+
+    static constexpr NVSCoherenceOps Operations = {&Key, &ApplyWrite, &CachedValue};
+};
+#else
+template<typename Owner>
+class NVSCoherenceLink {
+protected:
+    void Attach(nvs_handle_t, const std::string&) {}
+    void Detach() {}
+    void Publish(const void*, size_t) {}
+
+    template<typename Fn>
+    bool ReadPeer(Fn&&) const {
+        return false;
+    }
+};
+#endif
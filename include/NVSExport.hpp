@@ -0,0 +1,210 @@
+#pragma once
+#include <nvs.h>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if __has_include("sdkconfig.h")
+#include "sdkconfig.h"
+#endif
+
+#include "NVSResult.hpp"
+
+#ifndef CONFIG_ESPNVSVALUE_TRANSFER_BUFFER_SIZE
+#define CONFIG_ESPNVSVALUE_TRANSFER_BUFFER_SIZE 128
+#endif
+
+/**
+ * Size of the fixed buffers used by NVSExporter and NVSImporter.
+ * Values up to this size are transferred without any heap allocation.
+ */
+constexpr size_t NVSTransferBufferSize = CONFIG_ESPNVSVALUE_TRANSFER_BUFFER_SIZE;
+
+/**
+ * Version byte written after the "NVSX" magic
+ */
+constexpr uint8_t NVSTransferFormatVersion = 1;
+
+/**
+ * @brief Receives a chunk of the export stream.
+ * Return false to abort the export.
+ */
+typedef bool (*NVSExportSink)(void* context, const uint8_t* data, size_t size);
+
+/**
+ * @brief Fills buffer with up to size bytes of the import stream.
+ * Return the number of bytes written, or 0 at the end of the stream.
+ */
+typedef size_t (*NVSImportSource)(void* context, uint8_t* buffer, size_t size);
+
+/**
+ * @brief Returns the next key to export, or nullptr after the last one.
+ */
+typedef const char* (*NVSKeySource)(void* context);
+
+struct NVSExportStats {
+    uint32_t records = 0;
+    uint32_t bytes = 0;
+    /**
+     * Entries that could not be read or were too large to export
+     */
+    uint32_t skipped = 0;
+    /**
+     * Values larger than NVSTransferBufferSize that needed a temporary heap buffer
+     */
+    uint32_t heapFallbacks = 0;
+};
+
+struct NVSImportStats {
+    uint32_t records = 0;
+    uint32_t written = 0;
+    uint32_t unchanged = 0;
+    uint32_t heapFallbacks = 0;
+};
+
+/**
+ * @brief Stream all entries of a namespace to a sink in a compact binary format.
+ *
+ * Stream format (all integers little endian):
+ *  - Header: "NVSX" magic, version byte
+ *  - Records: type (nvs_type_t, 1 byte), key length (1 byte), key,
+ *    then for NVS_TYPE_STR and NVS_TYPE_BLOB a LEB128 payload length,
+ *    then the payload (integers use their natural width, strings have no null terminator)
+ *  - End marker: type 0x00, followed by the CRC32 of all preceding bytes
+ *
+ * Output is collected in a fixed NVSTransferBufferSize buffer and handed to
+ * the sink whenever it is full. Values which fit into this buffer are read
+ * directly into it. Larger strings and blobs need a temporary heap buffer
+ * because NVS can only read them as a whole.
+ */
+class NVSExporter {
+public:
+    NVSExporter(NVSExportSink sink, void* context);
+
+    /**
+     * @brief Convenience constructor accepting any callable with the
+     * signature bool(const uint8_t* data, size_t size).
+     * The callable must outlive the exporter.
+     */
+    template<typename Sink>
+    explicit NVSExporter(Sink& sink) : NVSExporter([](void* context, const uint8_t* data, size_t size) {
+        return (*static_cast<Sink*>(context))(data, size);
+    }, static_cast<void*>(&sink)) {}
+
+    /**
+     * If false, values larger than NVSTransferBufferSize are skipped
+     * instead of being read through a temporary heap buffer.
+     */
+    bool allowHeapForLargeValues = true;
+
+    /**
+     * @brief Export every entry of the given namespace.
+     *
+     * @param nvs Handle opened on namespc, used to read the values
+     * @param partition Partition label used for the entry iterator
+     * @param namespc Namespace name used for the entry iterator
+     */
+    NVSTransferResult exportNamespace(nvs_handle_t nvs, const char* partition, const char* namespc);
+
+    /**
+     * @brief Export only the given keys, in the same stream format.
+     *
+     * Instead of iterating the namespace, each key is looked up as blob and
+     * then as string, which are the types written by the value classes.
+     * Keys which don't exist as either are skipped.
+     */
+    NVSTransferResult exportKeys(nvs_handle_t nvs, NVSKeySource next, void* context);
+
+    /**
+     * @brief Convenience overload of exportKeys() accepting any callable
+     * with the signature const char*().
+     */
+    template<typename Source>
+    NVSTransferResult exportKeys(nvs_handle_t nvs, Source&& next) {
+        using SourceType = std::remove_reference_t<Source>;
+        return exportKeys(nvs, [](void* context) {
+            return static_cast<const char*>((*static_cast<SourceType*>(context))());
+        }, static_cast<void*>(&next));
+    }
+
+    const NVSExportStats& stats() const { return _stats; }
+
+private:
+    /**
+     * @brief Reset the state and write the stream header
+     */
+    bool Begin();
+    /**
+     * @brief Write the end marker and checksum and flush the buffer
+     */
+    bool Finish();
+    bool ExportEntry(nvs_handle_t nvs, const char* key, nvs_type_t type);
+    bool Put(const void* data, size_t size);
+    bool PutByte(uint8_t byte);
+    bool Flush();
+
+    NVSExportSink _sink;
+    void* _context;
+    NVSTransferResult _result;
+    uint32_t _crc;
+    size_t _fill;
+    NVSExportStats _stats;
+    uint8_t _buffer[NVSTransferBufferSize];
+};
+
+/**
+ * @brief Apply a stream produced by NVSExporter to a namespace.
+ *
+ * Records whose stored value already matches are not written.
+ * All writes are committed with a single nvs_commit() at the end.
+ *
+ * The import is not atomic. The checksum is only known at the end of the
+ * stream, so records are applied before it is verified, and NVS stores each
+ * write right away, whether or not it is committed. A truncated or corrupt
+ * stream therefore leaves the records before the error written. Import with
+ * dryRun first if the stream can be replayed and must be validated before
+ * anything is written.
+ *
+ * Lengths are checked against the NVS limits (3999 bytes for strings,
+ * 508000 bytes for blobs) before a value is allocated.
+ */
+class NVSImporter {
+public:
+    NVSImporter(NVSImportSource source, void* context);
+
+    /**
+     * @brief Convenience constructor accepting any callable with the
+     * signature size_t(uint8_t* buffer, size_t size).
+     * The callable must outlive the importer.
+     */
+    template<typename Source>
+    explicit NVSImporter(Source& source) : NVSImporter([](void* context, uint8_t* buffer, size_t size) {
+        return (*static_cast<Source*>(context))(buffer, size);
+    }, static_cast<void*>(&source)) {}
+
+    /**
+     * If true, the stream is parsed and verified but nothing is written.
+     */
+    bool dryRun = false;
+
+    NVSTransferResult importNamespace(nvs_handle_t nvs);
+
+    const NVSImportStats& stats() const { return _stats; }
+
+private:
+    NVSTransferResult ImportRecord(nvs_handle_t nvs, nvs_type_t type, const char* key);
+    NVSTransferResult ApplyInteger(nvs_handle_t nvs, nvs_type_t type, const char* key, uint64_t value);
+    NVSTransferResult ApplyVariable(nvs_handle_t nvs, nvs_type_t type, const char* key, uint8_t* value, size_t size);
+    bool Get(void* data, size_t size);
+    bool GetByte(uint8_t& byte);
+    NVSTransferResult GetLength(size_t& length);
+
+    NVSImportSource _source;
+    void* _context;
+    uint32_t _crc;
+    size_t _position;
+    size_t _available;
+    NVSImportStats _stats;
+    uint8_t _buffer[NVSTransferBufferSize];
+    uint8_t _value[NVSTransferBufferSize];
+};
@@ -0,0 +1,358 @@
+#pragma once
+#include <nvs.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "NVSLog.hpp"
+#include "NVSResult.hpp"
+#include "NVSTrace.hpp"
+#include "NVSValueBase.hpp"
+
+/**
+ * @brief Up to Count boolean flags packed into a single NVS entry.
+ *
+ * Flags are identified by an enum whose values are the bit indices, so flag
+ * names are resolved at compile time. Up to 64 flags are stored as one u64
+ * entry, larger sets as one blob of little-endian 64 bit words.
+ *
+ * The entry is read once by the constructor or updateFromNVS(). Reading and
+ * changing flags in RAM is atomic, so flags can be tested from any task.
+ * set() only writes to NVS if the packed value has actually changed.
+ *
+ * Example:
+ *   enum class Feature : uint8_t { Wifi, Bluetooth, Ota, Count };
+ *   NVSFlagSet<Feature> features(nvs, "features", {Feature::Wifi});
+ *   if(features.test(Feature::Ota)) ...
+ *   features.set(Feature::Bluetooth, true);
+ *   features.set<Feature::Wifi>(false); // index checked at compile time
+ *
+ * @tparam Flag Enum type with values 0 ... Count - 1
+ * @tparam Count Number of flags. Defaults to Flag::Count.
+ */
+template<typename Flag, size_t Count = static_cast<size_t>(Flag::Count)>
+class NVSFlagSet : public NVSValueBase {
+    static_assert(std::is_enum_v<Flag>, "NVSFlagSet requires an enum type");
+    static_assert(Count > 0, "NVSFlagSet requires at least one flag");
+
+public:
+    /**
+     * Number of 64 bit words stored in NVS
+     */
+    static constexpr size_t StoredWords = (Count + 63) / 64;
+    static constexpr size_t StoredSize = StoredWords * sizeof(uint64_t);
+
+    /**
+     * Empty default constructor.
+     * You need to assign this instance to an NVSFlagSet before actually using it.
+     */
+    NVSFlagSet() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _exists(false), _words(), _default() {}
+
+    /**
+     * Main constructor.
+     * @param defaultFlags Flags which are set if the entry does not exist in NVS
+     */
+    NVSFlagSet(nvs_handle_t nvs, const std::string& key, std::initializer_list<Flag> defaultFlags = {})
+        : nvs(nvs), _key(key), _exists(false), _words(), _default() {
+        for(Flag flag : defaultFlags) {
+            if(InRange(flag)) {
+                _default[WordOf(flag)] |= MaskOf(flag);
+            }
+        }
+        updateFromNVS();
+    }
+
+    NVSFlagSet(const NVSFlagSet&) = delete;
+
+    /**
+     * Takes over the flags of other without reading NVS
+     */
+    NVSFlagSet(NVSFlagSet&& other)
+        : nvs(other.nvs), _key(std::move(other._key)), _exists(other._exists), _words() {
+        uint32_t words[Words];
+        other.Load(words);
+        for(size_t i = 0; i < Words; i++) {
+            _words[i].store(words[i], std::memory_order_relaxed);
+        }
+        memcpy(_default, other._default, sizeof(_default));
+        other.nvs = std::numeric_limits<nvs_handle_t>::max();
+    }
+
+    NVSFlagSet& operator=(NVSFlagSet&& other) {
+        nvs = other.nvs;
+        _key = std::move(other._key);
+        memcpy(_default, other._default, sizeof(_default));
+        if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
+            updateFromNVS();
+        }
+        return *this;
+    }
+
+    // NVSValueBase implementation
+    const std::string& key() const override { return _key; }
+    bool exists() const override { return _exists; }
+
+    /**
+     * @brief Return the packed flags as stored in NVS (little-endian words)
+     */
+    std::string asString() const override {
+        uint8_t buffer[StoredSize];
+        serializeTo(buffer, sizeof(buffer));
+        return std::string(reinterpret_cast<const char*>(buffer), sizeof(buffer));
+    }
+
+    NVSValueDescriptor descriptor() const override {
+        bool isDefault = true;
+        for(size_t i = 0; i < Words; i++) {
+            isDefault = isDefault && _words[i].load(std::memory_order_relaxed) == _default[i];
+        }
+        return NVSValueDescriptor{StoredWords == 1 ? NVSValueKind::UnsignedInteger : NVSValueKind::Blob,
+                                  StoredSize, _exists, isDefault};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override {
+        if(bufferSize >= StoredSize) {
+            uint32_t words[Words];
+            Load(words);
+            for(size_t i = 0; i < Words; i++) {
+                for(size_t byte = 0; byte < 4; byte++) {
+                    buffer[i * 4 + byte] = static_cast<uint8_t>(words[i] >> (8 * byte));
+                }
+            }
+        }
+        return StoredSize;
+    }
+
+    /**
+     * @brief Return whether a flag is set. Flags outside the set are never set.
+     */
+    bool test(Flag flag) const {
+        return InRange(flag) && (_words[WordOf(flag)].load(std::memory_order_relaxed) & MaskOf(flag)) != 0;
+    }
+
+    /**
+     * @brief Return whether a flag is set, checking at compile time that it is part of the set
+     */
+    template<Flag F>
+    bool test() const {
+        static_assert(static_cast<size_t>(F) < Count, "Flag is outside of the NVSFlagSet");
+        return test(F);
+    }
+
+    bool operator[](Flag flag) const { return test(flag); }
+
+    /**
+     * @brief Set or clear a flag and write the packed value if it has changed
+     */
+    NVSSetResult set(Flag flag, bool value) {
+        return set({{flag, value}});
+    }
+
+    /**
+     * @brief Set or clear a flag, checking at compile time that it is part of the set
+     */
+    template<Flag F>
+    NVSSetResult set(bool value) {
+        static_assert(static_cast<size_t>(F) < Count, "Flag is outside of the NVSFlagSet");
+        return set({{F, value}});
+    }
+
+    /**
+     * @brief Set or clear several flags with a single NVS write.
+     * Nothing is changed if one of the flags is outside the set.
+     */
+    NVSSetResult set(std::initializer_list<std::pair<Flag, bool>> changes) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        for(const std::pair<Flag, bool>& change : changes) {
+            if(!InRange(change.first)) {
+                return NVSSetResult::Error;
+            }
+        }
+        bool changed = false;
+        for(const std::pair<Flag, bool>& change : changes) {
+            std::atomic<uint32_t>& word = _words[WordOf(change.first)];
+            uint32_t mask = MaskOf(change.first);
+            uint32_t previous = change.second
+                ? word.fetch_or(mask, std::memory_order_relaxed)
+                : word.fetch_and(~mask, std::memory_order_relaxed);
+            changed = changed || ((previous & mask) != 0) != change.second;
+        }
+        if(!changed) {
+            return NVSSetResult::Unchanged;
+        }
+        return WriteToNVS();
+    }
+
+    /**
+     * @brief Read the packed flags from NVS
+     * This is automatically called in the constructor,
+     * so you only need to call this if the NVS value has been updated
+     */
+    void updateFromNVS() {
+        NVSTracePrintf("Reading flag set %s", _key.c_str());
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            NVSCriticalPrintf("Invalid NVS instance");
+            return;
+        }
+        uint32_t words[Words];
+        _exists = ReadFromNVS(words);
+        if(!_exists) {
+            memcpy(words, _default, sizeof(words));
+        }
+        for(size_t i = 0; i < Words; i++) {
+            _words[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Migrate flags which were previously stored as individual NVSValue<bool> keys.
+     *
+     * If the flag set does not exist in NVS yet, every legacy key which exists
+     * overrides the default of its flag and the packed value is written.
+     * The legacy keys are erased afterwards, all with a single commit.
+     * Calling this again after a successful migration only probes the legacy keys.
+     *
+     * @param legacyKeys Key of each flag, indexed by the flag value. nullptr if a flag has no legacy key.
+     * @return Updated if flags were migrated, Unchanged if no legacy key was found
+     */
+    template<size_t N>
+    NVSSetResult migrateFrom(const char* const (&legacyKeys)[N]) {
+        static_assert(N == Count, "NVSFlagSet::migrateFrom() needs one legacy key per flag");
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        size_t found = 0;
+        for(size_t i = 0; i < Count; i++) {
+            if(legacyKeys[i] == nullptr) {
+                continue;
+            }
+            uint8_t value = 0;
+            size_t size = sizeof(value);
+            if(NVSFlashGetBlob(nvs, legacyKeys[i], &value, &size) != ESP_OK || size != sizeof(bool)) {
+                continue;
+            }
+            found++;
+            if(!_exists) {
+                Flag flag = static_cast<Flag>(i);
+                if(value != 0) {
+                    _words[WordOf(flag)].fetch_or(MaskOf(flag), std::memory_order_relaxed);
+                } else {
+                    _words[WordOf(flag)].fetch_and(~MaskOf(flag), std::memory_order_relaxed);
+                }
+            }
+        }
+        if(found == 0) {
+            return NVSSetResult::Unchanged;
+        }
+        NVSInfoPrintf("Migrating %d legacy flags into %s", found, _key.c_str());
+        // The packed value must be stored before the legacy keys are erased
+        if(!_exists && WriteWithoutCommit() != ESP_OK) {
+            return NVSSetResult::Error;
+        }
+        for(size_t i = 0; i < Count; i++) {
+            if(legacyKeys[i] != nullptr) {
+                NVSFlashEraseKey(nvs, legacyKeys[i]);
+            }
+        }
+        NVSFlashCommit(nvs, _key.c_str());
+        return NVSSetResult::Updated;
+    }
+
+    nvs_handle_t nvs;
+    std::string _key;
+    bool _exists;
+
+private:
+    static constexpr size_t Words = StoredWords * 2;
+
+    static bool InRange(Flag flag) {
+        if(static_cast<size_t>(flag) < Count) {
+            return true;
+        }
+        NVSErrorPrintf("Flag %d is outside of a set of %d flags", static_cast<int>(flag), Count);
+        return false;
+    }
+
+    static size_t WordOf(Flag flag) { return static_cast<size_t>(flag) / 32; }
+    static uint32_t MaskOf(Flag flag) { return uint32_t(1) << (static_cast<size_t>(flag) % 32); }
+
+    void Load(uint32_t (&words)[Words]) const {
+        for(size_t i = 0; i < Words; i++) {
+            words[i] = _words[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    bool ReadFromNVS(uint32_t (&words)[Words]) {
+        esp_err_t err;
+        if constexpr (StoredWords == 1) {
+            uint64_t value = 0;
+            err = NVSFlashGetU64(nvs, _key.c_str(), &value);
+            words[0] = static_cast<uint32_t>(value);
+            words[1] = static_cast<uint32_t>(value >> 32);
+        } else {
+            uint8_t buffer[StoredSize];
+            size_t size = sizeof(buffer);
+            err = NVSFlashGetBlob(nvs, _key.c_str(), buffer, &size);
+            if(err == ESP_OK && size != sizeof(buffer)) {
+                NVSWarningPrintf("Flag set %s has %d bytes instead of %d", _key.c_str(), size, sizeof(buffer));
+                err = ESP_ERR_NVS_INVALID_LENGTH;
+            }
+            for(size_t i = 0; err == ESP_OK && i < Words; i++) {
+                words[i] = static_cast<uint32_t>(buffer[i * 4]) | (static_cast<uint32_t>(buffer[i * 4 + 1]) << 8) |
+                           (static_cast<uint32_t>(buffer[i * 4 + 2]) << 16) | (static_cast<uint32_t>(buffer[i * 4 + 3]) << 24);
+            }
+        }
+        if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            NVSErrorPrintf("Failed to read flag set %s: %s", _key.c_str(), esp_err_to_name(err));
+        }
+        return err == ESP_OK;
+    }
+
+    esp_err_t Store(const uint32_t (&words)[Words]) {
+        if constexpr (StoredWords == 1) {
+            return NVSFlashSetU64(nvs, _key.c_str(), static_cast<uint64_t>(words[0]) | (static_cast<uint64_t>(words[1]) << 32));
+        } else {
+            uint8_t buffer[StoredSize];
+            serializeTo(buffer, sizeof(buffer));
+            return NVSFlashSetBlob(nvs, _key.c_str(), buffer, sizeof(buffer));
+        }
+    }
+
+    esp_err_t WriteWithoutCommit() {
+        uint32_t written[Words];
+        uint32_t current[Words];
+        esp_err_t err;
+        // Another task may change flags while we write: repeat until NVS holds the latest value
+        Load(current);
+        do {
+            memcpy(written, current, sizeof(written));
+            if((err = Store(written)) != ESP_OK) {
+                NVSCriticalPrintf("Failed to write flag set %s: %s", _key.c_str(), esp_err_to_name(err));
+                return err;
+            }
+            Load(current);
+        } while(memcmp(written, current, sizeof(written)) != 0);
+        _exists = true;
+        return ESP_OK;
+    }
+
+    NVSSetResult WriteToNVS() {
+        if(WriteWithoutCommit() != ESP_OK) {
+            return NVSSetResult::Error;
+        }
+        NVSFlashCommit(nvs, _key.c_str());
+        return NVSSetResult::Updated;
+    }
+
+    std::atomic<uint32_t> _words[Words];
+    uint32_t _default[Words];
+};
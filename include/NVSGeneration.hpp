@@ -0,0 +1,222 @@
+#pragma once
+#include <nvs.h>
+#include <cstddef>
+#include <cstdint>
+
+#include "NVSExport.hpp"
+#include "NVSResult.hpp"
+#include "NVSValueBase.hpp"
+#include "NVSWritePolicy.hpp"
+
+/**
+ * @brief Generation of the last write of one key
+ */
+struct NVSGenerationEntry {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint32_t generation;
+};
+
+/**
+ * @brief Stamps every write with a monotonic generation number, so that
+ * only values changed since a given generation need to be synchronized.
+ *
+ * Each stamp increments the generation and records it for the written key.
+ * The table is persisted as a single blob by persist(). Before the first
+ * tracked write after a persist, a small dirty marker is written by
+ * markDirty(), so if the device resets before the next persist(), the lost
+ * stamps are detected on the next boot. The marker holds a lease: an upper
+ * bound of the generations stamped until it is renewed, every
+ * LeaseGenerations stamps. After a reset, the tracker continues above the
+ * lease, so generations never repeat, and all changes up to that point are
+ * treated as unknown, i.e. exportChangedSince() falls back to a full export
+ * for older generations.
+ * The same happens for generations whose entries have been evicted from a
+ * full table. A sync can therefore send too much, but never misses a change
+ * of a tracked write.
+ *
+ * Exports only contain existing keys, so an erased key can't be sent as part
+ * of a delta. Report erased keys with erased(), which forces the next sync
+ * to be a full export. Its receiver should replace its copy of the namespace
+ * instead of merging it, to drop erased keys as well.
+ *
+ * Entry storage is provided by the caller, see NVSStaticGenerationTracker.
+ * The tracker is not thread-safe.
+ */
+class NVSGenerationTracker {
+public:
+    static constexpr const char* TableKey = "_nvsv_gen";
+    static constexpr const char* DirtyKey = "_nvsv_gendirty";
+
+    /**
+     * @brief Load the persisted table.
+     * @param nvs Handle of the namespace of the tracked values, opened read/write
+     */
+    NVSGenerationTracker(nvs_handle_t nvs, NVSGenerationEntry* entries, size_t capacity);
+
+    NVSGenerationTracker(const NVSGenerationTracker&) = delete;
+    NVSGenerationTracker& operator=(const NVSGenerationTracker&) = delete;
+
+    /**
+     * @brief Generation of the last stamp. Pass it to the next exportChangedSince().
+     */
+    uint32_t generation() const { return _generation; }
+
+    /**
+     * @brief Changes at or before this generation may not be tracked
+     */
+    uint32_t floor() const { return _floor; }
+
+    /**
+     * Generations stamped per write of the dirty marker
+     */
+    static constexpr uint32_t LeaseGenerations = 32;
+
+    /**
+     * @brief Write the dirty marker, unless it has been written since the last
+     * persist() and its lease covers the next stamp.
+     * Must be called before a tracked value is written, which set() and
+     * NVSGenerationWritePolicy do.
+     */
+    esp_err_t markDirty();
+
+    /**
+     * @brief Record a successful write of key
+     * @return The new generation
+     */
+    uint32_t stamp(const char* key);
+
+    /**
+     * @brief Record that key has been erased. Older generations fall back to a full export.
+     * @return The new generation
+     */
+    uint32_t erased(const char* key);
+
+    /**
+     * @brief Generation of the last tracked write of key, 0 if it is not tracked
+     */
+    uint32_t generationOf(const char* key) const;
+
+    /**
+     * @brief Whether key may have changed after the given generation
+     */
+    bool changedSince(const char* key, uint32_t generation) const;
+
+    /**
+     * @brief Number of keys which changed after the given generation,
+     * or SIZE_MAX if all keys have to be assumed changed
+     */
+    size_t countChangedSince(uint32_t generation) const;
+
+    /**
+     * @brief Set a value and stamp it if it has been written (NVSSetResult::Updated).
+     * Works with all value classes. For NVSValue, NVSGenerationWritePolicy also
+     * stamps deferred values when they are written.
+     */
+    template<typename Value, typename T>
+    NVSSetResult set(Value& value, const T& newValue) {
+        markDirty();
+        NVSSetResult result = value.set(newValue);
+        if(result == NVSSetResult::Updated) {
+            stamp(value.key().c_str());
+        }
+        return result;
+    }
+
+    /**
+     * @brief Export the values changed after the given generation in the NVSExporter format.
+     *
+     * If generation is older than floor(), the whole namespace is exported.
+     * Pass 0 for the first sync, which is always a full export.
+     * The tracker's own keys are not exported by a delta export.
+     *
+     * @param partition Partition label, only used for a full export
+     * @param namespc Namespace name of the handle, only used for a full export
+     */
+    NVSTransferResult exportChangedSince(uint32_t generation, NVSExporter& exporter,
+                                         const char* partition, const char* namespc);
+
+    /**
+     * @brief Write the table and clear the dirty marker, with a single commit.
+     * Call it e.g. after a sync or before deep sleep.
+     */
+    esp_err_t persist();
+
+    /**
+     * @brief Whether stamps have been recorded since the last persist()
+     */
+    bool dirty() const { return _dirty; }
+
+private:
+    struct TableHeader {
+        uint32_t version;
+        uint32_t generation;
+        uint32_t floor;
+        uint32_t count;
+    };
+
+    static constexpr uint32_t TableVersion = 1;
+
+    void Load();
+    void LoadTable(size_t size);
+    NVSGenerationEntry* Find(const char* key);
+    const NVSGenerationEntry* Find(const char* key) const;
+
+    nvs_handle_t _nvs;
+    NVSGenerationEntry* _entries;
+    size_t _capacity;
+    size_t _count;
+    uint32_t _generation;
+    uint32_t _floor;
+    bool _dirty;
+    // Highest generation covered by the dirty marker
+    uint32_t _lease;
+};
+
+/**
+ * @brief NVSGenerationTracker with storage for Capacity keys inside the object.
+ */
+template<size_t Capacity>
+class NVSStaticGenerationTracker : public NVSGenerationTracker {
+public:
+    explicit NVSStaticGenerationTracker(nvs_handle_t nvs) : NVSGenerationTracker(nvs, _storage, Capacity) {}
+
+private:
+    // Not value-initialized: the base class constructor has already loaded the table into it
+    NVSGenerationEntry _storage[Capacity];
+};
+
+/**
+ * @brief Write policy which stamps every write of an NVSValue, including
+ * writes of deferred values. Combine it with other policies using NVSCombinedWritePolicy.
+ */
+class NVSGenerationWritePolicy {
+public:
+    NVSGenerationWritePolicy() : tracker(nullptr) {}
+    NVSGenerationWritePolicy(NVSGenerationTracker& tracker) : tracker(&tracker) {}
+
+    template<typename Value, typename T>
+    NVSWriteDecision evaluate(Value&, const T&, const T&) {
+        return NVSWriteDecision::Write;
+    }
+
+    template<typename Value>
+    bool mayFlush(Value&) {
+        return true;
+    }
+
+    template<typename Value>
+    void beforeWrite(Value&) {
+        if(tracker != nullptr) {
+            tracker->markDirty();
+        }
+    }
+
+    template<typename Value>
+    void onWritten(Value& value) {
+        if(tracker != nullptr) {
+            tracker->stamp(value.key().c_str());
+        }
+    }
+
+    NVSGenerationTracker* tracker;
+};
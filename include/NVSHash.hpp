@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Compute a CRC32 (IEEE 802.3, reflected polynomial 0xEDB88320).
+ *
+ * The result is compatible with zlib's crc32() and the ESP ROM crc32_le():
+ * pass the previous result as @p crc to continue a running checksum.
+ * The NVS on-flash format uses this function with an initial value of 0xFFFFFFFF.
+ *
+ * This implementation uses a 16-entry lookup table so it can be used both on
+ * the target and in host-side tools without pulling in a 1 KiB table.
+ */
+uint32_t NVSCrc32(const void* data, size_t size, uint32_t crc = 0);
@@ -0,0 +1,221 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include "NVSLog.hpp"
+
+/*
+ * Compile-time mapping of long logical setting names to NVS keys.
+ *
+ * NVS keys are limited to 15 characters. Names which fit are used unchanged,
+ * so existing keys keep working. Longer names such as "power.channel1.voltage"
+ * are mapped to a hint of up to 4 characters of their last segment, a '~' and
+ * 10 characters of a 64 bit FNV-1a hash of the full name, e.g. "volt~k2d0..."
+ *
+ * The mapping is evaluated by the compiler. At runtime, only the resulting
+ * key is used, so a value stores the same _key string as before.
+ */
+
+namespace nvs_key_detail {
+constexpr size_t MaxKeyLength = 15;
+constexpr size_t HintLength = 4;
+constexpr size_t HashLength = 10;
+constexpr char HashMarker = '~';
+constexpr char Alphabet[] = "0123456789abcdefghijklmnopqrstuv";
+
+constexpr size_t Length(const char* text) {
+    size_t length = 0;
+    while(text[length] != '\0') {
+        length++;
+    }
+    return length;
+}
+
+constexpr bool Equal(const char* a, const char* b) {
+    size_t i = 0;
+    for(; a[i] != '\0' && a[i] == b[i]; i++) {}
+    return a[i] == b[i];
+}
+
+constexpr uint64_t Fnv1a(const char* text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; text[i] != '\0'; i++) {
+        hash ^= static_cast<uint8_t>(text[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+constexpr bool IsHintChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+/**
+ * Evaluating a call to this function in a constant expression fails,
+ * which turns the error into a compile error naming it.
+ */
+inline void EmptyNVSKeyName() {}
+inline void CollidingNVSKeysInSchema() {}
+inline void UnknownNameInNVSKeySchema(const char* name) {
+    NVSErrorPrintf("Name %s is not part of the NVS key schema", name);
+}
+} // namespace nvs_key_detail
+
+/**
+ * @brief A logical setting name and the NVS key it is stored under.
+ *
+ * Converts implicitly to std::string, so it can be passed to every value
+ * constructor in place of the key, usually through NVS_KEY():
+ *
+ *   NVSValue<float> voltage(nvs, NVS_KEY("power.channel1.voltage"));
+ */
+struct NVSKey {
+    /**
+     * Logical name, kept for diagnostics
+     */
+    const char* name;
+    /**
+     * Null-terminated NVS key
+     */
+    char key[nvs_key_detail::MaxKeyLength + 1];
+
+    constexpr NVSKey() : name(""), key{} {}
+
+    constexpr explicit NVSKey(const char* logicalName) : name(logicalName), key{} {
+        size_t length = nvs_key_detail::Length(logicalName);
+        if(length == 0) {
+            nvs_key_detail::EmptyNVSKeyName();
+        }
+        if(length <= nvs_key_detail::MaxKeyLength) {
+            for(size_t i = 0; i < length; i++) {
+                key[i] = logicalName[i];
+            }
+            return;
+        }
+        // Hint: the first characters of the last segment
+        size_t segment = length;
+        while(segment > 0 && logicalName[segment - 1] != '.') {
+            segment--;
+        }
+        size_t position = 0;
+        for(size_t i = segment; i < length && position < nvs_key_detail::HintLength; i++) {
+            if(nvs_key_detail::IsHintChar(logicalName[i])) {
+                key[position++] = logicalName[i];
+            }
+        }
+        key[position++] = nvs_key_detail::HashMarker;
+        uint64_t hash = nvs_key_detail::Fnv1a(logicalName);
+        for(size_t i = 0; i < nvs_key_detail::HashLength; i++) {
+            key[position++] = nvs_key_detail::Alphabet[hash & 0x1F];
+            hash >>= 5;
+        }
+    }
+
+    /**
+     * @brief Whether the name was too long and has been hashed
+     */
+    constexpr bool hashed() const {
+        return !nvs_key_detail::Equal(name, key);
+    }
+
+    constexpr const char* c_str() const { return key; }
+
+    operator std::string() const { return std::string(key); }
+};
+
+/**
+ * @brief Map a logical name to its NVS key at compile time
+ */
+#define NVS_KEY(name) ([]() { constexpr NVSKey nvsKey(name); return nvsKey; }())
+
+/**
+ * @brief A set of setting names whose keys are checked for collisions at compile time.
+ *
+ * Create it with NVSMakeKeySchema() as constexpr variable. If two names map
+ * to the same key, compilation fails in CollidingNVSKeysInSchema():
+ *
+ *   constexpr auto PowerKeys = NVSMakeKeySchema("power.channel1.voltage", "power.channel2.voltage");
+ *   NVSValue<float> voltage(nvs, NVS_SCHEMA_KEY(PowerKeys, "power.channel1.voltage"));
+ *
+ * nameOf() provides the reverse lookup for diagnostics, e.g. when dumping a namespace.
+ */
+template<size_t N>
+struct NVSKeySchema {
+    NVSKey keys[N];
+
+    constexpr size_t size() const { return N; }
+    constexpr const NVSKey& operator[](size_t index) const { return keys[index]; }
+    constexpr const NVSKey* begin() const { return keys; }
+    constexpr const NVSKey* end() const { return keys + N; }
+
+    /**
+     * Returned by get() for names which are not part of the schema.
+     * Its key is empty, so NVS rejects reads and writes instead of using another setting's key.
+     */
+    static constexpr NVSKey Unknown = NVSKey();
+
+    /**
+     * @brief Index of a name of the schema. In a constant expression,
+     * a name which is not part of the schema fails to compile, at runtime it returns N.
+     */
+    constexpr size_t indexOf(const char* name) const {
+        for(size_t i = 0; i < N; i++) {
+            if(nvs_key_detail::Equal(keys[i].name, name)) {
+                return i;
+            }
+        }
+        nvs_key_detail::UnknownNameInNVSKeySchema(name);
+        return N;
+    }
+
+    /**
+     * @brief Key of a name of the schema, or Unknown if it is not part of it.
+     * Only checked at compile time in a constant expression, use NVS_SCHEMA_KEY() otherwise.
+     */
+    constexpr const NVSKey& get(const char* name) const {
+        size_t index = indexOf(name);
+        return index < N ? keys[index] : Unknown;
+    }
+
+    /**
+     * @brief Logical name of an NVS key, or nullptr if it is not part of the schema
+     */
+    constexpr const char* nameOf(const char* key) const {
+        for(size_t i = 0; i < N; i++) {
+            if(nvs_key_detail::Equal(keys[i].key, key)) {
+                return keys[i].name;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Whether all names map to different keys
+     */
+    constexpr bool unique() const {
+        for(size_t i = 0; i < N; i++) {
+            for(size_t j = i + 1; j < N; j++) {
+                if(nvs_key_detail::Equal(keys[i].key, keys[j].key)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Key of a name of a constexpr schema. A name which is not part of the schema fails to compile.
+ */
+#define NVS_SCHEMA_KEY(schema, name) ((schema)[std::integral_constant<size_t, (schema).indexOf(name)>::value])
+
+template<typename... Names>
+constexpr NVSKeySchema<sizeof...(Names)> NVSMakeKeySchema(const Names&... names) {
+    NVSKeySchema<sizeof...(Names)> schema{{NVSKey(names)...}};
+    if(!schema.unique()) {
+        nvs_key_detail::CollidingNVSKeysInSchema();
+    }
+    return schema;
+}
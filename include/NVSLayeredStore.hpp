@@ -0,0 +1,295 @@
+#pragma once
+#include <nvs.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <type_traits>
+
+#include "NVSLog.hpp"
+#include "NVSResult.hpp"
+#include "NVSValueBase.hpp"
+#include "NVSValue.hpp"
+
+/**
+ * @brief Layer which provided a value of an NVSLayeredStore
+ */
+enum class NVSLayer : uint8_t {
+    /**
+     * Writable namespace holding all values changed on the device
+     */
+    Overlay = 0,
+    /**
+     * Read-only partition provisioned at manufacturing
+     */
+    Factory = 1,
+    /**
+     * Compiled default of the value object
+     */
+    Default = 2
+};
+
+const char* NVSLayerToString(NVSLayer layer);
+
+/**
+ * @brief Entry of the negative lookup cache of an NVSLayeredStore
+ */
+struct NVSLayeredMiss {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    /**
+     * Bit mask of the layers (1 << NVSLayer) which are known not to contain the key
+     */
+    uint8_t layers;
+};
+
+struct NVSLayeredStoreStats {
+    uint32_t overlayHits;
+    uint32_t factoryHits;
+    uint32_t defaultHits;
+    /**
+     * Flash lookups skipped because of the negative lookup cache
+     */
+    uint32_t lookupsAvoided;
+};
+
+/**
+ * @brief Values layered over a read-only factory partition.
+ *
+ * Reads check the writable overlay namespace first, then the factory
+ * namespace and finally fall back to the compiled default. Writes only go to
+ * the overlay, so a factory reset is a single nvs_erase_all() of the overlay.
+ *
+ * Keys missing from a layer are remembered in a small negative lookup cache,
+ * so reading a value which only has a default probes each layer only once.
+ * The cache is updated by writes through the store; write to the overlay
+ * namespace only through the store or call invalidateCache() afterwards.
+ *
+ * Storage for the cache is provided by the caller,
+ * see NVSStaticLayeredStore for a store with inline storage.
+ */
+class NVSLayeredStore {
+public:
+    static constexpr nvs_handle_t NoFactory = std::numeric_limits<nvs_handle_t>::max();
+
+    /**
+     * @param overlay Handle of the writable namespace
+     * @param factory Handle of the read-only factory namespace, NoFactory if not provisioned
+     */
+    NVSLayeredStore(nvs_handle_t overlay, nvs_handle_t factory, NVSLayeredMiss* cache, size_t cacheCapacity);
+
+    NVSLayeredStore(const NVSLayeredStore&) = delete;
+    NVSLayeredStore& operator=(const NVSLayeredStore&) = delete;
+
+    /**
+     * @brief Initialize a factory partition and open one of its namespaces read-only
+     * @return The handle, or std::nullopt if the partition or namespace does not exist
+     */
+    static std::optional<nvs_handle_t> OpenFactory(const char* partition, const char* namespc);
+
+    /**
+     * @brief Read a blob of exactly size bytes from the first layer containing it
+     * @return Default if no layer contains a blob of this size. The content of buffer is undefined in this case.
+     */
+    NVSLayer readBlob(const char* key, void* buffer, size_t size);
+
+    /**
+     * @brief Read a string (NVS string or blob) from the first layer containing it
+     * @return Default if no layer contains the key. value is unchanged in this case.
+     */
+    NVSLayer readString(const char* key, std::string& value);
+
+    /**
+     * @brief Write a blob to the overlay and commit
+     */
+    esp_err_t writeBlob(const char* key, const void* data, size_t size);
+
+    /**
+     * @brief Write an NVS string to the overlay and commit
+     */
+    esp_err_t writeString(const char* key, const std::string& value);
+
+    /**
+     * @brief Erase a key from the overlay, so the factory value or default applies again
+     */
+    esp_err_t revert(const char* key);
+
+    /**
+     * @brief Erase all keys of the overlay with a single nvs_erase_all().
+     * Value objects need to call updateFromNVS() afterwards.
+     */
+    esp_err_t factoryReset();
+
+    /**
+     * @brief Forget all cached misses
+     */
+    void invalidateCache();
+
+    nvs_handle_t overlay() const { return _overlay; }
+    nvs_handle_t factory() const { return _factory; }
+    const NVSLayeredStoreStats& stats() const { return _stats; }
+
+private:
+    /**
+     * @brief Whether key is known to be missing from layer. Counts avoided lookups.
+     */
+    bool IsKnownMiss(const char* key, NVSLayer layer);
+    void RememberMiss(const char* key, NVSLayer layer);
+    void ForgetMiss(const char* key, NVSLayer layer);
+    NVSLayeredMiss* Find(const char* key);
+    NVSLayer Served(NVSLayer layer);
+
+    nvs_handle_t _overlay;
+    nvs_handle_t _factory;
+    NVSLayeredMiss* _cache;
+    size_t _cacheCapacity;
+    size_t _nextSlot;
+    NVSLayeredStoreStats _stats;
+};
+
+/**
+ * @brief NVSLayeredStore with a negative lookup cache of CacheSlots keys inside the object.
+ */
+template<size_t CacheSlots = 32>
+class NVSStaticLayeredStore : public NVSLayeredStore {
+public:
+    NVSStaticLayeredStore(nvs_handle_t overlay, nvs_handle_t factory = NoFactory)
+        : NVSLayeredStore(overlay, factory, _storage, CacheSlots), _storage() {}
+
+private:
+    NVSLayeredMiss _storage[CacheSlots];
+};
+
+/**
+ * @brief Cached value read from an NVSLayeredStore.
+ *
+ * Like NVSValue, the value is read once and cached. set() writes to the
+ * overlay only, revert() erases the overlay key so the factory value or the
+ * compiled default applies again. T may be std::string or any trivially
+ * copyable type, which is stored as a blob like NVSValue<T> does.
+ */
+template<typename T>
+class NVSLayeredValue : public NVSValueBase {
+public:
+    NVSLayeredValue() : _key(), _value(), _default(), _store(nullptr), _layer(NVSLayer::Default) {}
+
+    NVSLayeredValue(NVSLayeredStore& store, const std::string& key, const T& defaultValue = T())
+        : _key(key), _value(defaultValue), _default(defaultValue), _store(&store), _layer(NVSLayer::Default) {
+        updateFromNVS();
+    }
+
+    const std::string& key() const override { return _key; }
+
+    /**
+     * @brief Whether the value is stored in the overlay or the factory partition
+     */
+    bool exists() const override { return _layer != NVSLayer::Default; }
+
+    std::string asString() const override {
+        return nvs_value_detail::ToBinaryString(_value);
+    }
+
+    NVSValueDescriptor descriptor() const override {
+        return NVSValueDescriptor{NVSValueKindOf<T>(), size(), exists(), _value == _default};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override {
+        if(bufferSize >= size()) {
+            memcpy(buffer, Data(), size());
+        }
+        return size();
+    }
+
+    const T& value() const { return _value; }
+
+    size_t size() const {
+        if constexpr (std::is_same_v<T, std::string>) {
+            return _value.size();
+        } else {
+            return sizeof(T);
+        }
+    }
+
+    /**
+     * @brief Layer which provided the current value
+     */
+    NVSLayer layer() const { return _layer; }
+
+    /**
+     * @brief Read the value from the first layer containing it
+     */
+    void updateFromNVS() {
+        if(_store == nullptr) {
+            NVSCriticalPrintf("Invalid layered store");
+            return;
+        }
+        if constexpr (std::is_same_v<T, std::string>) {
+            _layer = _store->readString(_key.c_str(), _value);
+        } else {
+            _layer = _store->readBlob(_key.c_str(), static_cast<void*>(&_value), sizeof(T));
+        }
+        if(_layer == NVSLayer::Default) {
+            _value = _default;
+        }
+    }
+
+    /**
+     * @brief Write the value to the overlay.
+     * The write is skipped if the new value equals the current value of any layer.
+     */
+    NVSSetResult set(const T& newValue) {
+        if(_store == nullptr) {
+            return NVSSetResult::NotInitialized;
+        }
+        if(_value == newValue) {
+            return NVSSetResult::Unchanged;
+        }
+        esp_err_t err;
+        if constexpr (std::is_same_v<T, std::string>) {
+            err = _store->writeString(_key.c_str(), newValue);
+        } else {
+            err = _store->writeBlob(_key.c_str(), static_cast<const void*>(&newValue), sizeof(T));
+        }
+        if(err != ESP_OK) {
+            return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+        _value = newValue;
+        _layer = NVSLayer::Overlay;
+        return NVSSetResult::Updated;
+    }
+
+    /**
+     * @brief Erase the overlay value, so the factory value or the default applies again
+     * @return Unchanged if the value was not stored in the overlay
+     */
+    NVSSetResult revert() {
+        if(_store == nullptr) {
+            return NVSSetResult::NotInitialized;
+        }
+        if(_layer != NVSLayer::Overlay) {
+            return NVSSetResult::Unchanged;
+        }
+        if(_store->revert(_key.c_str()) != ESP_OK) {
+            return NVSSetResult::Error;
+        }
+        updateFromNVS();
+        return NVSSetResult::Updated;
+    }
+
+    std::string _key;
+    T _value;
+    T _default;
+
+private:
+    const void* Data() const {
+        if constexpr (std::is_same_v<T, std::string>) {
+            return _value.data();
+        } else {
+            return &_value;
+        }
+    }
+
+    NVSLayeredStore* _store;
+    NVSLayer _layer;
+};
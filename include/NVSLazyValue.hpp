@@ -7,36 +7,94 @@
 #include <string>
 #include <type_traits>
 
+#include "NVSCoherence.hpp"
+#include "NVSHash.hpp"
 #include "NVSLog.hpp"
 #include "NVSResult.hpp"
+#include "NVSTrace.hpp"
 #include "NVSUtils.hpp"
 #include "NVSValue.hpp"
 
 /**
- * @brief Lazily read a value from NVS on every access instead of caching it locally.
- *
- * This API mirrors NVSValue where practical, but value access always performs a fresh read.
+ * @brief Strategy used by NVSLazyValue::set() to decide whether a write is necessary.
+ */
+enum class NVSLazyChangeDetection : uint8_t {
+    /**
+     * Read the stored value from NVS and compare it to the new value (default).
+     */
+    Compare = 0,
+    /**
+     * Keep a CRC32 of the last value read or written and skip the write if the
+     * new value has the same hash. No flash read is performed once the hash is known.
+     */
+    Hash = 1,
+    /**
+     * Like Hash, but a matching hash is confirmed by reading the stored value,
+     * so hash collisions can never suppress a write. Differing hashes still
+     * skip the compare read.
+     */
+    HashVerified = 2
+};
+
+/**
+ * @brief Counters for the hash-based change detection of NVSLazyValue
+ */
+struct NVSLazyValueStats {
+    /**
+     * Number of set() calls that decided between Unchanged and a write without reading NVS
+     */
+    uint32_t readsAvoided = 0;
+    /**
+     * Number of flash reads performed only to (re)build the hash
+     */
+    uint32_t hashRebuilds = 0;
+    /**
+     * Number of matching hashes that turned out to be collisions (HashVerified only)
+     */
+    uint32_t collisionFallbacks = 0;
+};
+
+/**
+ * @brief Non-virtual implementation of NVSLazyValue and NVSPlainLazyValue.
  */
 template<typename T>
-class NVSLazyValue : public NVSValueBase {
+class NVSLazyValueCore : public NVSCoherenceLink<NVSLazyValueCore<T>> {
 public:
-    NVSLazyValue() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _default() {}
-    NVSLazyValue(const NVSLazyValue&) = default;
-    NVSLazyValue(NVSLazyValue&&) = default;
-    NVSLazyValue& operator=(const NVSLazyValue&) = default;
-    NVSLazyValue& operator=(NVSLazyValue&&) = default;
+    NVSLazyValueCore() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _default() {}
 
-    NVSLazyValue(nvs_handle_t nvsHandle, const std::string& key, const T& defaultValue = T())
-        : nvs(nvsHandle), _key(key), _default(defaultValue) {}
+    NVSLazyValueCore(const NVSLazyValueCore& other) : NVSLazyValueCore(other.nvs, other._key, other._default) {
+        _changeDetection = other._changeDetection;
+    }
+
+    NVSLazyValueCore& operator=(const NVSLazyValueCore& other) {
+        nvs = other.nvs;
+        _key = other._key;
+        _default = other._default;
+        _changeDetection = other._changeDetection;
+        invalidateHash();
+        this->Attach(nvs, _key);
+        return *this;
+    }
+
+    NVSLazyValueCore(nvs_handle_t nvsHandle, const std::string& key, const T& defaultValue = T())
+        : nvs(nvsHandle), _key(key), _default(defaultValue) {
+        this->Attach(nvs, _key);
+    }
+
+    NVSLazyValueCore(nvs_handle_t nvsHandle, const char* key, const T& defaultValue = T())
+        : nvs(nvsHandle), _key(key != nullptr ? key : ""), _default(defaultValue) {
+        this->Attach(nvs, _key);
+    }
 
-    NVSLazyValue(nvs_handle_t nvsHandle, const char* key, const T& defaultValue = T())
-        : nvs(nvsHandle), _key(key != nullptr ? key : ""), _default(defaultValue) {}
+    ~NVSLazyValueCore() {
+        this->Detach();
+    }
 
-    const std::string& key() const override {
+    const std::string& key() const {
         return _key;
     }
 
-    bool exists() const override {
+    bool exists() const {
         size_t valueSize = 0;
         if(QueryValueSize(valueSize) != NVSQueryResult::OK) {
             return false;
@@ -44,16 +102,59 @@ public:
         return valueSize == sizeof(T);
     }
 
+    /**
+     * @brief Select how set() detects unchanged values.
+     *
+     * In the hash modes, only a 32-bit hash of the last value read or written
+     * is kept in RAM. The hash is rebuilt lazily on the next access.
+     * Note that writes to the same key through another instance are not
+     * visible to this instance unless CONFIG_ESPNVSVALUE_COHERENCE is enabled;
+     * otherwise call invalidateHash() or updateFromNVS() after them.
+     */
+    void setChangeDetection(NVSLazyChangeDetection mode) {
+        _changeDetection = mode;
+        invalidateHash();
+    }
+
+    NVSLazyChangeDetection changeDetection() const {
+        return _changeDetection;
+    }
+
+    /**
+     * @brief Forget the cached hash. The next set() will read NVS once to rebuild it.
+     */
+    void invalidateHash() {
+        _hashValid = false;
+    }
+
+    const NVSLazyValueStats& stats() const {
+        return _stats;
+    }
+
     /**
      * @brief Return the raw bytes of the stored value.
      *
      * For non-string types, this returns the binary representation of the
      * NVS value in a std::string.
      */
-    std::string asString() const override {
+    std::string asString() const {
         return nvs_value_detail::ToBinaryString(value());
     }
 
+    NVSValueDescriptor descriptor() const {
+        T loadedValue{};
+        bool stored = TryReadValue(loadedValue);
+        return NVSValueDescriptor{NVSValueKindOf<T>(), sizeof(T), stored, !stored || loadedValue == _default};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const {
+        if(bufferSize >= sizeof(T)) {
+            T loadedValue = value();
+            memcpy(buffer, &loadedValue, sizeof(T));
+        }
+        return sizeof(T);
+    }
+
     T value() const {
         T loadedValue = _default;
         if(!TryReadValue(loadedValue)) {
@@ -78,7 +179,8 @@ public:
     }
 
     void updateFromNVS() {
-        // Intentionally empty: values are always read on demand.
+        // Values are always read on demand. Only drop the change detection hash.
+        invalidateHash();
     }
 
     NVSSetResult set(const T& newValue) {
@@ -93,16 +195,23 @@ public:
             return NVSSetResult::Nullptr;
         }
 
-        if(exists() && value() == *newValue) {
+        if(_changeDetection == NVSLazyChangeDetection::Compare) {
+            if(exists() && value() == *newValue) {
+                return NVSSetResult::Unchanged;
+            }
+        } else if(IsUnchangedByHash(*newValue)) {
             return NVSSetResult::Unchanged;
         }
 
-        esp_err_t err = nvs_set_blob(nvs, _key.c_str(), static_cast<const void*>(newValue), sizeof(T));
+        esp_err_t err = NVSFlashSetBlob(nvs, _key.c_str(), static_cast<const void*>(newValue), sizeof(T));
         if(err != ESP_OK) {
             NVSCriticalPrintf("Failed to write NVS key %s: %s", SafeKey(), esp_err_to_name(err));
+            invalidateHash();
             return NVSSetResult::Error;
         }
-        nvs_commit(nvs);
+        NVSFlashCommit(nvs, _key.c_str());
+        RememberHash(HashOf(*newValue), true);
+        this->Publish(newValue, sizeof(T));
         return NVSSetResult::Updated;
     }
 
@@ -137,18 +246,46 @@ private:
             NVSCriticalPrintf("Invalid NVS instance or key");
             return NVSQueryResult::Error;
         }
+        if(this->ReadPeer([&](const void*, size_t size) { valueSize = size; })) {
+            return NVSQueryResult::OK;
+        }
         return NVSValueSize(nvs, _key, valueSize);
     }
 
     bool TryReadValue(T& loadedValue) const {
+        return ReadValue(loadedValue) == NVSQueryResult::OK;
+    }
+
+    /**
+     * @brief Read the stored value and refresh the change detection hash.
+     *
+     * A stored value with the wrong size is reported as NotFound,
+     * since it can never compare equal to a valid value.
+     */
+    NVSQueryResult ReadValue(T& loadedValue) const {
         size_t valueSize = 0;
+        if(IsInitialized() && this->ReadPeer([&](const void* data, size_t size) {
+            valueSize = size;
+            if(size == sizeof(T)) {
+                memcpy(static_cast<void*>(&loadedValue), data, sizeof(T));
+            }
+        })) {
+            // Served by a caching instance of the same key without accessing flash
+            if(valueSize != sizeof(T)) {
+                RememberHash(0, false);
+                return NVSQueryResult::NotFound;
+            }
+            RememberHash(HashOf(loadedValue), true);
+            return NVSQueryResult::OK;
+        }
         switch(QueryValueSize(valueSize)) {
             case NVSQueryResult::OK:
                 break;
             case NVSQueryResult::NotFound:
-                return false;
+                RememberHash(0, false);
+                return NVSQueryResult::NotFound;
             case NVSQueryResult::Error:
-                return false;
+                return NVSQueryResult::Error;
         }
 
         if(valueSize != sizeof(T)) {
@@ -157,59 +294,203 @@ private:
                 SafeKey(),
                 valueSize,
                 sizeof(T));
-            return false;
+            RememberHash(0, false);
+            return NVSQueryResult::NotFound;
         }
 
-        esp_err_t err = nvs_get_blob(nvs, _key.c_str(), static_cast<void*>(&loadedValue), &valueSize);
+        esp_err_t err = NVSFlashGetBlob(nvs, _key.c_str(), static_cast<void*>(&loadedValue), &valueSize);
         if(err != ESP_OK) {
             NVSWarningPrintf("Failed to read NVS key %s: %s", SafeKey(), esp_err_to_name(err));
+            return NVSQueryResult::Error;
+        }
+        RememberHash(HashOf(loadedValue), true);
+        return NVSQueryResult::OK;
+    }
+
+    static uint32_t HashOf(const T& candidate) {
+        return NVSCrc32(&candidate, sizeof(T));
+    }
+
+    friend class NVSCoherenceLink<NVSLazyValueCore>;
+
+    /**
+     * @brief Another instance of this key has written data: adopt its hash instead of reading
+     */
+    void ApplyPeerWrite(const void* data, size_t size) {
+        if(size == sizeof(T)) {
+            RememberHash(NVSCrc32(data, size), true);
+        } else {
+            RememberHash(0, false);
+        }
+    }
+
+    bool CachedPeerValue(const void*&, size_t&) const {
+        return false;
+    }
+
+    void RememberHash(uint32_t hash, bool stored) const {
+        _hash = hash;
+        _hashStored = stored;
+        _hashValid = true;
+    }
+
+    /**
+     * @brief Decide whether newValue equals the stored value using the cached hash.
+     */
+    bool IsUnchangedByHash(const T& newValue) {
+        if(!_hashValid) {
+            // Rebuild the hash. This read doubles as the compare read.
+            T loadedValue{};
+            NVSQueryResult result = ReadValue(loadedValue);
+            if(result == NVSQueryResult::Error) {
+                // Can't tell. Write unconditionally, like Compare mode does for unreadable values.
+                return false;
+            }
+            _stats.hashRebuilds++;
+            return result == NVSQueryResult::OK && loadedValue == newValue;
+        }
+
+        if(!_hashStored || _hash != HashOf(newValue)) {
+            _stats.readsAvoided++;
             return false;
         }
-        return true;
+        if(_changeDetection == NVSLazyChangeDetection::Hash) {
+            _stats.readsAvoided++;
+            return true;
+        }
+        // HashVerified: confirm the match with a compare read
+        T loadedValue{};
+        if(ReadValue(loadedValue) == NVSQueryResult::OK && loadedValue == newValue) {
+            return true;
+        }
+        _stats.collisionFallbacks++;
+        return false;
     }
+
+    NVSLazyChangeDetection _changeDetection = NVSLazyChangeDetection::Compare;
+    mutable bool _hashValid = false;
+    mutable bool _hashStored = false;
+    mutable uint32_t _hash = 0;
+    NVSLazyValueStats _stats;
 };
 
 template<>
-class NVSLazyValue<std::string> : public NVSValueBase {
+class NVSLazyValueCore<std::string> : public NVSCoherenceLink<NVSLazyValueCore<std::string>> {
 public:
-    NVSLazyValue() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _default() {}
-    NVSLazyValue(const NVSLazyValue&) = default;
-    NVSLazyValue(NVSLazyValue&&) = default;
-    NVSLazyValue& operator=(const NVSLazyValue&) = default;
-    NVSLazyValue& operator=(NVSLazyValue&&) = default;
+    NVSLazyValueCore() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _default() {}
 
-    NVSLazyValue(nvs_handle_t nvsHandle, const std::string& key, const std::string& defaultValue = std::string())
-        : nvs(nvsHandle), _key(key), _default(defaultValue) {}
+    NVSLazyValueCore(const NVSLazyValueCore& other) : NVSLazyValueCore(other.nvs, other._key, other._default) {
+        _changeDetection = other._changeDetection;
+    }
 
-    NVSLazyValue(nvs_handle_t nvsHandle, const char* key, const char* defaultValue = "")
-        : nvs(nvsHandle), _key(key != nullptr ? key : ""), _default(defaultValue != nullptr ? defaultValue : "") {}
+    NVSLazyValueCore& operator=(const NVSLazyValueCore& other) {
+        nvs = other.nvs;
+        _key = other._key;
+        _default = other._default;
+        _changeDetection = other._changeDetection;
+        invalidateHash();
+        this->Attach(nvs, _key);
+        return *this;
+    }
 
-    NVSLazyValue(nvs_handle_t nvsHandle, const char* key, const std::string& defaultValue)
-        : nvs(nvsHandle), _key(key != nullptr ? key : ""), _default(defaultValue) {}
+    NVSLazyValueCore(nvs_handle_t nvsHandle, const std::string& key, const std::string& defaultValue = std::string())
+        : nvs(nvsHandle), _key(key), _default(defaultValue) {
+        this->Attach(nvs, _key);
+    }
+
+    NVSLazyValueCore(nvs_handle_t nvsHandle, const char* key, const char* defaultValue = "")
+        : nvs(nvsHandle), _key(key != nullptr ? key : ""), _default(defaultValue != nullptr ? defaultValue : "") {
+        this->Attach(nvs, _key);
+    }
+
+    NVSLazyValueCore(nvs_handle_t nvsHandle, const char* key, const std::string& defaultValue)
+        : nvs(nvsHandle), _key(key != nullptr ? key : ""), _default(defaultValue) {
+        this->Attach(nvs, _key);
+    }
 
-    const std::string& key() const override {
+    ~NVSLazyValueCore() {
+        this->Detach();
+    }
+
+    const std::string& key() const {
         return _key;
     }
 
-    bool exists() const override {
+    bool exists() const {
         size_t valueSize = 0;
-        return IsInitialized() && NVSStringValueSize(nvs, _key, valueSize, NVSStringStoragePreference::PreferBlob) == NVSQueryResult::OK;
+        return QueryValueSize(valueSize) == NVSQueryResult::OK;
+    }
+
+    /**
+     * @brief Select how set() detects unchanged values.
+     * @see NVSLazyValue<T>::setChangeDetection()
+     */
+    void setChangeDetection(NVSLazyChangeDetection mode) {
+        _changeDetection = mode;
+        invalidateHash();
+    }
+
+    NVSLazyChangeDetection changeDetection() const {
+        return _changeDetection;
+    }
+
+    /**
+     * @brief Forget the cached hash. The next set() will read NVS once to rebuild it.
+     */
+    void invalidateHash() {
+        _hashValid = false;
+    }
+
+    const NVSLazyValueStats& stats() const {
+        return _stats;
     }
 
     /**
      * @brief Return the stored string value unchanged.
      */
-    std::string asString() const override {
+    std::string asString() const {
         return value();
     }
 
+    NVSValueDescriptor descriptor() const {
+        size_t valueSize = 0;
+        bool stored = QueryValueSize(valueSize) == NVSQueryResult::OK;
+        if(!stored) {
+            return NVSValueDescriptor{NVSValueKind::String, _default.size(), false, true};
+        }
+        return NVSValueDescriptor{NVSValueKind::String, valueSize, true, valueSize == _default.size() && StoredEqualsDefault()};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const {
+        size_t valueSize = bufferSize;
+        if(IsInitialized() && this->ReadPeer([&](const void* data, size_t size) {
+            valueSize = size;
+            if(size <= bufferSize) {
+                memcpy(buffer, data, size);
+            }
+        })) {
+            return valueSize;
+        }
+        NVSQueryResult result = IsInitialized()
+            ? NVSReadStringValueInto(nvs, _key, buffer, valueSize, NVSStringStoragePreference::PreferBlob)
+            : NVSQueryResult::NotFound;
+        if(result == NVSQueryResult::OK || (result == NVSQueryResult::Error && valueSize > bufferSize)) {
+            return valueSize;
+        }
+        // Missing or unreadable values serialize as the default, like value()
+        if(bufferSize >= _default.size()) {
+            memcpy(buffer, _default.data(), _default.size());
+        }
+        return _default.size();
+    }
+
     std::string value() const {
         if(!IsInitialized()) {
             return _default;
         }
 
         std::string loadedValue;
-        if(NVSReadStringValue(nvs, _key, loadedValue, NVSStringStoragePreference::PreferBlob) != NVSQueryResult::OK) {
+        if(ReadValue(loadedValue) != NVSQueryResult::OK) {
             return _default;
         }
         return loadedValue;
@@ -228,14 +509,15 @@ public:
 
     size_t size() const {
         size_t valueSize = 0;
-        if(exists() && NVSStringValueSize(nvs, _key, valueSize, NVSStringStoragePreference::PreferBlob) == NVSQueryResult::OK) {
+        if(QueryValueSize(valueSize) == NVSQueryResult::OK) {
             return valueSize;
         }
         return _default.size();
     }
 
     void updateFromNVS() {
-        // Intentionally empty: values are always read on demand.
+        // Values are always read on demand. Only drop the change detection hash.
+        invalidateHash();
     }
 
     NVSSetResult set(const std::string& newValue) {
@@ -243,16 +525,23 @@ public:
             return NVSSetResult::NotInitialized;
         }
 
-        if(value() == newValue) {
+        if(_changeDetection == NVSLazyChangeDetection::Compare) {
+            if(value() == newValue) {
+                return NVSSetResult::Unchanged;
+            }
+        } else if(IsUnchangedByHash(newValue)) {
             return NVSSetResult::Unchanged;
         }
 
-        esp_err_t err = nvs_set_blob(nvs, _key.c_str(), newValue.data(), newValue.size());
+        esp_err_t err = NVSFlashSetBlob(nvs, _key.c_str(), newValue.data(), newValue.size());
         if(err != ESP_OK) {
             NVSCriticalPrintf("Failed to write NVS key %s: %s", SafeKey(), esp_err_to_name(err));
+            invalidateHash();
             return NVSSetResult::Error;
         }
-        nvs_commit(nvs);
+        NVSFlashCommit(nvs, _key.c_str());
+        RememberHash(HashOf(newValue), true);
+        this->Publish(newValue.data(), newValue.size());
         return NVSSetResult::Updated;
     }
 
@@ -282,4 +571,157 @@ private:
     const char* SafeKey() const {
         return _key.empty() ? "<null>" : _key.c_str();
     }
-};
\ No newline at end of file
+
+    NVSQueryResult QueryValueSize(size_t& valueSize) const {
+        if(!IsInitialized()) {
+            return NVSQueryResult::NotFound;
+        }
+        if(this->ReadPeer([&](const void*, size_t size) { valueSize = size; })) {
+            return NVSQueryResult::OK;
+        }
+        return NVSStringValueSize(nvs, _key, valueSize, NVSStringStoragePreference::PreferBlob);
+    }
+
+    /**
+     * @brief Compare the stored value with the default without allocating.
+     *
+     * Short values are compared through a stack buffer. For longer values the
+     * change detection hash is used if available, otherwise they are
+     * conservatively reported as different.
+     */
+    bool StoredEqualsDefault() const {
+        bool equal = false;
+        if(this->ReadPeer([&](const void* data, size_t size) {
+            equal = size == _default.size() && memcmp(data, _default.data(), size) == 0;
+        })) {
+            return equal;
+        }
+        uint8_t buffer[64];
+        size_t valueSize = sizeof(buffer);
+        if(_default.size() < sizeof(buffer)) {
+            return NVSReadStringValueInto(nvs, _key, buffer, valueSize, NVSStringStoragePreference::PreferBlob) == NVSQueryResult::OK
+                && valueSize == _default.size() && memcmp(buffer, _default.data(), valueSize) == 0;
+        }
+        return _hashValid && _hashStored && _hash == HashOf(_default);
+    }
+
+    NVSQueryResult ReadValue(std::string& loadedValue) const {
+        if(this->ReadPeer([&](const void* data, size_t size) { loadedValue.assign(static_cast<const char*>(data), size); })) {
+            // Served by a caching instance of the same key without accessing flash
+            RememberHash(HashOf(loadedValue), true);
+            return NVSQueryResult::OK;
+        }
+        NVSQueryResult result = NVSReadStringValue(nvs, _key, loadedValue, NVSStringStoragePreference::PreferBlob);
+        if(result == NVSQueryResult::OK) {
+            RememberHash(HashOf(loadedValue), true);
+        } else if(result == NVSQueryResult::NotFound) {
+            RememberHash(0, false);
+        }
+        return result;
+    }
+
+    static uint32_t HashOf(const std::string& candidate) {
+        return HashOf(candidate.data(), candidate.size());
+    }
+
+    static uint32_t HashOf(const void* data, size_t size) {
+        // Fold the length in so that strings differing only in trailing bytes
+        // are less likely to collide.
+        uint32_t length = static_cast<uint32_t>(size);
+        return NVSCrc32(&length, sizeof(length), NVSCrc32(data, size));
+    }
+
+    friend class NVSCoherenceLink<NVSLazyValueCore>;
+
+    /**
+     * @brief Another instance of this key has written data: adopt its hash instead of reading
+     */
+    void ApplyPeerWrite(const void* data, size_t size) {
+        RememberHash(HashOf(data, size), true);
+    }
+
+    bool CachedPeerValue(const void*&, size_t&) const {
+        return false;
+    }
+
+    void RememberHash(uint32_t hash, bool stored) const {
+        _hash = hash;
+        _hashStored = stored;
+        _hashValid = true;
+    }
+
+    /**
+     * @brief Decide whether newValue equals the current value using the cached hash.
+     *
+     * Like the Compare mode, a missing key is considered equal to the default value.
+     */
+    bool IsUnchangedByHash(const std::string& newValue) {
+        if(!_hashValid) {
+            // Rebuild the hash. This read doubles as the compare read.
+            std::string loadedValue;
+            NVSQueryResult result = ReadValue(loadedValue);
+            if(result == NVSQueryResult::Error) {
+                return false;
+            }
+            _stats.hashRebuilds++;
+            return (result == NVSQueryResult::OK ? loadedValue : _default) == newValue;
+        }
+
+        if(!_hashStored) {
+            _stats.readsAvoided++;
+            return newValue == _default;
+        }
+        if(_hash != HashOf(newValue)) {
+            _stats.readsAvoided++;
+            return false;
+        }
+        if(_changeDetection == NVSLazyChangeDetection::Hash) {
+            _stats.readsAvoided++;
+            return true;
+        }
+        // HashVerified: confirm the match with a compare read
+        std::string loadedValue;
+        if(ReadValue(loadedValue) == NVSQueryResult::OK && loadedValue == newValue) {
+            return true;
+        }
+        _stats.collisionFallbacks++;
+        return false;
+    }
+
+    NVSLazyChangeDetection _changeDetection = NVSLazyChangeDetection::Compare;
+    mutable bool _hashValid = false;
+    mutable bool _hashStored = false;
+    mutable uint32_t _hash = 0;
+    NVSLazyValueStats _stats;
+};
+
+/**
+ * @brief Lazily read a value from NVS on every access instead of caching it locally.
+ *
+ * This API mirrors NVSValue where practical, but value access always performs a fresh read.
+ * See NVSPlainLazyValue for the same value without virtual methods.
+ */
+template<typename T>
+class NVSLazyValue : public NVSValueBase, public NVSLazyValueCore<T> {
+    typedef NVSLazyValueCore<T> Core;
+
+public:
+    using Core::Core;
+
+    const std::string& key() const override { return Core::key(); }
+    bool exists() const override { return Core::exists(); }
+    std::string asString() const override { return Core::asString(); }
+    NVSValueDescriptor descriptor() const override { return Core::descriptor(); }
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override { return Core::serializeTo(buffer, bufferSize); }
+};
+
+/**
+ * @brief NVSLazyValue without NVSValueBase, see NVSPlainValue
+ */
+template<typename T>
+class NVSPlainLazyValue : public NVSLazyValueCore<T> {
+    typedef NVSLazyValueCore<T> Core;
+
+public:
+    using Core::Core;
+};
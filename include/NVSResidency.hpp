@@ -0,0 +1,326 @@
+#pragma once
+#include <nvs.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include "NVSArena.hpp"
+#include "NVSLog.hpp"
+#include "NVSResult.hpp"
+#include "NVSTrace.hpp"
+#include "NVSValueBase.hpp"
+
+/**
+ * @brief Access and residency counters of one adaptive value
+ */
+struct NVSResidencyStats {
+    uint32_t accesses;
+    /**
+     * Accesses served from the RAM cache
+     */
+    uint32_t hits;
+    /**
+     * Accesses which read flash
+     */
+    uint32_t misses;
+    uint32_t promotions;
+    uint32_t evictions;
+    /**
+     * Decayed access frequency used to rank values, see NVSResidencyManager::rebalance()
+     */
+    uint32_t score;
+    bool resident;
+
+    uint8_t hitRatePercent() const {
+        return accesses > 0 ? static_cast<uint8_t>(static_cast<uint64_t>(hits) * 100 / accesses) : 0;
+    }
+};
+
+/**
+ * @brief Counters of an NVSResidencyManager
+ */
+struct NVSResidencyManagerStats {
+    size_t budget;
+    /**
+     * Cache bytes of all resident values
+     */
+    size_t used;
+    size_t values;
+    size_t resident;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t promotions;
+    uint32_t evictions;
+    uint32_t rebalances;
+
+    uint8_t hitRatePercent() const {
+        uint32_t accesses = hits + misses;
+        return accesses > 0 ? static_cast<uint8_t>(static_cast<uint64_t>(hits) * 100 / accesses) : 0;
+    }
+};
+
+class NVSResidencyManager;
+
+/**
+ * @brief Intrusive list entry of a value managed by an NVSResidencyManager.
+ * Use NVSAdaptiveValue, or derive from it for other fixed-size types.
+ */
+class NVSResidentNode {
+public:
+    const NVSResidencyStats& residency() const { return _stats; }
+    virtual const std::string& residentKey() const = 0;
+
+protected:
+    NVSResidentNode() : _manager(nullptr), _next(nullptr), _cache(nullptr), _cacheSize(0), _cachedExists(false), _considered(false), _epochAccesses(0), _stats() {}
+    ~NVSResidentNode() { Detach(); }
+
+    NVSResidentNode(const NVSResidentNode&) = delete;
+    NVSResidentNode& operator=(const NVSResidentNode&) = delete;
+
+    /**
+     * @brief Register with manager. cacheSize bytes are charged to its budget while resident.
+     */
+    void Attach(NVSResidencyManager* manager, size_t cacheSize);
+
+    /**
+     * @brief Release the cache and unregister. Owners call this first in their destructor.
+     */
+    void Detach();
+
+    /**
+     * @brief Read the value into out, from the cache or with Fill(), and account the access
+     * @return false if the value can't be read
+     */
+    bool Read(void* out, bool& exists);
+
+    /**
+     * @brief Update the cache after the value has been written
+     */
+    void Written(const void* data);
+
+    /**
+     * @brief Read the stored value from flash into memory, or the default if it doesn't exist
+     * @return false on a read error
+     */
+    virtual bool Fill(void* memory, bool& exists) const = 0;
+
+    /**
+     * @brief The cached value, nullptr if the value is not resident
+     */
+    const void* Cached(bool& exists) const {
+        exists = _cachedExists;
+        return _cache;
+    }
+
+private:
+    friend class NVSResidencyManager;
+
+    NVSResidencyManager* _manager;
+    NVSResidentNode* _next;
+    void* _cache;
+    size_t _cacheSize;
+    bool _cachedExists;
+    // Visited by the current rebalance()
+    bool _considered;
+    uint32_t _epochAccesses;
+    NVSResidencyStats _stats;
+};
+
+/**
+ * @brief Decides which adaptive values are cached in RAM, within a byte budget.
+ *
+ * Every access of an adaptive value is counted. A value which is read from
+ * flash promoteAfter times within one epoch is promoted right away if the
+ * budget has room. rebalance() ends the epoch: each value's score becomes
+ * half its previous score plus its accesses in the epoch, and the hottest
+ * non-resident values replace colder resident ones, so the cache follows
+ * changing access patterns, e.g. from commissioning to steady state.
+ *
+ * Cache memory is taken from an NVSArena if one is given, otherwise from
+ * the default heap. Rebalancing is O(n^2) in the number of values, which
+ * is meant for tens of values, not thousands (see NVSTable for those).
+ *
+ * Like NVSArena, the manager and its values are not thread-safe.
+ */
+class NVSResidencyManager {
+public:
+    /**
+     * @param budget Maximum cache bytes of all resident values
+     * @param arena Arena for cache memory, nullptr for the default heap
+     * @param rebalanceEvery Call rebalance() after this many accesses, 0 to only rebalance explicitly
+     * @param promoteAfter Flash reads within one epoch after which a value is promoted if it fits
+     */
+    NVSResidencyManager(size_t budget, NVSArena* arena = nullptr, uint32_t rebalanceEvery = 0, uint32_t promoteAfter = 2);
+    ~NVSResidencyManager();
+
+    NVSResidencyManager(const NVSResidencyManager&) = delete;
+    NVSResidencyManager& operator=(const NVSResidencyManager&) = delete;
+
+    /**
+     * @brief End the current epoch and move the cache to the hottest values within the budget
+     */
+    void rebalance();
+
+    /**
+     * @brief Change the budget. Resident values are evicted, coldest first, until it is met.
+     */
+    void setBudget(size_t budget);
+    size_t budget() const { return _stats.budget; }
+
+    NVSResidencyManagerStats stats() const { return _stats; }
+
+    /**
+     * @brief Call callback(const NVSResidentNode&) for every managed value,
+     * e.g. to log residency() by residentKey() while tuning the budget
+     */
+    template<typename Callback>
+    void forEach(Callback&& callback) const {
+        for(const NVSResidentNode* node = _head; node != nullptr; node = node->_next) {
+            callback(*node);
+        }
+    }
+
+private:
+    friend class NVSResidentNode;
+
+    void Link(NVSResidentNode& node);
+    void Unlink(NVSResidentNode& node);
+    void Accessed(NVSResidentNode& node, bool hit, const void* data, bool exists);
+    bool Promote(NVSResidentNode& node, const void* data, bool exists);
+    void Evict(NVSResidentNode& node);
+    NVSResidentNode* Coldest(uint32_t belowScore) const;
+    void* Allocate(size_t size);
+    void Free(void* memory);
+
+    NVSArena* _arena;
+    uint32_t _rebalanceEvery;
+    uint32_t _promoteAfter;
+    uint32_t _accessesSinceRebalance;
+    NVSResidentNode* _head;
+    NVSResidencyManagerStats _stats;
+};
+
+/**
+ * @brief Value which is either cached in RAM like NVSValue or read from flash
+ * on every access like NVSLazyValue, as decided by an NVSResidencyManager.
+ *
+ * set() always writes through, so evicting a value never loses data.
+ * Instances are not linked for coherence. T must be trivially copyable.
+ */
+template<typename T>
+class NVSAdaptiveValue : public NVSValueBase, public NVSResidentNode {
+    static_assert(std::is_trivially_copyable_v<T>, "NVSAdaptiveValue requires a trivially copyable type");
+
+public:
+    NVSAdaptiveValue(NVSResidencyManager& manager, nvs_handle_t nvs, const std::string& key, const T& defaultValue = T())
+        : nvs(nvs), _key(key), _default(defaultValue) {
+        Attach(&manager, sizeof(T));
+    }
+
+    ~NVSAdaptiveValue() {
+        Detach();
+    }
+
+    const std::string& key() const override { return _key; }
+    const std::string& residentKey() const override { return _key; }
+
+    bool exists() const override {
+        bool stored = false;
+        if(Cached(stored) == nullptr) {
+            T loadedValue;
+            Fill(&loadedValue, stored);
+        }
+        return stored;
+    }
+
+    std::string asString() const override {
+        T loadedValue = Peek();
+        return std::string(reinterpret_cast<const char*>(&loadedValue), sizeof(T));
+    }
+
+    NVSValueDescriptor descriptor() const override {
+        bool stored = false;
+        T loadedValue = Peek(&stored);
+        return NVSValueDescriptor{NVSValueKindOf<T>(), sizeof(T), stored, !stored || loadedValue == _default};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override {
+        if(bufferSize >= sizeof(T)) {
+            T loadedValue = Peek();
+            memcpy(buffer, &loadedValue, sizeof(T));
+        }
+        return sizeof(T);
+    }
+
+    /**
+     * @brief The current value. Counted as access by the residency manager.
+     */
+    T value() {
+        T loadedValue;
+        bool stored = false;
+        if(nvs == std::numeric_limits<nvs_handle_t>::max() || !Read(&loadedValue, stored)) {
+            return _default;
+        }
+        return loadedValue;
+    }
+
+    NVSSetResult set(const T& newValue) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        bool stored = false;
+        T currentValue = Peek(&stored);
+        if(stored && currentValue == newValue) {
+            return NVSSetResult::Unchanged;
+        }
+        esp_err_t err = NVSFlashSetBlob(nvs, _key.c_str(), static_cast<const void*>(&newValue), sizeof(T));
+        if(err != ESP_OK) {
+            NVSCriticalPrintf("Failed to write NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
+            return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+        NVSFlashCommit(nvs, _key.c_str());
+        Written(&newValue);
+        return NVSSetResult::Updated;
+    }
+
+    nvs_handle_t nvs;
+    std::string _key;
+    T _default;
+
+protected:
+    bool Fill(void* memory, bool& stored) const override {
+        T loadedValue = _default;
+        size_t size = sizeof(T);
+        esp_err_t err = NVSFlashGetBlob(nvs, _key.c_str(), static_cast<void*>(&loadedValue), &size);
+        stored = err == ESP_OK && size == sizeof(T);
+        if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            NVSWarningPrintf("Failed to read NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
+            return false;
+        }
+        memcpy(memory, stored ? static_cast<const void*>(&loadedValue) : static_cast<const void*>(&_default), sizeof(T));
+        return true;
+    }
+
+private:
+    /**
+     * Current value without counting an access
+     */
+    T Peek(bool* stored = nullptr) const {
+        bool exists = false;
+        T loadedValue = _default;
+        const void* cached = Cached(exists);
+        if(cached != nullptr) {
+            memcpy(static_cast<void*>(&loadedValue), cached, sizeof(T));
+        } else if(nvs == std::numeric_limits<nvs_handle_t>::max() || !Fill(&loadedValue, exists)) {
+            exists = false;
+            loadedValue = _default;
+        }
+        if(stored != nullptr) {
+            *stored = exists;
+        }
+        return loadedValue;
+    }
+};
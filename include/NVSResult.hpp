@@ -15,6 +15,16 @@ enum class NVSSetResult : int8_t {
      * Value was not changed
      */
     Unchanged = 1,
+    /**
+     * The write policy considered the new value equal to the current one.
+     * Neither NVS nor the cached value have been changed.
+     */
+    Suppressed = 2,
+    /**
+     * The write policy postponed the write. The new value is held in RAM
+     * and will be written by a later set(), poll() or flush().
+     */
+    Deferred = 3,
     /**
      * Error: Class has not been initialized
      */
@@ -26,7 +36,49 @@ enum class NVSSetResult : int8_t {
     /**
      * Error: Unknown error
      */
-    Error = -3
+    Error = -3,
+    /**
+     * Error: Not enough free space in the NVS partition, or the write policy
+     * rejected the value to keep space for more important values
+     */
+    NoSpace = -4
 };
 
 const char* NVSSetResultToString(NVSSetResult setResult);
+
+/**
+ * @brief Result of a streaming export or import (see NVSExport.hpp).
+ * Negative values are errors.
+ */
+enum class NVSTransferResult : int8_t {
+    /**
+     * All records have been transferred
+     */
+    OK = 0,
+    /**
+     * Error: The sink callback rejected data
+     */
+    SinkError = -1,
+    /**
+     * Error: The stream ended before the end marker
+     */
+    Truncated = -2,
+    /**
+     * Error: The stream is not a valid record stream
+     */
+    FormatError = -3,
+    /**
+     * Error: The checksum at the end of the stream does not match
+     */
+    ChecksumMismatch = -4,
+    /**
+     * Error: Reading or writing NVS failed
+     */
+    NVSError = -5,
+    /**
+     * Error: A temporary buffer for a large value could not be allocated
+     */
+    NoMemory = -6
+};
+
+const char* NVSTransferResultToString(NVSTransferResult transferResult);
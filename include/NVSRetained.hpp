@@ -0,0 +1,331 @@
+#pragma once
+#include <nvs.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#if __has_include("sdkconfig.h")
+#include "sdkconfig.h"
+#endif
+
+#include "NVSLog.hpp"
+#include "NVSResult.hpp"
+#include "NVSValueBase.hpp"
+#include "NVSValue.hpp"
+
+#ifndef CONFIG_ESPNVSVALUE_RETAINED_SIZE
+#define CONFIG_ESPNVSVALUE_RETAINED_SIZE 512
+#endif
+
+/**
+ * Size of the region returned by NVSRetainedMemory()
+ */
+constexpr size_t NVSRetainedMemorySize = CONFIG_ESPNVSVALUE_RETAINED_SIZE;
+
+/**
+ * @brief Default retained region of NVSRetainedMemorySize bytes.
+ *
+ * On the target, the region is placed in RTC slow memory (RTC_NOINIT_ATTR),
+ * so it survives deep sleep but not a power-on reset. On the host, it is an
+ * ordinary static buffer, so a wake-up can be simulated by constructing a new
+ * NVSRetainedStore over it.
+ */
+void* NVSRetainedMemory();
+
+/**
+ * @brief Header of one value in a retained region
+ */
+struct NVSRetainedSlot {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint16_t size;
+    /**
+     * NVSRetainedStore::SlotValid, SlotExists and SlotDirty
+     */
+    uint8_t flags;
+    uint8_t reserved;
+    /**
+     * CRC32 of the slot header and the value bytes which follow it
+     */
+    uint32_t crc;
+};
+
+struct NVSRetainedStats {
+    /**
+     * Whether the retained region was valid at startup, i.e. this is a wake-up from deep sleep
+     */
+    bool restored;
+    uint32_t wakesSinceFlush;
+    /**
+     * Changes which have been kept in retained memory instead of being written to flash
+     */
+    uint32_t writesAbsorbed;
+    uint32_t flushes;
+    uint32_t slotsFlushed;
+    /**
+     * Slots which were discarded because their checksum did not match
+     */
+    uint32_t corruptSlots;
+    size_t usedBytes;
+    size_t capacity;
+};
+
+/**
+ * @brief Write-back tier for values of duty-cycled devices.
+ *
+ * Values bound to the store keep their current value in a retained memory
+ * region, e.g. RTC slow memory, which survives deep sleep. Changes are only
+ * written to the region. They are written to NVS, with a single commit, by
+ * flush(), or by beforeSleep() every flushEveryWakes wake-ups and whenever
+ * the battery is low. After a wake-up, values are restored from the region
+ * without reading flash.
+ *
+ * The region and each value are protected by a CRC32. A corrupted region is
+ * discarded as a whole, a corrupted value is read from NVS again. Neither is
+ * ever written to NVS. Changes which have not been flushed are lost on a
+ * power-on reset or brownout, so only use it for values which may fall back
+ * to an older state, e.g. sequence numbers which are resynchronized anyway.
+ *
+ * Slots are allocated in the order values are bound and stay allocated for
+ * the lifetime of the region, so bind the same keys in every wake-up.
+ * Use one region per namespace.
+ */
+class NVSRetainedStore {
+public:
+    static constexpr uint8_t SlotValid = 0x01;
+    /**
+     * The value exists in NVS or has been set
+     */
+    static constexpr uint8_t SlotExists = 0x02;
+    /**
+     * The value has been changed and not been flushed yet
+     */
+    static constexpr uint8_t SlotDirty = 0x04;
+
+    /**
+     * @param nvs Handle of the namespace, opened read/write
+     * @param region Retained memory, aligned to 4 bytes
+     * @param size Size of region in bytes
+     * @param flushEveryWakes beforeSleep() flushes after this many wake-ups, 0 to only flush explicitly or on low battery
+     */
+    NVSRetainedStore(nvs_handle_t nvs, void* region = NVSRetainedMemory(), size_t size = NVSRetainedMemorySize,
+                     uint32_t flushEveryWakes = 10);
+
+    NVSRetainedStore(const NVSRetainedStore&) = delete;
+    NVSRetainedStore& operator=(const NVSRetainedStore&) = delete;
+
+    /**
+     * @brief Call once per wake-up before entering deep sleep.
+     * Counts the wake-up and flushes if flushEveryWakes have passed or lowBattery is set.
+     * @return Unchanged if nothing has been written to NVS
+     */
+    NVSSetResult beforeSleep(bool lowBattery = false);
+
+    /**
+     * @brief Write all changed values to NVS and commit once
+     * @return Unchanged if no value has changed since the last flush
+     */
+    NVSSetResult flush();
+
+    /**
+     * @brief Discard the region including all changes which have not been flushed
+     */
+    void clear();
+
+    size_t dirtyCount() const;
+    bool restored() const { return _stats.restored; }
+    NVSRetainedStats stats() const;
+    nvs_handle_t nvs() const { return _nvs; }
+
+    uint32_t flushEveryWakes;
+
+    // Slot access for NVSRetainedValue
+
+    /**
+     * @brief Find the slot of key, or allocate a new one
+     * @return nullptr if the region is full or the key is retained with a different size
+     */
+    NVSRetainedSlot* bind(const char* key, size_t size);
+
+    /**
+     * @brief Copy the retained value of a slot
+     * @return false if the slot has not been filled yet or its checksum does not match
+     */
+    bool load(NVSRetainedSlot* slot, void* data, size_t size, bool& exists);
+
+    /**
+     * @brief Update a slot. A dirty slot is written by the next flush.
+     */
+    void store(NVSRetainedSlot* slot, const void* data, size_t size, bool exists, bool dirty);
+
+    /**
+     * @brief Write a single dirty slot to NVS and commit
+     */
+    NVSSetResult flushSlot(NVSRetainedSlot* slot);
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t usedBytes;
+        uint32_t wakesSinceFlush;
+        uint32_t crc;
+    };
+
+    static constexpr uint32_t Magic = 0x4e565352; // "NVSR"
+
+    bool IsValid() const;
+    void SealHeader();
+    static uint8_t* Data(NVSRetainedSlot* slot) { return reinterpret_cast<uint8_t*>(slot + 1); }
+    static size_t SlotBytes(size_t size);
+    static uint32_t SlotCrc(const NVSRetainedSlot* slot);
+    /**
+     * @brief Iterate slots in allocation order, nullptr after the last one
+     */
+    NVSRetainedSlot* Next(NVSRetainedSlot* slot) const;
+    /**
+     * @brief Write a dirty, intact slot to NVS without committing
+     */
+    esp_err_t Write(NVSRetainedSlot* slot);
+
+    nvs_handle_t _nvs;
+    Header* _header;
+    size_t _capacity;
+    NVSRetainedStats _stats;
+};
+
+/**
+ * @brief Value cached in retained memory and written to NVS by its NVSRetainedStore.
+ *
+ * set() only updates the retained copy and returns NVSSetResult::Deferred.
+ * If no slot could be allocated, the value is written through like NVSValue.
+ * T must be trivially copyable and is stored as a blob like NVSValue<T> does,
+ * so both can be used for the same key.
+ */
+template<typename T>
+class NVSRetainedValue : public NVSValueBase {
+    static_assert(std::is_trivially_copyable_v<T>, "NVSRetainedValue requires a trivially copyable type");
+    static_assert(sizeof(T) <= std::numeric_limits<uint16_t>::max(), "NVSRetainedValue is limited to 64 KiB");
+
+public:
+    NVSRetainedValue() : _key(), _value(), _default(), _exists(false), _store(nullptr), _slot(nullptr) {}
+
+    NVSRetainedValue(NVSRetainedStore& store, const std::string& key, const T& defaultValue = T())
+        : _key(key), _value(defaultValue), _default(defaultValue), _exists(false), _store(&store), _slot(store.bind(key.c_str(), sizeof(T))) {
+        if(_slot == nullptr || !_store->load(_slot, &_value, sizeof(T), _exists)) {
+            updateFromNVS();
+        }
+    }
+
+    NVSRetainedValue(const NVSRetainedValue&) = delete;
+    NVSRetainedValue& operator=(const NVSRetainedValue&) = delete;
+
+    const std::string& key() const override { return _key; }
+    bool exists() const override { return _exists; }
+
+    std::string asString() const override {
+        return nvs_value_detail::ToBinaryString(_value);
+    }
+
+    NVSValueDescriptor descriptor() const override {
+        return NVSValueDescriptor{NVSValueKindOf<T>(), sizeof(T), _exists, _value == _default};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override {
+        if(bufferSize >= sizeof(T)) {
+            memcpy(buffer, &_value, sizeof(T));
+        }
+        return sizeof(T);
+    }
+
+    inline T value() const { return _value; }
+
+    size_t size() const { return sizeof(T); }
+
+    /**
+     * @brief Whether the value is kept in retained memory, i.e. set() does not write flash
+     */
+    bool retained() const { return _slot != nullptr; }
+
+    /**
+     * @brief Read the value from NVS and replace the retained copy.
+     * A change which has not been flushed is discarded.
+     */
+    void updateFromNVS() {
+        if(_store == nullptr) {
+            NVSCriticalPrintf("Invalid retained store");
+            return;
+        }
+        size_t size = 0;
+        switch(NVSValueSize(_store->nvs(), _key, size)) {
+            case NVSQueryResult::OK:
+                if(size == sizeof(T) && NVSFlashGetBlob(_store->nvs(), _key.c_str(), static_cast<void*>(&_value), &size) == ESP_OK) {
+                    _exists = true;
+                    break;
+                }
+                NVSWarningPrintf("Size of value in NVS for key %s (%d bytes) does not match expected size %d", _key.c_str(), size, sizeof(T));
+                [[fallthrough]];
+            case NVSQueryResult::NotFound:
+                _exists = false;
+                _value = _default;
+                break;
+            case NVSQueryResult::Error:
+                NVSErrorPrintf("Failed to get size of NVS key %s", _key.c_str());
+                // Don't retain a value which might not match NVS
+                return;
+        }
+        if(_slot != nullptr) {
+            _store->store(_slot, &_value, sizeof(T), _exists, false);
+        }
+    }
+
+    /**
+     * @brief Update the retained copy
+     * @return Deferred if the change is retained until the next flush, Updated if it has been written through
+     */
+    NVSSetResult set(const T& newValue) {
+        if(_store == nullptr) {
+            return NVSSetResult::NotInitialized;
+        }
+        if(_exists && _value == newValue) {
+            return NVSSetResult::Unchanged;
+        }
+        _value = newValue;
+        _exists = true;
+        if(_slot != nullptr) {
+            _store->store(_slot, &_value, sizeof(T), true, true);
+            return NVSSetResult::Deferred;
+        }
+        esp_err_t err = NVSFlashSetBlob(_store->nvs(), _key.c_str(), static_cast<const void*>(&_value), sizeof(T));
+        if(err != ESP_OK) {
+            NVSCriticalPrintf("Failed to write NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
+            return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+        NVSFlashCommit(_store->nvs(), _key.c_str());
+        return NVSSetResult::Updated;
+    }
+
+    bool hasPendingWrite() const override {
+        return _slot != nullptr && (_slot->flags & NVSRetainedStore::SlotDirty) != 0;
+    }
+
+    /**
+     * @brief Write this value to NVS now if it has changed
+     */
+    NVSSetResult flush() override {
+        if(_store == nullptr) {
+            return NVSSetResult::NotInitialized;
+        }
+        return _slot != nullptr ? _store->flushSlot(_slot) : NVSSetResult::Unchanged;
+    }
+
+    std::string _key;
+    T _value;
+    T _default;
+    bool _exists;
+
+private:
+    NVSRetainedStore* _store;
+    NVSRetainedSlot* _slot;
+};
@@ -0,0 +1,253 @@
+#pragma once
+#include <nvs.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include "NVSLog.hpp"
+#include "NVSResult.hpp"
+#include "NVSTrace.hpp"
+#include "NVSUtils.hpp"
+
+/**
+ * @brief Append-only ring of the last Capacity records of type T.
+ *
+ * Each record is stored in its own slot key "<prefix><slot>" (three hex digits),
+ * together with its sequence number. A u32 head entry "<prefix>h" stores the
+ * sequence number of the next record. Appending therefore writes only the new
+ * record and the head, instead of rewriting an array of all records.
+ *
+ * Records are read one at a time, so iterating does not need RAM for more
+ * than one record. If power is lost between writing a record and updating the
+ * head, the record is found and the head is advanced on the next start.
+ */
+template<typename T, size_t Capacity>
+class NVSRingLog {
+public:
+    static_assert(std::is_trivially_copyable_v<T>, "NVSRingLog records are stored as raw bytes");
+    static_assert(Capacity > 0 && Capacity <= 0x1000, "Slot numbers must fit into three hex digits");
+
+    /**
+     * Maximum prefix length so that slot keys fit into the 15 character NVS key limit
+     */
+    static constexpr size_t MaxPrefixLength = 12;
+
+    /**
+     * Empty default constructor.
+     * You need to assign this instance before actually using it.
+     */
+    NVSRingLog() : nvs(std::numeric_limits<nvs_handle_t>::max()), _prefix(), _head(0) {}
+
+    /**
+     * Main constructor. Recovers the head position from NVS.
+     */
+    NVSRingLog(nvs_handle_t nvs, const std::string& prefix) : nvs(nvs), _prefix(prefix), _head(0) {
+        if(_prefix.size() > MaxPrefixLength) {
+            NVSErrorPrintf("Ring log prefix %s is longer than %d characters", _prefix.c_str(), MaxPrefixLength);
+            this->nvs = std::numeric_limits<nvs_handle_t>::max();
+            return;
+        }
+        recover();
+    }
+
+    /**
+     * @brief Number of records that can be read
+     */
+    size_t size() const {
+        return _head < Capacity ? _head : Capacity;
+    }
+
+    bool empty() const {
+        return _head == 0;
+    }
+
+    static constexpr size_t capacity() {
+        return Capacity;
+    }
+
+    /**
+     * @brief Sequence number the next appended record will get.
+     * This is also the total number of records appended so far.
+     */
+    uint32_t sequence() const {
+        return _head;
+    }
+
+    /**
+     * @brief Append a record, overwriting the oldest one if the log is full.
+     * Writes the record slot and the head entry, followed by a single commit.
+     */
+    NVSSetResult append(const T& record) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        Slot slot{_head, record};
+        char key[16];
+        SlotKey(_head, key);
+        esp_err_t err;
+        if((err = NVSFlashSetBlob(nvs, key, &slot, sizeof(slot))) != ESP_OK) {
+            NVSCriticalPrintf("Failed to write NVS key %s: %s", key, esp_err_to_name(err));
+            return NVSSetResult::Error;
+        }
+        // If this write is lost, recover() finds the record above and advances the head
+        HeadKey(key);
+        if((err = NVSFlashSetU32(nvs, key, _head + 1)) != ESP_OK) {
+            NVSCriticalPrintf("Failed to write NVS key %s: %s", key, esp_err_to_name(err));
+            return NVSSetResult::Error;
+        }
+        NVSFlashCommit(nvs);
+        _head++;
+        return NVSSetResult::Updated;
+    }
+
+    /**
+     * @brief Read a record by age, where age 0 is the newest record.
+     * @return false if there is no such record or it could not be read
+     */
+    bool read(size_t age, T& record) const {
+        if(age >= size()) {
+            return false;
+        }
+        Slot slot;
+        uint32_t sequence = _head - 1 - static_cast<uint32_t>(age);
+        if(!ReadSlot(sequence, slot) || slot.sequence != sequence) {
+            return false;
+        }
+        record = slot.record;
+        return true;
+    }
+
+    /**
+     * @brief Call callback(const T& record, uint32_t sequence) for each record from newest to oldest.
+     *
+     * Only one record is held in RAM at a time. The callback may return false
+     * to stop the iteration; callbacks returning void visit all records.
+     * Iteration also stops at the first missing or unreadable record.
+     *
+     * @return Number of records visited
+     */
+    template<typename Callback>
+    size_t forEachNewestFirst(Callback&& callback) const {
+        size_t visited = 0;
+        for(size_t age = 0; age < size(); ++age) {
+            Slot slot;
+            uint32_t sequence = _head - 1 - static_cast<uint32_t>(age);
+            if(!ReadSlot(sequence, slot) || slot.sequence != sequence) {
+                break;
+            }
+            visited++;
+            if constexpr (std::is_same_v<decltype(callback(slot.record, sequence)), bool>) {
+                if(!callback(slot.record, sequence)) {
+                    break;
+                }
+            } else {
+                callback(slot.record, sequence);
+            }
+        }
+        return visited;
+    }
+
+    /**
+     * @brief Determine the head position from NVS.
+     *
+     * This is automatically called in the constructor.
+     * Records written after the last stored head are found by probing the
+     * following slots. If the head entry is missing but records exist,
+     * all slots are scanned.
+     */
+    void recover() {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            NVSCriticalPrintf("Invalid NVS instance");
+            return;
+        }
+        char key[16];
+        HeadKey(key);
+        uint32_t head = 0;
+        esp_err_t err = NVSFlashGetU32(nvs, key, &head);
+        Slot slot;
+        if(err == ESP_ERR_NVS_NOT_FOUND && ReadSlot(0, slot)) {
+            NVSWarningPrintf("Head of ring log %s is missing, scanning all slots", _prefix.c_str());
+            head = ScanForHead();
+        } else if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            NVSErrorPrintf("Failed to read NVS key %s: %s", key, esp_err_to_name(err));
+            head = ScanForHead();
+        }
+        // Roll forward over records whose head update was lost
+        for(size_t i = 0; i < Capacity && ReadSlot(head, slot) && slot.sequence == head; ++i) {
+            NVSInfoPrintf("Recovered record %u of ring log %s", head, _prefix.c_str());
+            head++;
+        }
+        _head = head;
+    }
+
+    /**
+     * @brief Erase all records and the head entry
+     */
+    NVSSetResult clear() {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        char key[16];
+        for(size_t slot = 0; slot < Capacity; ++slot) {
+            SlotKey(slot, key);
+            NVSFlashEraseKey(nvs, key);
+        }
+        HeadKey(key);
+        NVSFlashEraseKey(nvs, key);
+        NVSFlashCommit(nvs);
+        _head = 0;
+        return NVSSetResult::Updated;
+    }
+
+    const std::string& prefix() const {
+        return _prefix;
+    }
+
+    nvs_handle_t nvs;
+
+private:
+    struct Slot {
+        uint32_t sequence;
+        T record;
+    };
+
+    void SlotKey(uint32_t sequence, char* key) const {
+        snprintf(key, 16, "%s%03x", _prefix.c_str(), static_cast<unsigned>(sequence % Capacity));
+    }
+
+    void HeadKey(char* key) const {
+        snprintf(key, 16, "%sh", _prefix.c_str());
+    }
+
+    bool ReadSlot(uint32_t sequence, Slot& slot) const {
+        char key[16];
+        SlotKey(sequence, key);
+        size_t size = sizeof(Slot);
+        esp_err_t err = NVSFlashGetBlob(nvs, key, &slot, &size);
+        if(err == ESP_ERR_NVS_NOT_FOUND) {
+            return false;
+        }
+        if(err != ESP_OK || size != sizeof(Slot)) {
+            NVSWarningPrintf("Failed to read NVS key %s: %s", key, esp_err_to_name(err));
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t ScanForHead() const {
+        uint32_t head = 0;
+        Slot slot;
+        for(size_t i = 0; i < Capacity; ++i) {
+            if(ReadSlot(static_cast<uint32_t>(i), slot) && slot.sequence % Capacity == i && slot.sequence + 1 > head) {
+                head = slot.sequence + 1;
+            }
+        }
+        return head;
+    }
+
+    std::string _prefix;
+    uint32_t _head;
+};
@@ -0,0 +1,163 @@
+#pragma once
+#include <nvs.h>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+
+#include "NVSUtils.hpp"
+
+/**
+ * @brief Declared usage of a value, used by NVSRouter to place it
+ */
+enum class NVSStorageClass : uint8_t {
+    /**
+     * Values without a declared class. Classes without a route use this route as well.
+     */
+    Default = 0,
+    /**
+     * Rarely changed values, e.g. identity, credentials or calibration
+     */
+    Cold = 1,
+    /**
+     * Frequently changed values, e.g. counters
+     */
+    Hot = 2,
+    /**
+     * Values which must always fit and stay readable
+     */
+    Critical = 3,
+    /**
+     * Logs, statistics and other data which can be lost
+     */
+    Bulk = 4
+};
+
+constexpr size_t NVSStorageClassCount = 5;
+
+const char* NVSStorageClassToString(NVSStorageClass storageClass);
+
+/**
+ * @brief Utilization and wear of the partition of one route
+ */
+struct NVSPartitionStats {
+    const char* partition;
+    const char* namespc;
+    size_t totalEntries;
+    size_t usedEntries;
+    size_t freeEntries;
+    uint8_t usedPercent;
+    size_t pageCount;
+    /**
+     * Page erases since the partition was formatted, estimated from the
+     * sequence numbers in the page headers: every page which becomes active
+     * gets the next sequence number, and every activation ends with an erase
+     * except for the pages in use now. 0 if the page headers could not be read.
+     */
+    uint32_t estimatedPageErases;
+    /**
+     * estimatedPageErases spread over all pages, i.e. the erase cycles each
+     * flash sector has used on average
+     */
+    uint32_t averageEraseCycles;
+    /**
+     * Number of keys routed here by handleFor() since boot
+     */
+    uint32_t routedKeys;
+};
+
+/**
+ * @brief Places values on different partitions or namespaces.
+ *
+ * Each storage class is routed to one route (a partition and namespace), or
+ * striped over several routes by a hash of the key. Value classes are not
+ * aware of the routing, they are simply constructed with the handle it returns:
+ *
+ *   NVSValue<uint32_t> bootCount(router.handleFor("boots", NVSStorageClass::Hot), "boots");
+ *
+ * Keeping frequently written values on their own partition means that
+ * garbage collection of that partition never has to move, and erase the
+ * sectors of, rarely changed values.
+ *
+ * The key hash is a CRC32 and therefore stable across builds. Changing the
+ * routes of a class after values have been written moves these values to
+ * other partitions, i.e. they are read as missing.
+ */
+class NVSRouter {
+public:
+    static constexpr size_t MaxRoutes = 8;
+    static constexpr size_t NoRoute = std::numeric_limits<size_t>::max();
+    static constexpr nvs_handle_t InvalidHandle = std::numeric_limits<nvs_handle_t>::max();
+
+    NVSRouter();
+    /**
+     * Closes all handles opened by addRoute(partition, namespc)
+     */
+    ~NVSRouter();
+
+    NVSRouter(const NVSRouter&) = delete;
+    NVSRouter& operator=(const NVSRouter&) = delete;
+
+    /**
+     * @brief Initialize a partition and open a namespace in it for read/write access
+     * @return Index of the new route, NoRoute on errors
+     */
+    size_t addRoute(const char* partition, const char* namespc, bool allowReinit = true);
+
+    /**
+     * @brief Add a route for a handle which has already been opened, e.g. by InitializeNVS().
+     * The handle is not closed by the router.
+     * @param partition Label of the partition of nvs, used for statistics
+     */
+    size_t addRoute(nvs_handle_t nvs, const char* partition, const char* namespc);
+
+    /**
+     * @brief Route all values of a class to one route
+     */
+    bool assign(NVSStorageClass storageClass, size_t route);
+
+    /**
+     * @brief Distribute the values of a class over several routes by key hash
+     */
+    bool stripe(NVSStorageClass storageClass, std::initializer_list<size_t> routes);
+
+    /**
+     * @brief Route of a key. Classes without routes use the Default routes,
+     * and if it has none either, the first route.
+     * @return NoRoute if no route has been added
+     */
+    size_t routeFor(const char* key, NVSStorageClass storageClass = NVSStorageClass::Default) const;
+
+    /**
+     * @brief Handle of the route of a key
+     * @return InvalidHandle if no route has been added. Value classes treat it as uninitialized.
+     */
+    nvs_handle_t handleFor(const char* key, NVSStorageClass storageClass = NVSStorageClass::Default);
+
+    size_t routeCount() const { return _routeCount; }
+    nvs_handle_t handle(size_t route) const { return route < _routeCount ? _routes[route].nvs : InvalidHandle; }
+
+    /**
+     * @brief Utilization and erase estimate of the partition of a route.
+     * Queries nvs_get_stats() and reads the header of every page.
+     */
+    NVSPartitionStats stats(size_t route) const;
+
+private:
+    struct Route {
+        const char* partition;
+        const char* namespc;
+        nvs_handle_t nvs;
+        bool owned;
+        uint32_t routedKeys;
+    };
+
+    size_t AddRoute(nvs_handle_t nvs, const char* partition, const char* namespc, bool owned);
+
+    Route _routes[MaxRoutes];
+    size_t _routeCount;
+    /**
+     * Bit mask of the routes of each storage class
+     */
+    uint8_t _classRoutes[NVSStorageClassCount];
+};
@@ -0,0 +1,197 @@
+#pragma once
+#include <nvs.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+
+#include "NVSResult.hpp"
+
+/**
+ * @brief A member of a snapshot group struct and the key it is stored under
+ */
+struct NVSGroupField {
+    const char* key;
+    size_t offset;
+    size_t size;
+};
+
+/**
+ * @brief Describe member of Struct stored under key, e.g. NVS_GROUP_FIELD(PidGains, kp, "pidKp")
+ */
+#define NVS_GROUP_FIELD(Struct, member, key) NVSGroupField{key, offsetof(Struct, member), sizeof(Struct::member)}
+
+/**
+ * @brief Read all fields into data. Missing fields and fields of a different size keep their value in data.
+ * @return Number of fields which exist with the expected size
+ */
+size_t NVSReadGroupFields(nvs_handle_t nvs, const NVSGroupField* fields, size_t count, void* data);
+
+/**
+ * @brief Write the fields which differ between current and next, followed by a single commit
+ * @param written Number of fields written
+ */
+NVSSetResult NVSWriteGroupFields(nvs_handle_t nvs, const NVSGroupField* fields, size_t count,
+                                 const void* current, const void* next, size_t& written);
+
+/**
+ * @brief Block the calling task until readers is 0, yielding the CPU in between
+ */
+void NVSWaitForSnapshotReaders(const std::atomic<uint32_t>& readers);
+
+/**
+ * @brief Related settings which are read and updated together, e.g. PID gains.
+ *
+ * The members of S are stored under one key each, in the same format as
+ * NVSValue of the member type, so existing keys keep working. set() writes
+ * all changed members with a single commit and then publishes the new struct
+ * as one epoch. The struct is kept in two copies: a publish fills the
+ * inactive copy and then switches the index, so readers on other tasks never
+ * see a mix of old and new members. Readers never wait for a writer, even one
+ * which they preempted in the middle of a publish. A writer waits (yielding
+ * the CPU) until readers which are still copying the inactive copy are done.
+ *
+ * Writers are serialized by a mutex. NVS itself writes every key when it is
+ * set, so after a reset during set() a prefix of the changed members may be
+ * stored. Store S as a single NVSValue<S> if that must not happen.
+ *
+ * S must be trivially copyable, e.g. use char arrays instead of std::string.
+ * Instances are not linked for coherence with NVSValue instances of the same keys.
+ */
+template<typename S>
+class NVSSnapshotGroup {
+    static_assert(std::is_trivially_copyable_v<S>, "NVSSnapshotGroup requires a trivially copyable struct");
+
+public:
+    /**
+     * @param fields Field descriptions. They must outlive the group, e.g. a static array.
+     */
+    template<size_t N>
+    NVSSnapshotGroup(nvs_handle_t nvs, const NVSGroupField (&fields)[N], const S& defaults = S())
+        : NVSSnapshotGroup(nvs, fields, N, defaults) {}
+
+    NVSSnapshotGroup(nvs_handle_t nvs, const NVSGroupField* fields, size_t count, const S& defaults = S())
+        : nvs(nvs), _fields(fields), _count(count), _default(defaults), _active(0), _readers(), _copies{{defaults, 0}, {defaults, 0}} {
+        updateFromNVS();
+    }
+
+    NVSSnapshotGroup(const NVSSnapshotGroup&) = delete;
+    NVSSnapshotGroup& operator=(const NVSSnapshotGroup&) = delete;
+
+    /**
+     * @brief Consistent copy of all members
+     * @return Epoch of the copy, incremented by every publish
+     */
+    uint32_t read(S& out) const {
+        while(true) {
+            uint8_t index = _active.load();
+            _readers[index].fetch_add(1);
+            // A publish may have switched the index and started refilling this copy
+            // before it was marked as being read. Such a publish doesn't wait for
+            // this reader, so the copy is skipped and the new active one is taken.
+            if(_active.load() == index) {
+                memcpy(static_cast<void*>(&out), &_copies[index].data, sizeof(S));
+                uint32_t epoch = _copies[index].epoch;
+                _readers[index].fetch_sub(1);
+                return epoch;
+            }
+            _readers[index].fetch_sub(1);
+        }
+    }
+
+    S snapshot() const {
+        S out;
+        read(out);
+        return out;
+    }
+
+    /**
+     * @brief Epoch of the current members
+     */
+    uint32_t epoch() const {
+        S values;
+        return read(values);
+    }
+
+    /**
+     * @brief Write the changed members with one commit, then publish them together.
+     * If a write fails, nothing is published and a retry writes all changed members again.
+     */
+    NVSSetResult set(const S& values) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        return SetLocked(values);
+    }
+
+    /**
+     * @brief Modify a copy of the current members with fn(S&) and set() it.
+     * Concurrent updates are serialized, so none of them is lost.
+     */
+    template<typename Fn>
+    NVSSetResult update(Fn&& fn) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        S values = _copies[_active.load()].data;
+        fn(values);
+        return SetLocked(values);
+    }
+
+    /**
+     * @brief Read all members from NVS and publish them
+     */
+    void updateFromNVS() {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        S values = _default;
+        NVSReadGroupFields(nvs, _fields, _count, &values);
+        Publish(values);
+    }
+
+    nvs_handle_t nvs;
+
+private:
+    NVSSetResult SetLocked(const S& values) {
+        size_t written = 0;
+        NVSSetResult result = NVSWriteGroupFields(nvs, _fields, _count, &_copies[_active.load()].data, &values, written);
+        if(result == NVSSetResult::Updated) {
+            Publish(values);
+        }
+        return result;
+    }
+
+    /**
+     * Only called with _writeMutex held, so there is a single writer
+     */
+    void Publish(const S& values) {
+        uint8_t active = _active.load();
+        uint8_t inactive = active ^ 1;
+        NVSWaitForSnapshotReaders(_readers[inactive]);
+        memcpy(static_cast<void*>(&_copies[inactive].data), &values, sizeof(S));
+        _copies[inactive].epoch = _copies[active].epoch + 1;
+        _active.store(inactive);
+    }
+
+    struct Copy {
+        S data;
+        uint32_t epoch;
+    };
+
+    const NVSGroupField* _fields;
+    size_t _count;
+    S _default;
+    std::mutex _writeMutex;
+    // Index of the copy which readers take
+    std::atomic<uint8_t> _active;
+    // Readers currently copying each copy
+    mutable std::atomic<uint32_t> _readers[2];
+    Copy _copies[2];
+};
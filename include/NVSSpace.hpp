@@ -0,0 +1,288 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+
+#include <nvs.h>
+
+#include "NVSValueBase.hpp"
+#include "NVSWritePolicy.hpp"
+
+/**
+ * @brief How a value is encoded in NVS, which determines its entry footprint
+ */
+enum class NVSEntryEncoding : uint8_t {
+    /**
+     * Integer types written by nvs_set_u8() ... nvs_set_u64()
+     */
+    Primitive = 0,
+    /**
+     * nvs_set_str(). The null terminator is stored as well.
+     */
+    String = 1,
+    /**
+     * nvs_set_blob(), used by NVSValue<T> for all non-string types
+     */
+    Blob = 2
+};
+
+/**
+ * Number of 32 byte entries of one NVS page
+ */
+constexpr size_t NVSEntriesPerPage = 126;
+
+/**
+ * @brief Number of 32 byte entries a value of the given size occupies in NVS.
+ *
+ * Strings occupy a header entry plus their data. Blobs occupy an index entry
+ * and one header entry per chunk; a chunk holds at most one page of data.
+ */
+size_t NVSEntryFootprint(NVSEntryEncoding encoding, size_t size);
+
+/**
+ * @brief Estimated footprint of a value based on its descriptor.
+ * Strings are counted as NVS strings, all other kinds as blobs.
+ */
+size_t NVSEntryFootprint(const NVSValueBase& value);
+
+/**
+ * @brief Footprint of a value of type T as written by NVSValue<T>
+ */
+template<typename T>
+size_t NVSEntryFootprintOf(const T&) {
+    return NVSEntryFootprint(NVSEntryEncoding::Blob, sizeof(T));
+}
+
+template<typename Traits, typename Alloc>
+size_t NVSEntryFootprintOf(const std::basic_string<char, Traits, Alloc>& value) {
+    return NVSEntryFootprint(NVSEntryEncoding::String, value.size());
+}
+
+/**
+ * @brief Importance of a value when the partition runs out of space.
+ * Lower priorities are throttled first.
+ */
+enum class NVSWritePriority : uint8_t {
+    /**
+     * Logs, statistics and other data which can be lost
+     */
+    Bulk = 0,
+    Normal = 1,
+    /**
+     * Settings which must always fit, e.g. credentials or calibration
+     */
+    Critical = 2
+};
+
+constexpr size_t NVSWritePriorityCount = 3;
+
+const char* NVSWritePriorityToString(NVSWritePriority priority);
+
+/**
+ * @brief Decision of NVSSpaceMonitor::admit()
+ */
+enum class NVSAdmission : uint8_t {
+    Admit = 0,
+    /**
+     * Free space is below the defer threshold of the priority. Retry later.
+     */
+    Defer = 1,
+    /**
+     * Free space is below the reject threshold of the priority, or the value does not fit at all
+     */
+    Reject = 2
+};
+
+const char* NVSAdmissionToString(NVSAdmission admission);
+
+/**
+ * @brief Free space which must remain after a write, in percent of the usable entries.
+ *
+ * The defaults keep the last 25% of the partition free of bulk data and
+ * the last 10% for critical values.
+ */
+struct NVSSpaceThresholds {
+    /**
+     * Writes which would leave less free space are deferred, indexed by NVSWritePriority
+     */
+    uint8_t deferBelowPercent[NVSWritePriorityCount] = {25, 10, 0};
+    /**
+     * Writes which would leave less free space are rejected, indexed by NVSWritePriority
+     */
+    uint8_t rejectBelowPercent[NVSWritePriorityCount] = {10, 5, 0};
+};
+
+/**
+ * @brief Entry usage of a partition
+ */
+struct NVSSpaceUsage {
+    size_t totalEntries;
+    size_t usedEntries;
+    /**
+     * Entries which can still be written. Erased entries are included since
+     * garbage collection reclaims them, the page reserved for garbage collection is not.
+     */
+    size_t headroomEntries;
+    size_t namespaceCount;
+};
+
+/**
+ * @brief Capacity forecast based on the growth of used entries since the last reset
+ */
+struct NVSSpaceForecast {
+    /**
+     * Net growth of used entries per hour. Negative if values have been erased.
+     */
+    int32_t netEntriesPerHour;
+    /**
+     * Entries written per hour through admitted writes, including rewrites of existing values
+     */
+    uint32_t writtenEntriesPerHour;
+    /**
+     * Hours until no headroom is left, UINT32_MAX if usage does not grow
+     */
+    uint32_t hoursUntilFull;
+    /**
+     * Hours until writes of each priority are deferred, UINT32_MAX if usage does not grow
+     */
+    uint32_t hoursUntilDeferred[NVSWritePriorityCount];
+};
+
+/**
+ * @brief Tracks the free entries of one NVS partition and admits writes by priority.
+ *
+ * nvs_get_stats() only evaluates the page counters held in RAM, but it still
+ * walks all pages, so it is called at most once per refresh interval.
+ * In between, admitted writes are accounted locally.
+ *
+ * All methods are thread-safe, so one monitor can be shared by all values of a partition.
+ */
+class NVSSpaceMonitor {
+public:
+    /**
+     * @param partition Partition label, nullptr for the default "nvs" partition
+     * @param refreshIntervalMs Minimum time between two calls to nvs_get_stats()
+     */
+    NVSSpaceMonitor(const char* partition = nullptr, uint32_t refreshIntervalMs = 1000,
+                    const NVSSpaceThresholds& thresholds = NVSSpaceThresholds());
+
+    NVSSpaceMonitor(const NVSSpaceMonitor&) = delete;
+    NVSSpaceMonitor& operator=(const NVSSpaceMonitor&) = delete;
+
+    /**
+     * @brief Read the entry counters of the partition now
+     */
+    esp_err_t refresh();
+
+    /**
+     * @brief Current usage. Refreshed if the refresh interval has elapsed.
+     */
+    NVSSpaceUsage usage();
+
+    /**
+     * @brief Decide whether a write of the given number of entries is allowed.
+     * This does not account the write, see account().
+     */
+    NVSAdmission admit(size_t entries, NVSWritePriority priority);
+
+    /**
+     * @brief Account a write until the next refresh.
+     * @param writtenEntries Entries of the new value
+     * @param releasedEntries Entries of the previous value, which are erased by the write
+     */
+    void account(size_t writtenEntries, size_t releasedEntries);
+
+    /**
+     * @brief Number of additional values of the given footprint which would still be admitted
+     */
+    size_t capacityFor(size_t entriesPerValue, NVSWritePriority priority);
+
+    NVSSpaceForecast forecast();
+
+    /**
+     * @brief Restart the forecast window at the current usage
+     */
+    void resetForecast();
+
+    const NVSSpaceThresholds& thresholds() const { return _thresholds; }
+    void setThresholds(const NVSSpaceThresholds& thresholds);
+
+private:
+    void RefreshIfStale();
+    esp_err_t Refresh();
+    size_t UsableEntries() const;
+    /**
+     * Headroom which corresponds to a threshold percentage
+     */
+    size_t ThresholdEntries(uint8_t percent) const;
+
+    std::mutex _mutex;
+    std::string _partition;
+    uint32_t _refreshIntervalMs;
+    NVSSpaceThresholds _thresholds;
+    NVSSpaceUsage _usage;
+    bool _valid;
+    uint32_t _refreshedMs;
+    uint32_t _forecastStartMs;
+    size_t _forecastStartUsed;
+    uint32_t _forecastWritten;
+};
+
+/**
+ * @brief Write policy which admits writes by free space and priority.
+ *
+ * Writes admitted by the monitor are written immediately. Deferred writes
+ * (NVSSetResult::Deferred) are held in RAM and written by poll() once enough
+ * space is available, e.g. after bulk data has been erased. Rejected writes
+ * return NVSSetResult::NoSpace and leave the cached value unchanged.
+ *
+ * Example:
+ *   NVSSpaceMonitor space;
+ *   NVSValue<LogBuffer, NVSSpaceWritePolicy> log(nvs, "log", {}, NVSSpaceWritePolicy(space, NVSWritePriority::Bulk));
+ */
+class NVSSpaceWritePolicy {
+public:
+    NVSSpaceWritePolicy() : monitor(nullptr), priority(NVSWritePriority::Normal) {}
+    NVSSpaceWritePolicy(NVSSpaceMonitor& monitor, NVSWritePriority priority = NVSWritePriority::Normal)
+        : monitor(&monitor), priority(priority) {}
+
+    template<typename Value, typename T>
+    NVSWriteDecision evaluate(Value& value, const T& current, const T& candidate) {
+        _writtenEntries = NVSEntryFootprintOf(candidate);
+        _releasedEntries = value.exists() ? NVSEntryFootprintOf(current) : 0;
+        if(monitor == nullptr) {
+            return NVSWriteDecision::Write;
+        }
+        // The new value is written before the previous one is erased,
+        // so even a rewrite needs room for the complete new value.
+        switch(monitor->admit(_writtenEntries, priority)) {
+            case NVSAdmission::Admit:
+                return NVSWriteDecision::Write;
+            case NVSAdmission::Defer:
+                return NVSWriteDecision::Defer;
+            default:
+                return NVSWriteDecision::Reject;
+        }
+    }
+
+    template<typename Value>
+    bool mayFlush(Value&) {
+        return monitor == nullptr || monitor->admit(_writtenEntries, priority) == NVSAdmission::Admit;
+    }
+
+    template<typename Value>
+    void onWritten(Value&) {
+        if(monitor != nullptr) {
+            monitor->account(_writtenEntries, _releasedEntries);
+        }
+    }
+
+    NVSSpaceMonitor* monitor;
+    NVSWritePriority priority;
+
+private:
+    size_t _writtenEntries = 0;
+    size_t _releasedEntries = 0;
+};
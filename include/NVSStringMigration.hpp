@@ -0,0 +1,138 @@
+#pragma once
+#include <nvs.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "NVSUtils.hpp"
+
+/**
+ * @brief State of one key during NVSStringMigrator::step()
+ */
+enum class NVSStringMigrationState : uint8_t {
+    /**
+     * Not scanned yet
+     */
+    Unknown = 0,
+    /**
+     * Stored in the preferred format, or not stored at all
+     */
+    Matching = 1,
+    /**
+     * Stored in the other format, waiting to be rewritten
+     */
+    Pending = 2,
+    Migrated = 3,
+    /**
+     * Can't be stored in the preferred format, e.g. a blob with null bytes
+     * which would have to become an NVS string
+     */
+    Incompatible = 4,
+    /**
+     * Could not be rewritten, retried by the next scan of the namespace
+     */
+    Failed = 5
+};
+
+const char* NVSStringMigrationStateToString(NVSStringMigrationState state);
+
+/**
+ * @brief A key to migrate and the storage format its reading class looks up first.
+ *
+ * NVSValue<std::string> prefers NVSStringStoragePreference::PreferString,
+ * NVSStringValue and NVSLazyValue<std::string> prefer PreferBlob.
+ */
+struct NVSStringMigrationKey {
+    const char* key;
+    NVSStringStoragePreference preference;
+    NVSStringMigrationState state = NVSStringMigrationState::Unknown;
+};
+
+/**
+ * @brief Progress of an NVSStringMigrator
+ */
+struct NVSStringMigrationProgress {
+    size_t total;
+    /**
+     * Keys which still need to be rewritten
+     */
+    size_t pending;
+    size_t migrated;
+    size_t incompatible;
+    size_t failed;
+    /**
+     * Failed lookups saved by every read of all migrated keys, i.e. migrated.
+     * Each read of a key in the wrong format first probes the preferred format.
+     */
+    size_t probesSavedPerRead;
+    /**
+     * Whether the namespace has been scanned and no key is pending
+     */
+    bool done;
+};
+
+/**
+ * @brief Rewrites string-like keys stored in the format their reading class does not prefer.
+ *
+ * NVSReadStringValue() looks up the preferred format first, so every read of
+ * a key in the other format costs a failed lookup. The migrator finds these
+ * keys with one iteration over the namespace and rewrites them in small
+ * batches, e.g. from an idle task, with one commit per batch.
+ *
+ * Each key is read, saved to a journal key, erased and written in the
+ * preferred format before the journal is erased. If power is lost in between,
+ * the next step() completes the interrupted migration from the journal.
+ *
+ * The migrator does not allocate besides the temporary copy of the value being
+ * migrated. The key array is provided and owned by the caller.
+ */
+class NVSStringMigrator {
+public:
+    /**
+     * Key of the journal entry in the migrated namespace
+     */
+    static constexpr const char* JournalKey = "_nvsv_strmig";
+
+    /**
+     * @param nvs Handle of the namespace, opened read/write
+     * @param partition Partition label, used for the scan
+     * @param namespc Namespace name of nvs, used for the scan
+     */
+    NVSStringMigrator(nvs_handle_t nvs, const char* partition, const char* namespc, NVSStringMigrationKey* keys, size_t count);
+
+    template<size_t N>
+    NVSStringMigrator(nvs_handle_t nvs, const char* partition, const char* namespc, NVSStringMigrationKey (&keys)[N])
+        : NVSStringMigrator(nvs, partition, namespc, keys, N) {}
+
+    NVSStringMigrator(const NVSStringMigrator&) = delete;
+    NVSStringMigrator& operator=(const NVSStringMigrator&) = delete;
+
+    /**
+     * @brief Do a bounded amount of migration work.
+     *
+     * The first call recovers an interrupted migration and scans the namespace.
+     * Every call rewrites at most maxKeys pending keys and commits once.
+     * A key which can't be rewritten after it has been erased ends the batch,
+     * it is restored from the journal by the next call.
+     * Failed keys are retried whenever the namespace is scanned again, i.e.
+     * after such an interruption or by a new migrator over the same keys.
+     */
+    NVSStringMigrationProgress step(size_t maxKeys = 4);
+
+    NVSStringMigrationProgress progress() const;
+
+    bool done() const { return progress().done; }
+
+private:
+    esp_err_t Recover();
+    NVSQueryResult Scan();
+    NVSStringMigrationState Migrate(NVSStringMigrationKey& entry);
+    esp_err_t Write(const char* key, NVSStringStoragePreference preference, const std::string& value);
+
+    nvs_handle_t _nvs;
+    const char* _partition;
+    const char* _namespace;
+    NVSStringMigrationKey* _keys;
+    size_t _count;
+    bool _scanned;
+};
@@ -2,7 +2,9 @@
 #include <nvs.h>
 #include <string>
 
+#include "NVSCoherence.hpp"
 #include "NVSResult.hpp"
+#include "NVSValueBase.hpp"
 
 /**
  * @brief Abstraction for binary value, represented by a std::string stored in ESP NVS
@@ -10,7 +12,7 @@
  * 
  * This class will only update the NVS value if the given value has actually been changed.
  */
-class NVSStringValue {
+class NVSStringValue : public NVSValueBase, public NVSCoherenceLink<NVSStringValue> {
 public:
     /**
      * Empty default constructor.
@@ -29,9 +31,18 @@ public:
      */
     NVSStringValue(nvs_handle_t nvs, const std::string& key, const std::string& defaultValue="");
 
-    const std::string& key() const;
+    ~NVSStringValue();
+
+    const std::string& key() const override;
     const std::string& value() const;
 
+    /**
+     * @brief Return the stored string value unchanged.
+     */
+    std::string asString() const override;
+    NVSValueDescriptor descriptor() const override;
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override;
+
     /**
      * @brief Equivalent to .value().c_str()
      * 
@@ -47,7 +58,7 @@ public:
      * @return true 
      * @return false 
      */
-    inline bool exists() const { return _exists; }
+    inline bool exists() const override { return _exists; }
 
     /**
      * @brief Read the value from the NVS storage
@@ -92,4 +103,10 @@ public:
     // This is not automatically written
     std::string _default;
     bool _exists;
+
+private:
+    friend class NVSCoherenceLink<NVSStringValue>;
+
+    void ApplyPeerWrite(const void* data, size_t size);
+    bool CachedPeerValue(const void*& data, size_t& size) const;
 };
\ No newline at end of file
@@ -0,0 +1,362 @@
+#pragma once
+#include <nvs.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include "NVSLog.hpp"
+#include "NVSResult.hpp"
+#include "NVSTrace.hpp"
+#include "NVSUtils.hpp"
+
+/**
+ * @brief Cache statistics of an NVSTable
+ */
+struct NVSTableStats {
+    /**
+     * Keys which exist in NVS
+     */
+    size_t present;
+    /**
+     * Entries currently held in the cache
+     */
+    size_t resident;
+    uint32_t hits;
+    /**
+     * Reads of existing keys which had to access flash
+     */
+    uint32_t misses;
+    uint32_t evictions;
+};
+
+/**
+ * @brief Keyed collection of up to MaxKeys values of type T, e.g. per-sensor calibration.
+ *
+ * Entry i is stored as a blob under the key prefix followed by i in decimal,
+ * e.g. "cal0" ... "cal499". Instead of one object per entry, the table keeps
+ * - a presence bitmap (one bit per key), built by one walk over the namespace
+ *   at construction, so lookups of missing keys never access flash
+ * - an index of the cache slot of each key
+ * - CacheSlots decoded entries, replacing the least recently used one on a miss
+ *
+ * get(), set() and contains() are O(1) for resident entries. forEach() streams
+ * over all existing entries without disturbing the cache.
+ *
+ * T must be trivially copyable. The table is not thread-safe.
+ */
+template<typename T, size_t MaxKeys, size_t CacheSlots = 8>
+class NVSTable {
+    static_assert(std::is_trivially_copyable_v<T>, "NVSTable requires a trivially copyable type");
+    static_assert(MaxKeys > 0 && CacheSlots > 0, "NVSTable requires at least one key and one cache slot");
+    static_assert(CacheSlots <= MaxKeys, "NVSTable has more cache slots than keys");
+
+public:
+    typedef std::conditional_t<CacheSlots < 0xFF, uint8_t, uint16_t> SlotIndex;
+
+    static constexpr size_t MaxPrefixLength = NVS_KEY_NAME_MAX_SIZE - 1 - (
+        MaxKeys <= 10 ? 1 : MaxKeys <= 100 ? 2 : MaxKeys <= 1000 ? 3 : MaxKeys <= 10000 ? 4 : 5);
+
+    /**
+     * @brief Build the presence bitmap of the table.
+     * @param nvs Handle of the namespace, opened read/write
+     * @param partition Partition label of the handle, e.g. NVS_DEFAULT_PART_NAME
+     * @param namespc Namespace name of the handle
+     * @param prefix Key prefix of up to MaxPrefixLength characters. It must not
+     *               be shared with other keys of the namespace ending in digits.
+     * @param defaultValue Value of keys which don't exist
+     */
+    NVSTable(nvs_handle_t nvs, const char* partition, const char* namespc, const char* prefix, const T& defaultValue = T())
+        : nvs(nvs), _prefix(prefix), _default(defaultValue), _present(), _slotOf(), _slots(), _useClock(0), _stats() {
+        if(_prefix.size() > MaxPrefixLength) {
+            NVSCriticalPrintf("Table key prefix %s is longer than %d characters", prefix, MaxPrefixLength);
+            this->nvs = std::numeric_limits<nvs_handle_t>::max();
+            return;
+        }
+        NVSForEachEntry(partition, namespc, NVS_TYPE_BLOB, [this](const nvs_entry_info_t& info) {
+            size_t index;
+            if(ParseKey(info.key, index)) {
+                SetPresent(index, true);
+            }
+            return true;
+        });
+        NVSDebugPrintf("Table %s has %d of %d keys", prefix, _stats.present, MaxKeys);
+    }
+
+    NVSTable(const NVSTable&) = delete;
+    NVSTable& operator=(const NVSTable&) = delete;
+
+    static constexpr size_t capacity() { return MaxKeys; }
+
+    /**
+     * @brief Number of keys which exist in NVS
+     */
+    size_t size() const { return _stats.present; }
+
+    /**
+     * @brief Whether entry index exists in NVS. Never accesses flash.
+     */
+    bool contains(size_t index) const {
+        return index < MaxKeys && (_present[index / 32] & (1u << (index % 32))) != 0;
+    }
+
+    /**
+     * @brief Whether entry index is held in the cache
+     */
+    bool resident(size_t index) const {
+        return index < MaxKeys && _slotOf[index] != 0;
+    }
+
+    /**
+     * @brief NVS key of entry index
+     */
+    std::string key(size_t index) const {
+        char buffer[NVS_KEY_NAME_MAX_SIZE];
+        FormatKey(index, buffer);
+        return std::string(buffer);
+    }
+
+    /**
+     * @brief Value of entry index, or the default if it doesn't exist or can't be read
+     */
+    T get(size_t index) {
+        const Slot* slot = Lookup(index);
+        return slot != nullptr ? slot->value : _default;
+    }
+
+    /**
+     * @brief Write entry index. The write is skipped if the value is unchanged.
+     */
+    NVSSetResult set(size_t index, const T& value) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        if(index >= MaxKeys) {
+            NVSErrorPrintf("Index %d out of range for table %s", index, _prefix.c_str());
+            return NVSSetResult::Error;
+        }
+        Slot* slot = Lookup(index);
+        if(slot != nullptr && memcmp(&slot->value, &value, sizeof(T)) == 0) {
+            return NVSSetResult::Unchanged;
+        }
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        FormatKey(index, key);
+        esp_err_t err;
+        if((err = NVSFlashSetBlob(nvs, key, static_cast<const void*>(&value), sizeof(T))) != ESP_OK) {
+            NVSCriticalPrintf("Failed to write NVS key %s: %s", key, esp_err_to_name(err));
+            return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+        NVSFlashCommit(nvs, key);
+        SetPresent(index, true);
+        if(slot == nullptr) {
+            slot = Allocate(index);
+        }
+        slot->value = value;
+        return NVSSetResult::Updated;
+    }
+
+    /**
+     * @brief Erase entry index from NVS and the cache
+     */
+    esp_err_t erase(size_t index) {
+        if(!contains(index)) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        FormatKey(index, key);
+        esp_err_t err = NVSFlashEraseKey(nvs, key);
+        if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            NVSErrorPrintf("Failed to erase NVS key %s: %s", key, esp_err_to_name(err));
+            return err;
+        }
+        NVSFlashCommit(nvs, key);
+        SetPresent(index, false);
+        Evict(index);
+        return ESP_OK;
+    }
+
+    /**
+     * @brief Call callback(index, value) for every existing entry in ascending order.
+     *
+     * Resident entries are taken from the cache, all others are read into a
+     * single temporary and are not cached. Return false from the callback to stop.
+     *
+     * @return Number of entries visited
+     */
+    template<typename Callback>
+    size_t forEach(Callback&& callback) {
+        size_t visited = 0;
+        T value;
+        for(size_t word = 0; word < BitmapWords; word++) {
+            for(uint32_t bits = _present[word]; bits != 0; bits &= bits - 1) {
+                size_t index = word * 32 + static_cast<size_t>(__builtin_ctz(bits));
+                if(_slotOf[index] != 0) {
+                    value = _slots[_slotOf[index] - 1].value;
+                } else if(!Read(index, value)) {
+                    continue;
+                }
+                visited++;
+                if(!callback(index, static_cast<const T&>(value))) {
+                    return visited;
+                }
+            }
+        }
+        return visited;
+    }
+
+    /**
+     * @brief Drop all cached entries. The presence bitmap is kept.
+     */
+    void clearCache() {
+        for(size_t i = 0; i < CacheSlots; i++) {
+            if(_slots[i].used) {
+                _slotOf[_slots[i].index] = 0;
+                _slots[i].used = false;
+            }
+        }
+        _stats.resident = 0;
+    }
+
+    const NVSTableStats& stats() const { return _stats; }
+
+    nvs_handle_t nvs;
+
+private:
+    struct Slot {
+        T value;
+        uint32_t lastUse;
+        uint16_t index;
+        bool used;
+    };
+
+    static constexpr size_t BitmapWords = (MaxKeys + 31) / 32;
+    static_assert(MaxKeys <= 0xFFFF, "NVSTable supports at most 65535 keys");
+
+    void FormatKey(size_t index, char* buffer) const {
+        snprintf(buffer, NVS_KEY_NAME_MAX_SIZE, "%s%u", _prefix.c_str(), static_cast<unsigned>(index));
+    }
+
+    /**
+     * Accepts exactly the keys produced by FormatKey()
+     */
+    bool ParseKey(const char* key, size_t& index) const {
+        if(strncmp(key, _prefix.c_str(), _prefix.size()) != 0) {
+            return false;
+        }
+        const char* digits = key + _prefix.size();
+        if(digits[0] < '0' || digits[0] > '9' || (digits[0] == '0' && digits[1] != '\0')) {
+            return false;
+        }
+        index = 0;
+        for(; *digits != '\0'; digits++) {
+            if(*digits < '0' || *digits > '9') {
+                return false;
+            }
+            index = index * 10 + static_cast<size_t>(*digits - '0');
+            if(index >= MaxKeys) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void SetPresent(size_t index, bool present) {
+        uint32_t bit = 1u << (index % 32);
+        bool wasPresent = (_present[index / 32] & bit) != 0;
+        if(present && !wasPresent) {
+            _present[index / 32] |= bit;
+            _stats.present++;
+        } else if(!present && wasPresent) {
+            _present[index / 32] &= ~bit;
+            _stats.present--;
+        }
+    }
+
+    bool Read(size_t index, T& value) const {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        FormatKey(index, key);
+        size_t size = sizeof(T);
+        esp_err_t err = NVSFlashGetBlob(nvs, key, static_cast<void*>(&value), &size);
+        if(err != ESP_OK || size != sizeof(T)) {
+            NVSWarningPrintf("Failed to read NVS key %s: %s", key, err != ESP_OK ? esp_err_to_name(err) : "size mismatch");
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Cached slot of an existing entry, loading it on a miss.
+     * nullptr if the entry doesn't exist or can't be read.
+     */
+    Slot* Lookup(size_t index) {
+        if(!contains(index)) {
+            return nullptr;
+        }
+        if(_slotOf[index] != 0) {
+            Slot* slot = &_slots[_slotOf[index] - 1];
+            slot->lastUse = ++_useClock;
+            _stats.hits++;
+            return slot;
+        }
+        _stats.misses++;
+        T value;
+        if(!Read(index, value)) {
+            return nullptr;
+        }
+        Slot* slot = Allocate(index);
+        slot->value = value;
+        return slot;
+    }
+
+    /**
+     * Slot for a non-resident entry: a free one or the least recently used one
+     */
+    Slot* Allocate(size_t index) {
+        Slot* slot = nullptr;
+        for(size_t i = 0; i < CacheSlots && slot == nullptr; i++) {
+            if(!_slots[i].used) {
+                slot = &_slots[i];
+            }
+        }
+        if(slot == nullptr) {
+            slot = &_slots[0];
+            for(size_t i = 1; i < CacheSlots; i++) {
+                if(_slots[i].lastUse < slot->lastUse) {
+                    slot = &_slots[i];
+                }
+            }
+            _slotOf[slot->index] = 0;
+            _stats.evictions++;
+        } else {
+            _stats.resident++;
+        }
+        slot->used = true;
+        slot->index = static_cast<uint16_t>(index);
+        slot->lastUse = ++_useClock;
+        _slotOf[index] = static_cast<SlotIndex>(slot - _slots + 1);
+        return slot;
+    }
+
+    void Evict(size_t index) {
+        if(_slotOf[index] != 0) {
+            _slots[_slotOf[index] - 1].used = false;
+            _slotOf[index] = 0;
+            _stats.resident--;
+        }
+    }
+
+    std::string _prefix;
+    T _default;
+    uint32_t _present[BitmapWords];
+    /**
+     * Cache slot of each entry plus one, 0 if it is not resident
+     */
+    SlotIndex _slotOf[MaxKeys];
+    Slot _slots[CacheSlots];
+    uint32_t _useClock;
+    NVSTableStats _stats;
+};
@@ -0,0 +1,285 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#if __has_include("sdkconfig.h")
+#include "sdkconfig.h"
+#endif
+
+#ifndef CONFIG_ESPNVSVALUE_TRACE
+#define CONFIG_ESPNVSVALUE_TRACE 0
+#endif
+
+/**
+ * @brief Kind of flash operation reported to the trace hooks
+ */
+enum class NVSTraceOp : uint8_t {
+    /**
+     * nvs_get_*() reading a value
+     */
+    Read = 0,
+    /**
+     * nvs_get_*() only querying the size or existence of a value
+     */
+    Probe = 1,
+    /**
+     * nvs_set_*()
+     */
+    Write = 2,
+    Commit = 3,
+    /**
+     * nvs_erase_key(), nvs_flash_erase()
+     */
+    Erase = 4,
+    /**
+     * A complete iteration over NVS entries
+     */
+    Iterate = 5,
+    /**
+     * nvs_flash_init(), nvs_open()
+     */
+    Open = 6
+};
+
+constexpr size_t NVSTraceOpCount = 7;
+
+const char* NVSTraceOpToString(NVSTraceOp op);
+
+/**
+ * @brief Called before every flash operation of this library.
+ *
+ * By default, these hooks are weakly linked to empty functions.
+ * You can specify your own functions to forward the events,
+ * e.g. to SystemView or a host trace file.
+ * The hooks are only called if CONFIG_ESPNVSVALUE_TRACE is enabled.
+ *
+ * @param key Key or namespace the operation refers to, may be nullptr (e.g. for commits)
+ * @param bytes Payload size for writes, buffer size for reads, 0 otherwise
+ */
+void NVSTraceBegin(NVSTraceOp op, const char* key, size_t bytes);
+
+/**
+ * @brief Called after every flash operation of this library.
+ * @param bytes Number of payload bytes read or written
+ * @param result Result of the ESP-IDF call
+ */
+void NVSTraceEnd(NVSTraceOp op, const char* key, size_t bytes, esp_err_t result);
+
+/**
+ * @brief Latency distribution of one operation kind.
+ *
+ * Percentiles are taken from a log-linear histogram and are accurate to 25%.
+ */
+struct NVSLatencySummary {
+    uint32_t count;
+    uint32_t p50Us;
+    uint32_t p99Us;
+    uint32_t maxUs;
+};
+
+/**
+ * @brief Latency of all traced operations of the given kind since boot or the last reset.
+ * All fields are 0 if tracing is disabled.
+ */
+NVSLatencySummary NVSTraceLatency(NVSTraceOp op);
+void NVSTraceResetLatency();
+
+/**
+ * @brief Microsecond clock used for latency measurement.
+ * By default, this is weakly linked to esp_timer_get_time().
+ */
+int64_t NVSTraceMicros();
+
+#if CONFIG_ESPNVSVALUE_TRACE
+void NVSTraceRecordLatency(NVSTraceOp op, uint32_t microseconds);
+
+/**
+ * @brief Traces the enclosing scope as one operation
+ */
+class NVSTraceScope {
+public:
+    NVSTraceScope(NVSTraceOp op, const char* key, size_t bytes = 0)
+        : _op(op), _key(key), _bytes(0), _result(ESP_OK), _start(NVSTraceMicros()) {
+        NVSTraceBegin(op, key, bytes);
+    }
+
+    ~NVSTraceScope() {
+        NVSTraceRecordLatency(_op, static_cast<uint32_t>(NVSTraceMicros() - _start));
+        NVSTraceEnd(_op, _key, _bytes, _result);
+    }
+
+    NVSTraceScope(const NVSTraceScope&) = delete;
+    NVSTraceScope& operator=(const NVSTraceScope&) = delete;
+
+    /**
+     * @brief Set the byte count and result reported to NVSTraceEnd()
+     * @return result, for chaining
+     */
+    esp_err_t finish(size_t bytes, esp_err_t result) {
+        _bytes = bytes;
+        _result = result;
+        return result;
+    }
+
+private:
+    NVSTraceOp _op;
+    const char* _key;
+    size_t _bytes;
+    esp_err_t _result;
+    int64_t _start;
+};
+#else
+class NVSTraceScope {
+public:
+    NVSTraceScope(NVSTraceOp, const char*, size_t = 0) {}
+    esp_err_t finish(size_t, esp_err_t result) { return result; }
+};
+#endif
+
+/*
+ * Traced wrappers for the ESP-IDF NVS functions used by this library.
+ * They are plain forwarding calls if CONFIG_ESPNVSVALUE_TRACE is disabled.
+ */
+
+inline esp_err_t NVSFlashGetBlob(nvs_handle_t nvs, const char* key, void* out, size_t* size) {
+    NVSTraceScope scope(out != nullptr ? NVSTraceOp::Read : NVSTraceOp::Probe, key, out != nullptr ? *size : 0);
+    esp_err_t err = nvs_get_blob(nvs, key, out, size);
+    return scope.finish(err == ESP_OK && out != nullptr ? *size : 0, err);
+}
+
+inline esp_err_t NVSFlashGetStr(nvs_handle_t nvs, const char* key, char* out, size_t* size) {
+    NVSTraceScope scope(out != nullptr ? NVSTraceOp::Read : NVSTraceOp::Probe, key, out != nullptr ? *size : 0);
+    esp_err_t err = nvs_get_str(nvs, key, out, size);
+    return scope.finish(err == ESP_OK && out != nullptr ? *size : 0, err);
+}
+
+inline esp_err_t NVSFlashGetU8(nvs_handle_t nvs, const char* key, uint8_t* out) {
+    NVSTraceScope scope(NVSTraceOp::Read, key, sizeof(uint8_t));
+    esp_err_t err = nvs_get_u8(nvs, key, out);
+    return scope.finish(err == ESP_OK ? sizeof(uint8_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashGetI8(nvs_handle_t nvs, const char* key, int8_t* out) {
+    NVSTraceScope scope(NVSTraceOp::Read, key, sizeof(int8_t));
+    esp_err_t err = nvs_get_i8(nvs, key, out);
+    return scope.finish(err == ESP_OK ? sizeof(int8_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashGetU16(nvs_handle_t nvs, const char* key, uint16_t* out) {
+    NVSTraceScope scope(NVSTraceOp::Read, key, sizeof(uint16_t));
+    esp_err_t err = nvs_get_u16(nvs, key, out);
+    return scope.finish(err == ESP_OK ? sizeof(uint16_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashGetI16(nvs_handle_t nvs, const char* key, int16_t* out) {
+    NVSTraceScope scope(NVSTraceOp::Read, key, sizeof(int16_t));
+    esp_err_t err = nvs_get_i16(nvs, key, out);
+    return scope.finish(err == ESP_OK ? sizeof(int16_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashGetU32(nvs_handle_t nvs, const char* key, uint32_t* out) {
+    NVSTraceScope scope(NVSTraceOp::Read, key, sizeof(uint32_t));
+    esp_err_t err = nvs_get_u32(nvs, key, out);
+    return scope.finish(err == ESP_OK ? sizeof(uint32_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashGetI32(nvs_handle_t nvs, const char* key, int32_t* out) {
+    NVSTraceScope scope(NVSTraceOp::Read, key, sizeof(int32_t));
+    esp_err_t err = nvs_get_i32(nvs, key, out);
+    return scope.finish(err == ESP_OK ? sizeof(int32_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashGetU64(nvs_handle_t nvs, const char* key, uint64_t* out) {
+    NVSTraceScope scope(NVSTraceOp::Read, key, sizeof(uint64_t));
+    esp_err_t err = nvs_get_u64(nvs, key, out);
+    return scope.finish(err == ESP_OK ? sizeof(uint64_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashGetI64(nvs_handle_t nvs, const char* key, int64_t* out) {
+    NVSTraceScope scope(NVSTraceOp::Read, key, sizeof(int64_t));
+    esp_err_t err = nvs_get_i64(nvs, key, out);
+    return scope.finish(err == ESP_OK ? sizeof(int64_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashSetBlob(nvs_handle_t nvs, const char* key, const void* value, size_t size) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, size);
+    esp_err_t err = nvs_set_blob(nvs, key, value, size);
+    return scope.finish(err == ESP_OK ? size : 0, err);
+}
+
+inline esp_err_t NVSFlashSetStr(nvs_handle_t nvs, const char* key, const char* value) {
+    size_t size = CONFIG_ESPNVSVALUE_TRACE ? strlen(value) + 1 : 0;
+    NVSTraceScope scope(NVSTraceOp::Write, key, size);
+    esp_err_t err = nvs_set_str(nvs, key, value);
+    return scope.finish(err == ESP_OK ? size : 0, err);
+}
+
+inline esp_err_t NVSFlashSetU8(nvs_handle_t nvs, const char* key, uint8_t value) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, sizeof(uint8_t));
+    esp_err_t err = nvs_set_u8(nvs, key, value);
+    return scope.finish(err == ESP_OK ? sizeof(uint8_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashSetI8(nvs_handle_t nvs, const char* key, int8_t value) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, sizeof(int8_t));
+    esp_err_t err = nvs_set_i8(nvs, key, value);
+    return scope.finish(err == ESP_OK ? sizeof(int8_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashSetU16(nvs_handle_t nvs, const char* key, uint16_t value) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, sizeof(uint16_t));
+    esp_err_t err = nvs_set_u16(nvs, key, value);
+    return scope.finish(err == ESP_OK ? sizeof(uint16_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashSetI16(nvs_handle_t nvs, const char* key, int16_t value) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, sizeof(int16_t));
+    esp_err_t err = nvs_set_i16(nvs, key, value);
+    return scope.finish(err == ESP_OK ? sizeof(int16_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashSetU32(nvs_handle_t nvs, const char* key, uint32_t value) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, sizeof(uint32_t));
+    esp_err_t err = nvs_set_u32(nvs, key, value);
+    return scope.finish(err == ESP_OK ? sizeof(uint32_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashSetI32(nvs_handle_t nvs, const char* key, int32_t value) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, sizeof(int32_t));
+    esp_err_t err = nvs_set_i32(nvs, key, value);
+    return scope.finish(err == ESP_OK ? sizeof(int32_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashSetU64(nvs_handle_t nvs, const char* key, uint64_t value) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, sizeof(uint64_t));
+    esp_err_t err = nvs_set_u64(nvs, key, value);
+    return scope.finish(err == ESP_OK ? sizeof(uint64_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashSetI64(nvs_handle_t nvs, const char* key, int64_t value) {
+    NVSTraceScope scope(NVSTraceOp::Write, key, sizeof(int64_t));
+    esp_err_t err = nvs_set_i64(nvs, key, value);
+    return scope.finish(err == ESP_OK ? sizeof(int64_t) : 0, err);
+}
+
+inline esp_err_t NVSFlashEraseKey(nvs_handle_t nvs, const char* key) {
+    NVSTraceScope scope(NVSTraceOp::Erase, key);
+    return scope.finish(0, nvs_erase_key(nvs, key));
+}
+
+inline esp_err_t NVSFlashEraseAll(nvs_handle_t nvs) {
+    NVSTraceScope scope(NVSTraceOp::Erase, nullptr);
+    return scope.finish(0, nvs_erase_all(nvs));
+}
+
+/**
+ * @param key Key which caused the commit, only used for tracing
+ */
+inline esp_err_t NVSFlashCommit(nvs_handle_t nvs, const char* key = nullptr) {
+    NVSTraceScope scope(NVSTraceOp::Commit, key);
+    return scope.finish(0, nvs_commit(nvs));
+}
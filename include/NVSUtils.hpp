@@ -1,7 +1,9 @@
 #pragma once
 #include <nvs.h>
+#include <cstdint>
 #include <string>
 #include <optional>
+#include <type_traits>
 
 /**
  * @brief Result codes for NVS query operations
@@ -53,6 +55,50 @@ NVSQueryResult NVSStringValueSize(nvs_handle_t nvs, const std::string& key, size
 NVSQueryResult NVSReadStringValue(nvs_handle_t nvs, const std::string& key, std::string& value,
                                   NVSStringStoragePreference preference = NVSStringStoragePreference::PreferBlob);
 
+/**
+ * @brief Read a string-like value from NVS into caller storage without allocating.
+ *
+ * Storage formats are handled like NVSReadStringValue(). On input, size is the
+ * capacity of buffer; on success it is set to the payload size. Reading a legacy
+ * string entry needs one extra byte for the null terminator.
+ * If the buffer is too small, nothing is read, Error is returned and size is set
+ * to the required capacity.
+ */
+NVSQueryResult NVSReadStringValueInto(nvs_handle_t nvs, const std::string& key, uint8_t* buffer, size_t& size,
+                                      NVSStringStoragePreference preference = NVSStringStoragePreference::PreferBlob);
+
+/**
+ * @brief Callback for NVSForEachEntry(). Return false to stop the iteration.
+ */
+typedef bool (*NVSEntryCallback)(void* context, const nvs_entry_info_t& info);
+
+/**
+ * @brief Iterate over all entries of a namespace using the NVS entry iterator.
+ *
+ * This hides the differences between the ESP-IDF v4 and v5 iterator APIs
+ * and does not allocate memory besides the iterator itself.
+ *
+ * @param partition NVS partition label, e.g. NVS_DEFAULT_PART_NAME
+ * @param namespc Namespace to iterate or nullptr for all namespaces
+ * @param type Entry type to iterate or NVS_TYPE_ANY
+ * @return OK if at least one entry was visited, NotFound if there are no
+ *         matching entries, Error if the iterator could not be created
+ */
+NVSQueryResult NVSForEachEntry(const char* partition, const char* namespc, nvs_type_t type,
+                               NVSEntryCallback callback, void* context);
+
+/**
+ * @brief Convenience overload of NVSForEachEntry() accepting any callable
+ * with the signature bool(const nvs_entry_info_t&).
+ */
+template<typename Callback>
+NVSQueryResult NVSForEachEntry(const char* partition, const char* namespc, nvs_type_t type, Callback&& callback) {
+    using CallbackType = std::remove_reference_t<Callback>;
+    return NVSForEachEntry(partition, namespc, type, [](void* context, const nvs_entry_info_t& info) {
+        return (*static_cast<CallbackType*>(context))(info);
+    }, static_cast<void*>(&callback));
+}
+
 /**
  * @brief Initialize NVS flash and open a namespace
  * 
@@ -71,4 +117,18 @@ NVSQueryResult NVSReadStringValue(nvs_handle_t nvs, const std::string& key, std:
  * @note The caller is responsible for closing the returned handle using nvs_close()
  * @note If allowReinit is true and the NVS partition is corrupted or incompatible, it will be erased and reinitialized
  */
-std::optional<nvs_handle_t> InitializeNVS(const char* namespc, bool allowReinit = true);
\ No newline at end of file
+std::optional<nvs_handle_t> InitializeNVS(const char* namespc, bool allowReinit = true);
+
+/**
+ * @brief Initialize an NVS partition other than the default one and open a namespace in it
+ *
+ * Like InitializeNVS(), but for the partition with the given label, e.g. a
+ * separate partition for frequently written values (see NVSRouter).
+ *
+ * @param partition Label of the NVS partition
+ * @param namespc The name of the NVS namespace to open
+ * @param allowReinit Whether to erase and reinitialize the partition on the same errors as InitializeNVS()
+ * @return std::optional<nvs_handle_t> containing the NVS handle if successful,
+ *         or std::nullopt if initialization or opening failed
+ */
+std::optional<nvs_handle_t> InitializeNVSPartition(const char* partition, const char* namespc, bool allowReinit = true);
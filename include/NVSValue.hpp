@@ -1,12 +1,17 @@
 #pragma once
 #include <nvs.h>
+#include <cstring>
 #include <string>
 #include <limits>
 #include <type_traits>
 
+#include "NVSCoherence.hpp"
 #include "NVSLog.hpp"
 #include "NVSUtils.hpp"
 #include "NVSResult.hpp"
+#include "NVSTrace.hpp"
+#include "NVSValueBase.hpp"
+#include "NVSWritePolicy.hpp"
 
 namespace nvs_value_detail {
 template<typename T>
@@ -21,100 +26,107 @@ std::string ToBinaryString(const T& value) {
 }
 } // namespace nvs_value_detail
 
-// Base class used for runtime enumeration of all NVS values.  Add new
-// virtual methods if additional introspection is required by callers.
-class NVSValueBase {
-public:
-    virtual ~NVSValueBase() = default;
-    virtual const std::string& key() const = 0;
-    virtual bool exists() const = 0;
-    /**
-     * @brief Return the stored value as a std::string.
-     *
-     * For non-string types, implementations return the raw binary bytes of
-     * the stored object in a std::string. For string specializations, the
-     * stored text is returned unchanged.
-     */
-    virtual std::string asString() const = 0;
-};
-
 /**
- * @brief Templated value stored in NVS
- * You can use this to store any type in NVS.
- * The memory for the given value is directly allocated in the NVS.
+ * @brief Non-virtual implementation of NVSValue and NVSPlainValue.
+ *
+ * Derived is the concrete value class, which is passed to the write policy.
  */
-template<typename T>
-class NVSValue : public NVSValueBase {
+template<typename T, typename Policy, typename Derived>
+class NVSValueCore : public NVSCoherenceLink<NVSValueCore<T, Policy, Derived>> {
 public:
     /**
      * Empty default constructor.
      * You need to assign/copy this instance to a NVSValue
      * before actually using it.
      */
-    NVSValue() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _value(), _exists(false) {}
+    NVSValueCore() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _value(), _exists(false), _pending(false), _policy() {}
     
-    NVSValue(NVSValue& copy): nvs(copy.nvs), _key(copy._key), _value(copy._value), _exists(copy._exists) {
+    NVSValueCore(NVSValueCore& copy): NVSCoherenceLink<NVSValueCore>(), nvs(copy.nvs), _key(copy._key), _value(copy._value), _exists(copy._exists), _pending(false), _policy(copy._policy) {
         // Read value from NVS
         if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
             this->updateFromNVS();
         }
+        this->Attach(nvs, _key);
     }
 
-    NVSValue(NVSValue&& copy): nvs(std::move(copy.nvs)), _key(std::move(copy._key)), _value(std::move(copy._value)), _exists(std::move(copy._exists)) {
+    NVSValueCore(NVSValueCore&& copy): NVSCoherenceLink<NVSValueCore>(), nvs(std::move(copy.nvs)), _key(std::move(copy._key)), _value(std::move(copy._value)), _exists(std::move(copy._exists)), _pending(false), _policy(std::move(copy._policy)) {
+        // The moved-from value must not write its moved-from state later
+        copy._pending = false;
         // Read value from NVS
         if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
             this->updateFromNVS();
         }
+        this->Attach(nvs, _key);
     }
-    NVSValue& operator=(NVSValue& copy) {
+    NVSValueCore& operator=(NVSValueCore& copy) {
         nvs = copy.nvs;
         _key = copy._key;
         _value = copy._value;
+        _policy = copy._policy;
 
         if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
             this->updateFromNVS();
         }
+        this->Attach(nvs, _key);
         return *this;
     }
 
-    NVSValue& operator=(NVSValue&& copy) {
+    NVSValueCore& operator=(NVSValueCore&& copy) {
         nvs = std::move(copy.nvs);
         _key = std::move(copy._key);
         _value = std::move(copy._value);
+        _policy = std::move(copy._policy);
+        copy._pending = false;
         
         if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
             this->updateFromNVS();
         }
+        this->Attach(nvs, _key);
         return *this;
     }
 
     /**
      * Main constructor.
      */
-    NVSValue(nvs_handle_t nvs, const std::string& key, const T& defaultValue = T()) : nvs(nvs), _key(key), _value(), _default(defaultValue) {
+    NVSValueCore(nvs_handle_t nvs, const std::string& key, const T& defaultValue = T(), const Policy& policy = Policy())
+        : nvs(nvs), _key(key), _value(), _default(defaultValue), _pending(false), _policy(policy) {
         this->updateFromNVS();
+        this->Attach(nvs, _key);
     }
 
-    // NVSValueBase implementation
-    const std::string& key() const override { return _key; }
-    bool exists() const override { return _exists; }
+    ~NVSValueCore() {
+        this->Detach();
+    }
+
+    const std::string& key() const { return _key; }
+    bool exists() const { return _exists; }
     /**
      * @brief Return the raw bytes of the stored value.
      *
      * This returns the binary representation of _value in a std::string;
      * it does not attempt a textual conversion or formatting.
      */
-    std::string asString() const override {
+    std::string asString() const {
         return nvs_value_detail::ToBinaryString(_value);
     }
 
+    NVSValueDescriptor descriptor() const {
+        return NVSValueDescriptor{NVSValueKindOf<T>(), sizeof(T), _exists, _value == _default};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const {
+        if(bufferSize >= sizeof(T)) {
+            memcpy(buffer, &_value, sizeof(T));
+        }
+        return sizeof(T);
+    }
+
     inline T value() const { return _value; }
     inline T& valueRef() const { return _value; }
 
     const uint8_t* data() const { return &_value; }
 
     bool empty() const { return !_exists; }
-    // exists() is already declared above with override
 
     size_t size() const { return sizeof(T); }
 
@@ -130,6 +142,10 @@ public:
             NVSCriticalPrintf("Invalid NVS instance");
             return;
         }
+        if(_pending) {
+            NVSDebugPrintf("Discarding pending value of key %s", _key.c_str());
+            _pending = false;
+        }
         /**
          * Strategy:
          *  1. Determine size of value in NVS
@@ -172,7 +188,7 @@ public:
         // Step 2: Allocate temporary buffer to read into
         // Step 3: Read value into temporary buffer.
         esp_err_t err;
-        if((err = nvs_get_blob(nvs, _key.c_str(), (void*)&_value, &value_size)) != ESP_OK) {
+        if((err = NVSFlashGetBlob(nvs, _key.c_str(), (void*)&_value, &value_size)) != ESP_OK) {
             // "Doesn't exist" has already been handled before, so this is an actual error.
             // We assume that the value did not change between reading the size (step 1) and now.
             // In case that assumption is value, this will fail with ESP_ERR_NVS_INVALID_LENGTH.
@@ -201,23 +217,54 @@ public:
             return NVSSetResult::NotInitialized;
         }
         if(_value == *newValue) {
-            return NVSSetResult::Unchanged;
+            return _pending ? poll() : NVSSetResult::Unchanged;
+        }
+        switch(_policy.evaluate(Self(), static_cast<const T&>(_value), *newValue)) {
+            case NVSWriteDecision::Suppress:
+                return NVSSetResult::Suppressed;
+            case NVSWriteDecision::Reject:
+                return NVSSetResult::NoSpace;
+            case NVSWriteDecision::Defer:
+                this->_value = *newValue;
+                this->_pending = true;
+                return NVSSetResult::Deferred;
+            case NVSWriteDecision::Write:
+                break;
         }
         // Update local value
         this->_value = *newValue;
-        this->_exists = true;
-        // Write to NVS. Use set_blob to use explicit size if string contains binary data
-        esp_err_t err;
-        if((err = nvs_set_blob(nvs, _key.c_str(), (void*)newValue, sizeof(T))) != ESP_OK) {
-            NVSCriticalPrintf("Failed to write NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
-            return NVSSetResult::Error;
+        return WriteToNVS();
+    }
+
+    /**
+     * @brief Write a deferred value if the write policy allows it now
+     * @return Unchanged if nothing is pending, Deferred if the policy still holds the value back
+     */
+    NVSSetResult poll() {
+        if(!_pending) {
+            return NVSSetResult::Unchanged;
         }
-        // Save to NV storage
-        nvs_commit(nvs);
-        return NVSSetResult::Updated;
+        if(!_policy.mayFlush(Self())) {
+            return NVSSetResult::Deferred;
+        }
+        return WriteToNVS();
+    }
+
+    bool hasPendingWrite() const { return _pending; }
 
+    NVSSetResult flush() {
+        if(!_pending) {
+            return NVSSetResult::Unchanged;
+        }
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        return WriteToNVS();
     }
 
+    Policy& policy() { return _policy; }
+    const Policy& policy() const { return _policy; }
+
     /**
      * @brief Update the value in the NVS and in the current instance
      * The update is skipped if the new value is equal to the current value.
@@ -229,6 +276,61 @@ public:
     T _value;
     T _default;
     bool _exists;
+    // Whether _value has been deferred by the write policy and differs from NVS
+    bool _pending;
+
+private:
+    Derived& Self() { return static_cast<Derived&>(*this); }
+
+    NVSSetResult WriteToNVS() {
+        // Keep the value pending until it has been written successfully
+        this->_pending = true;
+        NVSPolicyBeforeWrite(_policy, Self());
+        // Write to NVS. Use set_blob to use explicit size if string contains binary data
+        esp_err_t err;
+        if((err = NVSFlashSetBlob(nvs, _key.c_str(), (const void*)&_value, sizeof(T))) != ESP_OK) {
+            NVSCriticalPrintf("Failed to write NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
+            return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+        this->_pending = false;
+        this->_exists = true;
+        _policy.onWritten(Self());
+        // Save to NV storage
+        NVSFlashCommit(nvs, _key.c_str());
+        this->Publish(&_value, sizeof(T));
+        return NVSSetResult::Updated;
+    }
+
+    friend class NVSCoherenceLink<NVSValueCore>;
+
+    /**
+     * @brief Another instance of this key has written data. The last write wins,
+     * so a value deferred by the write policy is discarded.
+     */
+    void ApplyPeerWrite(const void* data, size_t size) {
+        _pending = false;
+        if(size != sizeof(T)) {
+            _exists = false;
+            _value = _default;
+            return;
+        }
+        memcpy(static_cast<void*>(&_value), data, sizeof(T));
+        _exists = true;
+    }
+
+    /**
+     * @brief Only a value which exists and is not pending is known to equal the stored value
+     */
+    bool CachedPeerValue(const void*& data, size_t& size) const {
+        if(!_exists || _pending) {
+            return false;
+        }
+        data = &_value;
+        size = sizeof(T);
+        return true;
+    }
+
+    Policy _policy;
 };
 
 /**
@@ -236,70 +338,102 @@ public:
  *
  * This specialization primarily stores values as NVS strings and falls back to
  * blob reads for compatibility with binary-backed string data.
+ *
+ * Strings with a custom allocator are supported as well, e.g. NVSArenaString.
+ * The cached value uses the allocator of the default value.
  */
-template<>
-class NVSValue<std::string> : public NVSValueBase {
+template<typename Traits, typename Alloc, typename Policy, typename Derived>
+class NVSValueCore<std::basic_string<char, Traits, Alloc>, Policy, Derived>
+    : public NVSCoherenceLink<NVSValueCore<std::basic_string<char, Traits, Alloc>, Policy, Derived>> {
 public:
+    typedef std::basic_string<char, Traits, Alloc> StringType;
+
     /**
      * Empty default constructor.
      * You need to assign/copy this instance to a NVSValue
      * before actually using it.
      */
-    NVSValue() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _value(), _exists(false) {}
+    NVSValueCore() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _value(), _exists(false), _pending(false), _policy() {}
     
-    NVSValue(NVSValue& copy): nvs(copy.nvs), _key(copy._key), _value(copy._value), _exists(copy._exists) {
+    NVSValueCore(NVSValueCore& copy): NVSCoherenceLink<NVSValueCore>(), nvs(copy.nvs), _key(copy._key), _value(copy._value), _exists(copy._exists), _pending(false), _policy(copy._policy) {
         // Read value from NVS
         if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
             this->updateFromNVS();
         }
+        this->Attach(nvs, _key);
     }
 
-    NVSValue(NVSValue&& copy): nvs(std::move(copy.nvs)), _key(std::move(copy._key)), _value(std::move(copy._value)), _exists(std::move(copy._exists)) {
+    NVSValueCore(NVSValueCore&& copy): NVSCoherenceLink<NVSValueCore>(), nvs(std::move(copy.nvs)), _key(std::move(copy._key)), _value(std::move(copy._value)), _exists(std::move(copy._exists)), _pending(false), _policy(std::move(copy._policy)) {
+        // The moved-from value must not write its moved-from state later
+        copy._pending = false;
         // Read value from NVS
         if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
             this->updateFromNVS();
         }
+        this->Attach(nvs, _key);
     }
 
-    NVSValue& operator=(NVSValue& copy) {
+    NVSValueCore& operator=(NVSValueCore& copy) {
         nvs = copy.nvs;
         _key = copy._key;
         _value = copy._value;
+        _policy = copy._policy;
 
         if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
             this->updateFromNVS();
         }
+        this->Attach(nvs, _key);
         return *this;
     }
 
-    NVSValue& operator=(NVSValue&& copy) {
+    NVSValueCore& operator=(NVSValueCore&& copy) {
         nvs = std::move(copy.nvs);
         _key = std::move(copy._key);
         _value = std::move(copy._value);
+        _policy = std::move(copy._policy);
+        copy._pending = false;
         
         if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
             this->updateFromNVS();
         }
+        this->Attach(nvs, _key);
         return *this;
     }
 
     /**
      * Main constructor.
      */
-    NVSValue(nvs_handle_t nvs, const std::string& key, const std::string& defaultValue = std::string()) : nvs(nvs), _key(key), _value(), _default(defaultValue) {
+    NVSValueCore(nvs_handle_t nvs, const std::string& key, const StringType& defaultValue = StringType(), const Policy& policy = Policy())
+        : nvs(nvs), _key(key), _value(defaultValue.get_allocator()), _default(defaultValue), _pending(false), _policy(policy) {
         this->updateFromNVS();
+        this->Attach(nvs, _key);
+    }
+
+    ~NVSValueCore() {
+        this->Detach();
     }
 
-    const std::string& key() const override { return _key; }
-    bool exists() const override { return _exists; }
+    const std::string& key() const { return _key; }
+    bool exists() const { return _exists; }
     /**
      * @brief Return the stored string value unchanged.
      */
-    std::string asString() const override { return _value; }
+    std::string asString() const { return std::string(_value.data(), _value.size()); }
 
-    inline std::string value() const { return _value; }
-    inline std::string& valueRef() { return _value; }
-    inline const std::string& valueRef() const { return _value; }
+    NVSValueDescriptor descriptor() const {
+        return NVSValueDescriptor{NVSValueKind::String, _value.size(), _exists, _value == _default};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const {
+        if(bufferSize >= _value.size()) {
+            memcpy(buffer, _value.data(), _value.size());
+        }
+        return _value.size();
+    }
+
+    inline StringType value() const { return _value; }
+    inline StringType& valueRef() { return _value; }
+    inline const StringType& valueRef() const { return _value; }
 
     /**
      * @brief Equivalent to .value().c_str()
@@ -310,7 +444,6 @@ public:
     const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(_value.data()); }
 
     bool empty() const { return !_exists || _value.empty(); }
-    // exists() is already declared above with override
 
     size_t size() const { return _value.size(); }
 
@@ -326,8 +459,12 @@ public:
             NVSCriticalPrintf("Invalid NVS instance");
             return;
         }
+        if(_pending) {
+            NVSDebugPrintf("Discarding pending value of key %s", _key.c_str());
+            _pending = false;
+        }
 
-        if(NVSReadStringValue(nvs, _key, _value, NVSStringStoragePreference::PreferString) != NVSQueryResult::OK) {
+        if(ReadFromNVS() != NVSQueryResult::OK) {
             _exists = false;
             _value = _default;
             return;
@@ -342,38 +479,179 @@ public:
      * @brief Update the value in the NVS and in the current instance
      * The update is skipped if the new value is equal to the current value.
      */
-    NVSSetResult set(const std::string& newValue) {
+    NVSSetResult set(const StringType& newValue) {
         if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
             return NVSSetResult::NotInitialized;
         }
         if(_value == newValue) {
-            return NVSSetResult::Unchanged;
+            return _pending ? poll() : NVSSetResult::Unchanged;
+        }
+        switch(_policy.evaluate(Self(), static_cast<const StringType&>(_value), newValue)) {
+            case NVSWriteDecision::Suppress:
+                return NVSSetResult::Suppressed;
+            case NVSWriteDecision::Reject:
+                return NVSSetResult::NoSpace;
+            case NVSWriteDecision::Defer:
+                this->_value = newValue;
+                this->_pending = true;
+                return NVSSetResult::Deferred;
+            case NVSWriteDecision::Write:
+                break;
         }
         // Update local value
         this->_value = newValue;
-        this->_exists = true;
-        // Write using NVS string storage. Blob-backed values remain readable.
-        esp_err_t err;
-        if((err = nvs_set_str(nvs, _key.c_str(), newValue.c_str())) != ESP_OK) {
-            NVSCriticalPrintf("Failed to write NVS string key %s: %s", _key.c_str(), esp_err_to_name(err));
-            return NVSSetResult::Error;
+        return WriteToNVS();
+    }
+
+    /**
+     * @brief Write a deferred value if the write policy allows it now
+     * @return Unchanged if nothing is pending, Deferred if the policy still holds the value back
+     */
+    NVSSetResult poll() {
+        if(!_pending) {
+            return NVSSetResult::Unchanged;
         }
-        // Save to NV storage
-        nvs_commit(nvs);
-        return NVSSetResult::Updated;
+        if(!_policy.mayFlush(Self())) {
+            return NVSSetResult::Deferred;
+        }
+        return WriteToNVS();
+    }
+
+    bool hasPendingWrite() const { return _pending; }
+
+    NVSSetResult flush() {
+        if(!_pending) {
+            return NVSSetResult::Unchanged;
+        }
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        return WriteToNVS();
     }
 
+    Policy& policy() { return _policy; }
+    const Policy& policy() const { return _policy; }
+
     /**
      * @brief Update the value in the NVS and in the current instance
      * The update is skipped if the new value is equal to the current value.
      */
     NVSSetResult set(const char* newValue) {
-        return set(std::string(newValue));
+        return set(StringType(newValue, _value.get_allocator()));
     }
 
     nvs_handle_t nvs;
     std::string _key;
-    std::string _value;
-    std::string _default;
+    StringType _value;
+    StringType _default;
     bool _exists;
-};
\ No newline at end of file
+    // Whether _value has been deferred by the write policy and differs from NVS
+    bool _pending;
+
+private:
+    Derived& Self() { return static_cast<Derived&>(*this); }
+
+    NVSQueryResult ReadFromNVS() {
+        if constexpr (std::is_same_v<StringType, std::string>) {
+            return NVSReadStringValue(nvs, _key, _value, NVSStringStoragePreference::PreferString);
+        } else {
+            // Read directly into _value so no temporary std::string is allocated from the default heap
+            size_t size = 0;
+            NVSQueryResult result = NVSStringValueSize(nvs, _key, size, NVSStringStoragePreference::PreferString);
+            if(result != NVSQueryResult::OK) {
+                return result;
+            }
+            // Legacy string entries are read including their null terminator
+            _value.resize(size + 1);
+            size = _value.size();
+            result = NVSReadStringValueInto(nvs, _key, reinterpret_cast<uint8_t*>(&_value[0]), size, NVSStringStoragePreference::PreferString);
+            _value.resize(result == NVSQueryResult::OK ? size : 0);
+            return result;
+        }
+    }
+
+    NVSSetResult WriteToNVS() {
+        // Keep the value pending until it has been written successfully
+        this->_pending = true;
+        NVSPolicyBeforeWrite(_policy, Self());
+        // Write using NVS string storage. Blob-backed values remain readable.
+        esp_err_t err;
+        if((err = NVSFlashSetStr(nvs, _key.c_str(), _value.c_str())) != ESP_OK) {
+            NVSCriticalPrintf("Failed to write NVS string key %s: %s", _key.c_str(), esp_err_to_name(err));
+            return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+        this->_pending = false;
+        this->_exists = true;
+        _policy.onWritten(Self());
+        // Save to NV storage
+        NVSFlashCommit(nvs, _key.c_str());
+        this->Publish(_value.data(), _value.size());
+        return NVSSetResult::Updated;
+    }
+
+    friend class NVSCoherenceLink<NVSValueCore>;
+
+    /**
+     * @brief Another instance of this key has written data. The last write wins,
+     * so a value deferred by the write policy is discarded.
+     */
+    void ApplyPeerWrite(const void* data, size_t size) {
+        _pending = false;
+        _value.assign(static_cast<const char*>(data), size);
+        _exists = true;
+    }
+
+    bool CachedPeerValue(const void*& data, size_t& size) const {
+        if(!_exists || _pending) {
+            return false;
+        }
+        data = _value.data();
+        size = _value.size();
+        return true;
+    }
+
+    Policy _policy;
+};
+
+/**
+ * @brief Templated value stored in NVS
+ * You can use this to store any type in NVS.
+ * The memory for the given value is directly allocated in the NVS.
+ *
+ * The optional Policy decides how changed values are written,
+ * see NVSWritePolicy.hpp. By default, every change is written immediately.
+ *
+ * NVSValue implements NVSValueBase, so it can be enumerated by NVSValueRegistry.
+ * See NVSPlainValue for the same value without virtual methods.
+ */
+template<typename T, typename Policy = NVSExactWritePolicy>
+class NVSValue : public NVSValueBase, public NVSValueCore<T, Policy, NVSValue<T, Policy>> {
+    typedef NVSValueCore<T, Policy, NVSValue<T, Policy>> Core;
+
+public:
+    using Core::Core;
+
+    const std::string& key() const override { return Core::key(); }
+    bool exists() const override { return Core::exists(); }
+    std::string asString() const override { return Core::asString(); }
+    NVSValueDescriptor descriptor() const override { return Core::descriptor(); }
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override { return Core::serializeTo(buffer, bufferSize); }
+    bool hasPendingWrite() const override { return Core::hasPendingWrite(); }
+    NVSSetResult flush() override { return Core::flush(); }
+};
+
+/**
+ * @brief NVSValue without NVSValueBase.
+ *
+ * It has no vtable pointer, all calls can be inlined and asString() etc. are
+ * only compiled if they are called. To enumerate it anyway, wrap it in an
+ * NVSValueAdapter (see NVSValueRegistry.hpp). Write policies which require
+ * an NVSValueBase, like NVSWindowWritePolicy, can't be used.
+ */
+template<typename T, typename Policy = NVSExactWritePolicy>
+class NVSPlainValue : public NVSValueCore<T, Policy, NVSPlainValue<T, Policy>> {
+    typedef NVSValueCore<T, Policy, NVSPlainValue<T, Policy>> Core;
+
+public:
+    using Core::Core;
+};
@@ -0,0 +1,241 @@
+#pragma once
+#include <nvs.h>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include "NVSLog.hpp"
+#include "NVSResult.hpp"
+#include "NVSTrace.hpp"
+#include "NVSValueBase.hpp"
+
+/**
+ * @brief Fixed-size array of values stored as a single blob.
+ *
+ * Compared to an array of NVSValue<T>, all N elements are read with a single
+ * lookup and share one key, one handle and one object.
+ *
+ * set(index, value) only changes the element in RAM and marks the array as
+ * dirty. commit() (or flush()) writes the whole array once, so a batch of
+ * element updates costs a single write. set(values) writes immediately.
+ *
+ * T must be trivially copyable. If the stored blob holds fewer elements,
+ * e.g. because N has grown, these are read and the others use the default.
+ */
+template<typename T, size_t N>
+class NVSValueArray : public NVSValueBase {
+    static_assert(std::is_trivially_copyable_v<T>, "NVSValueArray requires a trivially copyable type");
+    static_assert(N > 0, "NVSValueArray requires at least one element");
+
+public:
+    typedef std::array<T, N> ArrayType;
+
+    /**
+     * Empty default constructor.
+     * You need to assign this instance to a NVSValueArray
+     * before actually using it.
+     */
+    NVSValueArray() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _values(), _default(), _exists(false), _dirty(false) {}
+
+    /**
+     * Main constructor.
+     * @param defaultValue Default of every element
+     */
+    NVSValueArray(nvs_handle_t nvs, const std::string& key, const T& defaultValue = T())
+        : nvs(nvs), _key(key), _values(), _default(defaultValue), _exists(false), _dirty(false) {
+        this->updateFromNVS();
+    }
+
+    NVSValueArray(const NVSValueArray&) = default;
+    NVSValueArray& operator=(const NVSValueArray&) = default;
+
+    const std::string& key() const override { return _key; }
+    bool exists() const override { return _exists; }
+
+    std::string asString() const override {
+        return std::string(reinterpret_cast<const char*>(_values.data()), sizeof(ArrayType));
+    }
+
+    NVSValueDescriptor descriptor() const override {
+        bool isDefault = true;
+        for(const T& element : _values) {
+            isDefault = isDefault && element == _default;
+        }
+        return NVSValueDescriptor{NVSValueKind::Blob, sizeof(ArrayType), _exists, isDefault};
+    }
+
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override {
+        if(bufferSize >= sizeof(ArrayType)) {
+            memcpy(buffer, _values.data(), sizeof(ArrayType));
+        }
+        return sizeof(ArrayType);
+    }
+
+    const T& operator[](size_t index) const { return _values[index]; }
+    const ArrayType& values() const { return _values; }
+    const T* data() const { return _values.data(); }
+    const T* begin() const { return _values.data(); }
+    const T* end() const { return _values.data() + N; }
+    static constexpr size_t size() { return N; }
+
+    /**
+     * @brief Read the array from the NVS storage.
+     * A pending batch of element updates is discarded.
+     */
+    void updateFromNVS() {
+        NVSTracePrintf("Reading array key %s", _key.c_str());
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            NVSCriticalPrintf("Invalid NVS instance");
+            return;
+        }
+        if(_dirty) {
+            NVSDebugPrintf("Discarding pending elements of key %s", _key.c_str());
+            _dirty = false;
+        }
+        _values.fill(_default);
+        _exists = false;
+        // A single lookup: if the stored blob is smaller, only its size is read into the buffer
+        size_t size = sizeof(ArrayType);
+        esp_err_t err = NVSFlashGetBlob(nvs, _key.c_str(), static_cast<void*>(_values.data()), &size);
+        if(err == ESP_ERR_NVS_NOT_FOUND) {
+            NVSDebugPrintf("Key %s does not exist", _key.c_str());
+            return;
+        }
+        if(err == ESP_ERR_NVS_INVALID_LENGTH || (err == ESP_OK && size % sizeof(T) != 0)) {
+            NVSWarningPrintf("Size of value in NVS for key %s does not match expected size %d", _key.c_str(), sizeof(ArrayType));
+            _values.fill(_default);
+            return;
+        }
+        if(err != ESP_OK) {
+            NVSErrorPrintf("Failed to read NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
+            _values.fill(_default);
+            return;
+        }
+        if(size < sizeof(ArrayType)) {
+            // Stored with fewer elements, the remaining elements keep the default
+            NVSInfoPrintf("Array key %s holds %d of %d elements", _key.c_str(), size / sizeof(T), N);
+        }
+        _exists = true;
+    }
+
+    /**
+     * @brief Change one element in RAM. It is written by the next commit().
+     * @return Deferred if the element changed, Unchanged otherwise
+     */
+    NVSSetResult set(size_t index, const T& value) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        if(index >= N) {
+            NVSErrorPrintf("Index %d out of range for array key %s", index, _key.c_str());
+            return NVSSetResult::Error;
+        }
+        if(_values[index] == value) {
+            return NVSSetResult::Unchanged;
+        }
+        _values[index] = value;
+        _dirty = true;
+        return NVSSetResult::Deferred;
+    }
+
+    /**
+     * @brief Replace all elements and write the array immediately
+     */
+    NVSSetResult set(const ArrayType& values) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        if(_values == values && !_dirty && _exists) {
+            return NVSSetResult::Unchanged;
+        }
+        _values = values;
+        _dirty = true;
+        return commit();
+    }
+
+    /**
+     * @brief Write the array if elements have been changed by set(index, value)
+     */
+    NVSSetResult commit() {
+        if(!_dirty) {
+            return NVSSetResult::Unchanged;
+        }
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        esp_err_t err;
+        if((err = NVSFlashSetBlob(nvs, _key.c_str(), static_cast<const void*>(_values.data()), sizeof(ArrayType))) != ESP_OK) {
+            NVSCriticalPrintf("Failed to write NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
+            return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+        NVSFlashCommit(nvs, _key.c_str());
+        _dirty = false;
+        _exists = true;
+        return NVSSetResult::Updated;
+    }
+
+    bool hasPendingWrite() const override { return _dirty; }
+
+    NVSSetResult flush() override { return commit(); }
+
+    /**
+     * @brief Move elements stored under one key each, e.g. by an array of
+     * NVSValue<T>, into this array.
+     *
+     * Nothing happens if the array already exists. Otherwise every element key
+     * which exists with the size of T is read, the array is written and
+     * committed, and then the element keys are erased. Missing element keys
+     * keep the default.
+     *
+     * @param keyOf Callable returning the old key of element i, as std::string or const char*
+     * @return Unchanged if the array exists or no element key was found
+     */
+    template<typename KeyFn>
+    NVSSetResult migrateFrom(KeyFn&& keyOf) {
+        if(nvs == std::numeric_limits<nvs_handle_t>::max()) {
+            return NVSSetResult::NotInitialized;
+        }
+        if(_exists) {
+            return NVSSetResult::Unchanged;
+        }
+        size_t found = 0;
+        for(size_t i = 0; i < N; i++) {
+            std::string elementKey(keyOf(i));
+            size_t size = sizeof(T);
+            T element;
+            esp_err_t err = NVSFlashGetBlob(nvs, elementKey.c_str(), static_cast<void*>(&element), &size);
+            if(err == ESP_OK && size == sizeof(T)) {
+                _values[i] = element;
+                found++;
+            } else if(err != ESP_ERR_NVS_NOT_FOUND) {
+                NVSWarningPrintf("Not migrating key %s: %s", elementKey.c_str(), esp_err_to_name(err));
+            }
+        }
+        if(found == 0) {
+            return NVSSetResult::Unchanged;
+        }
+        _dirty = true;
+        NVSSetResult result = commit();
+        if(result != NVSSetResult::Updated) {
+            return result;
+        }
+        // The old keys are only erased once the array has been committed
+        for(size_t i = 0; i < N; i++) {
+            std::string elementKey(keyOf(i));
+            NVSFlashEraseKey(nvs, elementKey.c_str());
+        }
+        NVSFlashCommit(nvs, _key.c_str());
+        NVSInfoPrintf("Migrated %d elements into array key %s", found, _key.c_str());
+        return NVSSetResult::Updated;
+    }
+
+    nvs_handle_t nvs;
+    std::string _key;
+    ArrayType _values;
+    T _default;
+    bool _exists;
+    // Whether elements have been changed by set(index, value) and not been written yet
+    bool _dirty;
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include "NVSResult.hpp"
+
+/**
+ * @brief Category of a value, used by generic code to interpret its raw bytes.
+ */
+enum class NVSValueKind : uint8_t {
+    /**
+     * Arbitrary trivially copyable type, stored as raw bytes
+     */
+    Blob = 0,
+    Bool = 1,
+    SignedInteger = 2,
+    UnsignedInteger = 3,
+    Float = 4,
+    /**
+     * Text or binary string. The bytes do not include a null terminator.
+     */
+    String = 5
+};
+
+/**
+ * @brief Type information about a value which can be obtained without allocating memory
+ */
+struct NVSValueDescriptor {
+    NVSValueKind kind;
+    /**
+     * Size of the serialized value in bytes.
+     * For strings, this is the current length.
+     */
+    size_t size;
+    bool exists;
+    /**
+     * Whether the current value equals the default value
+     */
+    bool isDefault;
+};
+
+/**
+ * @brief Determine the NVSValueKind of a C++ type at compile time.
+ * Enums are reported as the integer kind of their underlying type.
+ */
+template<typename T>
+constexpr NVSValueKind NVSValueKindOf() {
+    using DecayedT = std::decay_t<T>;
+    if constexpr (std::is_same_v<DecayedT, bool>) {
+        return NVSValueKind::Bool;
+    } else if constexpr (std::is_same_v<DecayedT, std::string>) {
+        return NVSValueKind::String;
+    } else if constexpr (std::is_enum_v<DecayedT>) {
+        return NVSValueKindOf<std::underlying_type_t<DecayedT>>();
+    } else if constexpr (std::is_integral_v<DecayedT>) {
+        return std::is_signed_v<DecayedT> ? NVSValueKind::SignedInteger : NVSValueKind::UnsignedInteger;
+    } else if constexpr (std::is_floating_point_v<DecayedT>) {
+        return NVSValueKind::Float;
+    } else {
+        return NVSValueKind::Blob;
+    }
+}
+
+const char* NVSValueKindToString(NVSValueKind kind);
+
+// Base class used for runtime enumeration of all NVS values.  Add new
+// virtual methods if additional introspection is required by callers.
+class NVSValueBase {
+public:
+    virtual ~NVSValueBase() = default;
+    virtual const std::string& key() const = 0;
+    virtual bool exists() const = 0;
+    /**
+     * @brief Return the stored value as a std::string.
+     *
+     * For non-string types, implementations return the raw binary bytes of
+     * the stored object in a std::string. For string specializations, the
+     * stored text is returned unchanged.
+     */
+    virtual std::string asString() const = 0;
+
+    /**
+     * @brief Describe the value without allocating memory.
+     *
+     * Lazy values query NVS to fill in exists and isDefault.
+     */
+    virtual NVSValueDescriptor descriptor() const = 0;
+
+    /**
+     * @brief Copy the bytes returned by asString() into caller storage.
+     *
+     * Nothing is written if bufferSize is too small.
+     *
+     * @return The number of bytes written, or the required buffer size if it
+     *         is larger than bufferSize. Lazy strings stored in the legacy NVS
+     *         string format need one extra byte for the null terminator
+     *         during the read, which is reflected in the required size.
+     */
+    virtual size_t serializeTo(uint8_t* buffer, size_t bufferSize) const = 0;
+
+    /**
+     * @brief Whether a write policy is holding a changed value in RAM which
+     * has not been written to NVS yet.
+     */
+    virtual bool hasPendingWrite() const { return false; }
+
+    /**
+     * @brief Write a pending value to NVS now, regardless of the write policy.
+     * @return Unchanged if there was nothing to write
+     */
+    virtual NVSSetResult flush() { return NVSSetResult::Unchanged; }
+};
@@ -0,0 +1,177 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "NVSValueBase.hpp"
+
+/**
+ * @brief Receives one value during NVSValueRegistry::dump().
+ *
+ * data points into the scratch buffer passed to dump() and is only valid
+ * during the call. If the value does not fit into the scratch buffer,
+ * data is nullptr and size is the required buffer size.
+ */
+typedef void (*NVSDumpCallback)(void* context, const NVSValueBase& value, const NVSValueDescriptor& descriptor,
+                                const uint8_t* data, size_t size);
+
+/**
+ * @brief Fixed-capacity list of values for runtime enumeration.
+ *
+ * The registry does not own the values and never allocates memory.
+ * Storage for the value pointers is provided by the caller, see
+ * NVSStaticValueRegistry for a registry with inline storage.
+ */
+class NVSValueRegistry {
+public:
+    NVSValueRegistry(NVSValueBase** storage, size_t capacity);
+
+    NVSValueRegistry(const NVSValueRegistry&) = delete;
+    NVSValueRegistry& operator=(const NVSValueRegistry&) = delete;
+
+    /**
+     * @brief Add a value. Adding a value twice has no effect.
+     * @return false if the registry is full
+     */
+    bool add(NVSValueBase& value);
+
+    /**
+     * @brief Remove a value
+     * @return false if the value was not registered
+     */
+    bool remove(NVSValueBase& value);
+
+    /**
+     * @brief Find a registered value by its NVS key
+     * @return The value or nullptr
+     */
+    NVSValueBase* find(const char* key) const;
+
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+
+    NVSValueBase* const* begin() const { return _values; }
+    NVSValueBase* const* end() const { return _values + _size; }
+
+    /**
+     * @brief Call visitor(NVSValueBase&) for every registered value.
+     */
+    template<typename Visitor>
+    void forEach(Visitor&& visitor) const {
+        for(NVSValueBase* value : *this) {
+            visitor(*value);
+        }
+    }
+
+    /**
+     * @brief Serialize every value into scratch and pass it to callback.
+     *
+     * No heap memory is allocated by this function or by the value
+     * implementations it calls.
+     *
+     * @return Number of values that did not fit into the scratch buffer
+     */
+    size_t dump(NVSDumpCallback callback, void* context, uint8_t* scratch, size_t scratchSize) const;
+
+    /**
+     * @brief Convenience overload of dump() accepting any callable with the signature
+     * void(const NVSValueBase&, const NVSValueDescriptor&, const uint8_t* data, size_t size).
+     */
+    template<typename Callback>
+    size_t dump(Callback&& callback, uint8_t* scratch, size_t scratchSize) const {
+        using CallbackType = std::remove_reference_t<Callback>;
+        return dump([](void* context, const NVSValueBase& value, const NVSValueDescriptor& descriptor, const uint8_t* data, size_t size) {
+            (*static_cast<CallbackType*>(context))(value, descriptor, data, size);
+        }, static_cast<void*>(&callback), scratch, scratchSize);
+    }
+
+    /**
+     * @brief Write all values which have been deferred by their write policy,
+     * e.g. before entering deep sleep.
+     *
+     * @return Number of values which failed to write
+     */
+    size_t flush();
+
+private:
+    NVSValueBase** _values;
+    size_t _capacity;
+    size_t _size;
+};
+
+/**
+ * @brief NVSValueRegistry with storage for Capacity values inside the object.
+ */
+template<size_t Capacity>
+class NVSStaticValueRegistry : public NVSValueRegistry {
+public:
+    NVSStaticValueRegistry() : NVSValueRegistry(_storage, Capacity), _storage() {}
+
+    NVSStaticValueRegistry(std::initializer_list<NVSValueBase*> values) : NVSStaticValueRegistry() {
+        for(NVSValueBase* value : values) {
+            if(value != nullptr) {
+                add(*value);
+            }
+        }
+    }
+
+private:
+    NVSValueBase* _storage[Capacity];
+};
+
+/**
+ * @brief Implements NVSValueBase for a value without virtual methods, e.g. an
+ * NVSPlainValue or NVSPlainLazyValue, so it can be added to a registry.
+ *
+ * Only values which are enumerated pay for a vtable, and the introspection
+ * code is only compiled for their types:
+ *
+ *   NVSPlainValue<float> voltage(nvs, "voltage");
+ *   NVSValueAdapter<NVSPlainValue<float>> voltageEntry(voltage);
+ *   registry.add(voltageEntry);
+ *
+ * The adapter does not own the value, which must outlive it.
+ */
+template<typename Value>
+class NVSValueAdapter : public NVSValueBase {
+public:
+    explicit NVSValueAdapter(Value& value) : _value(value) {}
+
+    const std::string& key() const override { return _value.key(); }
+    bool exists() const override { return _value.exists(); }
+    std::string asString() const override { return _value.asString(); }
+    NVSValueDescriptor descriptor() const override { return _value.descriptor(); }
+    size_t serializeTo(uint8_t* buffer, size_t bufferSize) const override { return _value.serializeTo(buffer, bufferSize); }
+
+    bool hasPendingWrite() const override {
+        if constexpr (HasPendingWrite<Value>::value) {
+            return _value.hasPendingWrite();
+        } else {
+            return false;
+        }
+    }
+
+    NVSSetResult flush() override {
+        if constexpr (HasPendingWrite<Value>::value) {
+            return _value.flush();
+        } else {
+            return NVSSetResult::Unchanged;
+        }
+    }
+
+    Value& value() { return _value; }
+    const Value& value() const { return _value; }
+
+private:
+    // Lazy values never hold back writes and have no hasPendingWrite()
+    template<typename V, typename = void>
+    struct HasPendingWrite : std::false_type {};
+
+    template<typename V>
+    struct HasPendingWrite<V, std::void_t<decltype(std::declval<const V&>().hasPendingWrite())>> : std::true_type {};
+
+    Value& _value;
+};
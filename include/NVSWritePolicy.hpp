@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include "NVSValueBase.hpp"
+
+/**
+ * @brief Decision of a write policy for a changed value
+ */
+enum class NVSWriteDecision : uint8_t {
+    /**
+     * Write the new value to NVS now
+     */
+    Write = 0,
+    /**
+     * Discard the new value. The current value is considered equal.
+     */
+    Suppress = 1,
+    /**
+     * Keep the new value in RAM and write it once the policy allows it
+     */
+    Defer = 2,
+    /**
+     * Discard the new value because it must not be written, e.g. for lack of space
+     */
+    Reject = 3
+};
+
+/**
+ * @brief Milliseconds since boot, used by time-based write policies.
+ *
+ * By default, this is weakly linked to a function based on the FreeRTOS tick
+ * count. You can specify your own function, e.g. to use a different clock in tests.
+ */
+uint32_t NVSMillis();
+
+template<typename Policy, typename Value, typename = void>
+struct NVSHasBeforeWrite : std::false_type {};
+
+template<typename Policy, typename Value>
+struct NVSHasBeforeWrite<Policy, Value, std::void_t<decltype(std::declval<Policy&>().beforeWrite(std::declval<Value&>()))>>
+    : std::true_type {};
+
+/**
+ * @brief Call policy.beforeWrite(value) if the policy provides it
+ */
+template<typename Policy, typename Value>
+void NVSPolicyBeforeWrite(Policy& policy, Value& value) {
+    if constexpr (NVSHasBeforeWrite<Policy, Value>::value) {
+        policy.beforeWrite(value);
+    }
+}
+
+/**
+ * @brief Default write policy: every change is written immediately.
+ *
+ * A write policy is passed as second template argument to NVSValue and must provide:
+ *  - template<typename Value, typename T> NVSWriteDecision evaluate(Value& value, const T& current, const T& candidate)
+ *    called by set() when candidate differs from the current (RAM) value
+ *  - template<typename Value> bool mayFlush(Value& value) which tells whether a deferred value may be written now
+ *  - template<typename Value> void onWritten(Value& value) which is called after every successful write
+ * and may provide:
+ *  - template<typename Value> void beforeWrite(Value& value) which is called right before every write,
+ *    including writes of deferred values by flush()
+ * Value is the NVSValue or NVSPlainValue. A policy may take NVSValueBase& instead,
+ * in which case it can't be used with NVSPlainValue.
+ */
+struct NVSExactWritePolicy {
+    template<typename Value, typename T>
+    NVSWriteDecision evaluate(Value&, const T&, const T&) {
+        return NVSWriteDecision::Write;
+    }
+
+    template<typename Value>
+    bool mayFlush(Value&) {
+        return true;
+    }
+
+    template<typename Value>
+    void onWritten(Value&) {}
+};
+
+/**
+ * @brief Suppress writes of arithmetic values which differ by less than a tolerance.
+ *
+ * Changes are compared against the current value, which is not updated when a
+ * write is suppressed. Slowly drifting values are therefore written as soon as
+ * they have drifted further than the tolerance.
+ * Integers are compared exactly in their own type, so any change is written
+ * unless an epsilon is set. Non-arithmetic types are always written.
+ */
+class NVSToleranceWritePolicy {
+public:
+    /**
+     * @param absoluteEpsilon Changes up to this absolute difference are suppressed
+     * @param relativeEpsilon Changes up to this fraction of the larger magnitude are suppressed
+     */
+    NVSToleranceWritePolicy(double absoluteEpsilon = 0.0, double relativeEpsilon = 0.0)
+        : absoluteEpsilon(absoluteEpsilon), relativeEpsilon(relativeEpsilon) {}
+
+    template<typename Value, typename T>
+    NVSWriteDecision evaluate(Value&, const T& current, const T& candidate) {
+        if constexpr (std::is_floating_point_v<T>) {
+            double a = static_cast<double>(current);
+            double b = static_cast<double>(candidate);
+            double difference = std::fabs(a - b);
+            if(difference <= absoluteEpsilon || difference <= relativeEpsilon * std::fmax(std::fabs(a), std::fabs(b))) {
+                return NVSWriteDecision::Suppress;
+            }
+        } else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+            // Compare in the native type, a double cannot represent every 64 bit value
+            using Unsigned = std::make_unsigned_t<T>;
+            Unsigned low = static_cast<Unsigned>(std::min(current, candidate));
+            Unsigned high = static_cast<Unsigned>(std::max(current, candidate));
+            Unsigned difference = static_cast<Unsigned>(high - low);
+            if(difference == 0) {
+                return NVSWriteDecision::Suppress;
+            }
+            if(absoluteEpsilon > 0.0) {
+                if(absoluteEpsilon >= static_cast<double>(std::numeric_limits<Unsigned>::max())
+                   || difference <= static_cast<Unsigned>(absoluteEpsilon)) {
+                    return NVSWriteDecision::Suppress;
+                }
+            }
+            if(relativeEpsilon > 0.0) {
+                Unsigned magnitude = std::max(Magnitude(current), Magnitude(candidate));
+                if(static_cast<double>(difference) <= relativeEpsilon * static_cast<double>(magnitude)) {
+                    return NVSWriteDecision::Suppress;
+                }
+            }
+        }
+        return NVSWriteDecision::Write;
+    }
+
+    template<typename Value>
+    bool mayFlush(Value&) {
+        return true;
+    }
+
+    template<typename Value>
+    void onWritten(Value&) {}
+
+    double absoluteEpsilon;
+    double relativeEpsilon;
+
+private:
+    template<typename T>
+    static std::make_unsigned_t<T> Magnitude(T value) {
+        using Unsigned = std::make_unsigned_t<T>;
+        if constexpr (std::is_signed_v<T>) {
+            if(value < 0) {
+                return static_cast<Unsigned>(Unsigned(0) - static_cast<Unsigned>(value));
+            }
+        }
+        return static_cast<Unsigned>(value);
+    }
+};
+
+/**
+ * @brief Limit how often a value is written.
+ *
+ * Changes which arrive too early are held in RAM (NVSSetResult::Deferred)
+ * and written by the next set(), poll() or flush() call once the limits allow it.
+ */
+class NVSRateLimitWritePolicy {
+public:
+    /**
+     * @param minIntervalMs Minimum time between two writes, 0 to disable
+     * @param maxWritesPerHour Maximum number of writes per hour, 0 to disable
+     */
+    NVSRateLimitWritePolicy(uint32_t minIntervalMs = 0, uint32_t maxWritesPerHour = 0)
+        : minIntervalMs(minIntervalMs), maxWritesPerHour(maxWritesPerHour) {}
+
+    template<typename Value, typename T>
+    NVSWriteDecision evaluate(Value& value, const T&, const T&) {
+        return mayFlush(value) ? NVSWriteDecision::Write : NVSWriteDecision::Defer;
+    }
+
+    template<typename Value>
+    bool mayFlush(Value&) {
+        uint32_t now = NVSMillis();
+        if(_written && minIntervalMs > 0 && now - _lastWriteMs < minIntervalMs) {
+            return false;
+        }
+        if(maxWritesPerHour > 0) {
+            if(now - _windowStartMs >= MillisecondsPerHour) {
+                _windowStartMs = now;
+                _windowWrites = 0;
+            }
+            if(_windowWrites >= maxWritesPerHour) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename Value>
+    void onWritten(Value&) {
+        uint32_t now = NVSMillis();
+        if(!_written || now - _windowStartMs >= MillisecondsPerHour) {
+            _windowStartMs = now;
+            _windowWrites = 0;
+        }
+        _written = true;
+        _lastWriteMs = now;
+        _windowWrites++;
+    }
+
+    uint32_t minIntervalMs;
+    uint32_t maxWritesPerHour;
+
+private:
+    static constexpr uint32_t MillisecondsPerHour = 3600UL * 1000UL;
+
+    bool _written = false;
+    uint32_t _lastWriteMs = 0;
+    uint32_t _windowStartMs = 0;
+    uint32_t _windowWrites = 0;
+};
+
+/**
+ * @brief Apply two policies: a change is suppressed or rejected if either policy
+ * suppresses or rejects it, otherwise deferred if either defers it.
+ *
+ * Example: NVSCombinedWritePolicy<NVSToleranceWritePolicy, NVSRateLimitWritePolicy>
+ */
+template<typename First, typename Second>
+class NVSCombinedWritePolicy {
+public:
+    NVSCombinedWritePolicy(const First& first = First(), const Second& second = Second())
+        : first(first), second(second) {}
+
+    template<typename Value, typename T>
+    NVSWriteDecision evaluate(Value& value, const T& current, const T& candidate) {
+        NVSWriteDecision firstDecision = first.evaluate(value, current, candidate);
+        if(firstDecision == NVSWriteDecision::Suppress || firstDecision == NVSWriteDecision::Reject) {
+            return firstDecision;
+        }
+        NVSWriteDecision secondDecision = second.evaluate(value, current, candidate);
+        if(secondDecision == NVSWriteDecision::Write) {
+            return firstDecision;
+        }
+        return secondDecision;
+    }
+
+    template<typename Value>
+    bool mayFlush(Value& value) {
+        // Evaluate both so that stateful policies can update their windows
+        bool firstAllows = first.mayFlush(value);
+        bool secondAllows = second.mayFlush(value);
+        return firstAllows && secondAllows;
+    }
+
+    template<typename Value>
+    void beforeWrite(Value& value) {
+        NVSPolicyBeforeWrite(first, value);
+        NVSPolicyBeforeWrite(second, value);
+    }
+
+    template<typename Value>
+    void onWritten(Value& value) {
+        first.onWritten(value);
+        second.onWritten(value);
+    }
+
+    First first;
+    Second second;
+};
@@ -0,0 +1,282 @@
+#pragma once
+#include <cstddef>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "NVSSpace.hpp"
+#include "NVSValueBase.hpp"
+#include "NVSWritePolicy.hpp"
+
+/**
+ * @brief A value whose write is held back until the next write window
+ */
+struct NVSWriteSchedulerEntry {
+    NVSValueBase* value;
+    /**
+     * NVSMillis() when the value was first deferred
+     */
+    uint32_t sinceMs;
+    NVSWritePriority priority;
+    /**
+     * Set while a drain has already tried to write the value
+     */
+    bool attempted;
+    /**
+     * Set when the staleness deadline allowed the write outside a window
+     */
+    bool forced;
+};
+
+/**
+ * @brief Write metrics of an NVSWriteScheduler
+ */
+struct NVSWriteSchedulerStats {
+    /**
+     * Writes which happened immediately because a window was open
+     */
+    uint32_t immediateWrites;
+    /**
+     * Deferred writes written in a window
+     */
+    uint32_t windowWrites;
+    /**
+     * Deferred writes forced outside a window by the staleness deadline
+     */
+    uint32_t forcedWrites;
+    /**
+     * Deferred writes flushed outside a window before their deadline,
+     * e.g. by NVSValueRegistry::flush()
+     */
+    uint32_t flushedWrites;
+    /**
+     * Values which could not be queued because the queue was full
+     */
+    uint32_t overflows;
+    /**
+     * Values currently held back
+     */
+    uint32_t pending;
+    /**
+     * Longest and total time deferred writes were held back
+     */
+    uint32_t maxDeferredMs;
+    uint64_t totalDeferredMs;
+
+    uint32_t averageDeferredMs() const {
+        uint32_t deferred = windowWrites + forcedWrites + flushedWrites;
+        return deferred > 0 ? static_cast<uint32_t>(totalDeferredMs / deferred) : 0;
+    }
+};
+
+/**
+ * @brief Restricts flash writes to windows opened by the application.
+ *
+ * Writing to NVS disables the flash cache, which stalls both cores, so
+ * timing-critical phases must not write. Values using NVSWindowWritePolicy
+ * are written immediately while a window is open. Outside a window, their
+ * writes are deferred: the new value is served from RAM and queued here.
+ * openWindow() drains the queue, higher priorities and older values first.
+ *
+ * If maxStalenessMs is set, a value which has been held back for longer is
+ * written by poll() or by the value's own poll() even if no window is open.
+ * Call poll() where a write is acceptable but a window would be too long,
+ * msUntilDeadline() tells how long it can be postponed.
+ *
+ * NVSWindowWritePolicy cancels the queued write of its value when the value
+ * is destroyed, moved from or assigned to. A value which does not fit into a full queue is still deferred, but only
+ * written by its own poll() or flush(), e.g. NVSValueRegistry::flush().
+ *
+ * All methods are thread-safe. Values are written without holding the lock,
+ * cancel() waits until a drain on another task has finished writing the value.
+ * Entry storage is provided by the caller, see NVSStaticWriteScheduler.
+ */
+class NVSWriteScheduler {
+public:
+    /**
+     * @param maxStalenessMs Maximum time a write is held back, 0 to wait for a window indefinitely
+     */
+    NVSWriteScheduler(NVSWriteSchedulerEntry* entries, size_t capacity, uint32_t maxStalenessMs = 0);
+
+    NVSWriteScheduler(const NVSWriteScheduler&) = delete;
+    NVSWriteScheduler& operator=(const NVSWriteScheduler&) = delete;
+
+    /**
+     * @brief Allow writes and write all queued values
+     * @return Number of values which failed to write
+     */
+    size_t openWindow();
+
+    /**
+     * @brief Hold back writes from now on. A running drain stops after the current value.
+     */
+    void closeWindow();
+
+    bool windowOpen();
+
+    /**
+     * @brief Write all queued values if a window is open
+     * @return Number of values which failed to write
+     */
+    size_t drain();
+
+    /**
+     * @brief Write the values which have been held back for maxStalenessMs, even outside a window
+     * @return Number of values which failed to write
+     */
+    size_t poll();
+
+    /**
+     * @brief Time until poll() has to write the oldest queued value,
+     * 0 if it is overdue, UINT32_MAX if nothing is queued or there is no deadline
+     */
+    uint32_t msUntilDeadline();
+
+    uint32_t maxStalenessMs();
+    void setMaxStalenessMs(uint32_t maxStalenessMs);
+
+    NVSWriteSchedulerStats stats();
+    void resetStats();
+
+    /**
+     * @brief Called by the write policy for a changed value
+     * @return true if it may be written now, false if it has been deferred
+     */
+    bool request(NVSValueBase& value, NVSWritePriority priority);
+
+    /**
+     * @brief Whether a deferred value may be written now
+     */
+    bool mayWrite(NVSValueBase& value);
+
+    /**
+     * @brief Called by the write policy after a successful write
+     */
+    void written(NVSValueBase& value);
+
+    /**
+     * @brief Remove a value from the queue without writing it.
+     * Waits if a drain is currently writing the value, so it may be destroyed afterwards.
+     */
+    void cancel(NVSValueBase& value);
+
+private:
+    enum class DrainMode : uint8_t {
+        Window,
+        Overdue
+    };
+
+    size_t Drain(DrainMode mode);
+    NVSWriteSchedulerEntry* Find(const NVSValueBase& value);
+    void Remove(NVSWriteSchedulerEntry* entry);
+    bool Overdue(const NVSWriteSchedulerEntry& entry, uint32_t now) const;
+
+    std::mutex _mutex;
+    // Signalled when a drain has finished writing _writing
+    std::condition_variable _written;
+    NVSValueBase* _writing;
+    NVSWriteSchedulerEntry* _entries;
+    size_t _capacity;
+    size_t _count;
+    uint32_t _maxStalenessMs;
+    bool _open;
+    NVSWriteSchedulerStats _stats;
+};
+
+/**
+ * @brief NVSWriteScheduler with storage for Capacity queued values inside the object.
+ */
+template<size_t Capacity>
+class NVSStaticWriteScheduler : public NVSWriteScheduler {
+public:
+    explicit NVSStaticWriteScheduler(uint32_t maxStalenessMs = 0) : NVSWriteScheduler(_storage, Capacity, maxStalenessMs) {}
+
+private:
+    NVSWriteSchedulerEntry _storage[Capacity];
+};
+
+/**
+ * @brief Write policy which defers writes outside the windows of an NVSWriteScheduler.
+ *
+ * Example:
+ *   NVSStaticWriteScheduler<8> scheduler(60 * 1000);
+ *   NVSValue<float, NVSWindowWritePolicy> offset(nvs, "offset", 0.0f, NVSWindowWritePolicy(scheduler, NVSWritePriority::Critical));
+ */
+class NVSWindowWritePolicy {
+public:
+    NVSWindowWritePolicy() : scheduler(nullptr), priority(NVSWritePriority::Normal), _queued(nullptr) {}
+    NVSWindowWritePolicy(NVSWriteScheduler& scheduler, NVSWritePriority priority = NVSWritePriority::Normal)
+        : scheduler(&scheduler), priority(priority), _queued(nullptr) {}
+
+    /**
+     * A copy belongs to another value, which has nothing queued yet
+     */
+    NVSWindowWritePolicy(const NVSWindowWritePolicy& other)
+        : scheduler(other.scheduler), priority(other.priority), _queued(nullptr) {}
+
+    /**
+     * The moved-from value discards its pending write, so its queue entry is cancelled
+     */
+    NVSWindowWritePolicy(NVSWindowWritePolicy&& other)
+        : scheduler(other.scheduler), priority(other.priority), _queued(nullptr) {
+        other.Cancel();
+    }
+
+    NVSWindowWritePolicy& operator=(const NVSWindowWritePolicy& other) {
+        if(this != &other) {
+            // The value is assigned and reread, which discards its pending write
+            Cancel();
+            scheduler = other.scheduler;
+            priority = other.priority;
+        }
+        return *this;
+    }
+
+    NVSWindowWritePolicy& operator=(NVSWindowWritePolicy&& other) {
+        if(this != &other) {
+            Cancel();
+            other.Cancel();
+            scheduler = other.scheduler;
+            priority = other.priority;
+        }
+        return *this;
+    }
+
+    ~NVSWindowWritePolicy() {
+        Cancel();
+    }
+
+    template<typename T>
+    NVSWriteDecision evaluate(NVSValueBase& value, const T&, const T&) {
+        if(scheduler == nullptr || scheduler->request(value, priority)) {
+            return NVSWriteDecision::Write;
+        }
+        _queued = &value;
+        return NVSWriteDecision::Defer;
+    }
+
+    bool mayFlush(NVSValueBase& value) {
+        return scheduler == nullptr || scheduler->mayWrite(value);
+    }
+
+    void onWritten(NVSValueBase& value) {
+        if(scheduler != nullptr) {
+            scheduler->written(value);
+        }
+        _queued = nullptr;
+    }
+
+    NVSWriteScheduler* scheduler;
+    NVSWritePriority priority;
+
+private:
+    void Cancel() {
+        if(scheduler != nullptr && _queued != nullptr) {
+            scheduler->cancel(*_queued);
+        }
+        _queued = nullptr;
+    }
+
+    // The value whose write may be queued in scheduler
+    NVSValueBase* _queued;
+};
@@ -0,0 +1,125 @@
+#include "NVSArena.hpp"
+
+#include <algorithm>
+
+namespace {
+size_t AlignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+NVSArena::NVSArena(void* buffer, size_t size, uint32_t fallbackCaps) {
+    Initialize(buffer, size, fallbackCaps);
+}
+
+void NVSArena::Initialize(void* buffer, size_t size, uint32_t fallbackCaps) {
+    _fallbackCaps = fallbackCaps;
+    _stats = {};
+    if(buffer == nullptr) {
+        return;
+    }
+    // Align the usable region so that every block starts at an aligned address
+    uintptr_t address = reinterpret_cast<uintptr_t>(buffer);
+    size_t padding = AlignUp(address, Alignment) - address;
+    if(size < padding + Alignment) {
+        return;
+    }
+    size = (size - padding) / Alignment * Alignment;
+    _begin = static_cast<uint8_t*>(buffer) + padding;
+    _end = _begin + size;
+    _freeList = reinterpret_cast<FreeBlock*>(_begin);
+    _freeList->size = size;
+    _freeList->next = nullptr;
+    _stats.capacity = size;
+}
+
+bool NVSArena::owns(const void* pointer) const {
+    const uint8_t* bytes = static_cast<const uint8_t*>(pointer);
+    return bytes >= _begin && bytes < _end;
+}
+
+void* NVSArena::FallbackAllocate(size_t size) {
+    void* memory = _fallbackCaps != 0 ? heap_caps_malloc(size, _fallbackCaps) : nullptr;
+    if(memory != nullptr) {
+        _stats.fallbackAllocations++;
+    } else {
+        _stats.failedAllocations++;
+    }
+    return memory;
+}
+
+void* NVSArena::allocate(size_t size, size_t alignment) {
+    _stats.allocations++;
+    if(alignment > Alignment) {
+        return FallbackAllocate(size);
+    }
+    size_t blockSize = AlignUp(std::max<size_t>(size, 1) + HeaderSize, Alignment);
+
+    FreeBlock** link = &_freeList;
+    while(*link != nullptr && (*link)->size < blockSize) {
+        link = &(*link)->next;
+    }
+    FreeBlock* block = *link;
+    if(block == nullptr) {
+        return FallbackAllocate(size);
+    }
+
+    if(block->size - blockSize >= HeaderSize + Alignment) {
+        // Split: the remainder stays in the free list at the same position
+        FreeBlock* remainder = reinterpret_cast<FreeBlock*>(reinterpret_cast<uint8_t*>(block) + blockSize);
+        remainder->size = block->size - blockSize;
+        remainder->next = block->next;
+        *link = remainder;
+    } else {
+        blockSize = block->size;
+        *link = block->next;
+    }
+
+    *reinterpret_cast<size_t*>(block) = blockSize;
+    _stats.used += blockSize;
+    _stats.highWaterMark = std::max(_stats.highWaterMark, _stats.used);
+    return reinterpret_cast<uint8_t*>(block) + HeaderSize;
+}
+
+void NVSArena::deallocate(void* pointer) {
+    if(pointer == nullptr) {
+        return;
+    }
+    if(!owns(pointer)) {
+        heap_caps_free(pointer);
+        return;
+    }
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(static_cast<uint8_t*>(pointer) - HeaderSize);
+    block->size = *reinterpret_cast<size_t*>(block);
+    _stats.used -= block->size;
+
+    // Insert in address order and merge with adjacent free blocks
+    FreeBlock* previous = nullptr;
+    FreeBlock* next = _freeList;
+    while(next != nullptr && next < block) {
+        previous = next;
+        next = next->next;
+    }
+    block->next = next;
+    if(next != nullptr && reinterpret_cast<uint8_t*>(block) + block->size == reinterpret_cast<uint8_t*>(next)) {
+        block->size += next->size;
+        block->next = next->next;
+    }
+    if(previous != nullptr && reinterpret_cast<uint8_t*>(previous) + previous->size == reinterpret_cast<uint8_t*>(block)) {
+        previous->size += block->size;
+        previous->next = block->next;
+    } else if(previous != nullptr) {
+        previous->next = block;
+    } else {
+        _freeList = block;
+    }
+}
+
+NVSCapsArena::NVSCapsArena(size_t size, uint32_t caps, uint32_t fallbackCaps)
+    : _buffer(heap_caps_malloc(size, caps)) {
+    Initialize(_buffer, _buffer != nullptr ? size : 0, fallbackCaps);
+}
+
+NVSCapsArena::~NVSCapsArena() {
+    heap_caps_free(_buffer);
+}
@@ -0,0 +1,121 @@
+#include "NVSCoherence.hpp"
+
+#if CONFIG_ESPNVSVALUE_COHERENCE
+#include <limits>
+#include <mutex>
+
+#include "NVSHash.hpp"
+
+/**
+ * @brief Hash table of all linked instances, one intrusive list per bucket.
+ * Instances of the same handle and key always share a bucket.
+ */
+class NVSCoherenceDirectory {
+public:
+    static constexpr size_t BucketCount = 16;
+
+    static size_t BucketOf(nvs_handle_t handle, uint32_t keyHash) {
+        return (static_cast<size_t>(handle) * 31 + keyHash) % BucketCount;
+    }
+
+    static bool IsPeer(const NVSCoherenceNode& node, const NVSCoherenceNode& other) {
+        return &other != &node && other._handle == node._handle && other._keyHash == node._keyHash
+            && other._ops->key(other) == node._ops->key(node);
+    }
+
+    static void Link(NVSCoherenceNode& node) {
+        NVSCoherenceNode*& head = buckets[BucketOf(node._handle, node._keyHash)];
+        node._prev = nullptr;
+        node._next = head;
+        if(head != nullptr) {
+            head->_prev = &node;
+        }
+        head = &node;
+        node._linked = true;
+        stats.linked++;
+    }
+
+    static void Unlink(NVSCoherenceNode& node) {
+        if(!node._linked) {
+            return;
+        }
+        if(node._prev != nullptr) {
+            node._prev->_next = node._next;
+        } else {
+            buckets[BucketOf(node._handle, node._keyHash)] = node._next;
+        }
+        if(node._next != nullptr) {
+            node._next->_prev = node._prev;
+        }
+        node._next = nullptr;
+        node._prev = nullptr;
+        node._linked = false;
+        stats.linked--;
+    }
+
+    static std::mutex mutex;
+    static NVSCoherenceNode* buckets[BucketCount];
+    static NVSCoherenceStats stats;
+};
+
+std::mutex NVSCoherenceDirectory::mutex;
+NVSCoherenceNode* NVSCoherenceDirectory::buckets[NVSCoherenceDirectory::BucketCount] = {};
+NVSCoherenceStats NVSCoherenceDirectory::stats = {};
+
+void NVSCoherenceNode::Attach(nvs_handle_t handle, const std::string& key) {
+    std::lock_guard<std::mutex> lock(NVSCoherenceDirectory::mutex);
+    NVSCoherenceDirectory::Unlink(*this);
+    if(handle == std::numeric_limits<nvs_handle_t>::max() || key.empty()) {
+        return;
+    }
+    _handle = handle;
+    _keyHash = NVSCrc32(key.data(), key.size());
+    NVSCoherenceDirectory::Link(*this);
+}
+
+void NVSCoherenceNode::Detach() {
+    std::lock_guard<std::mutex> lock(NVSCoherenceDirectory::mutex);
+    NVSCoherenceDirectory::Unlink(*this);
+}
+
+void NVSCoherenceNode::Publish(const void* data, size_t size) {
+    std::lock_guard<std::mutex> lock(NVSCoherenceDirectory::mutex);
+    if(!_linked) {
+        return;
+    }
+    NVSCoherenceNode* peer = NVSCoherenceDirectory::buckets[NVSCoherenceDirectory::BucketOf(_handle, _keyHash)];
+    for(; peer != nullptr; peer = peer->_next) {
+        if(NVSCoherenceDirectory::IsPeer(*this, *peer)) {
+            peer->_ops->applyWrite(*peer, data, size);
+            NVSCoherenceDirectory::stats.peerUpdates++;
+        }
+    }
+}
+
+bool NVSCoherenceNode::ReadPeer(NVSCoherenceSink sink, void* context) const {
+    std::lock_guard<std::mutex> lock(NVSCoherenceDirectory::mutex);
+    if(!_linked) {
+        return false;
+    }
+    const NVSCoherenceNode* peer = NVSCoherenceDirectory::buckets[NVSCoherenceDirectory::BucketOf(_handle, _keyHash)];
+    for(; peer != nullptr; peer = peer->_next) {
+        const void* data = nullptr;
+        size_t size = 0;
+        if(NVSCoherenceDirectory::IsPeer(*this, *peer) && peer->_ops->cachedValue(*peer, data, size)) {
+            sink(context, data, size);
+            NVSCoherenceDirectory::stats.peerReads++;
+            return true;
+        }
+    }
+    return false;
+}
+
+NVSCoherenceStats NVSCoherenceGetStats() {
+    std::lock_guard<std::mutex> lock(NVSCoherenceDirectory::mutex);
+    return NVSCoherenceDirectory::stats;
+}
+#else
+NVSCoherenceStats NVSCoherenceGetStats() {
+    return NVSCoherenceStats{};
+}
+#endif
@@ -0,0 +1,533 @@
+#include "NVSExport.hpp"
+#include "NVSHash.hpp"
+#include "NVSLog.hpp"
+#include "NVSTrace.hpp"
+#include "NVSUtils.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+namespace {
+constexpr uint8_t Magic[4] = {'N', 'V', 'S', 'X'};
+constexpr uint8_t EndMarker = 0x00;
+// type + key length + key + 5 bytes LEB128 length
+constexpr size_t MaxRecordHeaderSize = 2 + 15 + 5;
+/**
+ * NVS strings can hold at most 4000 bytes including the null terminator
+ */
+constexpr size_t MaxStringLength = 4000 - 1;
+/**
+ * Largest blob NVS can store, independent of the partition size
+ */
+constexpr size_t MaxBlobLength = 508000;
+/**
+ * Stack window used to compare imported values with the stored ones
+ */
+constexpr size_t CompareWindowSize = 32;
+
+bool IsIntegerType(nvs_type_t type) {
+    switch(type) {
+        case NVS_TYPE_U8: case NVS_TYPE_I8:
+        case NVS_TYPE_U16: case NVS_TYPE_I16:
+        case NVS_TYPE_U32: case NVS_TYPE_I32:
+        case NVS_TYPE_U64: case NVS_TYPE_I64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * The low nibble of integer nvs_type_t values is their width in bytes
+ */
+size_t IntegerWidth(nvs_type_t type) {
+    return static_cast<size_t>(type) & 0x0F;
+}
+
+size_t EncodeRecordHeader(uint8_t* out, nvs_type_t type, const char* key, size_t keyLength, bool withLength, size_t payloadLength) {
+    size_t pos = 0;
+    out[pos++] = static_cast<uint8_t>(type);
+    out[pos++] = static_cast<uint8_t>(keyLength);
+    memcpy(out + pos, key, keyLength);
+    pos += keyLength;
+    if(withLength) {
+        do {
+            uint8_t byte = payloadLength & 0x7F;
+            payloadLength >>= 7;
+            out[pos++] = byte | (payloadLength != 0 ? 0x80 : 0x00);
+        } while(payloadLength != 0);
+    }
+    return pos;
+}
+
+template<typename Int>
+esp_err_t ReadIntegerAs(esp_err_t (*getter)(nvs_handle_t, const char*, Int*), nvs_handle_t nvs, const char* key, uint64_t& raw) {
+    Int value;
+    esp_err_t err = getter(nvs, key, &value);
+    raw = static_cast<uint64_t>(static_cast<std::make_unsigned_t<Int>>(value));
+    return err;
+}
+
+esp_err_t ReadInteger(nvs_handle_t nvs, const char* key, nvs_type_t type, uint64_t& raw) {
+    switch(type) {
+        case NVS_TYPE_U8: return ReadIntegerAs<uint8_t>(NVSFlashGetU8, nvs, key, raw);
+        case NVS_TYPE_I8: return ReadIntegerAs<int8_t>(NVSFlashGetI8, nvs, key, raw);
+        case NVS_TYPE_U16: return ReadIntegerAs<uint16_t>(NVSFlashGetU16, nvs, key, raw);
+        case NVS_TYPE_I16: return ReadIntegerAs<int16_t>(NVSFlashGetI16, nvs, key, raw);
+        case NVS_TYPE_U32: return ReadIntegerAs<uint32_t>(NVSFlashGetU32, nvs, key, raw);
+        case NVS_TYPE_I32: return ReadIntegerAs<int32_t>(NVSFlashGetI32, nvs, key, raw);
+        case NVS_TYPE_U64: return ReadIntegerAs<uint64_t>(NVSFlashGetU64, nvs, key, raw);
+        case NVS_TYPE_I64: return ReadIntegerAs<int64_t>(NVSFlashGetI64, nvs, key, raw);
+        default: return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+}
+
+template<typename Int>
+esp_err_t WriteIntegerAs(esp_err_t (*setter)(nvs_handle_t, const char*, Int), nvs_handle_t nvs, const char* key, uint64_t raw) {
+    return setter(nvs, key, static_cast<Int>(static_cast<std::make_unsigned_t<Int>>(raw)));
+}
+
+esp_err_t WriteInteger(nvs_handle_t nvs, const char* key, nvs_type_t type, uint64_t raw) {
+    switch(type) {
+        case NVS_TYPE_U8: return WriteIntegerAs<uint8_t>(NVSFlashSetU8, nvs, key, raw);
+        case NVS_TYPE_I8: return WriteIntegerAs<int8_t>(NVSFlashSetI8, nvs, key, raw);
+        case NVS_TYPE_U16: return WriteIntegerAs<uint16_t>(NVSFlashSetU16, nvs, key, raw);
+        case NVS_TYPE_I16: return WriteIntegerAs<int16_t>(NVSFlashSetI16, nvs, key, raw);
+        case NVS_TYPE_U32: return WriteIntegerAs<uint32_t>(NVSFlashSetU32, nvs, key, raw);
+        case NVS_TYPE_I32: return WriteIntegerAs<int32_t>(NVSFlashSetI32, nvs, key, raw);
+        case NVS_TYPE_U64: return WriteIntegerAs<uint64_t>(NVSFlashSetU64, nvs, key, raw);
+        case NVS_TYPE_I64: return WriteIntegerAs<int64_t>(NVSFlashSetI64, nvs, key, raw);
+        default: return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+}
+
+/**
+ * @brief Query the stored size of a string or blob entry.
+ * For strings, the size includes the null terminator.
+ */
+esp_err_t QueryVariableSize(nvs_handle_t nvs, const char* key, nvs_type_t type, size_t& size) {
+    size = 0;
+    return type == NVS_TYPE_STR ? NVSFlashGetStr(nvs, key, nullptr, &size) : NVSFlashGetBlob(nvs, key, nullptr, &size);
+}
+
+esp_err_t ReadVariable(nvs_handle_t nvs, const char* key, nvs_type_t type, uint8_t* out, size_t& size) {
+    return type == NVS_TYPE_STR ? NVSFlashGetStr(nvs, key, reinterpret_cast<char*>(out), &size) : NVSFlashGetBlob(nvs, key, out, &size);
+}
+} // namespace
+
+NVSExporter::NVSExporter(NVSExportSink sink, void* context)
+    : _sink(sink), _context(context), _result(NVSTransferResult::OK), _crc(0), _fill(0), _stats() {}
+
+NVSTransferResult NVSExporter::exportNamespace(nvs_handle_t nvs, const char* partition, const char* namespc) {
+    if(!Begin()) {
+        return _result;
+    }
+
+    NVSQueryResult iterationResult = NVSForEachEntry(partition, namespc, NVS_TYPE_ANY, [this, nvs](const nvs_entry_info_t& info) {
+        return ExportEntry(nvs, info.key, info.type);
+    });
+    if(_result != NVSTransferResult::OK) {
+        return _result;
+    }
+    if(iterationResult == NVSQueryResult::Error) {
+        return NVSTransferResult::NVSError;
+    }
+
+    if(!Finish()) {
+        return _result;
+    }
+    NVSDebugPrintf("Exported %u records (%u bytes) from namespace %s", _stats.records, _stats.bytes, namespc);
+    return NVSTransferResult::OK;
+}
+
+NVSTransferResult NVSExporter::exportKeys(nvs_handle_t nvs, NVSKeySource next, void* context) {
+    if(!Begin()) {
+        return _result;
+    }
+
+    for(const char* key = next(context); key != nullptr; key = next(context)) {
+        // Value classes only write blobs and strings, so probe these instead of iterating the namespace
+        size_t size = 0;
+        nvs_type_t type;
+        if(NVSFlashGetBlob(nvs, key, nullptr, &size) == ESP_OK) {
+            type = NVS_TYPE_BLOB;
+        } else if(NVSFlashGetStr(nvs, key, nullptr, &size) == ESP_OK) {
+            type = NVS_TYPE_STR;
+        } else {
+            NVSDebugPrintf("Key %s does not exist as blob or string, not exporting it", key);
+            _stats.skipped++;
+            continue;
+        }
+        if(!ExportEntry(nvs, key, type)) {
+            return _result;
+        }
+    }
+
+    if(!Finish()) {
+        return _result;
+    }
+    NVSDebugPrintf("Exported %u records (%u bytes)", _stats.records, _stats.bytes);
+    return NVSTransferResult::OK;
+}
+
+bool NVSExporter::Begin() {
+    _result = NVSTransferResult::OK;
+    _crc = 0;
+    _fill = 0;
+    _stats = NVSExportStats();
+    return Put(Magic, sizeof(Magic)) && PutByte(NVSTransferFormatVersion);
+}
+
+bool NVSExporter::Finish() {
+    if(!PutByte(EndMarker)) {
+        return false;
+    }
+    uint32_t crc = _crc;
+    uint8_t trailer[4] = {
+        static_cast<uint8_t>(crc), static_cast<uint8_t>(crc >> 8),
+        static_cast<uint8_t>(crc >> 16), static_cast<uint8_t>(crc >> 24)
+    };
+    return Put(trailer, sizeof(trailer)) && Flush();
+}
+
+bool NVSExporter::ExportEntry(nvs_handle_t nvs, const char* key, nvs_type_t type) {
+    size_t keyLength = strnlen(key, 15);
+    uint8_t header[MaxRecordHeaderSize];
+
+    if(IsIntegerType(type)) {
+        uint64_t raw = 0;
+        esp_err_t err = ReadInteger(nvs, key, type, raw);
+        if(err != ESP_OK) {
+            NVSWarningPrintf("Failed to read NVS key %s for export: %s", key, esp_err_to_name(err));
+            _stats.skipped++;
+            return true;
+        }
+        size_t headerSize = EncodeRecordHeader(header, type, key, keyLength, false, 0);
+        uint8_t payload[8];
+        size_t width = IntegerWidth(type);
+        for(size_t i = 0; i < width; ++i) {
+            payload[i] = static_cast<uint8_t>(raw >> (8 * i));
+        }
+        if(!Put(header, headerSize) || !Put(payload, width)) {
+            return false;
+        }
+        _stats.records++;
+        return true;
+    }
+
+    if(type != NVS_TYPE_STR && type != NVS_TYPE_BLOB) {
+        NVSWarningPrintf("Skipping NVS key %s with unsupported type 0x%02x", key, type);
+        _stats.skipped++;
+        return true;
+    }
+
+    size_t storedSize = 0;
+    esp_err_t err = QueryVariableSize(nvs, key, type, storedSize);
+    if(err != ESP_OK) {
+        NVSWarningPrintf("Failed to query NVS key %s for export: %s", key, esp_err_to_name(err));
+        _stats.skipped++;
+        return true;
+    }
+    // Strings are stored with a null terminator which is not exported
+    size_t payloadLength = (type == NVS_TYPE_STR && storedSize > 0) ? storedSize - 1 : storedSize;
+    size_t headerSize = EncodeRecordHeader(header, type, key, keyLength, true, payloadLength);
+
+    if(headerSize + storedSize <= NVSTransferBufferSize) {
+        // Read the value directly into the output buffer behind its header
+        if(_fill + headerSize + storedSize > NVSTransferBufferSize && !Flush()) {
+            return false;
+        }
+        uint8_t* record = _buffer + _fill;
+        size_t readSize = storedSize;
+        if((err = ReadVariable(nvs, key, type, record + headerSize, readSize)) != ESP_OK) {
+            NVSWarningPrintf("Failed to read NVS key %s for export: %s", key, esp_err_to_name(err));
+            _stats.skipped++;
+            return true;
+        }
+        memcpy(record, header, headerSize);
+        _crc = NVSCrc32(record, headerSize + payloadLength, _crc);
+        _fill += headerSize + payloadLength;
+        _stats.bytes += headerSize + payloadLength;
+        _stats.records++;
+        return true;
+    }
+
+    if(!allowHeapForLargeValues) {
+        NVSWarningPrintf("Skipping NVS key %s: %d bytes exceed the transfer buffer", key, storedSize);
+        _stats.skipped++;
+        return true;
+    }
+    std::unique_ptr<uint8_t[]> temporary(new (std::nothrow) uint8_t[storedSize]);
+    if(!temporary) {
+        NVSErrorPrintf("Failed to allocate %d bytes to export NVS key %s", storedSize, key);
+        _result = NVSTransferResult::NoMemory;
+        return false;
+    }
+    _stats.heapFallbacks++;
+    size_t readSize = storedSize;
+    if((err = ReadVariable(nvs, key, type, temporary.get(), readSize)) != ESP_OK) {
+        NVSWarningPrintf("Failed to read NVS key %s for export: %s", key, esp_err_to_name(err));
+        _stats.skipped++;
+        return true;
+    }
+    if(!Put(header, headerSize) || !Put(temporary.get(), payloadLength)) {
+        return false;
+    }
+    _stats.records++;
+    return true;
+}
+
+bool NVSExporter::Put(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    _crc = NVSCrc32(bytes, size, _crc);
+    _stats.bytes += size;
+    while(size > 0) {
+        if(_fill == NVSTransferBufferSize && !Flush()) {
+            return false;
+        }
+        size_t chunk = std::min(size, NVSTransferBufferSize - _fill);
+        memcpy(_buffer + _fill, bytes, chunk);
+        _fill += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+bool NVSExporter::PutByte(uint8_t byte) {
+    return Put(&byte, 1);
+}
+
+bool NVSExporter::Flush() {
+    if(_fill == 0) {
+        return true;
+    }
+    if(!_sink(_context, _buffer, _fill)) {
+        NVSErrorPrintf("Export sink rejected %d bytes", _fill);
+        _result = NVSTransferResult::SinkError;
+        return false;
+    }
+    _fill = 0;
+    return true;
+}
+
+NVSImporter::NVSImporter(NVSImportSource source, void* context)
+    : _source(source), _context(context), _crc(0), _position(0), _available(0), _stats() {}
+
+NVSTransferResult NVSImporter::importNamespace(nvs_handle_t nvs) {
+    _crc = 0;
+    _position = 0;
+    _available = 0;
+    _stats = NVSImportStats();
+
+    uint8_t header[sizeof(Magic) + 1];
+    if(!Get(header, sizeof(header))) {
+        return NVSTransferResult::Truncated;
+    }
+    if(memcmp(header, Magic, sizeof(Magic)) != 0 || header[sizeof(Magic)] != NVSTransferFormatVersion) {
+        NVSErrorPrintf("Import stream has an invalid header");
+        return NVSTransferResult::FormatError;
+    }
+
+    while(true) {
+        uint8_t type;
+        if(!GetByte(type)) {
+            return NVSTransferResult::Truncated;
+        }
+        if(type == EndMarker) {
+            break;
+        }
+        uint8_t keyLength;
+        if(!GetByte(keyLength)) {
+            return NVSTransferResult::Truncated;
+        }
+        if(keyLength == 0 || keyLength > 15) {
+            NVSErrorPrintf("Import stream contains an invalid key length %d", keyLength);
+            return NVSTransferResult::FormatError;
+        }
+        char key[16];
+        if(!Get(key, keyLength)) {
+            return NVSTransferResult::Truncated;
+        }
+        key[keyLength] = '\0';
+
+        NVSTransferResult result = ImportRecord(nvs, static_cast<nvs_type_t>(type), key);
+        if(result != NVSTransferResult::OK) {
+            return result;
+        }
+        _stats.records++;
+    }
+
+    uint32_t expectedCrc = _crc;
+    uint8_t trailer[4];
+    if(!Get(trailer, sizeof(trailer))) {
+        return NVSTransferResult::Truncated;
+    }
+    uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<uint32_t>(trailer[3]) << 24);
+    if(crc != expectedCrc) {
+        NVSErrorPrintf("Import stream checksum mismatch");
+        return NVSTransferResult::ChecksumMismatch;
+    }
+
+    if(!dryRun && _stats.written > 0) {
+        esp_err_t err = NVSFlashCommit(nvs);
+        if(err != ESP_OK) {
+            NVSErrorPrintf("Failed to commit imported values: %s", esp_err_to_name(err));
+            return NVSTransferResult::NVSError;
+        }
+    }
+    NVSDebugPrintf("Imported %u records: %u written, %u unchanged", _stats.records, _stats.written, _stats.unchanged);
+    return NVSTransferResult::OK;
+}
+
+NVSTransferResult NVSImporter::ImportRecord(nvs_handle_t nvs, nvs_type_t type, const char* key) {
+    if(IsIntegerType(type)) {
+        uint8_t payload[8];
+        size_t width = IntegerWidth(type);
+        if(!Get(payload, width)) {
+            return NVSTransferResult::Truncated;
+        }
+        uint64_t raw = 0;
+        for(size_t i = 0; i < width; ++i) {
+            raw |= static_cast<uint64_t>(payload[i]) << (8 * i);
+        }
+        return ApplyInteger(nvs, type, key, raw);
+    }
+
+    if(type != NVS_TYPE_STR && type != NVS_TYPE_BLOB) {
+        NVSErrorPrintf("Import stream contains unsupported type 0x%02x for key %s", type, key);
+        return NVSTransferResult::FormatError;
+    }
+
+    size_t length;
+    NVSTransferResult lengthResult = GetLength(length);
+    if(lengthResult != NVSTransferResult::OK) {
+        return lengthResult;
+    }
+    // Checked before allocating, the length comes from an untrusted stream
+    if(length > (type == NVS_TYPE_STR ? MaxStringLength : MaxBlobLength)) {
+        NVSErrorPrintf("Import stream contains %d bytes for key %s, more than NVS can store", length, key);
+        return NVSTransferResult::FormatError;
+    }
+    // One extra byte for the null terminator of strings
+    if(length < NVSTransferBufferSize) {
+        return ApplyVariable(nvs, type, key, _value, length);
+    }
+
+    std::unique_ptr<uint8_t[]> temporary(new (std::nothrow) uint8_t[length + 1]);
+    if(!temporary) {
+        NVSErrorPrintf("Failed to allocate %d bytes to import NVS key %s", length, key);
+        return NVSTransferResult::NoMemory;
+    }
+    _stats.heapFallbacks++;
+    return ApplyVariable(nvs, type, key, temporary.get(), length);
+}
+
+NVSTransferResult NVSImporter::ApplyInteger(nvs_handle_t nvs, nvs_type_t type, const char* key, uint64_t value) {
+    uint64_t current = 0;
+    if(ReadInteger(nvs, key, type, current) == ESP_OK && current == value) {
+        _stats.unchanged++;
+        return NVSTransferResult::OK;
+    }
+    if(!dryRun) {
+        esp_err_t err = WriteInteger(nvs, key, type, value);
+        if(err != ESP_OK) {
+            NVSErrorPrintf("Failed to import NVS key %s: %s", key, esp_err_to_name(err));
+            return NVSTransferResult::NVSError;
+        }
+    }
+    _stats.written++;
+    return NVSTransferResult::OK;
+}
+
+NVSTransferResult NVSImporter::ApplyVariable(nvs_handle_t nvs, nvs_type_t type, const char* key, uint8_t* value, size_t size) {
+    // Load the stored value into the buffer first, then compare the record
+    // with it through a small window while reading it from the stream.
+    // Sizes are compared first so that a differing value never needs to be read.
+    size_t storedSize = 0;
+    size_t expectedSize = type == NVS_TYPE_STR ? size + 1 : size;
+    bool unchanged = QueryVariableSize(nvs, key, type, storedSize) == ESP_OK && storedSize == expectedSize
+        && ReadVariable(nvs, key, type, value, storedSize) == ESP_OK;
+    size_t offset = 0;
+    while(unchanged && offset < size) {
+        uint8_t window[CompareWindowSize];
+        size_t chunk = std::min(size - offset, sizeof(window));
+        if(!Get(window, chunk)) {
+            return NVSTransferResult::Truncated;
+        }
+        if(memcmp(window, value + offset, chunk) != 0) {
+            memcpy(value + offset, window, chunk);
+            unchanged = false;
+        }
+        offset += chunk;
+    }
+    if(!Get(value + offset, size - offset)) {
+        return NVSTransferResult::Truncated;
+    }
+    value[size] = '\0';
+    if(unchanged) {
+        _stats.unchanged++;
+        return NVSTransferResult::OK;
+    }
+
+    if(!dryRun) {
+        esp_err_t err = type == NVS_TYPE_STR
+            ? NVSFlashSetStr(nvs, key, reinterpret_cast<const char*>(value))
+            : NVSFlashSetBlob(nvs, key, value, size);
+        if(err != ESP_OK) {
+            NVSErrorPrintf("Failed to import NVS key %s: %s", key, esp_err_to_name(err));
+            return NVSTransferResult::NVSError;
+        }
+    }
+    _stats.written++;
+    return NVSTransferResult::OK;
+}
+
+bool NVSImporter::Get(void* data, size_t size) {
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    while(size > 0) {
+        if(_position == _available) {
+            _position = 0;
+            _available = _source(_context, _buffer, NVSTransferBufferSize);
+            if(_available == 0) {
+                NVSErrorPrintf("Import stream ended unexpectedly");
+                return false;
+            }
+        }
+        size_t chunk = std::min(size, _available - _position);
+        memcpy(bytes, _buffer + _position, chunk);
+        _crc = NVSCrc32(_buffer + _position, chunk, _crc);
+        _position += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+bool NVSImporter::GetByte(uint8_t& byte) {
+    return Get(&byte, 1);
+}
+
+NVSTransferResult NVSImporter::GetLength(size_t& length) {
+    length = 0;
+    for(unsigned shift = 0; shift < 35; shift += 7) {
+        uint8_t byte;
+        if(!GetByte(byte)) {
+            return NVSTransferResult::Truncated;
+        }
+        size_t bits = byte & 0x7F;
+        // Bits shifted past size_t would silently wrap the length
+        if(shift >= sizeof(size_t) * 8 || (bits << shift) >> shift != bits) {
+            break;
+        }
+        length |= bits << shift;
+        if((byte & 0x80) == 0) {
+            return NVSTransferResult::OK;
+        }
+    }
+    NVSErrorPrintf("Import stream contains an invalid length");
+    return NVSTransferResult::FormatError;
+}
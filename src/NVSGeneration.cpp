@@ -0,0 +1,209 @@
+#include "NVSGeneration.hpp"
+
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+
+#include "NVSLog.hpp"
+#include "NVSTrace.hpp"
+
+NVSGenerationTracker::NVSGenerationTracker(nvs_handle_t nvs, NVSGenerationEntry* entries, size_t capacity)
+    : _nvs(nvs), _entries(entries), _capacity(capacity), _count(0), _generation(1), _floor(1), _dirty(false), _lease(0) {
+    Load();
+}
+
+esp_err_t NVSGenerationTracker::markDirty() {
+    if(_dirty && _generation < _lease) {
+        return ESP_OK;
+    }
+    // Lets the next boot detect stamps which have not been persisted, and continue above them
+    uint32_t lease = _generation + LeaseGenerations;
+    esp_err_t err = NVSFlashSetU32(_nvs, DirtyKey, lease);
+    if(err != ESP_OK) {
+        // Not dirty yet, so the next write tries again
+        NVSErrorPrintf("Failed to write generation dirty marker: %s", esp_err_to_name(err));
+        return err;
+    }
+    if((err = NVSFlashCommit(_nvs, DirtyKey)) != ESP_OK) {
+        NVSErrorPrintf("Failed to commit generation dirty marker: %s", esp_err_to_name(err));
+        return err;
+    }
+    _dirty = true;
+    _lease = lease;
+    return ESP_OK;
+}
+
+uint32_t NVSGenerationTracker::stamp(const char* key) {
+    // Normally written before the value already, this only covers direct calls
+    markDirty();
+    _generation++;
+    NVSGenerationEntry* entry = Find(key);
+    if(entry == nullptr) {
+        if(_count < _capacity) {
+            entry = &_entries[_count++];
+        } else if(_capacity > 0) {
+            // Evict the oldest entry. Its change can't be told apart from older ones anymore.
+            entry = &_entries[0];
+            for(size_t i = 1; i < _count; i++) {
+                if(_entries[i].generation < entry->generation) {
+                    entry = &_entries[i];
+                }
+            }
+            _floor = entry->generation > _floor ? entry->generation : _floor;
+            NVSDebugPrintf("Generation table full, evicted key %s", entry->key);
+        } else {
+            _floor = _generation;
+            return _generation;
+        }
+        memset(entry->key, 0, sizeof(entry->key));
+        strncpy(entry->key, key, sizeof(entry->key) - 1);
+    }
+    entry->generation = _generation;
+    NVSTracePrintf("Stamped key %s with generation %d", key, _generation);
+    return _generation;
+}
+
+uint32_t NVSGenerationTracker::erased(const char* key) {
+    markDirty();
+    _generation++;
+    NVSGenerationEntry* entry = Find(key);
+    if(entry != nullptr) {
+        *entry = _entries[--_count];
+    }
+    // A delta can't express the deletion, so every older generation needs a full export
+    _floor = _generation;
+    NVSTracePrintf("Key %s erased at generation %d", key, _generation);
+    return _generation;
+}
+
+uint32_t NVSGenerationTracker::generationOf(const char* key) const {
+    const NVSGenerationEntry* entry = Find(key);
+    return entry != nullptr ? entry->generation : 0;
+}
+
+bool NVSGenerationTracker::changedSince(const char* key, uint32_t generation) const {
+    return generation < _floor || generationOf(key) > generation;
+}
+
+size_t NVSGenerationTracker::countChangedSince(uint32_t generation) const {
+    if(generation < _floor) {
+        return std::numeric_limits<size_t>::max();
+    }
+    size_t count = 0;
+    for(size_t i = 0; i < _count; i++) {
+        count += _entries[i].generation > generation ? 1 : 0;
+    }
+    return count;
+}
+
+NVSTransferResult NVSGenerationTracker::exportChangedSince(uint32_t generation, NVSExporter& exporter,
+                                                           const char* partition, const char* namespc) {
+    if(generation < _floor) {
+        NVSDebugPrintf("Generation %d is older than %d, exporting everything", generation, _floor);
+        return exporter.exportNamespace(_nvs, partition, namespc);
+    }
+    size_t index = 0;
+    return exporter.exportKeys(_nvs, [this, generation, &index]() -> const char* {
+        for(; index < _count; index++) {
+            if(_entries[index].generation > generation) {
+                return _entries[index++].key;
+            }
+        }
+        return nullptr;
+    });
+}
+
+esp_err_t NVSGenerationTracker::persist() {
+    size_t size = sizeof(TableHeader) + _count * sizeof(NVSGenerationEntry);
+    std::unique_ptr<uint8_t[]> table(new (std::nothrow) uint8_t[size]);
+    if(!table) {
+        NVSErrorPrintf("Failed to allocate %d bytes for the generation table", size);
+        return ESP_ERR_NO_MEM;
+    }
+    TableHeader header = {TableVersion, _generation, _floor, static_cast<uint32_t>(_count)};
+    memcpy(table.get(), &header, sizeof(header));
+    memcpy(table.get() + sizeof(header), _entries, _count * sizeof(NVSGenerationEntry));
+    esp_err_t err = NVSFlashSetBlob(_nvs, TableKey, table.get(), size);
+    if(err != ESP_OK) {
+        NVSErrorPrintf("Failed to write generation table: %s", esp_err_to_name(err));
+        return err;
+    }
+    if(_dirty) {
+        err = NVSFlashEraseKey(_nvs, DirtyKey);
+        if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            NVSErrorPrintf("Failed to erase generation dirty marker: %s", esp_err_to_name(err));
+            return err;
+        }
+    }
+    err = NVSFlashCommit(_nvs, TableKey);
+    if(err == ESP_OK) {
+        _dirty = false;
+    }
+    return err;
+}
+
+void NVSGenerationTracker::Load() {
+    size_t size = 0;
+    esp_err_t err = NVSFlashGetBlob(_nvs, TableKey, nullptr, &size);
+    if(err == ESP_OK) {
+        LoadTable(size);
+    } else if(err != ESP_ERR_NVS_NOT_FOUND) {
+        NVSErrorPrintf("Failed to read generation table: %s", esp_err_to_name(err));
+    }
+
+    uint32_t marker = 0;
+    if(NVSFlashGetU32(_nvs, DirtyKey, &marker) == ESP_OK) {
+        // Stamps after the last persist() are lost, so every change up to now is unknown.
+        // They are at most the lease of the marker, so continuing above it never repeats a generation.
+        _generation = (marker > _generation ? marker : _generation) + 1;
+        _floor = _generation;
+        NVSInfoPrintf("Generation table was not persisted, assuming all values changed at generation %d", _generation);
+        _dirty = true;
+        persist();
+    }
+}
+
+void NVSGenerationTracker::LoadTable(size_t size) {
+    if(size < sizeof(TableHeader) || (size - sizeof(TableHeader)) % sizeof(NVSGenerationEntry) != 0) {
+        NVSWarningPrintf("Discarding generation table of unexpected size %d", size);
+        return;
+    }
+    std::unique_ptr<uint8_t[]> table(new (std::nothrow) uint8_t[size]);
+    if(!table) {
+        NVSErrorPrintf("Failed to allocate %d bytes for the generation table", size);
+        return;
+    }
+    TableHeader header;
+    esp_err_t err = NVSFlashGetBlob(_nvs, TableKey, table.get(), &size);
+    memcpy(&header, table.get(), sizeof(header));
+    if(err != ESP_OK || header.version != TableVersion) {
+        NVSWarningPrintf("Discarding invalid generation table");
+        return;
+    }
+    const uint8_t* stored = table.get() + sizeof(TableHeader);
+    size_t storedCount = (size - sizeof(TableHeader)) / sizeof(NVSGenerationEntry);
+    _count = storedCount < _capacity ? storedCount : _capacity;
+    memcpy(_entries, stored, _count * sizeof(NVSGenerationEntry));
+    _generation = header.generation;
+    _floor = header.floor;
+    // Entries which don't fit anymore are treated like evicted ones
+    for(size_t i = _count; i < storedCount; i++) {
+        NVSGenerationEntry entry;
+        memcpy(&entry, stored + i * sizeof(NVSGenerationEntry), sizeof(entry));
+        _floor = entry.generation > _floor ? entry.generation : _floor;
+    }
+}
+
+NVSGenerationEntry* NVSGenerationTracker::Find(const char* key) {
+    return const_cast<NVSGenerationEntry*>(static_cast<const NVSGenerationTracker*>(this)->Find(key));
+}
+
+const NVSGenerationEntry* NVSGenerationTracker::Find(const char* key) const {
+    for(size_t i = 0; i < _count; i++) {
+        if(strncmp(_entries[i].key, key, sizeof(_entries[i].key)) == 0) {
+            return &_entries[i];
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,192 @@
+#include "NVSLayeredStore.hpp"
+
+#include <nvs_flash.h>
+
+#include "NVSTrace.hpp"
+#include "NVSUtils.hpp"
+
+namespace {
+uint8_t LayerBit(NVSLayer layer) {
+    return static_cast<uint8_t>(1u << static_cast<uint8_t>(layer));
+}
+} // namespace
+
+const char* NVSLayerToString(NVSLayer layer) {
+    switch(layer) {
+        case NVSLayer::Overlay: return "Overlay";
+        case NVSLayer::Factory: return "Factory";
+        case NVSLayer::Default: return "Default";
+        default: return "Unknown";
+    }
+}
+
+NVSLayeredStore::NVSLayeredStore(nvs_handle_t overlay, nvs_handle_t factory, NVSLayeredMiss* cache, size_t cacheCapacity)
+    : _overlay(overlay), _factory(factory), _cache(cache), _cacheCapacity(cacheCapacity), _nextSlot(0), _stats() {
+    invalidateCache();
+}
+
+std::optional<nvs_handle_t> NVSLayeredStore::OpenFactory(const char* partition, const char* namespc) {
+    esp_err_t err;
+    {
+        NVSTraceScope scope(NVSTraceOp::Open, partition);
+        err = scope.finish(0, nvs_flash_init_partition(partition));
+    }
+    if(err != ESP_OK) {
+        NVSErrorPrintf("Failed to initialize factory partition %s: %s", partition, esp_err_to_name(err));
+        return std::nullopt;
+    }
+    nvs_handle_t handle;
+    {
+        NVSTraceScope scope(NVSTraceOp::Open, namespc);
+        err = scope.finish(0, nvs_open_from_partition(partition, namespc, NVS_READONLY, &handle));
+    }
+    if(err != ESP_OK) {
+        // A read-only namespace which does not exist can't be created
+        NVSWarningPrintf("Failed to open factory namespace %s: %s", namespc, esp_err_to_name(err));
+        return std::nullopt;
+    }
+    return handle;
+}
+
+NVSLayer NVSLayeredStore::readBlob(const char* key, void* buffer, size_t size) {
+    const NVSLayer layers[] = {NVSLayer::Overlay, NVSLayer::Factory};
+    for(NVSLayer layer : layers) {
+        nvs_handle_t handle = layer == NVSLayer::Overlay ? _overlay : _factory;
+        if(handle == NoFactory || IsKnownMiss(key, layer)) {
+            continue;
+        }
+        size_t storedSize = size;
+        esp_err_t err = NVSFlashGetBlob(handle, key, buffer, &storedSize);
+        if(err == ESP_OK && storedSize == size) {
+            return Served(layer);
+        }
+        if(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND || err == ESP_ERR_NVS_INVALID_LENGTH) {
+            // A value of the wrong size is treated like a missing value, as NVSValue does
+            RememberMiss(key, layer);
+        } else {
+            NVSWarningPrintf("Failed to read key %s from %s layer: %s", key, NVSLayerToString(layer), esp_err_to_name(err));
+        }
+    }
+    return Served(NVSLayer::Default);
+}
+
+NVSLayer NVSLayeredStore::readString(const char* key, std::string& value) {
+    const NVSLayer layers[] = {NVSLayer::Overlay, NVSLayer::Factory};
+    for(NVSLayer layer : layers) {
+        nvs_handle_t handle = layer == NVSLayer::Overlay ? _overlay : _factory;
+        if(handle == NoFactory || IsKnownMiss(key, layer)) {
+            continue;
+        }
+        switch(NVSReadStringValue(handle, key, value, NVSStringStoragePreference::PreferString)) {
+            case NVSQueryResult::OK:
+                return Served(layer);
+            case NVSQueryResult::NotFound:
+                RememberMiss(key, layer);
+                break;
+            case NVSQueryResult::Error:
+                break;
+        }
+    }
+    return Served(NVSLayer::Default);
+}
+
+esp_err_t NVSLayeredStore::writeBlob(const char* key, const void* data, size_t size) {
+    esp_err_t err = NVSFlashSetBlob(_overlay, key, data, size);
+    if(err != ESP_OK) {
+        NVSCriticalPrintf("Failed to write NVS key %s: %s", key, esp_err_to_name(err));
+        return err;
+    }
+    ForgetMiss(key, NVSLayer::Overlay);
+    return NVSFlashCommit(_overlay, key);
+}
+
+esp_err_t NVSLayeredStore::writeString(const char* key, const std::string& value) {
+    esp_err_t err = NVSFlashSetStr(_overlay, key, value.c_str());
+    if(err != ESP_OK) {
+        NVSCriticalPrintf("Failed to write NVS string key %s: %s", key, esp_err_to_name(err));
+        return err;
+    }
+    ForgetMiss(key, NVSLayer::Overlay);
+    return NVSFlashCommit(_overlay, key);
+}
+
+esp_err_t NVSLayeredStore::revert(const char* key) {
+    esp_err_t err = NVSFlashEraseKey(_overlay, key);
+    if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        NVSErrorPrintf("Failed to erase NVS key %s: %s", key, esp_err_to_name(err));
+        return err;
+    }
+    RememberMiss(key, NVSLayer::Overlay);
+    return NVSFlashCommit(_overlay, key);
+}
+
+esp_err_t NVSLayeredStore::factoryReset() {
+    esp_err_t err = NVSFlashEraseAll(_overlay);
+    if(err != ESP_OK) {
+        NVSErrorPrintf("Failed to erase overlay: %s", esp_err_to_name(err));
+        return err;
+    }
+    // Every cached key is now missing from the overlay
+    for(size_t i = 0; i < _cacheCapacity; i++) {
+        if(_cache[i].key[0] != '\0') {
+            _cache[i].layers |= LayerBit(NVSLayer::Overlay);
+        }
+    }
+    return NVSFlashCommit(_overlay);
+}
+
+void NVSLayeredStore::invalidateCache() {
+    for(size_t i = 0; i < _cacheCapacity; i++) {
+        _cache[i].key[0] = '\0';
+        _cache[i].layers = 0;
+    }
+}
+
+bool NVSLayeredStore::IsKnownMiss(const char* key, NVSLayer layer) {
+    NVSLayeredMiss* entry = Find(key);
+    if(entry != nullptr && (entry->layers & LayerBit(layer)) != 0) {
+        _stats.lookupsAvoided++;
+        return true;
+    }
+    return false;
+}
+
+void NVSLayeredStore::RememberMiss(const char* key, NVSLayer layer) {
+    if(_cacheCapacity == 0 || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return;
+    }
+    NVSLayeredMiss* entry = Find(key);
+    if(entry == nullptr) {
+        // Replace the slots round-robin
+        entry = &_cache[_nextSlot];
+        _nextSlot = (_nextSlot + 1) % _cacheCapacity;
+        strncpy(entry->key, key, sizeof(entry->key));
+        entry->layers = 0;
+    }
+    entry->layers |= LayerBit(layer);
+}
+
+void NVSLayeredStore::ForgetMiss(const char* key, NVSLayer layer) {
+    NVSLayeredMiss* entry = Find(key);
+    if(entry != nullptr) {
+        entry->layers &= static_cast<uint8_t>(~LayerBit(layer));
+    }
+}
+
+NVSLayeredMiss* NVSLayeredStore::Find(const char* key) {
+    for(size_t i = 0; i < _cacheCapacity; i++) {
+        if(_cache[i].key[0] != '\0' && strncmp(_cache[i].key, key, sizeof(_cache[i].key)) == 0) {
+            return &_cache[i];
+        }
+    }
+    return nullptr;
+}
+
+NVSLayer NVSLayeredStore::Served(NVSLayer layer) {
+    switch(layer) {
+        case NVSLayer::Overlay: _stats.overlayHits++; break;
+        case NVSLayer::Factory: _stats.factoryHits++; break;
+        default: _stats.defaultHits++; break;
+    }
+    return layer;
+}
@@ -0,0 +1,210 @@
+#include "NVSResidency.hpp"
+
+#include <cstring>
+
+#include <esp_heap_caps.h>
+
+#include "NVSLog.hpp"
+
+void NVSResidentNode::Attach(NVSResidencyManager* manager, size_t cacheSize) {
+    Detach();
+    _cacheSize = cacheSize;
+    if(manager != nullptr) {
+        manager->Link(*this);
+    }
+}
+
+void NVSResidentNode::Detach() {
+    if(_manager != nullptr) {
+        _manager->Unlink(*this);
+    }
+}
+
+bool NVSResidentNode::Read(void* out, bool& exists) {
+    bool hit = _cache != nullptr;
+    if(hit) {
+        memcpy(out, _cache, _cacheSize);
+        exists = _cachedExists;
+    } else if(!Fill(out, exists)) {
+        return false;
+    }
+    _stats.accesses++;
+    _epochAccesses++;
+    if(hit) {
+        _stats.hits++;
+    } else {
+        _stats.misses++;
+    }
+    if(_manager != nullptr) {
+        // May promote this value from out, or rebalance. out stays valid either way.
+        _manager->Accessed(*this, hit, out, exists);
+    }
+    return true;
+}
+
+void NVSResidentNode::Written(const void* data) {
+    if(_cache != nullptr) {
+        memcpy(_cache, data, _cacheSize);
+        _cachedExists = true;
+    }
+}
+
+NVSResidencyManager::NVSResidencyManager(size_t budget, NVSArena* arena, uint32_t rebalanceEvery, uint32_t promoteAfter)
+    : _arena(arena), _rebalanceEvery(rebalanceEvery), _promoteAfter(promoteAfter), _accessesSinceRebalance(0), _head(nullptr), _stats() {
+    _stats.budget = budget;
+}
+
+NVSResidencyManager::~NVSResidencyManager() {
+    while(_head != nullptr) {
+        Unlink(*_head);
+    }
+}
+
+void NVSResidencyManager::rebalance() {
+    _stats.rebalances++;
+    _accessesSinceRebalance = 0;
+    for(NVSResidentNode* node = _head; node != nullptr; node = node->_next) {
+        uint32_t score = node->_stats.score / 2;
+        node->_stats.score = node->_epochAccesses > std::numeric_limits<uint32_t>::max() - score
+            ? std::numeric_limits<uint32_t>::max()
+            : score + node->_epochAccesses;
+        node->_epochAccesses = 0;
+    }
+    for(NVSResidentNode* node = _head; node != nullptr; node = node->_next) {
+        node->_considered = false;
+    }
+    // Non-resident values are considered hottest first, each one once
+    while(true) {
+        NVSResidentNode* candidate = nullptr;
+        for(NVSResidentNode* node = _head; node != nullptr; node = node->_next) {
+            if(node->_cache != nullptr || node->_considered || node->_stats.score == 0) {
+                continue;
+            }
+            if(candidate == nullptr || node->_stats.score > candidate->_stats.score) {
+                candidate = node;
+            }
+        }
+        if(candidate == nullptr) {
+            break;
+        }
+        candidate->_considered = true;
+        uint32_t score = candidate->_stats.score;
+        // Room which can be made by evicting colder values
+        size_t available = _stats.budget > _stats.used ? _stats.budget - _stats.used : 0;
+        for(NVSResidentNode* node = _head; node != nullptr && available < candidate->_cacheSize; node = node->_next) {
+            if(node->_cache != nullptr && node->_stats.score < score) {
+                available += node->_cacheSize;
+            }
+        }
+        if(available < candidate->_cacheSize) {
+            // Smaller values may still fit
+            continue;
+        }
+        while(_stats.used + candidate->_cacheSize > _stats.budget) {
+            Evict(*Coldest(score));
+        }
+        Promote(*candidate, nullptr, false);
+    }
+    NVSDebugPrintf("Rebalanced residency: %d values, %d resident, %d of %d bytes", _stats.values, _stats.resident, _stats.used, _stats.budget);
+}
+
+void NVSResidencyManager::setBudget(size_t budget) {
+    _stats.budget = budget;
+    NVSResidentNode* coldest;
+    while(_stats.used > _stats.budget && (coldest = Coldest(std::numeric_limits<uint32_t>::max())) != nullptr) {
+        Evict(*coldest);
+    }
+}
+
+void NVSResidencyManager::Link(NVSResidentNode& node) {
+    node._manager = this;
+    node._next = _head;
+    _head = &node;
+    _stats.values++;
+}
+
+void NVSResidencyManager::Unlink(NVSResidentNode& node) {
+    if(node._cache != nullptr) {
+        Evict(node);
+    }
+    for(NVSResidentNode** link = &_head; *link != nullptr; link = &(*link)->_next) {
+        if(*link == &node) {
+            *link = node._next;
+            _stats.values--;
+            break;
+        }
+    }
+    node._manager = nullptr;
+    node._next = nullptr;
+}
+
+void NVSResidencyManager::Accessed(NVSResidentNode& node, bool hit, const void* data, bool exists) {
+    if(hit) {
+        _stats.hits++;
+    } else {
+        _stats.misses++;
+        if(node._epochAccesses >= _promoteAfter && _stats.used + node._cacheSize <= _stats.budget) {
+            Promote(node, data, exists);
+        }
+    }
+    if(_rebalanceEvery > 0 && ++_accessesSinceRebalance >= _rebalanceEvery) {
+        rebalance();
+    }
+}
+
+bool NVSResidencyManager::Promote(NVSResidentNode& node, const void* data, bool exists) {
+    void* memory = Allocate(node._cacheSize);
+    if(memory == nullptr) {
+        NVSWarningPrintf("Failed to allocate %d bytes to cache key %s", node._cacheSize, node.residentKey().c_str());
+        return false;
+    }
+    if(data != nullptr) {
+        memcpy(memory, data, node._cacheSize);
+    } else if(!node.Fill(memory, exists)) {
+        Free(memory);
+        return false;
+    }
+    node._cache = memory;
+    node._cachedExists = exists;
+    node._stats.promotions++;
+    node._stats.resident = true;
+    _stats.used += node._cacheSize;
+    _stats.resident++;
+    _stats.promotions++;
+    NVSTracePrintf("Promoted key %s (score %d)", node.residentKey().c_str(), node._stats.score);
+    return true;
+}
+
+void NVSResidencyManager::Evict(NVSResidentNode& node) {
+    Free(node._cache);
+    node._cache = nullptr;
+    node._stats.evictions++;
+    node._stats.resident = false;
+    _stats.used -= node._cacheSize;
+    _stats.resident--;
+    _stats.evictions++;
+    NVSTracePrintf("Evicted key %s (score %d)", node.residentKey().c_str(), node._stats.score);
+}
+
+NVSResidentNode* NVSResidencyManager::Coldest(uint32_t belowScore) const {
+    NVSResidentNode* coldest = nullptr;
+    for(NVSResidentNode* node = _head; node != nullptr; node = node->_next) {
+        if(node->_cache != nullptr && node->_stats.score < belowScore
+           && (coldest == nullptr || node->_stats.score < coldest->_stats.score)) {
+            coldest = node;
+        }
+    }
+    return coldest;
+}
+
+void* NVSResidencyManager::Allocate(size_t size) {
+    return _arena != nullptr ? _arena->allocate(size) : heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+}
+
+void NVSResidencyManager::Free(void* memory) {
+    if(_arena != nullptr) {
+        _arena->deallocate(memory);
+    } else {
+        heap_caps_free(memory);
+    }
+}
@@ -4,9 +4,25 @@ const char* NVSSetResultToString(NVSSetResult updateResult) {
     switch (updateResult) {
         case NVSSetResult::Updated: return "Updated";
         case NVSSetResult::Unchanged: return "Unchanged";
+        case NVSSetResult::Suppressed: return "Suppressed";
+        case NVSSetResult::Deferred: return "Deferred";
         case NVSSetResult::NotInitialized: return "NotInitialized";
         case NVSSetResult::Nullptr: return "Nullptr";
         case NVSSetResult::Error: return "Error";
+        case NVSSetResult::NoSpace: return "NoSpace";
+        default: return "Unknown";
+    }
+}
+
+const char* NVSTransferResultToString(NVSTransferResult transferResult) {
+    switch (transferResult) {
+        case NVSTransferResult::OK: return "OK";
+        case NVSTransferResult::SinkError: return "SinkError";
+        case NVSTransferResult::Truncated: return "Truncated";
+        case NVSTransferResult::FormatError: return "FormatError";
+        case NVSTransferResult::ChecksumMismatch: return "ChecksumMismatch";
+        case NVSTransferResult::NVSError: return "NVSError";
+        case NVSTransferResult::NoMemory: return "NoMemory";
         default: return "Unknown";
     }
 }
@@ -0,0 +1,237 @@
+#include "NVSRetained.hpp"
+
+#if __has_include(<esp_attr.h>)
+#include <esp_attr.h>
+#endif
+
+#include "NVSHash.hpp"
+#include "NVSTrace.hpp"
+
+#ifndef RTC_NOINIT_ATTR
+// Host builds: an ordinary static buffer stands in for RTC memory
+#define RTC_NOINIT_ATTR
+#endif
+
+namespace {
+constexpr size_t SlotAlignment = 4;
+
+RTC_NOINIT_ATTR uint32_t RetainedMemory[(NVSRetainedMemorySize + sizeof(uint32_t) - 1) / sizeof(uint32_t)];
+} // namespace
+
+void* NVSRetainedMemory() {
+    return RetainedMemory;
+}
+
+NVSRetainedStore::NVSRetainedStore(nvs_handle_t nvs, void* region, size_t size, uint32_t flushEveryWakes)
+    : flushEveryWakes(flushEveryWakes), _nvs(nvs), _header(static_cast<Header*>(region)), _capacity(size), _stats() {
+    if(_header == nullptr || _capacity < sizeof(Header)) {
+        NVSErrorPrintf("Retained region too small, values are written through");
+        _header = nullptr;
+        _capacity = 0;
+        return;
+    }
+    _stats.restored = IsValid();
+    if(_stats.restored) {
+        NVSDebugPrintf("Restored retained region (%d bytes, %d wakes since flush)", _header->usedBytes, _header->wakesSinceFlush);
+    } else {
+        // Expected after a power-on reset, RTC memory is not initialized then
+        NVSInfoPrintf("Retained region is not valid, starting empty");
+        clear();
+    }
+}
+
+NVSSetResult NVSRetainedStore::beforeSleep(bool lowBattery) {
+    if(_header == nullptr) {
+        return NVSSetResult::Unchanged;
+    }
+    _header->wakesSinceFlush++;
+    SealHeader();
+    if(lowBattery || (flushEveryWakes > 0 && _header->wakesSinceFlush >= flushEveryWakes)) {
+        NVSDebugPrintf("Flushing retained values after %d wakes%s", _header->wakesSinceFlush, lowBattery ? " (low battery)" : "");
+        return flush();
+    }
+    return NVSSetResult::Unchanged;
+}
+
+NVSSetResult NVSRetainedStore::flush() {
+    if(_header == nullptr) {
+        return NVSSetResult::Unchanged;
+    }
+    NVSSetResult result = NVSSetResult::Unchanged;
+    size_t written = 0;
+    for(NVSRetainedSlot* slot = Next(nullptr); slot != nullptr; slot = Next(slot)) {
+        if((slot->flags & SlotDirty) == 0) {
+            continue;
+        }
+        esp_err_t err = Write(slot);
+        if(err == ESP_OK) {
+            written++;
+        } else if(err != ESP_ERR_INVALID_CRC) {
+            // Keep the slot dirty, the next flush retries it
+            result = err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+    }
+    if(written > 0) {
+        NVSFlashCommit(_nvs, "retained");
+        _stats.flushes++;
+    }
+    if(result == NVSSetResult::Unchanged) {
+        result = written > 0 ? NVSSetResult::Updated : NVSSetResult::Unchanged;
+        _header->wakesSinceFlush = 0;
+        SealHeader();
+    }
+    return result;
+}
+
+void NVSRetainedStore::clear() {
+    if(_header == nullptr) {
+        return;
+    }
+    _header->magic = Magic;
+    _header->usedBytes = 0;
+    _header->wakesSinceFlush = 0;
+    SealHeader();
+}
+
+size_t NVSRetainedStore::dirtyCount() const {
+    size_t count = 0;
+    for(NVSRetainedSlot* slot = Next(nullptr); slot != nullptr; slot = Next(slot)) {
+        count += (slot->flags & SlotDirty) != 0 ? 1 : 0;
+    }
+    return count;
+}
+
+NVSRetainedStats NVSRetainedStore::stats() const {
+    NVSRetainedStats result = _stats;
+    result.wakesSinceFlush = _header != nullptr ? _header->wakesSinceFlush : 0;
+    result.usedBytes = _header != nullptr ? sizeof(Header) + _header->usedBytes : 0;
+    result.capacity = _capacity;
+    return result;
+}
+
+NVSRetainedSlot* NVSRetainedStore::bind(const char* key, size_t size) {
+    if(_header == nullptr) {
+        return nullptr;
+    }
+    for(NVSRetainedSlot* slot = Next(nullptr); slot != nullptr; slot = Next(slot)) {
+        if(strncmp(slot->key, key, NVS_KEY_NAME_MAX_SIZE) != 0) {
+            continue;
+        }
+        if(slot->size != size) {
+            NVSWarningPrintf("Key %s is retained with %d bytes instead of %d, writing it through", key, slot->size, size);
+            return nullptr;
+        }
+        return slot;
+    }
+    size_t bytes = SlotBytes(size);
+    if(sizeof(Header) + _header->usedBytes + bytes > _capacity) {
+        NVSWarningPrintf("Retained region is full, writing key %s through", key);
+        return nullptr;
+    }
+    NVSRetainedSlot* slot = reinterpret_cast<NVSRetainedSlot*>(reinterpret_cast<uint8_t*>(_header + 1) + _header->usedBytes);
+    memset(slot, 0, bytes);
+    strncpy(slot->key, key, NVS_KEY_NAME_MAX_SIZE - 1);
+    slot->size = static_cast<uint16_t>(size);
+    // Not valid yet, so the value is read from NVS before it is used
+    slot->crc = SlotCrc(slot);
+    _header->usedBytes += static_cast<uint32_t>(bytes);
+    SealHeader();
+    return slot;
+}
+
+bool NVSRetainedStore::load(NVSRetainedSlot* slot, void* data, size_t size, bool& exists) {
+    if((slot->flags & SlotValid) == 0 || slot->size != size) {
+        return false;
+    }
+    if(SlotCrc(slot) != slot->crc) {
+        NVSWarningPrintf("Retained copy of key %s is corrupted, reading NVS", slot->key);
+        _stats.corruptSlots++;
+        slot->flags = 0;
+        return false;
+    }
+    memcpy(data, Data(slot), size);
+    exists = (slot->flags & SlotExists) != 0;
+    return true;
+}
+
+void NVSRetainedStore::store(NVSRetainedSlot* slot, const void* data, size_t size, bool exists, bool dirty) {
+    memcpy(Data(slot), data, size);
+    slot->flags = SlotValid | (exists ? SlotExists : 0) | (dirty ? SlotDirty : 0);
+    slot->crc = SlotCrc(slot);
+    if(dirty) {
+        _stats.writesAbsorbed++;
+    }
+}
+
+NVSSetResult NVSRetainedStore::flushSlot(NVSRetainedSlot* slot) {
+    if((slot->flags & SlotDirty) == 0) {
+        return NVSSetResult::Unchanged;
+    }
+    esp_err_t err = Write(slot);
+    if(err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+    }
+    NVSFlashCommit(_nvs, slot->key);
+    _stats.flushes++;
+    return NVSSetResult::Updated;
+}
+
+bool NVSRetainedStore::IsValid() const {
+    if(_header->magic != Magic || _header->usedBytes > _capacity - sizeof(Header)) {
+        return false;
+    }
+    if(NVSCrc32(_header, offsetof(Header, crc)) != _header->crc) {
+        return false;
+    }
+    // The slot chain must end exactly at usedBytes
+    size_t offset = 0;
+    while(offset < _header->usedBytes) {
+        if(_header->usedBytes - offset < sizeof(NVSRetainedSlot)) {
+            return false;
+        }
+        const NVSRetainedSlot* slot = reinterpret_cast<const NVSRetainedSlot*>(reinterpret_cast<const uint8_t*>(_header + 1) + offset);
+        offset += SlotBytes(slot->size);
+    }
+    return offset == _header->usedBytes;
+}
+
+void NVSRetainedStore::SealHeader() {
+    _header->crc = NVSCrc32(_header, offsetof(Header, crc));
+}
+
+size_t NVSRetainedStore::SlotBytes(size_t size) {
+    return sizeof(NVSRetainedSlot) + (size + SlotAlignment - 1) / SlotAlignment * SlotAlignment;
+}
+
+uint32_t NVSRetainedStore::SlotCrc(const NVSRetainedSlot* slot) {
+    uint32_t crc = NVSCrc32(slot, offsetof(NVSRetainedSlot, crc));
+    return NVSCrc32(slot + 1, slot->size, crc);
+}
+
+NVSRetainedSlot* NVSRetainedStore::Next(NVSRetainedSlot* slot) const {
+    if(_header == nullptr) {
+        return nullptr;
+    }
+    uint8_t* begin = reinterpret_cast<uint8_t*>(_header + 1);
+    uint8_t* next = slot == nullptr ? begin : reinterpret_cast<uint8_t*>(slot) + SlotBytes(slot->size);
+    return next < begin + _header->usedBytes ? reinterpret_cast<NVSRetainedSlot*>(next) : nullptr;
+}
+
+esp_err_t NVSRetainedStore::Write(NVSRetainedSlot* slot) {
+    if(SlotCrc(slot) != slot->crc) {
+        // Never write a corrupted copy to NVS. The value object reads NVS again on the next wake-up.
+        NVSErrorPrintf("Retained copy of key %s is corrupted, discarding the change", slot->key);
+        _stats.corruptSlots++;
+        slot->flags = 0;
+        return ESP_ERR_INVALID_CRC;
+    }
+    esp_err_t err = NVSFlashSetBlob(_nvs, slot->key, Data(slot), slot->size);
+    if(err != ESP_OK) {
+        NVSCriticalPrintf("Failed to write retained key %s: %s", slot->key, esp_err_to_name(err));
+        return err;
+    }
+    slot->flags &= static_cast<uint8_t>(~SlotDirty);
+    slot->crc = SlotCrc(slot);
+    _stats.slotsFlushed++;
+    return ESP_OK;
+}
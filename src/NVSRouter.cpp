@@ -0,0 +1,179 @@
+#include "NVSRouter.hpp"
+
+#include <cstring>
+
+#include <esp_partition.h>
+
+#include "NVSHash.hpp"
+#include "NVSLog.hpp"
+#include "NVSTrace.hpp"
+
+namespace {
+constexpr size_t PageSize = 4096;
+constexpr size_t PageHeaderSequenceOffset = 4;
+constexpr uint32_t PageStateEmpty = 0xFFFFFFFF;
+constexpr uint32_t PageStateInvalid = 0;
+
+size_t CountRoutes(uint8_t mask) {
+    size_t count = 0;
+    for(; mask != 0; mask &= static_cast<uint8_t>(mask - 1)) {
+        count++;
+    }
+    return count;
+}
+} // namespace
+
+const char* NVSStorageClassToString(NVSStorageClass storageClass) {
+    switch(storageClass) {
+        case NVSStorageClass::Default: return "Default";
+        case NVSStorageClass::Cold: return "Cold";
+        case NVSStorageClass::Hot: return "Hot";
+        case NVSStorageClass::Critical: return "Critical";
+        case NVSStorageClass::Bulk: return "Bulk";
+        default: return "Unknown";
+    }
+}
+
+NVSRouter::NVSRouter() : _routes(), _routeCount(0), _classRoutes() {}
+
+NVSRouter::~NVSRouter() {
+    for(size_t i = 0; i < _routeCount; i++) {
+        if(_routes[i].owned) {
+            nvs_close(_routes[i].nvs);
+        }
+    }
+}
+
+size_t NVSRouter::addRoute(const char* partition, const char* namespc, bool allowReinit) {
+    if(_routeCount >= MaxRoutes) {
+        NVSErrorPrintf("Too many routes, can't add partition %s", partition);
+        return NoRoute;
+    }
+    std::optional<nvs_handle_t> nvs = InitializeNVSPartition(partition, namespc, allowReinit);
+    if(!nvs.has_value()) {
+        return NoRoute;
+    }
+    return AddRoute(nvs.value(), partition, namespc, true);
+}
+
+size_t NVSRouter::addRoute(nvs_handle_t nvs, const char* partition, const char* namespc) {
+    if(_routeCount >= MaxRoutes) {
+        NVSErrorPrintf("Too many routes, can't add partition %s", partition);
+        return NoRoute;
+    }
+    return AddRoute(nvs, partition, namespc, false);
+}
+
+bool NVSRouter::assign(NVSStorageClass storageClass, size_t route) {
+    return stripe(storageClass, {route});
+}
+
+bool NVSRouter::stripe(NVSStorageClass storageClass, std::initializer_list<size_t> routes) {
+    size_t index = static_cast<size_t>(storageClass);
+    if(index >= NVSStorageClassCount) {
+        return false;
+    }
+    uint8_t mask = 0;
+    for(size_t route : routes) {
+        if(route >= _routeCount) {
+            NVSErrorPrintf("Invalid route %d for storage class %s", route, NVSStorageClassToString(storageClass));
+            return false;
+        }
+        mask |= static_cast<uint8_t>(1u << route);
+    }
+    _classRoutes[index] = mask;
+    return true;
+}
+
+size_t NVSRouter::routeFor(const char* key, NVSStorageClass storageClass) const {
+    if(_routeCount == 0) {
+        return NoRoute;
+    }
+    size_t index = static_cast<size_t>(storageClass);
+    uint8_t mask = index < NVSStorageClassCount ? _classRoutes[index] : 0;
+    if(mask == 0) {
+        mask = _classRoutes[static_cast<size_t>(NVSStorageClass::Default)];
+    }
+    if(mask == 0) {
+        return 0;
+    }
+    size_t count = CountRoutes(mask);
+    size_t stripe = count > 1 ? NVSCrc32(key, strlen(key)) % count : 0;
+    for(size_t route = 0; route < MaxRoutes; route++) {
+        if((mask & (1u << route)) != 0 && stripe-- == 0) {
+            return route;
+        }
+    }
+    return 0;
+}
+
+nvs_handle_t NVSRouter::handleFor(const char* key, NVSStorageClass storageClass) {
+    size_t route = routeFor(key, storageClass);
+    if(route == NoRoute) {
+        NVSCriticalPrintf("No route for key %s", key);
+        return InvalidHandle;
+    }
+    _routes[route].routedKeys++;
+    NVSTracePrintf("Routing %s key %s to %s/%s", NVSStorageClassToString(storageClass), key, _routes[route].partition, _routes[route].namespc);
+    return _routes[route].nvs;
+}
+
+NVSPartitionStats NVSRouter::stats(size_t route) const {
+    NVSPartitionStats result = {};
+    if(route >= _routeCount) {
+        return result;
+    }
+    const Route& entry = _routes[route];
+    result.partition = entry.partition;
+    result.namespc = entry.namespc;
+    result.routedKeys = entry.routedKeys;
+
+    nvs_stats_t stats = {};
+    esp_err_t err;
+    {
+        NVSTraceScope scope(NVSTraceOp::Probe, entry.partition);
+        err = scope.finish(0, nvs_get_stats(entry.partition, &stats));
+    }
+    if(err != ESP_OK) {
+        NVSErrorPrintf("Failed to get statistics of partition %s: %s", entry.partition, esp_err_to_name(err));
+    } else {
+        result.totalEntries = stats.total_entries;
+        result.usedEntries = stats.used_entries;
+        result.freeEntries = stats.free_entries;
+        result.usedPercent = stats.total_entries > 0 ? static_cast<uint8_t>(stats.used_entries * 100 / stats.total_entries) : 0;
+    }
+
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, entry.partition);
+    if(partition == nullptr) {
+        NVSWarningPrintf("Partition %s not found, can't estimate erases", entry.partition);
+        return result;
+    }
+    result.pageCount = partition->size / PageSize;
+    // Sequence numbers are assigned in order of activation, starting at 0
+    uint32_t activations = 0;
+    size_t usedPages = 0;
+    for(size_t page = 0; page < result.pageCount; page++) {
+        uint32_t header[2];
+        if(esp_partition_read(partition, page * PageSize, header, sizeof(header)) != ESP_OK) {
+            NVSWarningPrintf("Failed to read page header %d of partition %s", page, entry.partition);
+            return result;
+        }
+        if(header[0] == PageStateEmpty || header[0] == PageStateInvalid) {
+            continue;
+        }
+        usedPages++;
+        uint32_t sequence = header[PageHeaderSequenceOffset / sizeof(uint32_t)];
+        activations = sequence + 1 > activations ? sequence + 1 : activations;
+    }
+    // Every activation ends with the page being erased by garbage collection, except for the pages in use now
+    result.estimatedPageErases = activations > usedPages ? activations - static_cast<uint32_t>(usedPages) : 0;
+    result.averageEraseCycles = result.pageCount > 0 ? result.estimatedPageErases / static_cast<uint32_t>(result.pageCount) : 0;
+    return result;
+}
+
+size_t NVSRouter::AddRoute(nvs_handle_t nvs, const char* partition, const char* namespc, bool owned) {
+    size_t index = _routeCount++;
+    _routes[index] = Route{partition, namespc, nvs, owned, 0};
+    NVSDebugPrintf("Added route %d to %s/%s", index, partition, namespc);
+    return index;
+}
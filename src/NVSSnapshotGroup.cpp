@@ -0,0 +1,81 @@
+#include "NVSSnapshotGroup.hpp"
+
+#include <memory>
+#include <new>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "NVSLog.hpp"
+#include "NVSTrace.hpp"
+
+namespace {
+constexpr size_t StackBufferSize = 64;
+} // namespace
+
+size_t NVSReadGroupFields(nvs_handle_t nvs, const NVSGroupField* fields, size_t count, void* data) {
+    size_t found = 0;
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    for(size_t i = 0; i < count; i++) {
+        const NVSGroupField& field = fields[i];
+        // A shorter stored value would only partially overwrite the field, so read into a buffer first
+        uint8_t stackBuffer[StackBufferSize];
+        std::unique_ptr<uint8_t[]> heapBuffer;
+        uint8_t* buffer = stackBuffer;
+        if(field.size > StackBufferSize) {
+            heapBuffer.reset(new (std::nothrow) uint8_t[field.size]);
+            buffer = heapBuffer.get();
+            if(buffer == nullptr) {
+                NVSErrorPrintf("Failed to allocate %d bytes for NVS key %s", field.size, field.key);
+                continue;
+            }
+        }
+        size_t size = field.size;
+        esp_err_t err = NVSFlashGetBlob(nvs, field.key, buffer, &size);
+        if(err == ESP_ERR_NVS_NOT_FOUND) {
+            continue;
+        }
+        if(err != ESP_OK || size != field.size) {
+            NVSWarningPrintf("Failed to read group key %s: %s", field.key, err != ESP_OK ? esp_err_to_name(err) : "size mismatch");
+            continue;
+        }
+        memcpy(bytes + field.offset, buffer, field.size);
+        found++;
+    }
+    return found;
+}
+
+NVSSetResult NVSWriteGroupFields(nvs_handle_t nvs, const NVSGroupField* fields, size_t count,
+                                 const void* current, const void* next, size_t& written) {
+    written = 0;
+    const uint8_t* currentBytes = static_cast<const uint8_t*>(current);
+    const uint8_t* nextBytes = static_cast<const uint8_t*>(next);
+    for(size_t i = 0; i < count; i++) {
+        const NVSGroupField& field = fields[i];
+        if(memcmp(currentBytes + field.offset, nextBytes + field.offset, field.size) == 0) {
+            continue;
+        }
+        esp_err_t err = NVSFlashSetBlob(nvs, field.key, nextBytes + field.offset, field.size);
+        if(err != ESP_OK) {
+            NVSCriticalPrintf("Failed to write group key %s: %s", field.key, esp_err_to_name(err));
+            if(written > 0) {
+                NVSFlashCommit(nvs, field.key);
+            }
+            return err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? NVSSetResult::NoSpace : NVSSetResult::Error;
+        }
+        written++;
+    }
+    if(written == 0) {
+        return NVSSetResult::Unchanged;
+    }
+    NVSFlashCommit(nvs, fields[0].key);
+    NVSTracePrintf("Wrote %d of %d group keys", written, count);
+    return NVSSetResult::Updated;
+}
+
+void NVSWaitForSnapshotReaders(const std::atomic<uint32_t>& readers) {
+    // Readers may have a lower priority than the writer, so spinning could starve them
+    while(readers.load() != 0) {
+        vTaskDelay(1);
+    }
+}
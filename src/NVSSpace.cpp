@@ -0,0 +1,214 @@
+#include "NVSSpace.hpp"
+
+#include <algorithm>
+
+#include "NVSLog.hpp"
+#include "NVSTrace.hpp"
+
+namespace {
+constexpr size_t EntrySize = 32;
+/**
+ * Data bytes of one blob chunk: a full page minus the chunk header entry
+ */
+constexpr size_t MaxChunkSize = (NVSEntriesPerPage - 1) * EntrySize;
+constexpr uint32_t MillisecondsPerHour = 3600UL * 1000UL;
+/**
+ * Growth rates are only extrapolated after this time, so single writes
+ * right after a reset do not produce absurd forecasts
+ */
+constexpr uint32_t MinForecastWindowMs = 60UL * 1000UL;
+
+size_t DataEntries(size_t size) {
+    return (size + EntrySize - 1) / EntrySize;
+}
+} // namespace
+
+size_t NVSEntryFootprint(NVSEntryEncoding encoding, size_t size) {
+    switch(encoding) {
+        case NVSEntryEncoding::Primitive:
+            return 1;
+        case NVSEntryEncoding::String:
+            return 1 + DataEntries(size + 1);
+        case NVSEntryEncoding::Blob:
+        default: {
+            size_t chunks = std::max<size_t>(1, (size + MaxChunkSize - 1) / MaxChunkSize);
+            return 1 + chunks + DataEntries(size);
+        }
+    }
+}
+
+size_t NVSEntryFootprint(const NVSValueBase& value) {
+    NVSValueDescriptor descriptor = value.descriptor();
+    return NVSEntryFootprint(descriptor.kind == NVSValueKind::String ? NVSEntryEncoding::String : NVSEntryEncoding::Blob,
+                             descriptor.size);
+}
+
+const char* NVSWritePriorityToString(NVSWritePriority priority) {
+    switch(priority) {
+        case NVSWritePriority::Bulk: return "Bulk";
+        case NVSWritePriority::Normal: return "Normal";
+        case NVSWritePriority::Critical: return "Critical";
+        default: return "Unknown";
+    }
+}
+
+const char* NVSAdmissionToString(NVSAdmission admission) {
+    switch(admission) {
+        case NVSAdmission::Admit: return "Admit";
+        case NVSAdmission::Defer: return "Defer";
+        case NVSAdmission::Reject: return "Reject";
+        default: return "Unknown";
+    }
+}
+
+NVSSpaceMonitor::NVSSpaceMonitor(const char* partition, uint32_t refreshIntervalMs, const NVSSpaceThresholds& thresholds)
+    : _partition(partition != nullptr ? partition : NVS_DEFAULT_PART_NAME),
+      _refreshIntervalMs(refreshIntervalMs),
+      _thresholds(thresholds),
+      _usage(),
+      _valid(false),
+      _refreshedMs(0),
+      _forecastStartMs(0),
+      _forecastStartUsed(0),
+      _forecastWritten(0) {}
+
+esp_err_t NVSSpaceMonitor::refresh() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return Refresh();
+}
+
+NVSSpaceUsage NVSSpaceMonitor::usage() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    RefreshIfStale();
+    return _usage;
+}
+
+NVSAdmission NVSSpaceMonitor::admit(size_t entries, NVSWritePriority priority) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    RefreshIfStale();
+    if(!_valid) {
+        // Without statistics, leave the decision to NVS itself
+        return NVSAdmission::Admit;
+    }
+    size_t index = std::min(static_cast<size_t>(priority), NVSWritePriorityCount - 1);
+    size_t headroom = _usage.headroomEntries;
+    if(entries > headroom) {
+        NVSWarningPrintf("No space for %d entries in partition %s (%d free)", entries, _partition.c_str(), headroom);
+        return NVSAdmission::Reject;
+    }
+    size_t remaining = headroom - entries;
+    if(remaining < ThresholdEntries(_thresholds.rejectBelowPercent[index])) {
+        NVSDebugPrintf("Rejecting %s write of %d entries, %d free", NVSWritePriorityToString(priority), entries, headroom);
+        return NVSAdmission::Reject;
+    }
+    if(remaining < ThresholdEntries(_thresholds.deferBelowPercent[index])) {
+        NVSDebugPrintf("Deferring %s write of %d entries, %d free", NVSWritePriorityToString(priority), entries, headroom);
+        return NVSAdmission::Defer;
+    }
+    return NVSAdmission::Admit;
+}
+
+void NVSSpaceMonitor::account(size_t writtenEntries, size_t releasedEntries) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _forecastWritten += static_cast<uint32_t>(writtenEntries);
+    // Only the net change is kept: the previous value is erased after the new one has been written
+    _usage.usedEntries = _usage.usedEntries + writtenEntries > releasedEntries
+        ? _usage.usedEntries + writtenEntries - releasedEntries
+        : 0;
+    _usage.headroomEntries = _usage.headroomEntries + releasedEntries > writtenEntries
+        ? _usage.headroomEntries + releasedEntries - writtenEntries
+        : 0;
+}
+
+size_t NVSSpaceMonitor::capacityFor(size_t entriesPerValue, NVSWritePriority priority) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    RefreshIfStale();
+    size_t index = std::min(static_cast<size_t>(priority), NVSWritePriorityCount - 1);
+    size_t reserve = ThresholdEntries(std::max(_thresholds.deferBelowPercent[index], _thresholds.rejectBelowPercent[index]));
+    size_t headroom = _usage.headroomEntries;
+    if(entriesPerValue == 0 || headroom <= reserve) {
+        return 0;
+    }
+    return (headroom - reserve) / entriesPerValue;
+}
+
+NVSSpaceForecast NVSSpaceMonitor::forecast() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    RefreshIfStale();
+    NVSSpaceForecast result = {};
+    result.hoursUntilFull = std::numeric_limits<uint32_t>::max();
+    for(uint32_t& hours : result.hoursUntilDeferred) {
+        hours = std::numeric_limits<uint32_t>::max();
+    }
+    uint32_t elapsedMs = NVSMillis() - _forecastStartMs;
+    if(!_valid || elapsedMs < MinForecastWindowMs) {
+        return result;
+    }
+    int64_t growth = static_cast<int64_t>(_usage.usedEntries) - static_cast<int64_t>(_forecastStartUsed);
+    result.netEntriesPerHour = static_cast<int32_t>(growth * MillisecondsPerHour / elapsedMs);
+    result.writtenEntriesPerHour = static_cast<uint32_t>(static_cast<uint64_t>(_forecastWritten) * MillisecondsPerHour / elapsedMs);
+    if(result.netEntriesPerHour <= 0) {
+        return result;
+    }
+    size_t headroom = _usage.headroomEntries;
+    uint32_t rate = static_cast<uint32_t>(result.netEntriesPerHour);
+    result.hoursUntilFull = static_cast<uint32_t>(headroom / rate);
+    for(size_t i = 0; i < NVSWritePriorityCount; i++) {
+        size_t threshold = ThresholdEntries(_thresholds.deferBelowPercent[i]);
+        result.hoursUntilDeferred[i] = headroom > threshold ? static_cast<uint32_t>((headroom - threshold) / rate) : 0;
+    }
+    return result;
+}
+
+void NVSSpaceMonitor::resetForecast() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    RefreshIfStale();
+    _forecastStartMs = NVSMillis();
+    _forecastStartUsed = _usage.usedEntries;
+    _forecastWritten = 0;
+}
+
+void NVSSpaceMonitor::setThresholds(const NVSSpaceThresholds& thresholds) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _thresholds = thresholds;
+}
+
+void NVSSpaceMonitor::RefreshIfStale() {
+    if(!_valid || NVSMillis() - _refreshedMs >= _refreshIntervalMs) {
+        Refresh();
+    }
+}
+
+esp_err_t NVSSpaceMonitor::Refresh() {
+    nvs_stats_t stats = {};
+    esp_err_t err;
+    {
+        NVSTraceScope scope(NVSTraceOp::Probe, _partition.c_str());
+        err = scope.finish(0, nvs_get_stats(_partition.c_str(), &stats));
+    }
+    _refreshedMs = NVSMillis();
+    if(err != ESP_OK) {
+        NVSErrorPrintf("Failed to get statistics of partition %s: %s", _partition.c_str(), esp_err_to_name(err));
+        return err;
+    }
+    _usage.totalEntries = stats.total_entries;
+    _usage.usedEntries = stats.used_entries;
+    _usage.namespaceCount = stats.namespace_count;
+    // Erased entries are reclaimed by garbage collection, but one page is always kept free for it
+    size_t reclaimable = stats.total_entries > stats.used_entries ? stats.total_entries - stats.used_entries : 0;
+    _usage.headroomEntries = reclaimable > NVSEntriesPerPage ? reclaimable - NVSEntriesPerPage : 0;
+    if(!_valid) {
+        _valid = true;
+        _forecastStartMs = _refreshedMs;
+        _forecastStartUsed = _usage.usedEntries;
+    }
+    return ESP_OK;
+}
+
+size_t NVSSpaceMonitor::UsableEntries() const {
+    return _usage.totalEntries > NVSEntriesPerPage ? _usage.totalEntries - NVSEntriesPerPage : 0;
+}
+
+size_t NVSSpaceMonitor::ThresholdEntries(uint8_t percent) const {
+    return UsableEntries() * percent / 100;
+}
@@ -0,0 +1,205 @@
+#include "NVSStringMigration.hpp"
+
+#include <cstring>
+
+#include "NVSLog.hpp"
+#include "NVSTrace.hpp"
+
+namespace {
+/**
+ * NVS strings can hold at most 4000 bytes including the null terminator
+ */
+constexpr size_t MaxStringLength = 4000 - 1;
+
+NVSStringStoragePreference StoredPreference(NVSStringStoragePreference preference) {
+    return preference == NVSStringStoragePreference::PreferBlob ? NVSStringStoragePreference::PreferString
+                                                                : NVSStringStoragePreference::PreferBlob;
+}
+
+bool MatchesPreference(nvs_type_t type, NVSStringStoragePreference preference) {
+    return preference == NVSStringStoragePreference::PreferBlob ? type == NVS_TYPE_BLOB : type == NVS_TYPE_STR;
+}
+} // namespace
+
+const char* NVSStringMigrationStateToString(NVSStringMigrationState state) {
+    switch(state) {
+        case NVSStringMigrationState::Unknown: return "Unknown";
+        case NVSStringMigrationState::Matching: return "Matching";
+        case NVSStringMigrationState::Pending: return "Pending";
+        case NVSStringMigrationState::Migrated: return "Migrated";
+        case NVSStringMigrationState::Incompatible: return "Incompatible";
+        case NVSStringMigrationState::Failed: return "Failed";
+        default: return "Unknown";
+    }
+}
+
+NVSStringMigrator::NVSStringMigrator(nvs_handle_t nvs, const char* partition, const char* namespc, NVSStringMigrationKey* keys, size_t count)
+    : _nvs(nvs), _partition(partition != nullptr ? partition : NVS_DEFAULT_PART_NAME), _namespace(namespc), _keys(keys), _count(count), _scanned(false) {}
+
+NVSStringMigrationProgress NVSStringMigrator::step(size_t maxKeys) {
+    if(!_scanned) {
+        if(Recover() != ESP_OK || Scan() == NVSQueryResult::Error) {
+            return progress();
+        }
+        _scanned = true;
+    }
+    size_t migrated = 0;
+    for(size_t i = 0; i < _count && migrated < maxKeys; i++) {
+        if(_keys[i].state == NVSStringMigrationState::Pending) {
+            _keys[i].state = Migrate(_keys[i]);
+            migrated++;
+            if(!_scanned) {
+                // The journal still holds this key, the next key must not overwrite it
+                break;
+            }
+        }
+    }
+    if(migrated > 0) {
+        NVSFlashCommit(_nvs, JournalKey);
+    }
+    return progress();
+}
+
+NVSStringMigrationProgress NVSStringMigrator::progress() const {
+    NVSStringMigrationProgress result = {};
+    result.total = _count;
+    for(size_t i = 0; i < _count; i++) {
+        switch(_keys[i].state) {
+            case NVSStringMigrationState::Pending: result.pending++; break;
+            case NVSStringMigrationState::Migrated: result.migrated++; break;
+            case NVSStringMigrationState::Incompatible: result.incompatible++; break;
+            case NVSStringMigrationState::Failed: result.failed++; break;
+            default: break;
+        }
+    }
+    result.probesSavedPerRead = result.migrated;
+    result.done = _scanned && result.pending == 0;
+    return result;
+}
+
+/**
+ * @brief Complete a migration which was interrupted by a reset.
+ *
+ * Journal layout: preference (1 byte), key length (1 byte), key, value
+ */
+esp_err_t NVSStringMigrator::Recover() {
+    std::string journal;
+    NVSQueryResult result = NVSReadStringValue(_nvs, JournalKey, journal, NVSStringStoragePreference::PreferBlob);
+    if(result == NVSQueryResult::NotFound) {
+        return ESP_OK;
+    }
+    if(result == NVSQueryResult::Error) {
+        return ESP_FAIL;
+    }
+    size_t keyLength = journal.size() >= 2 ? static_cast<uint8_t>(journal[1]) : 0;
+    if(keyLength == 0 || keyLength >= NVS_KEY_NAME_MAX_SIZE || journal.size() < 2 + keyLength) {
+        NVSWarningPrintf("Discarding invalid string migration journal");
+        NVSFlashEraseKey(_nvs, JournalKey);
+        return ESP_OK;
+    }
+    NVSStringStoragePreference preference = static_cast<NVSStringStoragePreference>(journal[0]);
+    std::string key = journal.substr(2, keyLength);
+    std::string value = journal.substr(2 + keyLength);
+    NVSInfoPrintf("Completing interrupted string migration of key %s", key.c_str());
+    // The key may still be stored in the old format, or already in the new one
+    NVSFlashEraseKey(_nvs, key.c_str());
+    esp_err_t err = Write(key.c_str(), preference, value);
+    if(err != ESP_OK) {
+        NVSErrorPrintf("Failed to restore key %s from the string migration journal: %s", key.c_str(), esp_err_to_name(err));
+        return err;
+    }
+    NVSFlashEraseKey(_nvs, JournalKey);
+    NVSFlashCommit(_nvs, JournalKey);
+    return ESP_OK;
+}
+
+NVSQueryResult NVSStringMigrator::Scan() {
+    // Failed keys are retried, e.g. after a transient error by a new
+    // migrator over the same key array
+    for(size_t i = 0; i < _count; i++) {
+        if(_keys[i].state == NVSStringMigrationState::Failed) {
+            _keys[i].state = NVSStringMigrationState::Unknown;
+        }
+    }
+    // Keys which are stored in the preferred format are already fast, even if
+    // an outdated entry of the other format exists as well. Migrated keys
+    // keep their state unless they are found in the other format again.
+    NVSQueryResult result = NVSForEachEntry(_partition, _namespace, NVS_TYPE_ANY, [this](const nvs_entry_info_t& info) {
+        if(info.type != NVS_TYPE_STR && info.type != NVS_TYPE_BLOB) {
+            return true;
+        }
+        for(size_t i = 0; i < _count; i++) {
+            NVSStringMigrationKey& entry = _keys[i];
+            if(entry.key == nullptr || strncmp(entry.key, info.key, NVS_KEY_NAME_MAX_SIZE) != 0) {
+                continue;
+            }
+            if(MatchesPreference(info.type, entry.preference)) {
+                if(entry.state != NVSStringMigrationState::Migrated) {
+                    entry.state = NVSStringMigrationState::Matching;
+                }
+            } else if(entry.state == NVSStringMigrationState::Unknown || entry.state == NVSStringMigrationState::Migrated) {
+                entry.state = NVSStringMigrationState::Pending;
+            }
+        }
+        return true;
+    });
+    if(result == NVSQueryResult::Error) {
+        return result;
+    }
+    // Keys which are not stored at all don't need to be migrated
+    for(size_t i = 0; i < _count; i++) {
+        if(_keys[i].state == NVSStringMigrationState::Unknown) {
+            _keys[i].state = NVSStringMigrationState::Matching;
+        }
+    }
+    return NVSQueryResult::OK;
+}
+
+NVSStringMigrationState NVSStringMigrator::Migrate(NVSStringMigrationKey& entry) {
+    std::string value;
+    // Look up the stored format first, so this read needs no failed probe either
+    switch(NVSReadStringValue(_nvs, entry.key, value, StoredPreference(entry.preference))) {
+        case NVSQueryResult::OK:
+            break;
+        case NVSQueryResult::NotFound:
+            return NVSStringMigrationState::Matching;
+        case NVSQueryResult::Error:
+            return NVSStringMigrationState::Failed;
+    }
+    if(entry.preference == NVSStringStoragePreference::PreferString
+       && (value.size() > MaxStringLength || memchr(value.data(), '\0', value.size()) != nullptr)) {
+        NVSWarningPrintf("Key %s can't be stored as NVS string", entry.key);
+        return NVSStringMigrationState::Incompatible;
+    }
+
+    size_t keyLength = strlen(entry.key);
+    std::string journal;
+    journal.reserve(2 + keyLength + value.size());
+    journal.push_back(static_cast<char>(entry.preference));
+    journal.push_back(static_cast<char>(keyLength));
+    journal.append(entry.key, keyLength);
+    journal.append(value);
+    esp_err_t err = NVSFlashSetBlob(_nvs, JournalKey, journal.data(), journal.size());
+    if(err != ESP_OK) {
+        NVSErrorPrintf("Failed to write string migration journal for key %s: %s", entry.key, esp_err_to_name(err));
+        return NVSStringMigrationState::Failed;
+    }
+    // Entries of different types can share a key, so the old entry has to be erased first
+    NVSFlashEraseKey(_nvs, entry.key);
+    if((err = Write(entry.key, entry.preference, value)) != ESP_OK) {
+        // The journal is kept and committed by step(), the next step() restores the key from it
+        NVSErrorPrintf("Failed to rewrite key %s: %s", entry.key, esp_err_to_name(err));
+        _scanned = false;
+        return NVSStringMigrationState::Failed;
+    }
+    NVSFlashEraseKey(_nvs, JournalKey);
+    NVSDebugPrintf("Migrated key %s (%d bytes)", entry.key, value.size());
+    return NVSStringMigrationState::Migrated;
+}
+
+esp_err_t NVSStringMigrator::Write(const char* key, NVSStringStoragePreference preference, const std::string& value) {
+    if(preference == NVSStringStoragePreference::PreferString) {
+        return NVSFlashSetStr(_nvs, key, value.c_str());
+    }
+    return NVSFlashSetBlob(_nvs, key, value.data(), value.size());
+}
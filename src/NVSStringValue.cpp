@@ -4,6 +4,7 @@
 
 #include "NVSUtils.hpp"
 #include "NVSResult.hpp"
+#include "NVSTrace.hpp"
 #include "NVSLog.hpp"
 
 NVSStringValue::NVSStringValue() : nvs(std::numeric_limits<nvs_handle_t>::max()), _key(), _value(), _exists(false) {
@@ -15,20 +16,23 @@ NVSStringValue::NVSStringValue(nvs_handle_t nvs, const std::string& key, const s
     if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
         this->updateFromNVS();
     }
+    this->Attach(nvs, _key);
 }
 
-NVSStringValue::NVSStringValue(NVSStringValue& copy): nvs(copy.nvs), _key(copy._key), _value(copy._value), _exists(copy._exists) {
+NVSStringValue::NVSStringValue(NVSStringValue& copy): NVSCoherenceLink(), nvs(copy.nvs), _key(copy._key), _value(copy._value), _exists(copy._exists) {
     // Read value from NVS
     if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
         this->updateFromNVS();
     }
+    this->Attach(nvs, _key);
 }
 
-NVSStringValue::NVSStringValue(NVSStringValue&& copy): nvs(std::move(copy.nvs)), _key(std::move(copy._key)), _value(std::move(copy._value)), _exists(std::move(copy._exists)) {
+NVSStringValue::NVSStringValue(NVSStringValue&& copy): NVSCoherenceLink(), nvs(std::move(copy.nvs)), _key(std::move(copy._key)), _value(std::move(copy._value)), _exists(std::move(copy._exists)) {
     // Read value from NVS
     if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
         this->updateFromNVS();
     }
+    this->Attach(nvs, _key);
 }
 
 NVSStringValue& NVSStringValue::operator=(NVSStringValue& copy) {
@@ -39,6 +43,7 @@ NVSStringValue& NVSStringValue::operator=(NVSStringValue& copy) {
     if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
         this->updateFromNVS();
     }
+    this->Attach(nvs, _key);
     return *this;
 }
 
@@ -50,9 +55,14 @@ NVSStringValue& NVSStringValue::operator=(NVSStringValue&& copy) {
     if(nvs != std::numeric_limits<nvs_handle_t>::max()) {
         this->updateFromNVS();
     }
+    this->Attach(nvs, _key);
     return *this;
 }
 
+NVSStringValue::~NVSStringValue() {
+    this->Detach();
+}
+
 const std::string& NVSStringValue::key() const {
     return _key;
 }
@@ -61,6 +71,21 @@ const std::string& NVSStringValue::value() const {
     return _value;
 }
 
+std::string NVSStringValue::asString() const {
+    return _value;
+}
+
+NVSValueDescriptor NVSStringValue::descriptor() const {
+    return NVSValueDescriptor{NVSValueKind::String, _value.size(), _exists, _value == _default};
+}
+
+size_t NVSStringValue::serializeTo(uint8_t* buffer, size_t bufferSize) const {
+    if(bufferSize >= _value.size()) {
+        memcpy(buffer, _value.data(), _value.size());
+    }
+    return _value.size();
+}
+
 void NVSStringValue::updateFromNVS() {
     // For debugging
     NVSTracePrintf("Reading key %s", _key.c_str());
@@ -93,12 +118,13 @@ NVSSetResult NVSStringValue::set(const std::string& newValue) {
     this->_exists = true;
     // Write to NVS. Use set_blob to use explicit size if string contains binary data
     esp_err_t err;
-    if((err = nvs_set_blob(nvs, _key.c_str(), newValue.data(), newValue.size())) != ESP_OK) {
+    if((err = NVSFlashSetBlob(nvs, _key.c_str(), newValue.data(), newValue.size())) != ESP_OK) {
         NVSCriticalPrintf("Failed to write NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
         return NVSSetResult::Error;
     }
     // Save to NV storage
-    nvs_commit(nvs);
+    NVSFlashCommit(nvs, _key.c_str());
+    this->Publish(_value.data(), _value.size());
     return NVSSetResult::Updated;
 }
 
@@ -123,7 +149,7 @@ NVSSetResult NVSStringValue::set(const char* newValue) {
     this->_value = std::string(newValue, len);
     // Write to NVS
     esp_err_t err;
-    if((err = nvs_set_blob(nvs, _key.c_str(), _value.c_str(), len)) != ESP_OK) {
+    if((err = NVSFlashSetBlob(nvs, _key.c_str(), _value.c_str(), len)) != ESP_OK) {
         NVSCriticalPrintf("Failed to write NVS key %s: %s", _key.c_str(), esp_err_to_name(err));
         return NVSSetResult::Error;
     }
@@ -132,6 +158,21 @@ NVSSetResult NVSStringValue::set(const char* newValue) {
     // Set successfully -> exists is true.
     this->_exists = true;
     // Save to NV storage
-    nvs_commit(nvs);
+    NVSFlashCommit(nvs, _key.c_str());
+    this->Publish(_value.data(), _value.size());
     return NVSSetResult::Updated;
 }
+
+void NVSStringValue::ApplyPeerWrite(const void* data, size_t size) {
+    _value.assign(static_cast<const char*>(data), size);
+    _exists = true;
+}
+
+bool NVSStringValue::CachedPeerValue(const void*& data, size_t& size) const {
+    if(!_exists) {
+        return false;
+    }
+    data = _value.data();
+    size = _value.size();
+    return true;
+}
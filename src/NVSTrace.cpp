@@ -0,0 +1,116 @@
+#include "NVSTrace.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+#include <esp_timer.h>
+
+const char* NVSTraceOpToString(NVSTraceOp op) {
+    switch(op) {
+        case NVSTraceOp::Read: return "Read";
+        case NVSTraceOp::Probe: return "Probe";
+        case NVSTraceOp::Write: return "Write";
+        case NVSTraceOp::Commit: return "Commit";
+        case NVSTraceOp::Erase: return "Erase";
+        case NVSTraceOp::Iterate: return "Iterate";
+        case NVSTraceOp::Open: return "Open";
+        default: return "Unknown";
+    }
+}
+
+__attribute__ ((weak)) void NVSTraceBegin(NVSTraceOp op, const char* key, size_t bytes) {
+}
+
+__attribute__ ((weak)) void NVSTraceEnd(NVSTraceOp op, const char* key, size_t bytes, esp_err_t result) {
+}
+
+__attribute__ ((weak)) int64_t NVSTraceMicros() {
+    return esp_timer_get_time();
+}
+
+#if CONFIG_ESPNVSVALUE_TRACE
+namespace {
+/**
+ * Log-linear histogram: 4 buckets per power of two, exact below 4 us, up to 2^25 us
+ */
+constexpr uint32_t SubBuckets = 4;
+constexpr uint32_t BucketCount = 96;
+
+struct LatencyHistogram {
+    std::atomic<uint32_t> buckets[BucketCount];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> max;
+};
+
+LatencyHistogram histograms[NVSTraceOpCount];
+
+uint32_t BucketOf(uint32_t microseconds) {
+    if(microseconds < SubBuckets) {
+        return microseconds;
+    }
+    uint32_t exponent = 31 - __builtin_clz(microseconds);
+    uint32_t index = (exponent - 1) * SubBuckets + ((microseconds >> (exponent - 2)) & (SubBuckets - 1));
+    return std::min(index, BucketCount - 1);
+}
+
+uint32_t BucketUpperBound(uint32_t index) {
+    if(index < SubBuckets) {
+        return index;
+    }
+    uint32_t exponent = index / SubBuckets + 1;
+    uint32_t lower = (SubBuckets + index % SubBuckets) << (exponent - 2);
+    return lower + (1u << (exponent - 2)) - 1;
+}
+
+uint32_t Percentile(const LatencyHistogram& histogram, uint32_t count, uint32_t max, uint32_t percent) {
+    // Rank of the requested sample, rounded up
+    uint32_t rank = static_cast<uint32_t>((static_cast<uint64_t>(count) * percent + 99) / 100);
+    uint32_t seen = 0;
+    for(uint32_t i = 0; i < BucketCount; i++) {
+        seen += histogram.buckets[i].load(std::memory_order_relaxed);
+        if(seen >= rank) {
+            return std::min(BucketUpperBound(i), max);
+        }
+    }
+    return max;
+}
+} // namespace
+
+void NVSTraceRecordLatency(NVSTraceOp op, uint32_t microseconds) {
+    LatencyHistogram& histogram = histograms[static_cast<size_t>(op) % NVSTraceOpCount];
+    histogram.buckets[BucketOf(microseconds)].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    uint32_t max = histogram.max.load(std::memory_order_relaxed);
+    while(microseconds > max && !histogram.max.compare_exchange_weak(max, microseconds, std::memory_order_relaxed)) {
+    }
+}
+
+NVSLatencySummary NVSTraceLatency(NVSTraceOp op) {
+    const LatencyHistogram& histogram = histograms[static_cast<size_t>(op) % NVSTraceOpCount];
+    NVSLatencySummary summary = {};
+    summary.count = histogram.count.load(std::memory_order_relaxed);
+    summary.maxUs = histogram.max.load(std::memory_order_relaxed);
+    if(summary.count > 0) {
+        summary.p50Us = Percentile(histogram, summary.count, summary.maxUs, 50);
+        summary.p99Us = Percentile(histogram, summary.count, summary.maxUs, 99);
+    }
+    return summary;
+}
+
+void NVSTraceResetLatency() {
+    for(LatencyHistogram& histogram : histograms) {
+        for(std::atomic<uint32_t>& bucket : histogram.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        histogram.count.store(0, std::memory_order_relaxed);
+        histogram.max.store(0, std::memory_order_relaxed);
+    }
+}
+#else
+NVSLatencySummary NVSTraceLatency(NVSTraceOp op) {
+    return NVSLatencySummary{};
+}
+
+void NVSTraceResetLatency() {
+}
+#endif
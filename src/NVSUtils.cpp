@@ -1,11 +1,13 @@
 #include "NVSUtils.hpp"
 #include "NVSLog.hpp"
+#include "NVSTrace.hpp"
 
 #include <nvs_flash.h>
+#include <esp_idf_version.h>
 
 NVSQueryResult NVSValueSize(nvs_handle_t nvs, const std::string& key, size_t& size) {
     esp_err_t err;
-    if((err = nvs_get_blob(nvs, key.c_str(), nullptr, &size)) != ESP_OK) {
+    if((err = NVSFlashGetBlob(nvs, key.c_str(), nullptr, &size)) != ESP_OK) {
         if(err == ESP_ERR_NVS_NOT_FOUND) {
             // Not found, no error
             NVSDebugPrintf("Key %s does not exist", key.c_str());
@@ -20,7 +22,7 @@ NVSQueryResult NVSValueSize(nvs_handle_t nvs, const std::string& key, size_t& si
 
 namespace {
 NVSQueryResult QueryBlobStringValueSize(nvs_handle_t nvs, const std::string& key, size_t& size) {
-    esp_err_t err = nvs_get_blob(nvs, key.c_str(), nullptr, &size);
+    esp_err_t err = NVSFlashGetBlob(nvs, key.c_str(), nullptr, &size);
     if(err == ESP_OK) {
         return NVSQueryResult::OK;
     }
@@ -33,7 +35,7 @@ NVSQueryResult QueryBlobStringValueSize(nvs_handle_t nvs, const std::string& key
 }
 
 NVSQueryResult QueryLegacyStringValueSize(nvs_handle_t nvs, const std::string& key, size_t& size) {
-    esp_err_t err = nvs_get_str(nvs, key.c_str(), nullptr, &size);
+    esp_err_t err = NVSFlashGetStr(nvs, key.c_str(), nullptr, &size);
     if(err == ESP_OK) {
         if(size > 0) {
             size -= 1;
@@ -50,7 +52,7 @@ NVSQueryResult QueryLegacyStringValueSize(nvs_handle_t nvs, const std::string& k
 
 NVSQueryResult ReadBlobStringValue(nvs_handle_t nvs, const std::string& key, std::string& value) {
     size_t size = 0;
-    esp_err_t err = nvs_get_blob(nvs, key.c_str(), nullptr, &size);
+    esp_err_t err = NVSFlashGetBlob(nvs, key.c_str(), nullptr, &size);
     if(err == ESP_OK) {
         if(size == 0) {
             value.clear();
@@ -58,7 +60,7 @@ NVSQueryResult ReadBlobStringValue(nvs_handle_t nvs, const std::string& key, std
         }
 
         value.resize(size);
-        if((err = nvs_get_blob(nvs, key.c_str(), value.data(), &size)) != ESP_OK) {
+        if((err = NVSFlashGetBlob(nvs, key.c_str(), value.data(), &size)) != ESP_OK) {
             NVSWarningPrintf("Failed to read blob-backed NVS key %s: %s", key.c_str(), esp_err_to_name(err));
             return NVSQueryResult::Error;
         }
@@ -75,7 +77,7 @@ NVSQueryResult ReadBlobStringValue(nvs_handle_t nvs, const std::string& key, std
 
 NVSQueryResult ReadLegacyStringValue(nvs_handle_t nvs, const std::string& key, std::string& value) {
     size_t size = 0;
-    esp_err_t err = nvs_get_str(nvs, key.c_str(), nullptr, &size);
+    esp_err_t err = NVSFlashGetStr(nvs, key.c_str(), nullptr, &size);
     if(err == ESP_ERR_NVS_NOT_FOUND) {
         return NVSQueryResult::NotFound;
     }
@@ -85,7 +87,7 @@ NVSQueryResult ReadLegacyStringValue(nvs_handle_t nvs, const std::string& key, s
     }
 
     std::string buffer(size, '\0');
-    if((err = nvs_get_str(nvs, key.c_str(), buffer.data(), &size)) != ESP_OK) {
+    if((err = NVSFlashGetStr(nvs, key.c_str(), buffer.data(), &size)) != ESP_OK) {
         NVSWarningPrintf("Failed to read legacy string NVS key %s: %s", key.c_str(), esp_err_to_name(err));
         return NVSQueryResult::Error;
     }
@@ -93,6 +95,53 @@ NVSQueryResult ReadLegacyStringValue(nvs_handle_t nvs, const std::string& key, s
     value.assign(buffer.data(), size > 0 ? size - 1 : 0);
     return NVSQueryResult::OK;
 }
+
+NVSQueryResult ReadBlobStringValueInto(nvs_handle_t nvs, const std::string& key, uint8_t* buffer, size_t& size) {
+    size_t storedSize = 0;
+    esp_err_t err = NVSFlashGetBlob(nvs, key.c_str(), nullptr, &storedSize);
+    if(err == ESP_ERR_NVS_NOT_FOUND) {
+        return NVSQueryResult::NotFound;
+    }
+    if(err != ESP_OK) {
+        NVSWarningPrintf("Failed to query blob-backed NVS key %s: %s", key.c_str(), esp_err_to_name(err));
+        return NVSQueryResult::Error;
+    }
+    if(storedSize > size) {
+        NVSDebugPrintf("Buffer for NVS key %s is too small (%d < %d bytes)", key.c_str(), size, storedSize);
+        size = storedSize;
+        return NVSQueryResult::Error;
+    }
+    if(storedSize > 0 && (err = NVSFlashGetBlob(nvs, key.c_str(), buffer, &storedSize)) != ESP_OK) {
+        NVSWarningPrintf("Failed to read blob-backed NVS key %s: %s", key.c_str(), esp_err_to_name(err));
+        return NVSQueryResult::Error;
+    }
+    size = storedSize;
+    return NVSQueryResult::OK;
+}
+
+NVSQueryResult ReadLegacyStringValueInto(nvs_handle_t nvs, const std::string& key, uint8_t* buffer, size_t& size) {
+    size_t storedSize = 0;
+    esp_err_t err = NVSFlashGetStr(nvs, key.c_str(), nullptr, &storedSize);
+    if(err == ESP_ERR_NVS_NOT_FOUND) {
+        return NVSQueryResult::NotFound;
+    }
+    if(err != ESP_OK) {
+        NVSWarningPrintf("Failed to query legacy string NVS key %s: %s", key.c_str(), esp_err_to_name(err));
+        return NVSQueryResult::Error;
+    }
+    // storedSize includes the null terminator
+    if(storedSize > size) {
+        NVSDebugPrintf("Buffer for NVS key %s is too small (%d < %d bytes)", key.c_str(), size, storedSize);
+        size = storedSize;
+        return NVSQueryResult::Error;
+    }
+    if((err = NVSFlashGetStr(nvs, key.c_str(), reinterpret_cast<char*>(buffer), &storedSize)) != ESP_OK) {
+        NVSWarningPrintf("Failed to read legacy string NVS key %s: %s", key.c_str(), esp_err_to_name(err));
+        return NVSQueryResult::Error;
+    }
+    size = storedSize > 0 ? storedSize - 1 : 0;
+    return NVSQueryResult::OK;
+}
 } // namespace
 
 NVSQueryResult NVSStringValueSize(nvs_handle_t nvs, const std::string& key, size_t& size, NVSStringStoragePreference preference) {
@@ -143,14 +192,85 @@ NVSQueryResult NVSReadStringValue(nvs_handle_t nvs, const std::string& key, std:
     return secondResult;
 }
 
+NVSQueryResult NVSReadStringValueInto(nvs_handle_t nvs, const std::string& key, uint8_t* buffer, size_t& size, NVSStringStoragePreference preference) {
+    NVSQueryResult firstResult;
+    NVSQueryResult secondResult;
+
+    if(preference == NVSStringStoragePreference::PreferString) {
+        firstResult = ReadLegacyStringValueInto(nvs, key, buffer, size);
+        if(firstResult != NVSQueryResult::NotFound) {
+            return firstResult;
+        }
+        secondResult = ReadBlobStringValueInto(nvs, key, buffer, size);
+    } else {
+        firstResult = ReadBlobStringValueInto(nvs, key, buffer, size);
+        if(firstResult != NVSQueryResult::NotFound) {
+            return firstResult;
+        }
+        secondResult = ReadLegacyStringValueInto(nvs, key, buffer, size);
+    }
+
+    if(secondResult == NVSQueryResult::NotFound) {
+        NVSDebugPrintf("Key %s does not exist", key.c_str());
+    }
+    return secondResult;
+}
+
+NVSQueryResult NVSForEachEntry(const char* partition, const char* namespc, nvs_type_t type,
+                               NVSEntryCallback callback, void* context) {
+    NVSTraceScope scope(NVSTraceOp::Iterate, namespc);
+    nvs_entry_info_t info;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    nvs_iterator_t it = nullptr;
+    esp_err_t err = nvs_entry_find(partition, namespc, type, &it);
+    if(err == ESP_ERR_NVS_NOT_FOUND) {
+        return NVSQueryResult::NotFound;
+    }
+    if(err != ESP_OK) {
+        NVSErrorPrintf("Failed to iterate NVS namespace %s: %s", namespc != nullptr ? namespc : "<all>", esp_err_to_name(err));
+        return NVSQueryResult::Error;
+    }
+    while(err == ESP_OK) {
+        nvs_entry_info(it, &info);
+        if(!callback(context, info)) {
+            break;
+        }
+        err = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+#else
+    nvs_iterator_t it = nvs_entry_find(partition, namespc, type);
+    if(it == nullptr) {
+        return NVSQueryResult::NotFound;
+    }
+    while(it != nullptr) {
+        nvs_entry_info(it, &info);
+        if(!callback(context, info)) {
+            break;
+        }
+        it = nvs_entry_next(it);
+    }
+    nvs_release_iterator(it);
+#endif
+    return NVSQueryResult::OK;
+}
+
 std::optional<nvs_handle_t> InitializeNVS(const char* namespc, bool allowReinit) {
     // Initialize NVS
-    esp_err_t ret = nvs_flash_init();
+    esp_err_t ret;
+    {
+        NVSTraceScope scope(NVSTraceOp::Open, nullptr);
+        ret = scope.finish(0, nvs_flash_init());
+    }
     if (allowReinit && (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND || ret == ESP_ERR_NVS_INVALID_STATE)) {
         // NVS partition was truncated and needs to be erased
+        {
+            NVSTraceScope scope(NVSTraceOp::Erase, nullptr);
+            nvs_flash_erase(); // Without error check
+        }
         // Retry nvs_flash_init
-        nvs_flash_erase(); // Without error check
-        ret = nvs_flash_init();
+        NVSTraceScope scope(NVSTraceOp::Open, nullptr);
+        ret = scope.finish(0, nvs_flash_init());
     }
     if(ret != ESP_OK) {
         NVSErrorPrintf("NVS flash init failed: %s", esp_err_to_name(ret));
@@ -159,11 +279,46 @@ std::optional<nvs_handle_t> InitializeNVS(const char* namespc, bool allowReinit)
 
     // Open namespace for read/write access
     nvs_handle_t handle;
-    ret = nvs_open(namespc, NVS_READWRITE, &handle);
+    {
+        NVSTraceScope scope(NVSTraceOp::Open, namespc);
+        ret = scope.finish(0, nvs_open(namespc, NVS_READWRITE, &handle));
+    }
     if (ret != ESP_OK) {
         NVSErrorPrintf("Failed to open NVS namespace '%s': %s", namespc, esp_err_to_name(ret));
         return std::nullopt;
     }
 
     return handle;
-}
\ No newline at end of file
+}
+
+std::optional<nvs_handle_t> InitializeNVSPartition(const char* partition, const char* namespc, bool allowReinit) {
+    esp_err_t ret;
+    {
+        NVSTraceScope scope(NVSTraceOp::Open, partition);
+        ret = scope.finish(0, nvs_flash_init_partition(partition));
+    }
+    if (allowReinit && (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND || ret == ESP_ERR_NVS_INVALID_STATE)) {
+        {
+            NVSTraceScope scope(NVSTraceOp::Erase, partition);
+            nvs_flash_erase_partition(partition); // Without error check
+        }
+        NVSTraceScope scope(NVSTraceOp::Open, partition);
+        ret = scope.finish(0, nvs_flash_init_partition(partition));
+    }
+    if(ret != ESP_OK) {
+        NVSErrorPrintf("NVS flash init of partition %s failed: %s", partition, esp_err_to_name(ret));
+        return std::nullopt;
+    }
+
+    nvs_handle_t handle;
+    {
+        NVSTraceScope scope(NVSTraceOp::Open, namespc);
+        ret = scope.finish(0, nvs_open_from_partition(partition, namespc, NVS_READWRITE, &handle));
+    }
+    if (ret != ESP_OK) {
+        NVSErrorPrintf("Failed to open NVS namespace '%s' in partition %s: %s", namespc, partition, esp_err_to_name(ret));
+        return std::nullopt;
+    }
+
+    return handle;
+}
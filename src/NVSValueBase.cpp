@@ -0,0 +1,13 @@
+#include "NVSValueBase.hpp"
+
+const char* NVSValueKindToString(NVSValueKind kind) {
+    switch (kind) {
+        case NVSValueKind::Blob: return "Blob";
+        case NVSValueKind::Bool: return "Bool";
+        case NVSValueKind::SignedInteger: return "SignedInteger";
+        case NVSValueKind::UnsignedInteger: return "UnsignedInteger";
+        case NVSValueKind::Float: return "Float";
+        case NVSValueKind::String: return "String";
+        default: return "Unknown";
+    }
+}
@@ -0,0 +1,65 @@
+#include "NVSValueRegistry.hpp"
+
+#include <cstring>
+
+NVSValueRegistry::NVSValueRegistry(NVSValueBase** storage, size_t capacity)
+    : _values(storage), _capacity(capacity), _size(0) {}
+
+bool NVSValueRegistry::add(NVSValueBase& value) {
+    for(NVSValueBase* registered : *this) {
+        if(registered == &value) {
+            return true;
+        }
+    }
+    if(_size == _capacity) {
+        return false;
+    }
+    _values[_size++] = &value;
+    return true;
+}
+
+bool NVSValueRegistry::remove(NVSValueBase& value) {
+    for(size_t i = 0; i < _size; ++i) {
+        if(_values[i] == &value) {
+            // Keep registration order
+            memmove(&_values[i], &_values[i + 1], (_size - i - 1) * sizeof(NVSValueBase*));
+            _size--;
+            return true;
+        }
+    }
+    return false;
+}
+
+NVSValueBase* NVSValueRegistry::find(const char* key) const {
+    for(NVSValueBase* value : *this) {
+        if(value->key() == key) {
+            return value;
+        }
+    }
+    return nullptr;
+}
+
+size_t NVSValueRegistry::flush() {
+    size_t failed = 0;
+    for(size_t i = 0; i < _size; i++) {
+        if(_values[i]->hasPendingWrite() && static_cast<int8_t>(_values[i]->flush()) < 0) {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+size_t NVSValueRegistry::dump(NVSDumpCallback callback, void* context, uint8_t* scratch, size_t scratchSize) const {
+    size_t truncated = 0;
+    for(NVSValueBase* value : *this) {
+        NVSValueDescriptor descriptor = value->descriptor();
+        size_t size = value->serializeTo(scratch, scratchSize);
+        if(size > scratchSize) {
+            truncated++;
+            callback(context, *value, descriptor, nullptr, size);
+        } else {
+            callback(context, *value, descriptor, scratch, size);
+        }
+    }
+    return truncated;
+}
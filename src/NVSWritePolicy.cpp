@@ -0,0 +1,8 @@
+#include "NVSWritePolicy.hpp"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+__attribute__ ((weak)) uint32_t NVSMillis() {
+    return static_cast<uint32_t>(xTaskGetTickCount()) * portTICK_PERIOD_MS;
+}
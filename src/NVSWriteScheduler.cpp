@@ -0,0 +1,207 @@
+#include "NVSWriteScheduler.hpp"
+
+#include <limits>
+
+#include "NVSLog.hpp"
+
+NVSWriteScheduler::NVSWriteScheduler(NVSWriteSchedulerEntry* entries, size_t capacity, uint32_t maxStalenessMs)
+    : _writing(nullptr), _entries(entries), _capacity(capacity), _count(0), _maxStalenessMs(maxStalenessMs), _open(false), _stats() {}
+
+size_t NVSWriteScheduler::openWindow() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _open = true;
+    }
+    NVSTracePrintf("Write window opened");
+    return Drain(DrainMode::Window);
+}
+
+void NVSWriteScheduler::closeWindow() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _open = false;
+}
+
+bool NVSWriteScheduler::windowOpen() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _open;
+}
+
+size_t NVSWriteScheduler::drain() {
+    return Drain(DrainMode::Window);
+}
+
+size_t NVSWriteScheduler::poll() {
+    return Drain(DrainMode::Overdue);
+}
+
+uint32_t NVSWriteScheduler::msUntilDeadline() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_maxStalenessMs == 0 || _count == 0) {
+        return std::numeric_limits<uint32_t>::max();
+    }
+    uint32_t now = NVSMillis();
+    uint32_t oldest = 0;
+    for(size_t i = 0; i < _count; i++) {
+        uint32_t age = now - _entries[i].sinceMs;
+        oldest = age > oldest ? age : oldest;
+    }
+    return oldest < _maxStalenessMs ? _maxStalenessMs - oldest : 0;
+}
+
+uint32_t NVSWriteScheduler::maxStalenessMs() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _maxStalenessMs;
+}
+
+void NVSWriteScheduler::setMaxStalenessMs(uint32_t maxStalenessMs) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _maxStalenessMs = maxStalenessMs;
+}
+
+NVSWriteSchedulerStats NVSWriteScheduler::stats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    NVSWriteSchedulerStats result = _stats;
+    result.pending = static_cast<uint32_t>(_count);
+    return result;
+}
+
+void NVSWriteScheduler::resetStats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats = NVSWriteSchedulerStats();
+}
+
+bool NVSWriteScheduler::request(NVSValueBase& value, NVSWritePriority priority) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_open) {
+        return true;
+    }
+    NVSWriteSchedulerEntry* entry = Find(value);
+    if(entry != nullptr) {
+        // Keep the time of the first deferral, so repeated changes can't postpone the deadline
+        entry->priority = priority > entry->priority ? priority : entry->priority;
+        return false;
+    }
+    if(_count >= _capacity) {
+        NVSWarningPrintf("Write queue full, key %s is only written by its own poll()", value.key().c_str());
+        _stats.overflows++;
+        return false;
+    }
+    _entries[_count++] = NVSWriteSchedulerEntry{&value, NVSMillis(), priority, false, false};
+    NVSTracePrintf("Deferring %s write of key %s until the next window", NVSWritePriorityToString(priority), value.key().c_str());
+    return false;
+}
+
+bool NVSWriteScheduler::mayWrite(NVSValueBase& value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_open) {
+        return true;
+    }
+    NVSWriteSchedulerEntry* entry = Find(value);
+    if(entry == nullptr || !Overdue(*entry, NVSMillis())) {
+        return false;
+    }
+    entry->forced = true;
+    return true;
+}
+
+void NVSWriteScheduler::written(NVSValueBase& value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    NVSWriteSchedulerEntry* entry = Find(value);
+    if(entry == nullptr) {
+        _stats.immediateWrites++;
+        return;
+    }
+    uint32_t deferredMs = NVSMillis() - entry->sinceMs;
+    if(_open) {
+        _stats.windowWrites++;
+    } else if(entry->forced) {
+        _stats.forcedWrites++;
+        NVSDebugPrintf("Forced write of key %s after %d ms", value.key().c_str(), deferredMs);
+    } else {
+        _stats.flushedWrites++;
+    }
+    _stats.maxDeferredMs = deferredMs > _stats.maxDeferredMs ? deferredMs : _stats.maxDeferredMs;
+    _stats.totalDeferredMs += deferredMs;
+    Remove(entry);
+}
+
+void NVSWriteScheduler::cancel(NVSValueBase& value) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _written.wait(lock, [this, &value]() { return _writing != &value; });
+    NVSWriteSchedulerEntry* entry = Find(value);
+    if(entry != nullptr) {
+        Remove(entry);
+    }
+}
+
+size_t NVSWriteScheduler::Drain(DrainMode mode) {
+    size_t failures = 0;
+    while(true) {
+        NVSValueBase* value = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(mode == DrainMode::Window && !_open) {
+                break;
+            }
+            uint32_t now = NVSMillis();
+            NVSWriteSchedulerEntry* next = nullptr;
+            for(size_t i = 0; i < _count; i++) {
+                NVSWriteSchedulerEntry& entry = _entries[i];
+                if(entry.attempted || (mode == DrainMode::Overdue && !Overdue(entry, now))) {
+                    continue;
+                }
+                if(next == nullptr || entry.priority > next->priority
+                   || (entry.priority == next->priority && now - entry.sinceMs > now - next->sinceMs)) {
+                    next = &entry;
+                }
+            }
+            if(next == nullptr) {
+                break;
+            }
+            next->attempted = true;
+            next->forced = mode == DrainMode::Overdue;
+            value = next->value;
+            // cancel() waits for this write, so the value can't be destroyed meanwhile
+            _writing = value;
+        }
+        // Written without the lock, since the policy calls written() from within flush()
+        NVSSetResult result = value->flush();
+        if(static_cast<int8_t>(result) < 0) {
+            NVSErrorPrintf("Failed to write deferred key %s: %s", value->key().c_str(), NVSSetResultToString(result));
+            failures++;
+        }
+        bool pending = value->hasPendingWrite();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _writing = nullptr;
+            NVSWriteSchedulerEntry* entry = Find(*value);
+            if(entry != nullptr && !pending) {
+                // Values which have been written or discarded elsewhere, e.g. by a coherent peer
+                Remove(entry);
+            }
+        }
+        _written.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(size_t i = 0; i < _count; i++) {
+        _entries[i].attempted = false;
+    }
+    return failures;
+}
+
+NVSWriteSchedulerEntry* NVSWriteScheduler::Find(const NVSValueBase& value) {
+    for(size_t i = 0; i < _count; i++) {
+        if(_entries[i].value == &value) {
+            return &_entries[i];
+        }
+    }
+    return nullptr;
+}
+
+void NVSWriteScheduler::Remove(NVSWriteSchedulerEntry* entry) {
+    *entry = _entries[--_count];
+}
+
+bool NVSWriteScheduler::Overdue(const NVSWriteSchedulerEntry& entry, uint32_t now) const {
+    return _maxStalenessMs > 0 && now - entry.sinceMs >= _maxStalenessMs;
+}